@@ -88,11 +88,29 @@
    system which is slow to process stat requests (which I'm not sure exists) */
 #define MOD_CHECK_INTERVAL 3000
 
+/* The backup journal records the edits made to a window's text since it was
+   last written out in full, either by reading or saving the file (the journal
+   is then relative to the file on disk), or by WriteBackupFile (relative to
+   the backup file).  JOURNAL_NONE means that neither is up to date, and the
+   next backup must write the whole text (see enum journalStates in nedit.h) */
+#define JOURNAL_MAGIC "NEdit backup journal 1\n"
+
+/* Once the journal is larger than the text it describes (by this much), it
+   is cheaper to write a new full backup than to keep appending to it */
+#define JOURNAL_SLACK 65536
+
 static int doSave(WindowInfo *window);
 static void safeClose(WindowInfo *window);
 static int doOpen(WindowInfo *window, const char *name, const char *path,
      int flags);
 static void backupFileName(WindowInfo *window, char *name, size_t len);
+static void journalFileName(WindowInfo *window, char *name, size_t len);
+static FILE *openJournal(const char *name, int append);
+static int startJournal(WindowInfo *window, const char *baseType,
+	long baseSize, long baseTime);
+static void resetJournal(WindowInfo *window, int state);
+static void discardJournal(WindowInfo *window);
+static void recoverFromJournal(WindowInfo *window);
 static int writeBckVersion(WindowInfo *window);
 static int bckError(WindowInfo *window, const char *errString, const char *file);
 static int fileWasModifiedExternally(WindowInfo *window);
@@ -267,6 +285,10 @@ WindowInfo *EditExistingFile(WindowInfo *inWindow, const char *name,
     UpdateWindowReadOnly(window);
     UpdateStatsLine(window);
     
+    /* If a previous session left unsaved changes to the file in a backup
+       journal, offer to recover them */
+    recoverFromJournal(window);
+    
     /* Add the name to the convenience menu of previously opened files */
     strcpy(fullname, path);
     strcat(fullname, name);
@@ -590,6 +612,11 @@ static int doOpen(WindowInfo *window, const char *name, const char *path,
     }
     UpdateWindowReadOnly(window);
     
+    /* The text now matches the file, so future backups can be journaled
+       relative to it (but leave any existing journal on disk alone until
+       then, it may hold changes from an earlier session to recover) */
+    resetJournal(window, JOURNAL_ON_FILE);
+    
     return TRUE;
 }   
 
@@ -896,8 +923,10 @@ int SaveWindowAs(WindowInfo *window, const char *newName, int addWrap)
     /* Destroy the file closed property for the original file */
     DeleteFileClosedProperty(window);
 
-    /* Change the name of the file and save it under the new name */
+    /* Change the name of the file and save it under the new name.  Nothing
+       can be journaled relative to the new file until it is written */
     RemoveBackupFile(window);
+    resetJournal(window, JOURNAL_NONE);
     strcpy(window->filename, filename);
     strcpy(window->path, pathname);
     window->fileMode = 0;
@@ -1056,6 +1085,9 @@ static int doSave(WindowInfo *window)
     /* success, file was written */
     SetWindowModified(window, FALSE);
     
+    /* Any backup journal was relative to the old contents of the file */
+    discardJournal(window);
+    
     /* update the modification time */
     if (stat(fullname, &statbuf) == 0) {
 	window->lastModTime = statbuf.st_mtime;
@@ -1078,13 +1110,15 @@ static int doSave(WindowInfo *window)
 ** Create a backup file for the current window.  The name for the backup file
 ** is generated using the name and path stored in the window and adding a
 ** tilde (~) on UNIX and underscore (_) on VMS to the beginning of the name.  
+** This writes the whole text, and starts a new backup journal relative to it,
+** see UpdateBackupFile.
 */
 int WriteBackupFile(WindowInfo *window)
 {
     char *fileString = NULL;
     char name[MAXPATHLEN];
     FILE *fp;
-    int fd, fileLen;
+    int fd, fileLen, bufLen;
     
     /* Generate a name for the autoSave file */
     backupFileName(window, name, sizeof(name));
@@ -1119,7 +1153,7 @@ int WriteBackupFile(WindowInfo *window)
 
     /* get the text buffer contents and its length */
     fileString = BufGetAll(window->buffer);
-    fileLen = window->buffer->length;
+    fileLen = bufLen = window->buffer->length;
     
     /* If null characters are substituted for, put them back */
     BufUnsubstituteNullChars(fileString, window->buffer);
@@ -1156,9 +1190,103 @@ int WriteBackupFile(WindowInfo *window)
     /* Free the text buffer copy returned from XmTextGetString */
     NEditFree(fileString);
 
+    /* The changes recorded so far are in the text just written.  Start a
+       new journal of the changes made after this point.  If that fails, the
+       next backup will just write the whole text again */
+    window->journalTextLen = 0;
+    if (!startJournal(window, "backup", bufLen, 0))
+    	resetJournal(window, JOURNAL_NONE);
+
     return TRUE;
 }
 
+/*
+** Bring the backup for the current window up to date.  Usually this just
+** appends the changes made since the last backup (recorded by
+** JournalModification) to the backup journal, so the cost is proportional to
+** the size of the changes, rather than of the file.  The whole text is
+** written (by WriteBackupFile) if there is no valid journal, or if the
+** journal has grown larger than the text it describes.
+*/
+int UpdateBackupFile(WindowInfo *window)
+{
+    char name[MAXPATHLEN], fullname[MAXPATHLEN];
+    struct stat statbuf;
+    FILE *fp;
+    
+    if (window->journalState == JOURNAL_NONE || window->journalSize +
+    	    window->journalTextLen > window->buffer->length + JOURNAL_SLACK)
+    	return WriteBackupFile(window);
+    
+    /* A journal relative to the file on disk is started by the first backup
+       after the file is read or saved, as long as the file hasn't changed */
+    if (window->journalSize == 0) {
+    	strcpy(fullname, window->path);
+    	strcat(fullname, window->filename);
+    	if (stat(fullname, &statbuf) != 0 ||
+    	    	statbuf.st_mtime != window->lastModTime ||
+    	    	!startJournal(window, "file", (long)statbuf.st_size,
+    	    	(long)statbuf.st_mtime))
+    	    return WriteBackupFile(window);
+    }
+    
+    /* Append the changes to the journal.  If that fails, fall back on
+       writing the whole text, which also reports the error */
+    journalFileName(window, name, sizeof(name));
+    if ((fp = openJournal(name, True)) == NULL)
+    	return WriteBackupFile(window);
+    fwrite(window->journalText, sizeof(char), window->journalTextLen, fp);
+    if (ferror(fp) || fclose(fp) != 0)
+    	return WriteBackupFile(window);
+    window->journalSize += window->journalTextLen;
+    window->journalTextLen = 0;
+    return TRUE;
+}
+
+/*
+** Record a change to the text of the current window (with the arguments
+** passed to the buffer modify callback), to be added to the backup journal
+** by the next UpdateBackupFile.  Changes made while automatic backup is off,
+** or which aren't recorded for undo (with ignoreModify set), invalidate the
+** journal, so the next backup writes the whole text.
+*/
+void JournalModification(WindowInfo *window, int pos, int nInserted,
+	int nDeleted)
+{
+    char header[64], *text;
+    int len;
+    
+    if (window->journalState == JOURNAL_NONE)
+    	return;
+    if (!window->autoSave || window->ignoreModify ||
+    	    window->journalTextLen + nInserted >
+    	    window->buffer->length + JOURNAL_SLACK) {
+    	resetJournal(window, JOURNAL_NONE);
+    	return;
+    }
+    
+    /* Each record gives the position and the number of characters deleted
+       and inserted, followed by the inserted text and a newline */
+    sprintf(header, "R %d %d %d\n", pos, nDeleted, nInserted);
+    len = strlen(header);
+    if (window->journalTextLen + len + nInserted + 1 >
+    	    window->journalTextSize) {
+    	window->journalTextSize = window->journalTextLen + len + nInserted + 1;
+    	if (window->journalTextSize < window->journalTextLen * 2)
+    	    window->journalTextSize = window->journalTextLen * 2;
+    	window->journalText = (char *)NEditRealloc(window->journalText,
+    	    	window->journalTextSize);
+    }
+    memcpy(&window->journalText[window->journalTextLen], header, len);
+    window->journalTextLen += len;
+    text = BufGetRange(window->buffer, pos, pos + nInserted);
+    BufUnsubstituteNullChars(text, window->buffer);
+    memcpy(&window->journalText[window->journalTextLen], text, nInserted);
+    NEditFree(text);
+    window->journalTextLen += nInserted;
+    window->journalText[window->journalTextLen++] = '\n';
+}
+
 /*
 ** Remove the backup file associated with this window
 */
@@ -1166,12 +1294,22 @@ void RemoveBackupFile(WindowInfo *window)
 {
     char name[MAXPATHLEN];
     
+    /* The journal goes with the backup file, so changes can no longer be
+       appended to it.  If the text is unmodified (this was called after the
+       file was saved, or the changes to it were undone), later changes can
+       be journaled relative to the file, otherwise the next backup must write
+       the whole text */
+    resetJournal(window, window->filenameSet && !window->fileChanged ?
+    	    JOURNAL_ON_FILE : JOURNAL_NONE);
+    
     /* Don't delete backup files when backups aren't activated. */
     if (window->autoSave == FALSE)
         return;
       
     backupFileName(window, name, sizeof(name));
     remove(name);
+    journalFileName(window, name, sizeof(name));
+    remove(name);
 }
 
 /*
@@ -1199,6 +1337,212 @@ static void backupFileName(WindowInfo *window, char *name, size_t len)
 #endif /*VMS*/
 }
 
+/*
+** Generate the name of the backup journal for this window (the name of the
+** backup file with ".jnl" appended) & write into name
+*/
+static void journalFileName(WindowInfo *window, char *name, size_t len)
+{
+    backupFileName(window, name, len);
+    strncat(name, ".jnl", len - strlen(name) - 1);
+}
+
+/*
+** Open the backup journal "name" for appending, or if "append" is False,
+** create it anew, with the same restrictive permissions as the backup file
+*/
+static FILE *openJournal(const char *name, int append)
+{
+    FILE *fp;
+#ifndef VMS
+    int fd;
+#endif
+    
+    if (append)
+    	return fopen(name, "ab");
+    remove(name);
+#ifdef VMS
+    if ((fp = fopen(name, "w", "rfm = stmlf")) == NULL)
+    	return NULL;
+    chmod(name, S_IRUSR | S_IWUSR);
+#else
+    if ((fd = open(name, O_CREAT|O_EXCL|O_WRONLY, S_IRUSR | S_IWUSR)) < 0)
+    	return NULL;
+    if ((fp = fdopen(fd, "wb")) == NULL) {
+    	close(fd);
+    	return NULL;
+    }
+#endif /* VMS */
+    return fp;
+}
+
+/*
+** Start a new, empty backup journal for the current window, relative to the
+** "baseType" ("file" or "backup") of size "baseSize" and (for files)
+** modification time "baseTime".  Changes recorded but not yet written are
+** kept, to be appended by the next backup.
+*/
+static int startJournal(WindowInfo *window, const char *baseType,
+	long baseSize, long baseTime)
+{
+    char name[MAXPATHLEN];
+    FILE *fp;
+    int len;
+    
+    journalFileName(window, name, sizeof(name));
+    if ((fp = openJournal(name, False)) == NULL)
+    	return FALSE;
+    len = fprintf(fp, "%sbase %s %ld %ld\n", JOURNAL_MAGIC, baseType,
+    	    baseSize, baseTime);
+    if (len < 0 || ferror(fp) || fclose(fp) != 0) {
+    	remove(name);
+    	return FALSE;
+    }
+    window->journalState = strcmp(baseType, "file") ? JOURNAL_ON_BACKUP :
+    	    JOURNAL_ON_FILE;
+    window->journalSize = len;
+    return TRUE;
+}
+
+/*
+** Discard the changes recorded for the backup journal of the current window,
+** and set the journal state.  A journal on disk is left alone, but it will
+** be replaced rather than appended to by the next backup.
+*/
+static void resetJournal(WindowInfo *window, int state)
+{
+    NEditFree(window->journalText);
+    window->journalText = NULL;
+    window->journalTextLen = 0;
+    window->journalTextSize = 0;
+    window->journalSize = 0;
+    window->journalState = state;
+}
+
+/*
+** Remove the backup journal of the current window, after the file is saved
+** (the journal was relative to the old contents of the file)
+*/
+static void discardJournal(WindowInfo *window)
+{
+    char name[MAXPATHLEN];
+    
+    journalFileName(window, name, sizeof(name));
+    remove(name);
+    resetJournal(window, JOURNAL_ON_FILE);
+}
+
+/*
+** Called after a file is opened, to check for a backup journal left by an
+** earlier session which ended without saving the file.  If there is one,
+** and it still applies to the file (or its backup file), offer to replay the
+** changes it records.  The replayed changes are made as ordinary edits, so
+** they can be undone, and leave the window modified.
+*/
+static void recoverFromJournal(WindowInfo *window)
+{
+    char name[MAXPATHLEN], fullname[MAXPATHLEN], baseType[16];
+    char magic[sizeof(JOURNAL_MAGIC)], *text = NULL;
+    struct stat statbuf;
+    long baseSize, baseTime;
+    int pos, nDeleted, nInserted, readLen, valid, resp, c;
+    FILE *fp, *bfp;
+    
+    if (IS_ANY_LOCKED(window->lockReasons))
+    	return;
+    journalFileName(window, name, sizeof(name));
+    if ((fp = fopen(name, "rb")) == NULL)
+    	return;
+    
+    /* Read the header, and check that the journal still applies to the
+       file, or to the backup file, whichever it was relative to */
+    valid = fgets(magic, sizeof(magic), fp) != NULL &&
+    	    !strcmp(magic, JOURNAL_MAGIC) &&
+    	    fscanf(fp, "base %15s %ld %ld", baseType, &baseSize,
+    	    &baseTime) == 3 && getc(fp) == '\n';
+    if (valid && !strcmp(baseType, "file")) {
+    	/* A journal relative to the file which holds no changes (only the
+    	   header) has nothing to recover */
+    	if ((c = getc(fp)) == EOF) {
+    	    fclose(fp);
+    	    return;
+    	}
+    	ungetc(c, fp);
+    	strcpy(fullname, window->path);
+    	strcat(fullname, window->filename);
+    	valid = stat(fullname, &statbuf) == 0 &&
+    	    	(long)statbuf.st_size == baseSize &&
+    	    	(long)statbuf.st_mtime == baseTime;
+    } else if (valid && !strcmp(baseType, "backup") && baseSize >= 0) {
+    	backupFileName(window, fullname, sizeof(fullname));
+    	text = (char *)NEditMalloc(baseSize + 1);
+    	readLen = 0;
+    	valid = FALSE;
+    	if ((bfp = fopen(fullname, "rb")) != NULL) {
+    	    /* The backup must be exactly the size it had, not just as long */
+    	    readLen = fread(text, sizeof(char), baseSize, bfp);
+    	    valid = readLen == baseSize && getc(bfp) == EOF;
+    	    fclose(bfp);
+    	}
+    	text[readLen] = '\0';
+    } else
+    	valid = FALSE;
+    if (!valid) {
+    	DialogF(DF_WARN, window->shell, 1, "Backup Journal",
+    	    	"A backup journal with unsaved changes to %s was found,\n"
+    	    	"but the file has changed since, so it can't be used.", "OK",
+    	    	window->filename);
+    	NEditFree(text);
+    	fclose(fp);
+    	return;
+    }
+    
+    resp = DialogF(DF_QUES, window->shell, 2, "Backup Journal",
+    	    "Unsaved changes to %s were found in a backup journal\n"
+    	    "left by an earlier session.  Recover them?", "Recover",
+    	    "Discard", window->filename);
+    if (resp != 1) {
+    	NEditFree(text);
+    	fclose(fp);
+    	remove(name);
+    	return;
+    }
+    
+    /* Restore the text of the backup file, if the journal is relative to
+       it, then replay the changes.  Stop at the first incomplete record,
+       which was probably being written when the earlier session ended. */
+    if (text != NULL) {
+    	if (BufSubstituteNullChars(text, baseSize, window->buffer))
+    	    BufReplace(window->buffer, 0, window->buffer->length, text);
+    	NEditFree(text);
+    }
+    while (fscanf(fp, "R %d %d %d", &pos, &nDeleted, &nInserted) == 3 &&
+    	    getc(fp) == '\n') {
+    	if (pos < 0 || nDeleted < 0 || nInserted < 0 ||
+    	    	pos + nDeleted > window->buffer->length)
+    	    break;
+    	text = (char *)NEditMalloc(nInserted + 1);
+    	if ((int)fread(text, sizeof(char), nInserted, fp) != nInserted ||
+    	    	getc(fp) != '\n') {
+    	    NEditFree(text);
+    	    break;
+    	}
+    	text[nInserted] = '\0';
+    	if (!BufSubstituteNullChars(text, nInserted, window->buffer)) {
+    	    NEditFree(text);
+    	    break;
+    	}
+    	BufReplace(window->buffer, pos, pos + nDeleted, text);
+    	NEditFree(text);
+    }
+    fclose(fp);
+    
+    /* The journal on disk no longer describes the text relative to the file,
+       so the next backup writes the whole text (until then, the old journal
+       remains in case this session also ends unexpectedly) */
+    resetJournal(window, JOURNAL_NONE);
+}
+
 /*
 ** If saveOldVersion is on, copies the existing version of the file to
 ** <filename>.bck in anticipation of a new version being saved.  Returns
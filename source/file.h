@@ -53,6 +53,9 @@ int CloseFileAndWindow(WindowInfo *window, int preResponse);
 void PrintWindow(WindowInfo *window, int selectedOnly);
 void PrintString(const char *string, int length, Widget parent, const char *jobName);
 int WriteBackupFile(WindowInfo *window);
+int UpdateBackupFile(WindowInfo *window);
+void JournalModification(WindowInfo *window, int pos, int nInserted,
+	int nDeleted);
 int IncludeFile(WindowInfo *window, const char *name);
 int PromptForExistingFile(WindowInfo *window, char *prompt, char *fullname);
 int PromptForNewFile(WindowInfo *window, char *prompt, char *fullname,
@@ -44,6 +44,7 @@
 #include "../util/misc.h"
 #include "../util/DialogF.h"
 #include "../util/nedit_malloc.h"
+#include "../util/utils.h"
 
 #include <stdio.h>
 #include <limits.h>
@@ -72,11 +73,18 @@
 /* How much re-parsing to do when an unfinished style is encountered */
 #define PASS_2_REPARSE_CHUNK_SIZE 1000
 
+/* Maximum number of separate modified ranges remembered for deferred
+   re-parsing.  Beyond this, the closest neighbouring ranges are merged */
+#define MAX_DEFERRED_RANGES 16
+
 /* Initial forward expansion of parsing region in incremental reparsing,
    when style changes propagate forward beyond the original modification.
    This distance is increased by a factor of two for each subsequent step. */
 #define REPARSE_CHUNK_SIZE 80
 
+/* Upper bound on the length of a line of the pattern profiler report */
+#define PROFILE_REPORT_LINE_LEN 160
+
 /* Meanings of style buffer characters (styles). Don't use plain 'A' or 'B';
    it causes problems with EBCDIC coding (possibly negative offsets when 
    subtracting 'A'). */
@@ -99,6 +107,20 @@
 #define CAN_CROSS_LINE_BOUNDARIES(contextRequirements) \
     	(contextRequirements->nLines != 1 || contextRequirements->nChars != 0)
 
+/* Cost accumulated by a pattern while profiling is turned on.  The parser
+   looks for the end, error and sub-pattern start expressions of a pattern
+   all at once, in one combined expression, which says little about which
+   of them is expensive.  So while profiling, each of them is also run on
+   its own over the same text, and attempts, bytes and time are charged to
+   the pattern the expression belongs to.  Matches are counted for the
+   pattern whose start expression matched */
+typedef struct {
+    unsigned long attempts;
+    unsigned long matches;
+    unsigned long bytes;
+    double seconds;
+} patternProfile;
+
 /* "Compiled" version of pattern specification */
 typedef struct _highlightDataRec {
     regexp *startRE;
@@ -113,6 +135,8 @@ typedef struct _highlightDataRec {
     int nSubPatterns;
     int nSubBranches; /* Number of top-level branches of subPatternRE */
     int userStyleIndex;
+    char *name;
+    patternProfile profile;
     struct _highlightDataRec **subPatterns;
 } highlightDataRec;
 
@@ -122,6 +146,12 @@ typedef struct {
     int nChars;
 } reparseContext;
 
+/* A modified range of the buffer which has not yet been re-parsed */
+typedef struct {
+    int start;
+    int end;
+} deferredRange;
+
 /* Data structure attached to window to hold all syntax highlighting
    information (for both drawing and incremental reparsing) */
 typedef struct {
@@ -133,6 +163,11 @@ typedef struct {
     int nStyles;
     textBuffer *styleBuffer;
     patternSet *patternSetForWindow;
+    int nDeferred;          /* modified ranges awaiting re-parse, sorted */
+    deferredRange deferred[MAX_DEFERRED_RANGES + 1];
+    int redrawStart;        /* re-parsed range awaiting redisplay */
+    int redrawEnd;
+    XtWorkProcId reparseProcID;
 } windowHighlightData;
 
 static windowHighlightData *createHighlightData(WindowInfo *window,
@@ -148,6 +183,10 @@ static void handleUnparsedRegionCB(const textDisp* textD, int pos,
         const void* cbArg);
 static void incrementalReparse(windowHighlightData *highlightData,
     	textBuffer *buf, int pos, int nInserted, const char *delimiters);
+static void deferReparse(windowHighlightData *highlightData, int pos,
+        int nInserted, int nDeleted);
+static void flushDeferredReparse(const WindowInfo *window);
+static Boolean deferredReparseProc(XtPointer clientData);
 static int parseBufferRange(highlightDataRec *pass1Patterns,
     	highlightDataRec *pass2Patterns, textBuffer *buf, textBuffer *styleBuf,
         reparseContext *contextRequirements, int beginParse, int endParse,
@@ -158,6 +197,18 @@ static int parseString(highlightDataRec *pattern, const char **string,
 static void passTwoParseString(highlightDataRec *pattern, char *string,
         char *styleString, int length, char *prevChar, const char *delimiters,
         const char* lookBehindTo, const char* match_till);
+static int execPatternRE(highlightDataRec *pattern, regexp *re,
+        const char *string, const char *end, char prevChar, char succChar,
+        const char *delimiters, const char *lookBehindTo,
+        const char *match_till);
+static int execSubPatternRE(highlightDataRec *pattern, const char *string,
+        const char *end, char prevChar, char succChar,
+        const char *delimiters, const char *lookBehindTo,
+        const char *match_till);
+static int addProfileEntries(highlightProfileEntry **entries, int nEntries,
+        highlightDataRec *patterns, int pass);
+static void resetPatternProfile(highlightDataRec *patterns);
+static int compareProfileEntries(const void *e1, const void *e2);
 static void fillStyleString(const char **stringPtr, char **stylePtr,
         const char *toPtr, char style, char *prevChar);
 static void modifyStyleBuf(textBuffer *styleBuf, char *styleString,
@@ -186,6 +237,9 @@ static void updateWindowHeight(WindowInfo *window, int oldFontHeight);
 static int getFontHeight(WindowInfo *window);
 static styleTableEntry *styleTableEntryOfCode(WindowInfo *window, int hCode);
 
+/* Set when the pattern profiler is collecting statistics */
+static int ProfileHighlighting = False;
+
 /*
 ** Buffer modification callback for triggering re-parsing of modified
 ** text and keeping the style buffer synchronized with the text buffer.
@@ -247,10 +301,19 @@ void SyntaxHighlightModifyCB(int pos, int nInserted, int nDeleted,
        changes that are already scheduled for redraw */
     BufSelect(highlightData->styleBuffer, pos, pos+nInserted);
     
-    /* Re-parse around the changed region */
-    if (highlightData->pass1Patterns)
-    	incrementalReparse(highlightData, window->buffer, pos, nInserted,
-    	    	GetWindowDelimiters(window));
+    /* Remember the changed region for re-parsing.  Rather than re-parsing
+       for every modification (which, for macros and shell commands making
+       thousands of changes in a row, means parsing the same text over and
+       over), the re-parse is done once, when the display encounters the
+       unfinished text, when someone asks for style information, or when
+       the application becomes idle, whichever comes first */
+    if (highlightData->pass1Patterns) {
+    	deferReparse(highlightData, pos, nInserted, nDeleted);
+    	if (highlightData->reparseProcID == 0)
+    	    highlightData->reparseProcID = XtAppAddWorkProc(
+    	    	    XtWidgetToApplicationContext(window->shell),
+    	    	    deferredReparseProc, window);
+    }
 }
 
 /*
@@ -427,6 +490,10 @@ void UpdateHighlightStyles(WindowInfo *window)
     	return;
     }
     
+    /* Bring the style buffer up to date with any modifications still waiting
+       to be re-parsed with the old patterns, before it is handed over */
+    flushDeferredReparse(window);
+    
     /* Build new patterns */
     highlightData = createHighlightData(window, patterns);
     if (highlightData == NULL) {
@@ -493,6 +560,8 @@ void* GetHighlightInfo(WindowInfo *window, int pos)
     if (!highlightData)
 	return NULL;
     
+    flushDeferredReparse(window);
+    
     /* Be careful with signed/unsigned conversions. NO conversion here! */
     style = (int)BufGetCharacter(highlightData->styleBuffer, pos);
     
@@ -516,6 +585,139 @@ void* GetHighlightInfo(WindowInfo *window, int pos)
     return (void*)(intptr_t)pattern->userStyleIndex;    
 }
     
+/*
+** Turn collection of highlight pattern statistics on or off (for all
+** windows).  Collected statistics are kept when profiling is turned off.
+*/
+void SetHighlightProfiling(int state)
+{
+    ProfileHighlighting = state;
+}
+
+int GetHighlightProfiling(void)
+{
+    return ProfileHighlighting;
+}
+
+/*
+** Return the statistics collected by the pattern profiler for the patterns
+** highlighting "window", as an array allocated in "*entries" (to be freed by
+** the caller with NEditFree) in the order of the compiled patterns.  Entry
+** names point into the window's highlight data, and are only valid until the
+** patterns are recompiled.  Returns the number of entries.
+*/
+int GetHighlightProfile(WindowInfo *window, highlightProfileEntry **entries)
+{
+    windowHighlightData *highlightData =
+            (windowHighlightData *)window->highlightData;
+    int nEntries;
+
+    *entries = NULL;
+    if (highlightData == NULL)
+        return 0;
+    nEntries = addProfileEntries(entries, 0, highlightData->pass1Patterns, 1);
+    return addProfileEntries(entries, nEntries,
+            highlightData->pass2Patterns, 2);
+}
+
+/*
+** Clear the pattern profiler statistics of "window"
+*/
+void ResetHighlightProfile(WindowInfo *window)
+{
+    windowHighlightData *highlightData =
+            (windowHighlightData *)window->highlightData;
+
+    if (highlightData == NULL)
+        return;
+    resetPatternProfile(highlightData->pass1Patterns);
+    resetPatternProfile(highlightData->pass2Patterns);
+}
+
+/*
+** Create a textual report of the pattern profiler statistics for language
+** mode "langModeName", summed over all windows highlighted in that mode, and
+** sorted by the time spent in each pattern.  Returns an allocated string, to
+** be freed by the caller with NEditFree.
+*/
+char *HighlightProfileReport(const char *langModeName)
+{
+    highlightProfileEntry *entries = NULL, *winEntries, *e, *total;
+    windowHighlightData *highlightData;
+    WindowInfo *w;
+    int i, j, nEntries = 0, nWinEntries, nWindows = 0;
+    char *report, *outPtr;
+    
+    for (w=WindowList; w!=NULL; w=w->next) {
+        highlightData = (windowHighlightData *)w->highlightData;
+        if (highlightData == NULL || strcmp(langModeName,
+                highlightData->patternSetForWindow->languageMode))
+            continue;
+        nWindows++;
+        nWinEntries = GetHighlightProfile(w, &winEntries);
+        for (i=0; i<nWinEntries; i++) {
+            e = &winEntries[i];
+            for (j=0; j<nEntries; j++)
+                if (entries[j].pass == e->pass &&
+                        !strcmp(entries[j].name, e->name))
+                    break;
+            if (j == nEntries) {
+                entries = (highlightProfileEntry *)NEditRealloc(entries,
+                        sizeof(highlightProfileEntry) * (nEntries + 1));
+                entries[nEntries++] = *e;
+                continue;
+            }
+            total = &entries[j];
+            total->attempts += e->attempts;
+            total->matches += e->matches;
+            total->bytes += e->bytes;
+            total->seconds += e->seconds;
+        }
+        NEditFree(winEntries);
+    }
+    
+    if (nEntries > 1)
+        qsort(entries, nEntries, sizeof(highlightProfileEntry),
+                compareProfileEntries);
+
+    /* Header (2 lines), column heading (2 lines) and one line per pattern,
+       with pattern names truncated to 32 characters */
+    report = outPtr = (char*)NEditMalloc(strlen(langModeName) +
+            (nEntries + 4) * PROFILE_REPORT_LINE_LEN);
+    outPtr += sprintf(outPtr, "Language mode %s, %d window%s%s\n\n",
+            langModeName, nWindows, nWindows == 1 ? "" : "s",
+            ProfileHighlighting ? "" : " (profiling is off)");
+    outPtr += sprintf(outPtr, "%-32s %4s %10s %10s %12s %10s\n",
+            "Pattern", "Pass", "Attempts", "Matches", "Bytes", "Time (ms)");
+    outPtr += sprintf(outPtr, "%-32s %4s %10s %10s %12s %10s\n",
+            "-------", "----", "--------", "-------", "-----", "---------");
+    for (i=0; i<nEntries; i++) {
+        e = &entries[i];
+        outPtr += sprintf(outPtr, "%-32.32s %4d %10lu %10lu %12lu %10.2f\n",
+                e->name, e->pass, e->attempts, e->matches, e->bytes,
+                e->seconds * 1000.);
+    }
+    NEditFree(entries);
+    return report;
+}
+
+/*
+** Clear the pattern profiler statistics of all windows highlighted in
+** language mode "langModeName"
+*/
+void ResetHighlightProfileOfMode(const char *langModeName)
+{
+    windowHighlightData *highlightData;
+    WindowInfo *w;
+    
+    for (w=WindowList; w!=NULL; w=w->next) {
+        highlightData = (windowHighlightData *)w->highlightData;
+        if (highlightData != NULL && !strcmp(langModeName,
+                highlightData->patternSetForWindow->languageMode))
+            ResetHighlightProfile(w);
+    }
+}
+
 /*
 ** Free allocated memory associated with highlight data, including compiled
 ** regular expressions, style buffer and style table.  Note: be sure to
@@ -527,6 +729,8 @@ static void freeHighlightData(windowHighlightData *hd)
 {
     if (hd == NULL)
     	return;
+    if (hd->reparseProcID != 0)
+    	XtRemoveWorkProc(hd->reparseProcID);
     if (hd->pass1Patterns != NULL)
     	freePatterns(hd->pass1Patterns);
     if (hd->pass2Patterns != NULL)
@@ -832,6 +1036,9 @@ static windowHighlightData *createHighlightData(WindowInfo *window,
     highlightData->contextRequirements.nLines = contextLines;
     highlightData->contextRequirements.nChars = contextChars;
     highlightData->patternSetForWindow = patSet;
+    highlightData->nDeferred = 0;
+    highlightData->redrawStart = highlightData->redrawEnd = 0;
+    highlightData->reparseProcID = 0;
     
     return highlightData;
 }
@@ -889,6 +1096,8 @@ static highlightDataRec *compilePatterns(Widget dialogParent,
     for (i=0; i<nPatterns; i++) {
         compiledPats[i].colorOnly = patternSrc[i].flags & COLOR_ONLY;
         compiledPats[i].userStyleIndex = IndexOfNamedStyle(patternSrc[i].style);
+        compiledPats[i].name = NEditStrdup(patternSrc[i].name);
+        memset(&compiledPats[i].profile, 0, sizeof(patternProfile));
         if (compiledPats[i].colorOnly && compiledPats[i].nSubPatterns != 0)
         {
             DialogF(DF_WARN, dialogParent, 1, "Color-only Pattern",
@@ -1045,11 +1254,64 @@ static void freePatterns(highlightDataRec *patterns)
 
     for (i=0; patterns[i].style!=0; i++) {
         NEditFree(patterns[i].subPatterns);
+        NEditFree(patterns[i].name);
     }
 
     NEditFree(patterns);
 }
 
+/*
+** Append profile entries for the compiled pattern list "patterns" of
+** parsing pass "pass" to the array "*entries" of "nEntries" elements,
+** (re)allocating it as necessary.  Returns the new number of entries.
+*/
+static int addProfileEntries(highlightProfileEntry **entries, int nEntries,
+        highlightDataRec *patterns, int pass)
+{
+    highlightProfileEntry *e;
+    int i, nPatterns;
+    
+    if (patterns == NULL)
+        return nEntries;
+    for (nPatterns=0; patterns[nPatterns].style!=0; nPatterns++);
+    *entries = (highlightProfileEntry *)NEditRealloc(*entries,
+            sizeof(highlightProfileEntry) * (nEntries + nPatterns));
+    for (i=0; i<nPatterns; i++) {
+        e = &(*entries)[nEntries++];
+        if (i == 0)
+            e->name = pass == 1 ? "[pass 1 default]" : "[pass 2 default]";
+        else
+            e->name = patterns[i].name;
+        e->pass = pass;
+        e->attempts = patterns[i].profile.attempts;
+        e->matches = patterns[i].profile.matches;
+        e->bytes = patterns[i].profile.bytes;
+        e->seconds = patterns[i].profile.seconds;
+    }
+    return nEntries;
+}
+
+static void resetPatternProfile(highlightDataRec *patterns)
+{
+    int i;
+    
+    if (patterns == NULL)
+        return;
+    for (i=0; patterns[i].style!=0; i++)
+        memset(&patterns[i].profile, 0, sizeof(patternProfile));
+}
+
+/*
+** qsort comparison function for sorting profile entries by decreasing time
+*/
+static int compareProfileEntries(const void *e1, const void *e2)
+{
+    double t1 = ((const highlightProfileEntry *)e1)->seconds;
+    double t2 = ((const highlightProfileEntry *)e2)->seconds;
+    
+    return t1 < t2 ? 1 : (t1 > t2 ? -1 : 0);
+}
+
 /*
 ** Find the highlightPattern structure with a given name in the window.
 */
@@ -1080,6 +1342,7 @@ int HighlightCodeOfPos(WindowInfo *window, int pos)
     int hCode = 0;
     
     if (styleBuf != NULL) {
+      flushDeferredReparse(window);
       hCode = (unsigned char)BufGetCharacter(styleBuf, pos);
       if (hCode == UNFINISHED_STYLE) {
           /* encountered "unfinished" style, trigger parsing */
@@ -1107,6 +1370,7 @@ int HighlightLengthOfCodeFromPos(WindowInfo *window, int pos, int *checkCode)
     int oldPos = pos;
     
     if (styleBuf != NULL) {
+      flushDeferredReparse(window);
       hCode = (unsigned char)BufGetCharacter(styleBuf, pos);
       if (!hCode)
           return 0;
@@ -1149,6 +1413,7 @@ int StyleLengthOfCodeFromPos(WindowInfo *window, int pos,
     styleTableEntry *entry;
     
     if (styleBuf != NULL) {
+      flushDeferredReparse(window);
       hCode = (unsigned char)BufGetCharacter(styleBuf, pos);
       if (!hCode)
           return 0;
@@ -1291,12 +1556,20 @@ static void handleUnparsedRegion(const WindowInfo* window, textBuffer* styleBuf,
     highlightDataRec *pass2Patterns = highlightData->pass2Patterns;
     char *string, *styleString, *stylePtr, c, prevChar;
     const char *stringPtr;
-    int firstPass2Style = (unsigned char)pass2Patterns[1].style;
+    int firstPass2Style;
+    
+    /* Unfinished text may simply be text which was inserted but has not yet
+       been through the (deferred) pass 1 re-parse.  Do that first, it may
+       well be all that is needed */
+    flushDeferredReparse(window);
+    if (BufGetCharacter(styleBuf, pos) != UNFINISHED_STYLE)
+    	return;
     
     /* If there are no pass 2 patterns to process, do nothing (but this
        should never be triggered) */
     if (pass2Patterns == NULL)
     	return;
+    firstPass2Style = (unsigned char)pass2Patterns[1].style;
     
     /* Find the point at which to begin parsing to ensure that the character at
        pos is parsed correctly (beginSafety), at most one context distance back
@@ -1446,6 +1719,126 @@ static void incrementalReparse(windowHighlightData *highlightData,
     }	
 }
 
+/*
+** Add a modification (at "pos", "nDeleted" characters replaced by "nInserted"
+** characters) to the set of ranges in "highlightData" awaiting re-parsing.
+** Ranges already recorded are moved with the text, and merged with the new
+** range where they overlap or touch it.  When there are too many ranges, the
+** two which are closest together are combined into one.  The range awaiting
+** redisplay is adjusted for the modification as well (conservatively, by
+** stretching it over the modification if necessary).
+*/
+static void deferReparse(windowHighlightData *highlightData, int pos,
+        int nInserted, int nDeleted)
+{
+    deferredRange *ranges = highlightData->deferred;
+    int i, j, insertAt, closest, delta = nInserted - nDeleted;
+    int start = pos, end = pos + nInserted;
+
+    /* Shift or absorb the existing ranges, keeping them sorted */
+    for (i=0, j=0, insertAt=0; i<highlightData->nDeferred; i++) {
+    	if (ranges[i].end < pos) {
+    	    ranges[j++] = ranges[i];
+    	    insertAt = j;
+    	} else if (ranges[i].start > pos + nDeleted) {
+    	    ranges[j].start = ranges[i].start + delta;
+    	    ranges[j++].end = ranges[i].end + delta;
+    	} else {
+    	    start = min(start, ranges[i].start);
+    	    end = max(end, ranges[i].end <= pos + nDeleted ?
+    	    	    pos + nInserted : ranges[i].end + delta);
+    	}
+    }
+    memmove(&ranges[insertAt+1], &ranges[insertAt],
+    	    (j - insertAt) * sizeof(deferredRange));
+    ranges[insertAt].start = start;
+    ranges[insertAt].end = end;
+    highlightData->nDeferred = j + 1;
+    
+    /* Don't let the list grow without bound */
+    if (highlightData->nDeferred > MAX_DEFERRED_RANGES) {
+    	closest = 0;
+    	for (i=1; i<highlightData->nDeferred-1; i++)
+    	    if (ranges[i+1].start - ranges[i].end <
+    	    	    ranges[closest+1].start - ranges[closest].end)
+    	    	closest = i;
+    	ranges[closest].end = ranges[closest+1].end;
+    	memmove(&ranges[closest+1], &ranges[closest+2],
+    	    	(highlightData->nDeferred - closest - 2) *
+    	    	sizeof(deferredRange));
+    	highlightData->nDeferred--;
+    }
+    
+    /* Keep the pending redisplay range in step with the text */
+    if (highlightData->redrawEnd > highlightData->redrawStart &&
+    	    pos <= highlightData->redrawEnd) {
+    	highlightData->redrawEnd = max(pos + nInserted,
+    	    	highlightData->redrawEnd + delta);
+    	highlightData->redrawStart = min(pos, highlightData->redrawStart);
+    }
+}
+
+/*
+** Re-parse all of the modified ranges of the buffer which are waiting to be
+** re-parsed (see deferReparse), in buffer order, so that each re-parse starts
+** from correctly parsed text.  Areas where the styles changed are added to
+** the range waiting for redisplay, which is left to the idle procedure,
+** since this may be called while the text display is in the middle of drawing.
+*/
+static void flushDeferredReparse(const WindowInfo *window)
+{
+    windowHighlightData *highlightData =
+    	    (windowHighlightData *)window->highlightData;
+    textBuffer *styleBuf;
+    int i, changedStart, changedEnd;
+    
+    if (highlightData == NULL || highlightData->nDeferred == 0)
+    	return;
+    styleBuf = highlightData->styleBuffer;
+    
+    for (i=0; i<highlightData->nDeferred; i++) {
+    	changedStart = highlightData->deferred[i].start;
+    	changedEnd = highlightData->deferred[i].end;
+    	BufSelect(styleBuf, changedStart, changedEnd);
+    	incrementalReparse(highlightData, window->buffer, changedStart,
+    	    	changedEnd - changedStart, GetWindowDelimiters(window));
+    	if (styleBuf->primary.selected) {
+    	    changedStart = min(changedStart, styleBuf->primary.start);
+    	    changedEnd = max(changedEnd, styleBuf->primary.end);
+    	}
+    	if (highlightData->redrawEnd > highlightData->redrawStart) {
+    	    changedStart = min(changedStart, highlightData->redrawStart);
+    	    changedEnd = max(changedEnd, highlightData->redrawEnd);
+    	}
+    	highlightData->redrawStart = changedStart;
+    	highlightData->redrawEnd = changedEnd;
+    }
+    highlightData->nDeferred = 0;
+    BufUnselect(styleBuf);
+}
+
+/*
+** Xt work procedure for finishing deferred re-parsing when the application
+** becomes idle, and redisplaying the text whose styles have changed.
+*/
+static Boolean deferredReparseProc(XtPointer clientData)
+{
+    WindowInfo *window = (WindowInfo *)clientData;
+    windowHighlightData *highlightData =
+    	    (windowHighlightData *)window->highlightData;
+    int start, end;
+    
+    highlightData->reparseProcID = 0;
+    flushDeferredReparse(window);
+    
+    start = min(highlightData->redrawStart, window->buffer->length);
+    end = min(highlightData->redrawEnd, window->buffer->length);
+    highlightData->redrawStart = highlightData->redrawEnd = 0;
+    if (end > start)
+    	BufCheckDisplay(window->buffer, start, end);
+    return True;
+}
+
 /*
 ** Parse text in buffer "buf" between positions "beginParse" and "endParse"
 ** using pass 1 patterns over the entire range and pass 2 patterns where needed
@@ -1647,9 +2040,9 @@ static int parseString(highlightDataRec *pattern, const char **string,
     stringPtr = *string;
     stylePtr = *styleString;
     
-    while (ExecRE(pattern->subPatternRE, stringPtr, anchored ? *string+1 :
-	    *string+length+1, False, *prevChar, succChar, delimiters,
-            lookBehindTo, match_till)) {
+    while (execSubPatternRE(pattern, stringPtr,
+            anchored ? *string+1 : *string+length+1, *prevChar, succChar,
+            delimiters, lookBehindTo, match_till)) {
 	/* Beware of the case where only one real branch exists, but that 
 	   branch has sub-branches itself. In that case the top_branch refers 
 	   to the matching sub-branch and must be ignored. */
@@ -1679,8 +2072,8 @@ static int parseString(highlightDataRec *pattern, const char **string,
 		    subPat = pattern->subPatterns[i];
 		    if (subPat->colorOnly) {
 			if (!subExecuted) { 
-                            if (!ExecRE(pattern->endRE, savedStartPtr,
-				savedStartPtr+1, False, savedPrevChar, 
+                            if (!execPatternRE(pattern, pattern->endRE,
+				savedStartPtr, savedStartPtr+1, savedPrevChar,
 				succChar, delimiters, lookBehindTo, match_till)) {
 				fprintf(stderr, "Internal error, failed to "
 					"recover end match in parseString\n");
@@ -1723,6 +2116,8 @@ static int parseString(highlightDataRec *pattern, const char **string,
     	    fprintf(stderr, "Internal error, failed to match in parseString\n");
     	    return False;
     	}
+	if (ProfileHighlighting)
+	    subPat->profile.matches++;
     	
     	/* the sub-pattern is a simple match, just color it */
     	if (subPat->subPatternRE == NULL) {
@@ -1764,8 +2159,8 @@ static int parseString(highlightDataRec *pattern, const char **string,
 	    subSubPat = subPat->subPatterns[i];
 	    if (subSubPat->colorOnly) {
 		if (!subExecuted) { 
-                   if (!ExecRE(subPat->startRE, savedStartPtr, 
-			savedStartPtr+1, False, savedPrevChar, succChar,
+                   if (!execPatternRE(subPat, subPat->startRE,
+			savedStartPtr, savedStartPtr+1, savedPrevChar, succChar,
 			delimiters, lookBehindTo, match_till)) {
 			fprintf(stderr, "Internal error, failed to recover "
 					"start match in parseString\n");
@@ -1870,6 +2265,75 @@ static void fillStyleString(const char **stringPtr, char **stylePtr,
     *stringPtr = toPtr;
 }
 
+/*
+** Wrapper around ExecRE for the matching done by the highlighting parser,
+** which charges the execution to "pattern" when the pattern profiler is
+** turned on.  The scanned distance is measured to the end of the match, or
+** to "end" if nothing matched (ExecRE may stop earlier at a terminating
+** null, so this is an upper bound).
+*/
+static int execPatternRE(highlightDataRec *pattern, regexp *re,
+        const char *string, const char *end, char prevChar, char succChar,
+        const char *delimiters, const char *lookBehindTo,
+        const char *match_till)
+{
+    double startTime;
+    int matched;
+
+    if (!ProfileHighlighting)
+        return ExecRE(re, string, end, False, prevChar, succChar, delimiters,
+                lookBehindTo, match_till);
+
+    startTime = GetWallClock();
+    matched = ExecRE(re, string, end, False, prevChar, succChar, delimiters,
+            lookBehindTo, match_till);
+    pattern->profile.seconds += GetWallClock() - startTime;
+    pattern->profile.attempts++;
+    if (matched)
+        pattern->profile.bytes += re->endp[0] - string;
+    else if (end > string)
+        pattern->profile.bytes += end - string;
+    return matched;
+}
+
+/*
+** Execute the combined end, error and sub-pattern start expression of
+** "pattern".  When the pattern profiler is turned on, its components are
+** then run one by one over the same starting positions (up to where the
+** combined expression matched), so that each pattern is charged with the
+** cost of its own expressions.
+*/
+static int execSubPatternRE(highlightDataRec *pattern, const char *string,
+        const char *end, char prevChar, char succChar,
+        const char *delimiters, const char *lookBehindTo,
+        const char *match_till)
+{
+    regexp *re = pattern->subPatternRE;
+    highlightDataRec *subPat;
+    int i, matched;
+
+    matched = ExecRE(re, string, end, False, prevChar, succChar, delimiters,
+            lookBehindTo, match_till);
+    if (!ProfileHighlighting)
+        return matched;
+
+    if (matched)
+        end = re->startp[0] + 1;
+    if (pattern->endRE != NULL)
+        execPatternRE(pattern, pattern->endRE, string, end, prevChar,
+                succChar, delimiters, lookBehindTo, match_till);
+    if (pattern->errorRE != NULL)
+        execPatternRE(pattern, pattern->errorRE, string, end, prevChar,
+                succChar, delimiters, lookBehindTo, match_till);
+    for (i=0; i<pattern->nSubPatterns; i++) {
+        subPat = pattern->subPatterns[i];
+        if (!subPat->colorOnly && subPat->startRE != NULL)
+            execPatternRE(subPat, subPat->startRE, string, end, prevChar,
+                    succChar, delimiters, lookBehindTo, match_till);
+    }
+    return matched;
+}
+
 /*
 ** Incorporate changes from styleString into styleBuf, tracking changes
 ** in need of redisplay, and marking them for redisplay by the text
@@ -60,6 +60,16 @@ typedef struct {
     highlightPattern *patterns;
 } patternSet;
 
+/* Statistics gathered by the highlight pattern profiler for one pattern */
+typedef struct {
+    const char *name;
+    int pass;
+    unsigned long attempts;
+    unsigned long matches;
+    unsigned long bytes;
+    double seconds;
+} highlightProfileEntry;
+
 void SyntaxHighlightModifyCB(int pos, int nInserted, int nDeleted,
     	int nRestyled, const char *deletedText, void *cbArg);
 void StartHighlighting(WindowInfo *window, int warn);
@@ -82,5 +92,11 @@ Pixel HighlightColorValueOfCode(WindowInfo *window, int hCode,
       int *r, int *g, int *b);
 Pixel GetHighlightBGColorOfCode(WindowInfo *window, int hCode,
       int *r, int *g, int *b);
+void SetHighlightProfiling(int state);
+int GetHighlightProfiling(void);
+int GetHighlightProfile(WindowInfo *window, highlightProfileEntry **entries);
+void ResetHighlightProfile(WindowInfo *window);
+char *HighlightProfileReport(const char *langModeName);
+void ResetHighlightProfileOfMode(const char *langModeName);
 
 #endif /* NEDIT_HIGHLIGHT_H_INCLUDED */
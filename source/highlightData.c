@@ -44,16 +44,22 @@
 #include "../util/DialogF.h"
 #include "../util/managedList.h"
 #include "../util/nedit_malloc.h"
+#include "../util/utils.h"
 
 #include <stdio.h>
 #include <string.h>
 #include <limits.h>
+#include <unistd.h>
 #ifdef VMS
 #include "../util/VMSparam.h"
 #else
 #ifndef __MVS__
 #include <sys/param.h>
 #endif
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #endif /*VMS*/
 
 #include <Xm/Xm.h>
@@ -142,6 +148,16 @@ static void restoreCB(Widget w, XtPointer clientData, XtPointer callData);
 static void deleteCB(Widget w, XtPointer clientData, XtPointer callData);
 static void closeCB(Widget w, XtPointer clientData, XtPointer callData);
 static void helpCB(Widget w, XtPointer clientData, XtPointer callData);
+static void profileCB(Widget w, XtPointer clientData, XtPointer callData);
+static void profileEnableCB(Widget w, XtPointer clientData,
+        XtPointer callData);
+static void profileRefreshCB(Widget w, XtPointer clientData,
+        XtPointer callData);
+static void profileResetCB(Widget w, XtPointer clientData, XtPointer callData);
+static void profileCloseCB(Widget w, XtPointer clientData, XtPointer callData);
+static void profileDestroyCB(Widget w, XtPointer clientData,
+        XtPointer callData);
+static void updateProfileReport(void);
 static void *getDisplayedCB(void *oldItem, int explicitRequest, int *abort,
     	void *cbArg);
 static void setDisplayedCB(void *item, void *cbArg);
@@ -156,6 +172,20 @@ static highlightPattern *copyPatternSrc(highlightPattern *pat,
 static void freeItemCB(void *item);
 static void freePatternSrc(highlightPattern *pat, int freeStruct);
 static void freePatternSet(patternSet *p);
+static int addPatternSet(patternSet *patSet);
+#ifndef VMS
+static unsigned long hashPatternSource(const char *inString, int convertOld);
+static unsigned long hashString(unsigned long hash, const char *string);
+static int readPatternSetCache(unsigned long key, patternSet **sets);
+static int getCacheNumber(const unsigned char **ptr, const unsigned char *end,
+        unsigned long *number);
+static int getCacheString(const unsigned char **ptr, const unsigned char *end,
+        char **string);
+static void writePatternSetCache(unsigned long key, patternSet **sets,
+        int nSets);
+static void putCacheNumber(FILE *fp, unsigned long number);
+static void putCacheString(FILE *fp, const char *string);
+#endif /*VMS*/
 
 /* list of available highlight styles */
 static int NHighlightStyles = 0;
@@ -206,6 +236,13 @@ static struct {
                      NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
                      NULL, NULL, NULL, NULL, NULL, 0, NULL };
 
+/* Highlight pattern profiler report dialog information */
+static struct {
+    Widget form;
+    Widget textW;
+    Widget enableW;
+} ProfileDialog = {NULL, NULL, NULL};
+
 /* Pattern sources loaded from the .nedit file or set by the user */
 static int NPatternSets = 0;
 static patternSet *PatternSets[MAX_LANGUAGE_MODES];
@@ -1137,12 +1174,36 @@ char *WriteStylesString(void)
 ** The argument convertOld, reads patterns in pre 5.1 format (which means
 ** that they may contain regular expressions are of the older syntax where
 ** braces were not quoted, and \0 was a legal substitution character).
+**
+** Since the string (with the built-in default pattern sets it refers to) is
+** long and expensive to parse, the result is also saved in a binary cache
+** file, and read from there, instead, the next time the same string is
+** loaded.
 */
 int LoadHighlightString(char *inString, int convertOld)
 {
     char *inPtr = inString;
     patternSet *patSet;
-    int i;
+    int i, nSets;
+#ifndef VMS
+    patternSet *cachedSets[MAX_LANGUAGE_MODES];
+    int wasLoaded[MAX_LANGUAGE_MODES];
+    unsigned long cacheKey = hashPatternSource(inString, convertOld);
+    
+    nSets = readPatternSetCache(cacheKey, cachedSets);
+    if (nSets >= 0) {
+    	for (i=0; i<nSets; i++) {
+    	    if (!addPatternSet(cachedSets[i])) {
+    	    	while (++i < nSets)
+    	    	    freePatternSet(cachedSets[i]);
+    	    	return False;
+    	    }
+    	}
+    	return True;
+    }
+    for (i=0; i<MAX_LANGUAGE_MODES; i++)
+    	wasLoaded[i] = False;
+#endif /*VMS*/
     
     for (;;) {
    	
@@ -1152,26 +1213,292 @@ int LoadHighlightString(char *inString, int convertOld)
    	    return False;
    	
 	/* Add/change the pattern set in the list */
-	for (i=0; i<NPatternSets; i++) {
-	    if (!strcmp(PatternSets[i]->languageMode, patSet->languageMode)) {
-		freePatternSet(PatternSets[i]);
-		PatternSets[i] = patSet;
-		break;
-	    }
-	}
-	if (i == NPatternSets) {
-	    PatternSets[NPatternSets++] = patSet;
-   	    if (NPatternSets > MAX_LANGUAGE_MODES)
-   		return False;
-	}
+	i = addPatternSet(patSet);
+	if (i == 0)
+	    return False;
+#ifndef VMS
+	wasLoaded[i-1] = True;
+#endif
 	
     	/* if the string ends here, we're done */
    	inPtr += strspn(inPtr, " \t\n");
     	if (*inPtr == '\0')
-    	    return True;
+    	    break;
+    }
+
+#ifndef VMS
+    /* Cache the (final versions of the) pattern sets read from the string,
+       in the order in which they appear in the list, so adding them again in
+       that order leaves the list in the same state */
+    for (i=0, nSets=0; i<NPatternSets; i++)
+    	if (wasLoaded[i])
+    	    cachedSets[nSets++] = PatternSets[i];
+    writePatternSetCache(cacheKey, cachedSets, nSets);
+#endif /*VMS*/
+    return True;
+}
+
+/*
+** Add a pattern set to the PatternSets list, replacing (and freeing) any
+** existing set for the same language mode.  Returns the position of the set
+** in the list plus one, or 0 (after freeing the set) if the list is full.
+*/
+static int addPatternSet(patternSet *patSet)
+{
+    int i;
+    
+    for (i=0; i<NPatternSets; i++) {
+	if (!strcmp(PatternSets[i]->languageMode, patSet->languageMode)) {
+	    freePatternSet(PatternSets[i]);
+	    PatternSets[i] = patSet;
+	    return i + 1;
+	}
+    }
+    if (NPatternSets >= MAX_LANGUAGE_MODES) {
+    	freePatternSet(patSet);
+    	return 0;
+    }
+    PatternSets[NPatternSets++] = patSet;
+    return NPatternSets;
+}
+
+#ifndef VMS
+/*
+** The pattern set cache file holds pattern sets exactly as read by
+** LoadHighlightString, preceded by a key identifying the source they were
+** read from.  Numbers are stored as 4 byte, big endian values and strings as
+** a length (PATTERN_CACHE_NULL for a NULL string) followed by the characters
+** without terminator, so the file can be shared between different machines
+** using the same home directory.
+*/
+#define PATTERN_CACHE_MAGIC "NEdit pattern set cache 1\n"
+#define PATTERN_CACHE_NULL 0xffffffffUL
+
+/*
+** Compute the cache key for a highlight pattern string.  Since the string may
+** refer to the built-in pattern sets by name, those are included as well.
+*/
+static unsigned long hashPatternSource(const char *inString, int convertOld)
+{
+    unsigned long hash = 2166136261UL;
+    int i;
+    
+    hash = hashString(hash, convertOld ? "convert" : "");
+    hash = hashString(hash, inString);
+    for (i=0; i<(int)XtNumber(DefaultPatternSets); i++)
+    	hash = hashString(hash, DefaultPatternSets[i]);
+    return hash;
+}
+
+/*
+** Continue a (32 bit FNV-1a) hash over a string and its terminator
+*/
+static unsigned long hashString(unsigned long hash, const char *string)
+{
+    const unsigned char *c = (const unsigned char *)string;
+    
+    do {
+    	hash = ((hash ^ *c) * 16777619UL) & 0xffffffffUL;
+    } while (*c++ != '\0');
+    return hash;
+}
+
+/*
+** Read the pattern set cache file into "sets" (which must have room for
+** MAX_LANGUAGE_MODES entries), and return the number of pattern sets read.
+** Returns -1 if there is no cache, or if it was not created with the same
+** key, or is damaged in any way.
+*/
+static int readPatternSetCache(unsigned long key, patternSet **sets)
+{
+    const char *cacheName = GetRCFileName(NEDIT_PATTERN_CACHE);
+    const unsigned char *ptr, *end;
+    size_t magicLen = strlen(PATTERN_CACHE_MAGIC);
+    unsigned long number, nSets, nPatterns, flags;
+    unsigned long lineContext, charContext;
+    struct stat statbuf;
+    patternSet *patSet;
+    highlightPattern *pat;
+    void *fileMap;
+    int i, fd, nRead = 0, ok = False;
+    
+    if (cacheName == NULL || (fd = open(cacheName, O_RDONLY)) < 0)
+    	return -1;
+    if (fstat(fd, &statbuf) != 0 || statbuf.st_size < (off_t)magicLen) {
+    	close(fd);
+    	return -1;
+    }
+    fileMap = mmap(NULL, (size_t)statbuf.st_size, PROT_READ, MAP_PRIVATE,
+    	    fd, 0);
+    close(fd);
+    if (fileMap == MAP_FAILED)
+    	return -1;
+    ptr = (const unsigned char *)fileMap;
+    end = ptr + statbuf.st_size;
+    
+    if (memcmp(ptr, PATTERN_CACHE_MAGIC, magicLen) != 0)
+    	goto done;
+    ptr += magicLen;
+    if (!getCacheNumber(&ptr, end, &number) || number != key ||
+    	    !getCacheNumber(&ptr, end, &nSets) || nSets > MAX_LANGUAGE_MODES)
+    	goto done;
+    
+    for (nRead=0; nRead<(int)nSets; ) {
+    	patSet = (patternSet *)NEditMalloc(sizeof(patternSet));
+    	patSet->languageMode = NULL;
+    	patSet->nPatterns = 0;
+    	patSet->patterns = NULL;
+    	sets[nRead++] = patSet;
+    	if (!getCacheString(&ptr, end, &patSet->languageMode) ||
+    	    	patSet->languageMode == NULL ||
+    	    	!getCacheNumber(&ptr, end, &lineContext) ||
+    	    	!getCacheNumber(&ptr, end, &charContext) ||
+    	    	!getCacheNumber(&ptr, end, &nPatterns) ||
+    	    	nPatterns > MAX_PATTERNS)
+    	    goto done;
+    	patSet->lineContext = (int)lineContext;
+    	patSet->charContext = (int)charContext;
+    	if (nPatterns == 0)
+    	    continue;
+    	patSet->nPatterns = (int)nPatterns;
+    	patSet->patterns = (highlightPattern *)NEditCalloc(nPatterns,
+    	    	sizeof(highlightPattern));
+    	for (i=0; i<(int)nPatterns; i++) {
+    	    pat = &patSet->patterns[i];
+    	    if (!getCacheString(&ptr, end, &pat->name) ||
+    	    	    !getCacheString(&ptr, end, &pat->startRE) ||
+    	    	    !getCacheString(&ptr, end, &pat->endRE) ||
+    	    	    !getCacheString(&ptr, end, &pat->errorRE) ||
+    	    	    !getCacheString(&ptr, end, &pat->style) ||
+    	    	    !getCacheString(&ptr, end, &pat->subPatternOf) ||
+    	    	    !getCacheNumber(&ptr, end, &flags))
+    	    	goto done;
+    	    pat->flags = (int)flags;
+    	}
+    }
+    ok = ptr == end;
+
+done:
+    munmap(fileMap, (size_t)statbuf.st_size);
+    if (!ok) {
+    	while (nRead > 0)
+    	    freePatternSet(sets[--nRead]);
+    	return -1;
+    }
+    return nRead;
+}
+
+/*
+** Read a number from the pattern set cache data at *ptr, and advance *ptr
+** past it.  Returns False if the data ends before "end".
+*/
+static int getCacheNumber(const unsigned char **ptr, const unsigned char *end,
+        unsigned long *number)
+{
+    const unsigned char *p = *ptr;
+    
+    if (end - p < 4)
+    	return False;
+    *number = ((unsigned long)p[0] << 24) | ((unsigned long)p[1] << 16) |
+    	    ((unsigned long)p[2] << 8) | (unsigned long)p[3];
+    *ptr += 4;
+    return True;
+}
+
+/*
+** Read a string from the pattern set cache data at *ptr into a newly
+** allocated copy in *string, and advance *ptr past it.  Returns False
+** (with *string set to NULL) if the data ends before "end".
+*/
+static int getCacheString(const unsigned char **ptr, const unsigned char *end,
+        char **string)
+{
+    unsigned long length;
+    
+    *string = NULL;
+    if (!getCacheNumber(ptr, end, &length))
+    	return False;
+    if (length == PATTERN_CACHE_NULL)
+    	return True;
+    if ((unsigned long)(end - *ptr) < length)
+    	return False;
+    *string = (char *)NEditMalloc(length + 1);
+    memcpy(*string, *ptr, length);
+    (*string)[length] = '\0';
+    *ptr += length;
+    return True;
+}
+
+/*
+** Write pattern sets to the pattern set cache file, under "key".  The file is
+** written under a temporary name and renamed, so other NEdit processes never
+** see a partially written cache.  Failure is silent, the cache is only an
+** optimization.
+*/
+static void writePatternSetCache(unsigned long key, patternSet **sets,
+        int nSets)
+{
+    const char *cacheName = GetRCFileName(NEDIT_PATTERN_CACHE);
+    char tmpName[MAXPATHLEN + 24];
+    highlightPattern *pat;
+    FILE *fp;
+    int i, p;
+    
+    if (cacheName == NULL || strlen(cacheName) > MAXPATHLEN)
+    	return;
+    sprintf(tmpName, "%s.%ld", cacheName, (long)getpid());
+    if ((fp = fopen(tmpName, "wb")) == NULL)
+    	return;
+    
+    fputs(PATTERN_CACHE_MAGIC, fp);
+    putCacheNumber(fp, key);
+    putCacheNumber(fp, (unsigned long)nSets);
+    for (i=0; i<nSets; i++) {
+    	putCacheString(fp, sets[i]->languageMode);
+    	putCacheNumber(fp, (unsigned long)sets[i]->lineContext);
+    	putCacheNumber(fp, (unsigned long)sets[i]->charContext);
+    	putCacheNumber(fp, (unsigned long)sets[i]->nPatterns);
+    	for (p=0; p<sets[i]->nPatterns; p++) {
+    	    pat = &sets[i]->patterns[p];
+    	    putCacheString(fp, pat->name);
+    	    putCacheString(fp, pat->startRE);
+    	    putCacheString(fp, pat->endRE);
+    	    putCacheString(fp, pat->errorRE);
+    	    putCacheString(fp, pat->style);
+    	    putCacheString(fp, pat->subPatternOf);
+    	    putCacheNumber(fp, (unsigned long)pat->flags);
+    	}
     }
+    
+    if (ferror(fp)) {
+    	fclose(fp);
+    	remove(tmpName);
+    } else if (fclose(fp) != 0 || rename(tmpName, cacheName) != 0)
+    	remove(tmpName);
+}
+
+static void putCacheNumber(FILE *fp, unsigned long number)
+{
+    putc((int)((number >> 24) & 0xff), fp);
+    putc((int)((number >> 16) & 0xff), fp);
+    putc((int)((number >> 8) & 0xff), fp);
+    putc((int)(number & 0xff), fp);
 }
 
+static void putCacheString(FILE *fp, const char *string)
+{
+    size_t length;
+    
+    if (string == NULL) {
+    	putCacheNumber(fp, PATTERN_CACHE_NULL);
+    	return;
+    }
+    length = strlen(string);
+    putCacheNumber(fp, (unsigned long)length);
+    fwrite(string, 1, length, fp);
+}
+#endif /*VMS*/
+
 /*
 ** Create a string in the correct format for the highlightPatterns resource,
 ** containing all of the highlight pattern information from the stored
@@ -2285,7 +2612,7 @@ void EditHighlightPatterns(WindowInfo *window)
     Widget form, lmOptMenu, patternsForm, patternsFrame, patternsLbl;
     Widget lmForm, contextFrame, contextForm, styleLbl, styleBtn;
     Widget okBtn, applyBtn, checkBtn, deleteBtn, closeBtn, helpBtn;
-    Widget restoreBtn, nameLbl, typeLbl, typeBox, lmBtn, matchBox;
+    Widget restoreBtn, nameLbl, typeLbl, typeBox, lmBtn, matchBox, profileBtn;
     patternSet *patSet;
     XmString s1;
     int i, n, nPatterns;
@@ -2382,6 +2709,15 @@ void EditHighlightPatterns(WindowInfo *window)
     XtAddCallback(lmBtn, XmNactivateCallback, lmDialogCB, NULL);
     XmStringFree(s1);
     
+    profileBtn = XtVaCreateManagedWidget("profileBtn", xmPushButtonWidgetClass,
+            lmForm,
+    	    XmNlabelString, s1=MKSTRING("Show\nProfile..."),
+    	    XmNmnemonic, 'w',
+    	    XmNleftAttachment, XmATTACH_FORM,
+    	    XmNtopAttachment, XmATTACH_FORM, NULL);
+    XtAddCallback(profileBtn, XmNactivateCallback, profileCB, NULL);
+    XmStringFree(s1);
+    
     okBtn = XtVaCreateManagedWidget("ok", xmPushButtonWidgetClass, form,
             XmNlabelString, s1=XmStringCreateSimple("OK"),
             XmNmarginWidth, BUTTON_WIDTH_MARGIN,
@@ -2976,6 +3312,10 @@ static void langModeCB(Widget w, XtPointer clientData, XtPointer callData)
     	SetIntText(HighlightDialog.charContextW, newPatSet->charContext);
     }
     ChangeManagedListData(HighlightDialog.managedListW);
+    
+    /* Show the profile of the new language mode, if it's being displayed */
+    if (ProfileDialog.form != NULL)
+        updateProfileReport();
 }
 
 static void lmDialogCB(Widget w, XtPointer clientData, XtPointer callData)
@@ -3120,6 +3460,154 @@ static void helpCB(Widget w, XtPointer clientData, XtPointer callData)
     Help(HELP_PATTERNS);
 }
 
+/*
+** Present a dialog reporting the cost of the highlight patterns of the
+** language mode being edited, as collected by the pattern profiler in all
+** windows using that mode.  The dialog allows turning the profiler on and
+** off, and resetting the collected statistics.
+*/
+static void profileCB(Widget w, XtPointer clientData, XtPointer callData)
+{
+    Arg al[20];
+    int ac;
+    Widget closeBtn, resetBtn, refreshBtn;
+    XmString st1;
+
+    if (ProfileDialog.form != NULL) {
+        updateProfileReport();
+        RaiseDialogWindow(XtParent(ProfileDialog.form));
+        return;
+    }
+
+    ac = 0;
+    XtSetArg(al[ac], XmNautoUnmanage, False); ac++;
+    ProfileDialog.form = CreateFormDialog(HighlightDialog.shell,
+            "patternProfile", al, ac);
+    XtAddCallback(ProfileDialog.form, XmNdestroyCallback, profileDestroyCB,
+            NULL);
+    
+    ProfileDialog.enableW = XtVaCreateManagedWidget("enable",
+            xmToggleButtonWidgetClass, ProfileDialog.form,
+    	    XmNlabelString, st1=XmStringCreateSimple("Collect statistics"),
+    	    XmNmnemonic, 'S',
+    	    XmNset, GetHighlightProfiling(),
+    	    XmNleftAttachment, XmATTACH_POSITION,
+    	    XmNleftPosition, 1,
+    	    XmNbottomAttachment, XmATTACH_FORM,
+    	    XmNbottomOffset, BORDER, NULL);
+    XtAddCallback(ProfileDialog.enableW, XmNvalueChangedCallback,
+            profileEnableCB, NULL);
+    XmStringFree(st1);
+
+    closeBtn = XtVaCreateManagedWidget("close", xmPushButtonWidgetClass,
+            ProfileDialog.form,
+    	    XmNlabelString, st1=XmStringCreateSimple("Close"),
+    	    XmNmarginWidth, BUTTON_WIDTH_MARGIN,
+    	    XmNleftAttachment, XmATTACH_POSITION,
+    	    XmNleftPosition, 80,
+    	    XmNrightAttachment, XmATTACH_POSITION,
+    	    XmNrightPosition, 99,
+    	    XmNbottomAttachment, XmATTACH_FORM,
+    	    XmNbottomOffset, BORDER, NULL);
+    XtAddCallback(closeBtn, XmNactivateCallback, profileCloseCB, NULL);
+    XmStringFree(st1);
+
+    resetBtn = XtVaCreateManagedWidget("reset", xmPushButtonWidgetClass,
+            ProfileDialog.form,
+    	    XmNlabelString, st1=XmStringCreateSimple("Reset"),
+    	    XmNmnemonic, 'R',
+    	    XmNleftAttachment, XmATTACH_POSITION,
+    	    XmNleftPosition, 60,
+    	    XmNrightAttachment, XmATTACH_POSITION,
+    	    XmNrightPosition, 79,
+    	    XmNbottomAttachment, XmATTACH_FORM,
+    	    XmNbottomOffset, BORDER, NULL);
+    XtAddCallback(resetBtn, XmNactivateCallback, profileResetCB, NULL);
+    XmStringFree(st1);
+
+    refreshBtn = XtVaCreateManagedWidget("refresh", xmPushButtonWidgetClass,
+            ProfileDialog.form,
+    	    XmNlabelString, st1=XmStringCreateSimple("Refresh"),
+    	    XmNmnemonic, 'f',
+    	    XmNleftAttachment, XmATTACH_POSITION,
+    	    XmNleftPosition, 40,
+    	    XmNrightAttachment, XmATTACH_POSITION,
+    	    XmNrightPosition, 59,
+    	    XmNbottomAttachment, XmATTACH_FORM,
+    	    XmNbottomOffset, BORDER, NULL);
+    XtAddCallback(refreshBtn, XmNactivateCallback, profileRefreshCB, NULL);
+    XmStringFree(st1);
+    
+    ac = 0;
+    XtSetArg(al[ac], XmNrows, 20);  ac++;
+    XtSetArg(al[ac], XmNcolumns, 80);  ac++;
+    XtSetArg(al[ac], XmNeditMode, XmMULTI_LINE_EDIT);  ac++;
+    XtSetArg(al[ac], XmNeditable, False);  ac++;
+    XtSetArg(al[ac], XmNcursorPositionVisible, False);  ac++;
+    XtSetArg(al[ac], XmNtopAttachment, XmATTACH_FORM);  ac++;
+    XtSetArg(al[ac], XmNtopOffset, BORDER);  ac++;
+    XtSetArg(al[ac], XmNleftAttachment, XmATTACH_POSITION);  ac++;
+    XtSetArg(al[ac], XmNleftPosition, 1);  ac++;
+    XtSetArg(al[ac], XmNrightAttachment, XmATTACH_POSITION);  ac++;
+    XtSetArg(al[ac], XmNrightPosition, 99);  ac++;
+    XtSetArg(al[ac], XmNbottomAttachment, XmATTACH_WIDGET);  ac++;
+    XtSetArg(al[ac], XmNbottomWidget, closeBtn);  ac++;
+    XtSetArg(al[ac], XmNbottomOffset, BORDER);  ac++;
+    ProfileDialog.textW = XmCreateScrolledText(ProfileDialog.form,
+            "report", al, ac);
+    AddMouseWheelSupport(ProfileDialog.textW);
+    XtManageChild(ProfileDialog.textW);
+    
+    XtVaSetValues(ProfileDialog.form, XmNcancelButton, closeBtn, NULL);
+    XtVaSetValues(XtParent(ProfileDialog.form), XmNtitle,
+            "Highlight Pattern Profile", NULL);
+    AddDialogMnemonicHandler(ProfileDialog.form, FALSE);
+    updateProfileReport();
+    ManageDialogCenteredOnPointer(ProfileDialog.form);
+}
+
+static void profileEnableCB(Widget w, XtPointer clientData,
+        XtPointer callData)
+{
+    SetHighlightProfiling(XmToggleButtonGetState(w));
+    updateProfileReport();
+}
+
+static void profileRefreshCB(Widget w, XtPointer clientData,
+        XtPointer callData)
+{
+    updateProfileReport();
+}
+
+static void profileResetCB(Widget w, XtPointer clientData, XtPointer callData)
+{
+    ResetHighlightProfileOfMode(HighlightDialog.langModeName);
+    updateProfileReport();
+}
+
+static void profileCloseCB(Widget w, XtPointer clientData, XtPointer callData)
+{
+    XtDestroyWidget(XtParent(ProfileDialog.form));
+}
+
+static void profileDestroyCB(Widget w, XtPointer clientData,
+        XtPointer callData)
+{
+    ProfileDialog.form = NULL;
+}
+
+/*
+** Fill the pattern profile dialog with the current statistics for the
+** language mode shown in the highlight patterns dialog
+*/
+static void updateProfileReport(void)
+{
+    char *report = HighlightProfileReport(HighlightDialog.langModeName);
+    
+    XmTextSetString(ProfileDialog.textW, report);
+    NEditFree(report);
+}
+
 static void patTypeCB(Widget w, XtPointer clientData, XtPointer callData)
 {
     updateLabels();
@@ -35,8 +35,11 @@
 #include "nedit.h"
 #include "menu.h"
 #include "text.h"
+#include "preferences.h"
 #include "../util/rbTree.h"
+#include "../util/refString.h"
 #include "../util/nedit_malloc.h"
+#include "../util/utils.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -63,12 +66,22 @@
 #endif
 
 #define PROGRAM_SIZE  4096	/* Maximum program size */
+#define SYM_HASH_SIZE 4096	/* Number of buckets in the global symbol table */
+#define ARRAY_HASH_MIN 16	/* Number of elements an array needs before it
+    	    	    	    	   gets a hash index for looking up keys */
+#define GC_ALLOC_TRIGGER 1048576 /* Bytes of strings and array nodes to
+    	    	    	    	   allocate before garbage collection is
+    	    	    	    	   worth doing again */
+#define N_STRING_BUILDERS 8	/* Number of concatenation results which are
+    	    	    	    	   remembered for appending in place */
 #define MAX_ERR_MSG_LEN 256	/* Max. length for error messages */
 #define LOOP_STACK_SIZE 200	/* (Approx.) Number of break/continue stmts
     	    	    	    	   allowed per program */
-#define INSTRUCTION_LIMIT 100 	/* Number of instructions the interpreter is
-    	    	    	    	   allowed to execute before preempting and
-    	    	    	    	   returning to allow other things to run */
+#define TIME_CHECK_INTERVAL 1024 /* Number of instructions the interpreter
+    	    	    	    	   executes between looks at the clock to see
+    	    	    	    	   if the macro's time slice (macroTimeSlice
+    	    	    	    	   resource) is used up, and it should preempt
+    	    	    	    	   to allow other things to run */
 
 /* Temporary markers placed in a branch address location to designate
    which loop address (break or continue) the location needs */
@@ -77,11 +90,41 @@
 
 #define N_ARGS_ARG_SYM -1   	/* special arg number meaning $n_args value */
 
-enum opStatusCodes {STAT_OK=2, STAT_DONE, STAT_ERROR, STAT_PREEMPT};
+/* Longest line of the macro profile report: a name of up to 32 characters,
+   three counts, and a time of up to 12 characters (times are capped at
+   MAX_PROFILE_MSECS), with their separators */
+#define MAX_PROFILE_MSECS 999999999.99
+#define MACRO_PROFILE_LINE_LEN (32 + 3 * (TYPE_INT_STR_SIZE(unsigned long) + 1) \
+    	+ 12 + 2)
+
+enum opStatusCodes {STAT_OK=2, STAT_DONE, STAT_ERROR, STAT_PREEMPT,
+    	STAT_TIME_LIMIT};
 
 static void addLoopAddr(Inst *addr);
+static int optimizeProgram(Inst *code, int *lines, int len);
+static int findBranchTargets(Inst *code, int len, char *isTarget);
+static int foldConstants(Inst *code, int *lines, int len, char *isTarget);
+static int foldBinary(int op, int n1, int n2, int *result);
+static void addSuperInstructions(Inst *code, int len, char *isTarget);
+static int removeCode(Inst *code, int *lines, int len, int at, int count,
+	char *isTarget);
+static int instOp(Inst *inst);
+static int opOperandCount(int op);
+static int branchOperand(int op);
+static int isOpAt(Inst *code, int len, int i, int op);
+static int isIntConstPush(Inst *code, int i);
+static int hasTargetWithin(char *isTarget, int start, int count);
+static Symbol *intConstSymbol(int n);
 static void saveContext(RestartData *context);
 static void restoreContext(RestartData *context);
+static Symbol *newSymbol(const char *name, enum symTypes type,
+	DataValue value);
+static void addGlobalSymbol(Symbol *sym, const char *key);
+static void terminateString(DataValue *dv);
+static int runInstructions(RestartData *context);
+static int runProfiled(RestartData *context);
+static void startTimeSlice(RestartData *context);
+static int timeSliceUsed(RestartData *context);
 static int returnNoVal(void);
 static int returnVal(void);
 static int returnValOrNone(int valOnStack);
@@ -119,13 +162,27 @@ static int branch(void);
 static int branchTrue(void);
 static int branchFalse(void);
 static int branchNever(void);
+static int compareBranch(void);
+static int incrSym(void);
+static int arrayElemAssign(void);
+static DataValue *simpleSymValue(Symbol *sym);
 static int arrayRef(void);
+static int arrayRefLv(void);
 static int arrayAssign(void);
 static int arrayRefAndAssignSetup(void);
 static int beginArrayIter(void);
 static int arrayIter(void);
 static int inArray(void);
 static int deleteArrayElement(void);
+static int makeArrayKeyFromArgs(int nArgs, char **keyString, int leaveParams,
+        char *keyBuf);
+static int unshareArray(DataValue *theArray);
+static int arrayDeepCopy(DataValue *dstArray, DataValue *srcArray);
+static SparseArrayEntry *arrayFind(SparseArrayEntry *arrayPtr,
+        const char *keyStr);
+static void arrayHashRebuild(SparseArrayEntry *arrayPtr, int nBuckets);
+static void arrayHashRemove(SparseArrayEntry *arrayPtr,
+        SparseArrayEntry *entry);
 static void freeSymbolTable(Symbol *symTab);
 static int errCheck(const char *s);
 static int execError(const char *s1, const char *s2);
@@ -134,7 +191,22 @@ static rbTreeNode *arrayAllocateNode(rbTreeNode *src);
 static int arrayEntryCopyToNode(rbTreeNode *dst, rbTreeNode *src);
 static int arrayEntryCompare(rbTreeNode *left, rbTreeNode *right);
 static void arrayDisposeNode(rbTreeNode *src);
-static SparseArrayEntry *allocateSparseArrayEntry(void);
+static SparseArrayEntry *allocateSparseArrayEntry(size_t size);
+static void rememberArray(SparseArrayEntry *arrayPtr);
+static void markValue(DataValue *dv, int full);
+static void markArrayNodes(SparseArrayEntry *node, int full);
+static void collectGarbage(int full);
+struct ProgramProfileTag;
+struct ProfileRowTag;
+static Program *programAt(Inst *inst);
+static void profileInstruction(Inst *inst, double seconds, long bytes);
+static struct ProgramProfileTag *programProfile(Program *prog);
+static int addProgramRows(struct ProfileRowTag **rows, int nRows, int lines);
+static int mergeProfileRows(struct ProfileRowTag *rows, int nRows);
+static int compareRowNames(const void *r1, const void *r2);
+static int compareRowTimes(const void *r1, const void *r2);
+static char *rowName(struct ProfileRowTag *row, char *buf, int maxLen);
+static double rowMsecs(struct ProfileRowTag *row);
 
 /*#define DEBUG_ASSEMBLY*/
 /*#define DEBUG_STACK*/
@@ -159,19 +231,86 @@ static void stackdump(int n, int extra);
 #define DISASM_RT(i, n)
 #endif /* #ifndef DEBUG_STACK */
 
-/* Global symbols and function definitions */
-static Symbol *GlobalSymList = NULL;
-
-/* List of all memory allocated for strings */
+/* Global symbols and function definitions, hashed by name.  String
+   constants, which are only ever looked up by their value, are hashed by
+   value instead (see InstallStringConstSymbol) */
+static Symbol *GlobalSymTab[SYM_HASH_SIZE];
+
+/* Lists of all memory allocated for strings.  Garbage collection is
+   generational: young strings were allocated since the last collection,
+   old ones have survived at least one, and are only looked at again by a
+   full collection.  Each string is preceded by a header holding the link
+   to the next, the size of the allocation, and the mark byte for garbage
+   collection (which is always set for static strings, see PERM_ALLOC_STR) */
 static char *AllocatedStrings = NULL;
+static char *OldStrings = NULL;
+
+#define STR_HEADER_SIZE (sizeof(char *) + sizeof(int) + 1)
+#define STR_NEXT(mem) (*(char **)(mem))
+#define STR_SIZE(mem) (*(int *)((mem) + sizeof(char *)))
+#define STR_MARK(mem) (*((mem) + sizeof(char *) + sizeof(int)))
+
+static long YoungBytes = 0;	/* allocated since the last collection */
+static long OldBytes = 0;	/* survived past collections */
+static long OldBytesAfterFull = 0; /* ... as of the last full collection */
+
+/* Execution contexts of all macros which have not finished, and the number
+   of ContinueMacro calls in progress.  Garbage collection traces the stacks
+   of suspended macros, but can't run while one is actually executing */
+static RestartData *LiveContexts = NULL;
+static int ExecutionDepth = 0;
+
+/* Strings built by repeated concatenation (s = s "x") get spare room at the
+   end, so that further pieces can be appended in place rather than copying
+   the whole string each time.  A string is only extended while it is the
+   longest one in its buffer; the shorter strings sharing the buffer are no
+   longer null terminated then, and are copied by terminateString when they
+   are used as C strings.  The most recently used buffers come first. */
+typedef struct {
+    char *rep;			/* buffer (start of the strings in it) */
+    int len;			/* length of the longest string in it */
+    int size;			/* length it has room for */
+} StringBuilder;
+static StringBuilder StringBuilders[N_STRING_BUILDERS];
+
+static StringBuilder *findStringBuilder(const char *rep);
+static void addStringBuilder(StringBuilder *b, char *rep, int len, int size);
 
 typedef struct SparseArrayEntryWrapperTag {
     SparseArrayEntry 	data; /* LEAVE this as top entry */
     int inUse;              /* we use pointers to the data to refer to the entire struct */
+    int old;                /* on the OldSparseArrayEntries list */
     struct SparseArrayEntryWrapperTag *next;
 } SparseArrayEntryWrapper;
 
+/* The root node of an array, which holds no key or value of its own, also
+   carries the copy-on-write flag and the hash index of the array */
+typedef struct ArrayHeaderWrapperTag {
+    SparseArrayEntryWrapper entry; /* LEAVE this as top entry */
+    int shared;                 /* more than one variable or array element
+                                   refers to the array: it must be copied
+                                   before it is changed (see unshareArray) */
+    unsigned pathMark;          /* the same for all of the arrays on the
+                                   way to an element being assigned */
+    int nBuckets;               /* size of the hash index, 0 if none yet */
+    SparseArrayEntry **buckets; /* entries, chained through hashNext */
+    int remembered;             /* in RememberedArrays */
+} ArrayHeaderWrapper;
+
+#define ARRAY_HEADER(arrayPtr) ((ArrayHeaderWrapper *)(arrayPtr))
+#define ENTRY_SIZE(wrapper) ((wrapper)->data.key == NULL ? \
+        sizeof(ArrayHeaderWrapper) : sizeof(SparseArrayEntryWrapper))
+
+static unsigned ArrayPathMark = 0; /* last pathMark handed out */
+
+/* Young and old array nodes (see AllocatedStrings).  Old arrays which have
+   been given young nodes or values since the last collection are
+   remembered, because a young collection doesn't otherwise look into old
+   arrays */
 static SparseArrayEntryWrapper *AllocatedSparseArrayEntries = NULL; 
+static SparseArrayEntryWrapper *OldSparseArrayEntries = NULL; 
+static SparseArrayEntry **RememberedArrays = NULL;
+static int NRememberedArrays = 0, RememberedArraysSize = 0;
 
 /* Message strings used in macros (so they don't get repeated every time
    the macros are used */
@@ -182,10 +321,53 @@ static const char *StringToNumberMsg = "string could not be converted to number"
 /* Temporary global data for use while accumulating programs */
 static Symbol *LocalSymList = NULL;	 /* symbols local to the program */
 static Inst Prog[PROGRAM_SIZE]; 	 /* the program */
+static int ProgLines[PROGRAM_SIZE];	 /* source line of each location */
+static int SourceLine = 1;		 /* line the parser is reading */
 static Inst *ProgP;			 /* next free spot for code gen. */
 static Inst *LoopStack[LOOP_STACK_SIZE]; /* addresses of break, cont stmts */
 static Inst **LoopStackPtr = LoopStack;  /*  to fill at the end of a loop */
 
+/* All programs which have not been freed, most recently profiled first */
+static Program *AllPrograms = NULL;
+
+/* Statistics collected by the macro profiler.  Instructions, allocations
+   and time are charged to the source line of the instruction executed;
+   calls of built-in subroutines and action routines, along with the time
+   and allocations they take, are charged to the routine as well */
+typedef struct {
+    unsigned long count;	/* instructions executed, or calls */
+    unsigned long bytes;	/* bytes of strings and array nodes allocated */
+    double seconds;
+} ProfileCounts;
+
+typedef struct ProgramProfileTag {
+    Program *prog;		/* NULL once the program is freed */
+    const char *name;		/* where the program came from */
+    unsigned long calls;	/* times it was called or run */
+    int firstLine, nLines;	/* source lines it spans */
+    ProfileCounts *lines;	/* statistics of each of them */
+    struct ProgramProfileTag *next;
+} ProgramProfile;
+
+typedef struct SubrProfileTag {
+    Symbol *sym;
+    ProfileCounts counts;
+    struct SubrProfileTag *next;
+} SubrProfile;
+
+/* Line of the report, summing up a function (line 0), or a source line */
+typedef struct ProfileRowTag {
+    const char *name;
+    int line;
+    int builtIn;
+    unsigned long calls;
+    ProfileCounts counts;
+} ProfileRow;
+
+static int ProfileMacros = False;
+static ProgramProfile *ProgramProfiles = NULL;
+static SubrProfile *SubrProfiles = NULL;
+
 /* Global data for the interpreter */
 static DataValue *TheStack;	    /* the stack */
 static DataValue *StackP;	    /* next free spot on stack */
@@ -208,7 +390,8 @@ static int (*OpFns[N_OPS])() = {returnNoVal, returnVal, pushSymVal, dupStack,
     assign, callSubroutine, fetchRetVal, branch, branchTrue, branchFalse,
     branchNever, arrayRef, arrayAssign, beginArrayIter, arrayIter, inArray,
     deleteArrayElement, pushArraySymVal,
-    arrayRefAndAssignSetup, pushArgVal, pushArgCount, pushArgArray};
+    arrayRefAndAssignSetup, pushArgVal, pushArgCount, pushArgArray,
+    arrayRefLv, compareBranch, incrSym, arrayElemAssign};
 
 /* Stack-> symN-sym0(FP), argArray, nArgs, oldFP, retPC, argN-arg1, next, ... */
 #define FP_ARG_ARRAY_CACHE_INDEX (-1)
@@ -279,6 +462,7 @@ void BeginCreatingProgram(void)
     LocalSymList = NULL;
     ProgP = Prog;
     LoopStackPtr = LoopStack;
+    SourceLine = 1;
 }
 
 /*
@@ -292,13 +476,26 @@ Program *FinishCreatingProgram(void)
     int progLen, fpOffset = 0;
     Symbol *s;
     
+    ProgP = Prog + optimizeProgram(Prog, ProgLines, ProgP - Prog);
+    
     newProg = (Program *)NEditMalloc(sizeof(Program));
     progLen = ((char *)ProgP) - ((char *)Prog);
     newProg->code = (Inst *)NEditMalloc(progLen);
     memcpy(newProg->code, Prog, progLen);
+    newProg->length = ProgP - Prog;
+    newProg->lines = (int *)NEditMalloc(sizeof(int) * newProg->length);
+    memcpy(newProg->lines, ProgLines, sizeof(int) * newProg->length);
+    newProg->name = NULL;
+    newProg->profile = NULL;
     newProg->localSymList = LocalSymList;
     LocalSymList = NULL;
     
+    newProg->prev = NULL;
+    newProg->next = AllPrograms;
+    if (AllPrograms != NULL)
+        AllPrograms->prev = newProg;
+    AllPrograms = newProg;
+    
     /* Local variables' values are stored on the stack.  Here we assign
        frame pointer offsets to them. */
     for (s = newProg->localSymList; s != NULL; s = s->next)
@@ -311,11 +508,48 @@ Program *FinishCreatingProgram(void)
 
 void FreeProgram(Program *prog)
 {
+    if (prog->prev != NULL)
+        prog->prev->next = prog->next;
+    else
+        AllPrograms = prog->next;
+    if (prog->next != NULL)
+        prog->next->prev = prog->prev;
+    
+    /* statistics of the program are kept until the profile is reset */
+    if (prog->profile != NULL)
+        prog->profile->prog = NULL;
+    
     freeSymbolTable(prog->localSymList);
+    RefStringFree(prog->name);
+    NEditFree(prog->lines);
     NEditFree(prog->code);
     NEditFree(prog);    
 }
 
+/*
+** Give a program the name under which the profiler reports it (that of the
+** macro function it is, or of the file it came from), and number its lines
+** from firstLine, its position in that file
+*/
+void SetProgramSource(Program *prog, const char *name, int firstLine)
+{
+    int i;
+    
+    RefStringFree(prog->name);
+    prog->name = RefStringDup(name);
+    for (i = 0; i < prog->length; i++)
+        prog->lines[i] += firstLine - 1;
+}
+
+/*
+** Tell the program under construction the source line the parser has
+** reached, so the instructions added for it can be traced back to it
+*/
+void SetSourceLine(int line)
+{
+    SourceLine = line;
+}
+
 /*
 ** Add an operator (instruction) to the end of the current program
 */
@@ -326,6 +560,7 @@ int AddOp(int op, char **msg)
 	return 0;
     }
     ProgP->func = OpFns[op];
+    ProgLines[ProgP - Prog] = SourceLine;
     ProgP++;
     return 1;
 }
@@ -340,6 +575,7 @@ int AddSym(Symbol *sym, char **msg)
 	return 0;
     }
     ProgP->sym = sym;
+    ProgLines[ProgP - Prog] = SourceLine;
     ProgP++;
     return 1;
 }
@@ -354,6 +590,7 @@ int AddImmediate(int value, char **msg)
 	return 0;
     }
     ProgP->value = value;
+    ProgLines[ProgP - Prog] = SourceLine;
     ProgP++;
     return 1;
 }
@@ -369,6 +606,7 @@ int AddBranchOffset(Inst *to, char **msg)
     }
     /* Should be ptrdiff_t for branch offsets */
     ProgP->value = to - ProgP;
+    ProgLines[ProgP - Prog] = SourceLine;
     ProgP++;
     
     return 1;
@@ -392,11 +630,18 @@ void SwapCode(Inst *start, Inst *boundary, Inst *end)
 #define reverseCode(L, H) \
     do { register Inst t, *l = L, *h = H - 1; \
          while (l < h) { t = *h; *h-- = *l; *l++ = t; } } while (0)
+#define reverseLines(L, H) \
+    do { register int t, *l = ProgLines + (L - Prog), \
+                *h = ProgLines + (H - Prog) - 1; \
+         while (l < h) { t = *h; *h-- = *l; *l++ = t; } } while (0)
     /* double-reverse method: reverse elements of both parts then whole lot */
     /* eg abcdefABCD -1-> edcbaABCD -2-> edcbaDCBA -3-> DCBAedcba */
     reverseCode(start, boundary);   /* 1 */
     reverseCode(boundary, end);     /* 2 */
     reverseCode(start, end);        /* 3 */
+    reverseLines(start, boundary);
+    reverseLines(boundary, end);
+    reverseLines(start, end);
 }
 
 /*
@@ -458,6 +703,326 @@ void FillLoopAddrs(Inst *breakAddr, Inst *continueAddr)
     }
 }
 
+/*
+** Peephole optimization of a finished program.  Operations on integer
+** constants are done once here instead of every time the code runs, and
+** the commonest sequences of instructions are replaced by
+** superinstructions, which do the work of the whole sequence in one
+** dispatch.  Superinstructions take the place of the first instruction of
+** their sequence and read the operands of the rest where they are, so the
+** sequence can still be run step by step when its operands are not simple
+** integers or arrays (then the superinstruction does only the work of the
+** PUSH_SYM which it replaced).  Nothing is changed across the destination
+** of a branch.  Returns the new length of the program.
+*/
+static int optimizeProgram(Inst *code, int *lines, int len)
+{
+    char *isTarget;
+    
+    isTarget = (char *)NEditMalloc(len + 1);
+    if (findBranchTargets(code, len, isTarget)) {
+        len = foldConstants(code, lines, len, isTarget);
+        addSuperInstructions(code, len, isTarget);
+    }
+    NEditFree(isTarget);
+    return len;
+}
+
+/*
+** Mark the locations in code which branches go to in isTarget (len + 1
+** entries, the end of the program can be branched to, too).  Returns False
+** if code can't be read as a sequence of instructions
+*/
+static int findBranchTargets(Inst *code, int len, char *isTarget)
+{
+    int i, op, offset, target;
+    
+    memset(isTarget, 0, len + 1);
+    for (i = 0; i < len; i += 1 + opOperandCount(op)) {
+        op = instOp(&code[i]);
+        if (op < 0 || i + opOperandCount(op) >= len) {
+            return False;
+        }
+        offset = branchOperand(op);
+        if (offset != 0) {
+            target = i + offset + code[i + offset].value;
+            if (target >= 0 && target <= len) {
+                isTarget[target] = True;
+            }
+        }
+    }
+    return True;
+}
+
+/*
+** Replace operations on integer constants (PUSH_SYM c1, PUSH_SYM c2, op,
+** or PUSH_SYM c, op) by a PUSH_SYM of their result.  Results feed into the
+** operations which follow, so whole constant expressions are folded
+*/
+static int foldConstants(Inst *code, int *lines, int len, char *isTarget)
+{
+    int *starts, nStarts = 0;
+    int i, op, n1, n2, result, first;
+    
+    /* starts of the instructions seen, as a stack: after a fold, the
+       result is on top, ready to be an operand of what follows */
+    starts = (int *)NEditMalloc(sizeof(int) * len);
+    for (i = 0; i < len; i += 1 + opOperandCount(op)) {
+        op = instOp(&code[i]);
+        starts[nStarts++] = i;
+        if (nStarts >= 3 && isIntConstPush(code, starts[nStarts-3]) &&
+                isIntConstPush(code, starts[nStarts-2]) &&
+                !hasTargetWithin(isTarget, starts[nStarts-3], 5)) {
+            n1 = code[starts[nStarts-3] + 1].sym->value.val.n;
+            n2 = code[starts[nStarts-2] + 1].sym->value.val.n;
+            if (!foldBinary(op, n1, n2, &result)) {
+                continue;
+            }
+            first = starts[nStarts-3];
+            code[first + 1].sym = intConstSymbol(result);
+            len = removeCode(code, lines, len, first + 2, 3, isTarget);
+            nStarts -= 2;
+            i = first;
+            op = OP_PUSH_SYM;
+        } else if (nStarts >= 2 && isIntConstPush(code, starts[nStarts-2]) &&
+                (op == OP_NEGATE || op == OP_NOT) &&
+                !hasTargetWithin(isTarget, starts[nStarts-2], 3)) {
+            first = starts[nStarts-2];
+            n1 = code[first + 1].sym->value.val.n;
+            code[first + 1].sym = intConstSymbol(op == OP_NEGATE ? -n1 : !n1);
+            len = removeCode(code, lines, len, first + 2, 1, isTarget);
+            nStarts -= 1;
+            i = first;
+            op = OP_PUSH_SYM;
+        }
+    }
+    NEditFree(starts);
+    return len;
+}
+
+/*
+** Do binary operation op on integer constants n1 and n2 for foldConstants.
+** Returns False if op is not one which can be done ahead of time
+*/
+static int foldBinary(int op, int n1, int n2, int *result)
+{
+    switch (op) {
+      case OP_ADD:	*result = n1 + n2; break;
+      case OP_SUB:	*result = n1 - n2; break;
+      case OP_MUL:	*result = n1 * n2; break;
+      case OP_GT:	*result = n1 > n2; break;
+      case OP_LT:	*result = n1 < n2; break;
+      case OP_GE:	*result = n1 >= n2; break;
+      case OP_LE:	*result = n1 <= n2; break;
+      case OP_EQ:	*result = n1 == n2; break;
+      case OP_NE:	*result = n1 != n2; break;
+      case OP_BIT_AND:	*result = n1 & n2; break;
+      case OP_BIT_OR:	*result = n1 | n2; break;
+      case OP_DIV:
+      case OP_MOD:
+        /* leave division by zero to report its error when it's run */
+        if (n2 == 0 || n2 == -1) {
+            return False;
+        }
+        *result = op == OP_DIV ? n1 / n2 : n1 % n2;
+        break;
+      default:
+        return False;
+    }
+    return True;
+}
+
+/*
+** Replace the first instruction of each of these sequences by the
+** superinstruction for it:
+**
+**   PUSH_SYM a, PUSH_SYM b, GT/LT/GE/LE/EQ/NE, BRANCH_FALSE -> COMPARE_BRANCH
+**   PUSH_SYM a, INCR/DECR, ASSIGN a                        -> INCR_SYM
+**   PUSH_SYM a, PUSH_SYM k, ARRAY_REF 1, ASSIGN x          -> ARRAY_ELEM_ASSIGN
+*/
+static void addSuperInstructions(Inst *code, int len, char *isTarget)
+{
+    int i, op, seqLen;
+    
+    for (i = 0; i < len; i += seqLen) {
+        op = instOp(&code[i]);
+        seqLen = 1 + opOperandCount(op);
+        if (op != OP_PUSH_SYM) {
+            continue;
+        }
+        if (isOpAt(code, len, i + 2, OP_PUSH_SYM) &&
+                (isOpAt(code, len, i + 4, OP_GT) ||
+                 isOpAt(code, len, i + 4, OP_LT) ||
+                 isOpAt(code, len, i + 4, OP_GE) ||
+                 isOpAt(code, len, i + 4, OP_LE) ||
+                 isOpAt(code, len, i + 4, OP_EQ) ||
+                 isOpAt(code, len, i + 4, OP_NE)) &&
+                isOpAt(code, len, i + 5, OP_BRANCH_FALSE) &&
+                !hasTargetWithin(isTarget, i, 7)) {
+            code[i].func = OpFns[OP_COMPARE_BRANCH];
+            seqLen = 7;
+        } else if ((isOpAt(code, len, i + 2, OP_INCR) ||
+                    isOpAt(code, len, i + 2, OP_DECR)) &&
+                isOpAt(code, len, i + 3, OP_ASSIGN) &&
+                code[i + 4].sym == code[i + 1].sym &&
+                !hasTargetWithin(isTarget, i, 5)) {
+            code[i].func = OpFns[OP_INCR_SYM];
+            seqLen = 5;
+        } else if (isOpAt(code, len, i + 2, OP_PUSH_SYM) &&
+                isOpAt(code, len, i + 4, OP_ARRAY_REF) &&
+                code[i + 5].value == 1 &&
+                isOpAt(code, len, i + 6, OP_ASSIGN) &&
+                !hasTargetWithin(isTarget, i, 8)) {
+            code[i].func = OpFns[OP_ARRAY_ELEM_ASSIGN];
+            seqLen = 8;
+        }
+    }
+}
+
+/*
+** Remove count locations of code (and their line numbers) at "at",
+** adjusting the branches around them.  No branch may go into the removed
+** code.  Returns the new length
+*/
+static int removeCode(Inst *code, int *lines, int len, int at, int count,
+	char *isTarget)
+{
+    int i, op, offset, target;
+    
+    for (i = 0; i < len; i += 1 + opOperandCount(op)) {
+        op = instOp(&code[i]);
+        offset = branchOperand(op);
+        if (offset == 0) {
+            continue;
+        }
+        offset += i;
+        target = offset + code[offset].value;
+        if (offset < at && target >= at + count) {
+            code[offset].value -= count;
+        } else if (offset >= at + count && target < at) {
+            code[offset].value += count;
+        }
+    }
+    memmove(&code[at], &code[at + count], sizeof(Inst) * (len - at - count));
+    memmove(&lines[at], &lines[at + count], sizeof(int) * (len - at - count));
+    memmove(&isTarget[at], &isTarget[at + count], len + 1 - at - count);
+    return len - count;
+}
+
+/*
+** Return the operation (OP_ value) of the instruction inst, or -1 if it
+** isn't one
+*/
+static int instOp(Inst *inst)
+{
+    int op;
+    
+    for (op = 0; op < N_OPS; op++) {
+        if (inst->func == OpFns[op]) {
+            return op;
+        }
+    }
+    return -1;
+}
+
+/*
+** Return the number of operands which follow an instruction for operation op
+*/
+static int opOperandCount(int op)
+{
+    switch (op) {
+      case OP_PUSH_SYM:
+      case OP_ASSIGN:
+      case OP_BRANCH:
+      case OP_BRANCH_TRUE:
+      case OP_BRANCH_FALSE:
+      case OP_BRANCH_NEVER:
+      case OP_ARRAY_REF:
+      case OP_ARRAY_ASSIGN:
+      case OP_BEGIN_ARRAY_ITER:
+      case OP_ARRAY_DELETE:
+      case OP_ARRAY_REF_LV:
+      case OP_COMPARE_BRANCH:
+      case OP_INCR_SYM:
+      case OP_ARRAY_ELEM_ASSIGN:
+        return 1;
+      case OP_SUBR_CALL:
+      case OP_PUSH_ARRAY_SYM:
+      case OP_ARRAY_REF_ASSIGN_SETUP:
+        return 2;
+      case OP_ARRAY_ITER:
+        return 3;
+      default:
+        return 0;
+    }
+}
+
+/*
+** Return the position of the branch offset among the operands of an
+** instruction for operation op (1 for the first), or 0 if it has none
+*/
+static int branchOperand(int op)
+{
+    switch (op) {
+      case OP_BRANCH:
+      case OP_BRANCH_TRUE:
+      case OP_BRANCH_FALSE:
+      case OP_BRANCH_NEVER:
+        return 1;
+      case OP_ARRAY_ITER:
+        return 3;
+      default:
+        return 0;
+    }
+}
+
+static int isOpAt(Inst *code, int len, int i, int op)
+{
+    return i < len && code[i].func == OpFns[op];
+}
+
+static int isIntConstPush(Inst *code, int i)
+{
+    return code[i].func == OpFns[OP_PUSH_SYM] &&
+            code[i + 1].sym->type == CONST_SYM &&
+            code[i + 1].sym->value.tag == INT_TAG;
+}
+
+/*
+** Return True if any location in the count locations of code starting at
+** start, other than start itself, is the destination of a branch
+*/
+static int hasTargetWithin(char *isTarget, int start, int count)
+{
+    int i;
+    
+    for (i = start + 1; i < start + count; i++) {
+        if (isTarget[i]) {
+            return True;
+        }
+    }
+    return False;
+}
+
+/*
+** Find or make the symbol for integer constant n, named the way the parser
+** names the constants it reads
+*/
+static Symbol *intConstSymbol(int n)
+{
+    char name[TYPE_INT_STR_SIZE(int) + 6];
+    DataValue value;
+    Symbol *sym;
+    
+    sprintf(name, "const %d", n);
+    if ((sym = LookupSymbol(name)) == NULL) {
+        value.tag = INT_TAG;
+        value.val.n = n;
+        sym = InstallSymbol(name, CONST_SYM, value);
+    }
+    return sym;
+}
+
 /*
 ** Execute a compiled macro, "prog", using the arguments in the array
 ** "args".  Returns one of MACRO_DONE, MACRO_PREEMPT, or MACRO_ERROR.
@@ -481,8 +1046,12 @@ int ExecuteMacro(WindowInfo *window, Program *prog, int nArgs, DataValue *args,
     *continuation = context;
     context->stackP = context->stack;
     context->pc = prog->code;
+    if (ProfileMacros)
+        programProfile(prog)->calls++;
     context->runWindow = window;
     context->focusWindow = window;
+    context->next = LiveContexts;
+    LiveContexts = context;
 
     /* Push arguments and call information onto the stack */
     for (i=0; i<nArgs; i++)
@@ -518,59 +1087,139 @@ int ExecuteMacro(WindowInfo *window, Program *prog, int nArgs, DataValue *args,
 */
 int ContinueMacro(RestartData *continuation, DataValue *result, char **msg)
 {
-    register int status, instCount = 0;
-    register Inst *inst;
+    int status;
     RestartData oldContext;
     
     /* To allow macros to be invoked arbitrarily (such as those automatically
        triggered within smart-indent) within executing macros, this call is
        reentrant. */
     saveContext(&oldContext);
+    ++ExecutionDepth;
+    
+    /* Each macro keeps track of its own time slice, so one which is called
+       from within another macro is not cut short by its caller's */
+    startTimeSlice(continuation);
     
     /*
-    ** Execution Loop:  Call the succesive routine addresses in the program
-    ** until one returns something other than STAT_OK, then take action
+    ** Execution Loop:  Run instructions until one returns something other
+    ** than STAT_OK, or the time slice is used up, then take action.  The
+    ** profiler has a loop of its own, so that it costs nothing while it
+    ** is turned off
     */
     restoreContext(continuation);
     ErrMsg = NULL;
+    do {
+        if (ProfileMacros)
+            status = runProfiled(continuation);
+        else
+            status = runInstructions(continuation);
+    } while (status == STAT_OK);
+    
+    /* If the macro was preempted or used up its time slice, store re-start
+       information in continuation and give X, other macros, and other
+       shell scripts a chance to execute */
+    if (status == STAT_PREEMPT || status == STAT_TIME_LIMIT) {
+	saveContext(continuation);
+	restoreContext(&oldContext);
+	--ExecutionDepth;
+	return status == STAT_PREEMPT ? MACRO_PREEMPT : MACRO_TIME_LIMIT;
+    } else if (status == STAT_ERROR) {
+	*msg = ErrMsg;
+	FreeRestartData(continuation);
+	restoreContext(&oldContext);
+	--ExecutionDepth;
+	return MACRO_ERROR;
+    }
+    *msg = "";
+    *result = *--StackP;
+    if (result->tag == STRING_TAG)
+	terminateString(result);
+    FreeRestartData(continuation);
+    restoreContext(&oldContext);
+    --ExecutionDepth;
+    return MACRO_DONE;
+}
+
+/*
+** Call the succesive routine addresses in the program until one returns
+** something other than STAT_OK, or the time slice of the macro is used up
+** (STAT_TIME_LIMIT).  Returns STAT_OK if the profiler is turned on, which
+** is checked along with the clock
+*/
+static int runInstructions(RestartData *context)
+{
+    register int status, instCount = 0;
+    register Inst *inst;
+    
     for (;;) {
     	
     	/* Execute an instruction */
     	inst = PC++;
 	status = (inst->func)();
-    	
-    	/* If error return was not STAT_OK, return to caller */
-    	if (status != STAT_OK) {
-    	    if (status == STAT_PREEMPT) {
-    		saveContext(continuation);
-    		restoreContext(&oldContext);
-    		return MACRO_PREEMPT;
-    	    } else if (status == STAT_ERROR) {
-		*msg = ErrMsg;
-		FreeRestartData(continuation);
-		restoreContext(&oldContext);
-		return MACRO_ERROR;
-	    } else if (status == STAT_DONE) {
-		*msg = "";
-		*result = *--StackP;
-		FreeRestartData(continuation);
-		restoreContext(&oldContext);
-		return MACRO_DONE;
-	    }
-    	}
+    	if (status != STAT_OK)
+	    return status;
 	
-	/* Count instructions executed.  If the instruction limit is hit,
-	   preempt, store re-start information in continuation and give
-	   X, other macros, and other shell scripts a chance to execute */
-    	instCount++;
-	if (instCount >= INSTRUCTION_LIMIT) {
-    	    saveContext(continuation);
-    	    restoreContext(&oldContext);
-    	    return MACRO_TIME_LIMIT;
+	/* Count instructions executed, and check the clock every so often */
+    	if (++instCount >= TIME_CHECK_INTERVAL) {
+	    instCount = 0;
+	    if (timeSliceUsed(context))
+		return STAT_TIME_LIMIT;
+	    if (ProfileMacros)
+		return STAT_OK;
 	}
     }
 }
 
+/*
+** runInstructions for the profiler, charging each instruction with the
+** time it takes and the memory it allocates.  Returns STAT_OK when the
+** profiler is turned off
+*/
+static int runProfiled(RestartData *context)
+{
+    int status, instCount = 0;
+    Inst *inst;
+    long startBytes;
+    double startTime;
+    
+    while (ProfileMacros) {
+    	inst = PC++;
+	startBytes = YoungBytes;
+	startTime = GetWallClock();
+	status = (inst->func)();
+	profileInstruction(inst, GetWallClock() - startTime,
+		YoungBytes - startBytes);
+    	if (status != STAT_OK)
+	    return status;
+    	if (++instCount >= TIME_CHECK_INTERVAL) {
+	    instCount = 0;
+	    if (timeSliceUsed(context))
+		return STAT_TIME_LIMIT;
+	}
+    }
+    return STAT_OK;
+}
+
+/*
+** Record the time at which a macro starts (or resumes) executing, and how
+** long it may run before giving up control
+*/
+static void startTimeSlice(RestartData *context)
+{
+    context->sliceStart = GetWallClock();
+    context->sliceLength = GetPrefMacroTimeSlice();
+}
+
+/*
+** Return True if the macro described by context has run for its time
+** slice (in milliseconds) since startTimeSlice was called
+*/
+static int timeSliceUsed(RestartData *context)
+{
+    return GetWallClock() - context->sliceStart >=
+    	    context->sliceLength / 1000.;
+}
+
 /*
 ** If a macro is already executing, and requests that another macro be run,
 ** this can be called instead of ExecuteMacro to run it in the same context
@@ -601,6 +1250,8 @@ void RunMacroAsSubrCall(Program *prog)
     
     FrameP = StackP;
     PC = prog->code;
+    if (ProfileMacros)
+        programProfile(prog)->calls++;
     for (s = prog->localSymList; s != NULL; s = s->next) {
 	FP_GET_SYM_VAL(FrameP, s) = noValue;
 	StackP++;
@@ -609,6 +1260,14 @@ void RunMacroAsSubrCall(Program *prog)
 
 void FreeRestartData(RestartData *context)
 {
+    RestartData **link;
+
+    for (link = &LiveContexts; *link != NULL; link = &(*link)->next) {
+        if (*link == context) {
+            *link = context->next;
+            break;
+        }
+    }
     NEditFree(context->stack);
     NEditFree(context);
 }
@@ -688,7 +1347,8 @@ Symbol *LookupStringConstSymbol(const char *value)
 {
     Symbol *s;
 
-    for (s = GlobalSymList; s != NULL; s = s->next) {
+    for (s = GlobalSymTab[StringHashAddr(value) % SYM_HASH_SIZE]; s != NULL;
+	    s = s->next) {
         if (s->type == CONST_SYM &&
             s->value.tag == STRING_TAG &&
             !strcmp(s->value.val.str.rep, value)) {
@@ -714,7 +1374,9 @@ Symbol *InstallStringConstSymbol(const char *str)
     sprintf(stringName, "string #%d", stringConstIndex++);
     value.tag = STRING_TAG;
     AllocNStringCpy(&value.val.str, str);
-    return(InstallSymbol(stringName, CONST_SYM, value));
+    sym = newSymbol(stringName, CONST_SYM, value);
+    addGlobalSymbol(sym, str);
+    return sym;
 }
 
 /*
@@ -727,7 +1389,8 @@ Symbol *LookupSymbol(const char *name)
     for (s = LocalSymList; s != NULL; s = s->next)
 	if (strcmp(s->name, name) == 0)
 	    return s;
-    for (s = GlobalSymList; s != NULL; s = s->next)
+    for (s = GlobalSymTab[StringHashAddr(name) % SYM_HASH_SIZE]; s != NULL;
+	    s = s->next)
 	if (strcmp(s->name, name) == 0)
 	    return s;
     return NULL;
@@ -740,27 +1403,50 @@ Symbol *InstallSymbol(const char *name, enum symTypes type, DataValue value)
 {
     Symbol *s;
 
-    s = (Symbol *)NEditMalloc(sizeof(Symbol));
-    s->name = NEditStrdup(name);
-    s->type = type;
-    s->value = value;
+    s = newSymbol(name, type, value);
     if (type == LOCAL_SYM) {
     	s->next = LocalSymList;
     	LocalSymList = s;
-    } else {
-    	s->next = GlobalSymList;
-    	GlobalSymList = s;
-    }
+    } else
+    	addGlobalSymbol(s, name);
     return s;
 }
 
+/*
+** Allocate a symbol.  Names are shared, since the same names recur in the
+** local symbol lists of many programs.
+*/
+static Symbol *newSymbol(const char *name, enum symTypes type,
+	DataValue value)
+{
+    Symbol *s;
+
+    s = (Symbol *)NEditMalloc(sizeof(Symbol));
+    s->name = (char *)RefStringDup(name);
+    s->type = type;
+    s->value = value;
+    return s;
+}
+
+/*
+** Add sym to the global symbol table in the bucket for key.  Adding to
+** the front of the chain makes it shadow older symbols of the same name.
+*/
+static void addGlobalSymbol(Symbol *sym, const char *key)
+{
+    unsigned bucket = StringHashAddr(key) % SYM_HASH_SIZE;
+
+    sym->next = GlobalSymTab[bucket];
+    GlobalSymTab[bucket] = sym;
+}
+
 /*
 ** Promote a symbol from local to global, removing it from the local symbol
 ** list.
 **
 ** This is used as a forward declaration feature for macro functions.
 ** If a function is called (ie while parsing the macro) where the
-** function isn't defined yet, the symbol is put into the GlobalSymList
+** function isn't defined yet, the symbol is put into the global table
 ** so that the function definition uses the same symbol.
 **
 */
@@ -784,8 +1470,8 @@ Symbol *PromoteToGlobal(Symbol *sym)
     }
     
     /* There are two scenarios which could make this check succeed:
-       a) this sym is in the GlobalSymList as a LOCAL_SYM symbol
-       b) there is another symbol as a non-LOCAL_SYM in the GlobalSymList
+       a) this sym is in the global table as a LOCAL_SYM symbol
+       b) there is another symbol as a non-LOCAL_SYM in the global table
        Both are errors, without question.
        We currently just print this warning, but we should error out the
        parsing process. */
@@ -800,21 +1486,20 @@ Symbol *PromoteToGlobal(Symbol *sym)
         return sym;
     } else if (NULL != s) {
         /* case b)
-           sym will shadow the old symbol from the GlobalSymList */
+           sym will shadow the old symbol from the global table */
         fprintf(stderr,
                 "nedit: duplicate symbol in LocalSymList and GlobalSymList: %s\n",
                 sym->name);
     }
 
-    /* Add the symbol directly to the GlobalSymList, because InstallSymbol()
+    /* Add the symbol directly to the global table, because InstallSymbol()
        will allocate a new Symbol, which results in a memory leak of sym.
        Don't use MACRO_FUNCTION_SYM as type, because in
        macro.c:readCheckMacroString() we use ProgramFree() for the .val.prog,
        but this symbol has no program attached and ProgramFree() is not NULL
        pointer safe */
     sym->type = GLOBAL_SYM;
-    sym->next = GlobalSymList;
-    GlobalSymList = sym;
+    addGlobalSymbol(sym, sym->name);
 
     return sym;
 }
@@ -823,7 +1508,7 @@ Symbol *PromoteToGlobal(Symbol *sym)
 ** Allocate memory for a string, and keep track of it, such that it
 ** can be recovered later using GarbageCollectStrings.  (A linked list
 ** of pointers is maintained by threading through the memory behind
-** the returned pointers).  Length does not include the terminating null
+** the returned pointers, see STR_HEADER_SIZE).  Length does not include the terminating null
 ** character, so to allocate space for a string of strlen == n, you must
 ** use AllocString(n+1).
 */
@@ -839,13 +1524,15 @@ char *AllocString(int length)
 {
     char *mem;
     
-    mem = (char*)NEditMalloc(length + sizeof(char *) + 1);
-    *((char **)mem) = AllocatedStrings;
+    mem = (char*)NEditMalloc(length + STR_HEADER_SIZE);
+    STR_NEXT(mem) = AllocatedStrings;
+    STR_SIZE(mem) = length + STR_HEADER_SIZE;
     AllocatedStrings = mem;
+    YoungBytes += length + STR_HEADER_SIZE;
 #ifdef TRACK_GARBAGE_LEAKS
     ++numAllocatedStrings;
 #endif
-    return mem + sizeof(char *) + 1;
+    return mem + STR_HEADER_SIZE;
 }
 
 /* 
@@ -857,19 +1544,21 @@ int AllocNString(NString *string, int length)
 {
     char *mem;
     
-    mem = (char*)NEditMalloc(length + sizeof(char *) + 1);
+    mem = (char*)NEditMalloc(length + STR_HEADER_SIZE);
     if (!mem) {
         string->rep = 0;
         string->len = 0;
         return False;
     }
       
-    *((char **)mem) = AllocatedStrings;
+    STR_NEXT(mem) = AllocatedStrings;
+    STR_SIZE(mem) = length + STR_HEADER_SIZE;
     AllocatedStrings = mem;
+    YoungBytes += length + STR_HEADER_SIZE;
 #ifdef TRACK_GARBAGE_LEAKS
     ++numAllocatedStrings;
 #endif
-    string->rep = mem + sizeof(char *) + 1;
+    string->rep = mem + STR_HEADER_SIZE;
     string->rep[length-1] = '\0';                /* forced \0 */
     string->len = length-1;
     return True;
@@ -925,117 +1614,225 @@ int AllocNStringCpy(NString *string, const char *s)
     return True;
 }
 
-static SparseArrayEntry *allocateSparseArrayEntry(void)
+static SparseArrayEntry *allocateSparseArrayEntry(size_t size)
 {
     SparseArrayEntryWrapper *mem;
 
-    mem = (SparseArrayEntryWrapper *)NEditMalloc(sizeof(SparseArrayEntryWrapper));
+    mem = (SparseArrayEntryWrapper *)NEditMalloc(size);
     mem->next = AllocatedSparseArrayEntries;
+    mem->inUse = 0;
+    mem->old = 0;
     AllocatedSparseArrayEntries = mem;
+    YoungBytes += size;
 #ifdef TRACK_GARBAGE_LEAKS
     ++numAllocatedSparseArrayElements;
 #endif
     return(&(mem->data));
 }
 
-static void MarkArrayContentsAsUsed(SparseArrayEntry *arrayPtr)
+/*
+** Note that an array is about to be given new nodes or values.  If it is
+** old, young garbage collection has to look through it for them
+*/
+static void rememberArray(SparseArrayEntry *arrayPtr)
 {
-    SparseArrayEntry *globalSEUse;
+    ArrayHeaderWrapper *header = ARRAY_HEADER(arrayPtr);
 
-    if (arrayPtr) {
-        ((SparseArrayEntryWrapper *)arrayPtr)->inUse = 1;
-        for (globalSEUse = (SparseArrayEntry *)rbTreeBegin((rbTreeNode *)arrayPtr);
-            globalSEUse != NULL;
-            globalSEUse = (SparseArrayEntry *)rbTreeNext((rbTreeNode *)globalSEUse)) {
+    if (!header->entry.old || header->remembered) {
+        return;
+    }
+    if (NRememberedArrays == RememberedArraysSize) {
+        RememberedArraysSize = RememberedArraysSize == 0 ? 64 :
+                2 * RememberedArraysSize;
+        RememberedArrays = (SparseArrayEntry **)NEditRealloc(RememberedArrays,
+                RememberedArraysSize * sizeof(SparseArrayEntry *));
+    }
+    RememberedArrays[NRememberedArrays++] = arrayPtr;
+    header->remembered = 1;
+}
 
-            ((SparseArrayEntryWrapper *)globalSEUse)->inUse = 1;
-            /* test first because it may be read-only static string */
-            if (!(*(globalSEUse->key - 1))) {
-                *(globalSEUse->key - 1) = 1;
-            }
-            if (globalSEUse->value.tag == STRING_TAG) {
-                /* test first because it may be read-only static string */
-                if (!(*(globalSEUse->value.val.str.rep - 1))) {
-                    *(globalSEUse->value.val.str.rep - 1) = 1;
-                }
-            }
-            else if (globalSEUse->value.tag == ARRAY_TAG) {
-                MarkArrayContentsAsUsed(globalSEUse->value.val.arrayPtr);
-            }
+/*
+** Mark a string, or an array and everything in it, as still referenced.
+** Only a full collection looks into old arrays: a young one finds whatever
+** young memory they refer to through RememberedArrays instead
+*/
+static void markValue(DataValue *dv, int full)
+{
+    SparseArrayEntryWrapper *wrapper;
+    SparseArrayEntry *node;
+
+    if (dv->tag == STRING_TAG) {
+        /* test first because it may be read-only static string */
+        if (!(*(dv->val.str.rep - 1))) {
+            *(dv->val.str.rep - 1) = 1;
+        }
+        return;
+    }
+    if (dv->tag != ARRAY_TAG || dv->val.arrayPtr == NULL) {
+        return;
+    }
+
+    node = dv->val.arrayPtr;
+    wrapper = (SparseArrayEntryWrapper *)node;
+    /* arrays can be shared, don't go through one a second time */
+    if (wrapper->inUse || (wrapper->old && !full)) {
+        return;
+    }
+    wrapper->inUse = 1;
+    if (node->key == NULL) {
+        markArrayNodes((SparseArrayEntry *)node->nodePtrs.parent, full);
+    }
+    else if (node->nodePtrs.color != -1) {
+        /* the position of a for-in loop (see beginArrayIter), which must
+           keep the rest of the array it is stepping through */
+        while (node->nodePtrs.parent != NULL) {
+            node = (SparseArrayEntry *)node->nodePtrs.parent;
         }
+        markArrayNodes(node, full);
     }
 }
 
 /*
-** Collect strings that are no longer referenced from the global symbol
-** list.  THIS CAN NOT BE RUN WHILE ANY MACROS ARE EXECUTING.  It must
-** only be run after all macro activity has ceased.
+** Mark the nodes of a (sub-)tree of an array, and their keys and values
 */
+static void markArrayNodes(SparseArrayEntry *node, int full)
+{
+    while (node != NULL) {
+        ((SparseArrayEntryWrapper *)node)->inUse = 1;
+        /* test first because it may be read-only static string */
+        if (!(*(node->key - 1))) {
+            *(node->key - 1) = 1;
+        }
+        markValue(&node->value, full);
+        markArrayNodes((SparseArrayEntry *)node->nodePtrs.left, full);
+        node = (SparseArrayEntry *)node->nodePtrs.right;
+    }
+}
 
-void GarbageCollectStrings(void)
+/*
+** Collect strings and arrays which are no longer referenced from the global
+** symbol table or the stack of any macro which has not finished.  A young
+** collection only considers what was allocated since the last one, which
+** is the bulk of the garbage, and costs accordingly.  Survivors become old.
+*/
+static void collectGarbage(int full)
 {
     SparseArrayEntryWrapper *nextAP, *thisAP;
+    RestartData *context;
+    DataValue *dv;
     char *p, *next;
     Symbol *s;
+    int i, old;
+
+    /* the buffers of strings being built may be freed */
+    memset(StringBuilders, 0, sizeof(StringBuilders));
 
     /* mark all strings as unreferenced */
-    for (p = AllocatedStrings; p != NULL; p = *((char **)p)) {
-    	*(p + sizeof(char *)) = 0;
+    for (p = AllocatedStrings; p != NULL; p = STR_NEXT(p)) {
+    	STR_MARK(p) = 0;
     }
-    
     for (thisAP = AllocatedSparseArrayEntries;
         thisAP != NULL; thisAP = thisAP->next) {
         thisAP->inUse = 0;
     }
-
-    /* Sweep the global symbol list, marking which strings are still
-       referenced */
-    for (s = GlobalSymList; s != NULL; s = s->next) {
-    	if (s->value.tag == STRING_TAG) {
-            /* test first because it may be read-only static string */
-            if (!(*(s->value.val.str.rep - 1))) {
-    	        *(s->value.val.str.rep - 1) = 1;
-            }
+    if (full) {
+        for (p = OldStrings; p != NULL; p = STR_NEXT(p)) {
+    	    STR_MARK(p) = 0;
         }
-        else if (s->value.tag == ARRAY_TAG) {
-            MarkArrayContentsAsUsed(s->value.val.arrayPtr);
+        for (thisAP = OldSparseArrayEntries;
+            thisAP != NULL; thisAP = thisAP->next) {
+            thisAP->inUse = 0;
         }
     }
 
-    /* Collect all of the strings which remain unreferenced */
-    next = AllocatedStrings;
-    AllocatedStrings = NULL;
-    while (next != NULL) {
-    	p = next;
-    	next = *((char **)p);
-    	if (*(p + sizeof(char *)) != 0) {
-    	    *((char **)p) = AllocatedStrings;
-    	    AllocatedStrings = p;
-    	}
-        else {
+    /* Sweep the global symbol table and the stacks of suspended macros,
+       marking which strings are still referenced */
+    for (i = 0; i < SYM_HASH_SIZE; i++) {
+	for (s = GlobalSymTab[i]; s != NULL; s = s->next) {
+    	    markValue(&s->value, full);
+	}
+    }
+    for (context = LiveContexts; context != NULL; context = context->next) {
+        for (dv = context->stack; dv < context->stackP; dv++) {
+            markValue(dv, full);
+        }
+    }
+    for (i = 0; i < NRememberedArrays; i++) {
+        if (!full) {
+            markArrayNodes(
+                    (SparseArrayEntry *)RememberedArrays[i]->nodePtrs.parent,
+                    full);
+        }
+        ARRAY_HEADER(RememberedArrays[i])->remembered = 0;
+    }
+    NRememberedArrays = 0;
+
+    /* Collect all of the strings which remain unreferenced, and make the
+       rest old */
+    for (old = 0; old <= full; old++) {
+        next = old ? OldStrings : AllocatedStrings;
+        if (old) {
+            OldStrings = NULL;
+        }
+        while (next != NULL) {
+    	    p = next;
+    	    next = STR_NEXT(p);
+    	    if (STR_MARK(p) != 0) {
+    	        STR_NEXT(p) = OldStrings;
+    	        OldStrings = p;
+    	        if (!old) {
+    	            OldBytes += STR_SIZE(p);
+    	        }
+    	    }
+            else {
 #ifdef TRACK_GARBAGE_LEAKS
-            --numAllocatedStrings;
+                --numAllocatedStrings;
 #endif
-    	    NEditFree(p);
-    	}
+    	        if (old) {
+    	            OldBytes -= STR_SIZE(p);
+    	        }
+    	        NEditFree(p);
+    	    }
+        }
     }
+    AllocatedStrings = NULL;
     
-    nextAP = AllocatedSparseArrayEntries;
-    AllocatedSparseArrayEntries = NULL;
-    while (nextAP != NULL) {
-        thisAP = nextAP;
-        nextAP = nextAP->next;
-        if (thisAP->inUse != 0) {
-            thisAP->next = AllocatedSparseArrayEntries;
-            AllocatedSparseArrayEntries = thisAP;
+    for (old = 0; old <= full; old++) {
+        nextAP = old ? OldSparseArrayEntries : AllocatedSparseArrayEntries;
+        if (old) {
+            OldSparseArrayEntries = NULL;
         }
-        else {
+        while (nextAP != NULL) {
+            thisAP = nextAP;
+            nextAP = nextAP->next;
+            if (thisAP->inUse != 0) {
+                thisAP->next = OldSparseArrayEntries;
+                OldSparseArrayEntries = thisAP;
+                if (!old) {
+                    thisAP->old = 1;
+                    OldBytes += ENTRY_SIZE(thisAP);
+                }
+            }
+            else {
 #ifdef TRACK_GARBAGE_LEAKS
-            --numAllocatedSparseArrayElements;
+                --numAllocatedSparseArrayElements;
 #endif
-            NEditFree(thisAP);
+                if (old) {
+                    OldBytes -= ENTRY_SIZE(thisAP);
+                }
+                if (thisAP->data.key == NULL) {
+                    NEditFree(ARRAY_HEADER(thisAP)->buckets);
+                }
+                NEditFree(thisAP);
+            }
         }
     }
+    AllocatedSparseArrayEntries = NULL;
+
+    YoungBytes = 0;
+    if (full) {
+        OldBytesAfterFull = OldBytes;
+    }
 
 #ifdef TRACK_GARBAGE_LEAKS
     printf("str count = %d\nary count = %d\n", numAllocatedStrings, numAllocatedSparseArrayElements);
@@ -1043,14 +1840,41 @@ void GarbageCollectStrings(void)
 }
 
 /*
-** Save and restore execution context to data structure "context"
+** Collect all strings and arrays that are no longer referenced from the
+** global symbol table, or from the stacks of macros which are suspended
+** (preempted, or waiting for a shell command or dialog).  THIS CAN NOT BE
+** RUN WHILE A MACRO IS EXECUTING, and does nothing if called from within one.
 */
-static void saveContext(RestartData *context)
+void GarbageCollectStrings(void)
 {
-    context->stack = TheStack;
-    context->stackP = StackP;
-    context->frameP = FrameP;
-    context->pc = PC;
+    if (ExecutionDepth == 0) {
+        collectGarbage(True);
+    }
+}
+
+/*
+** Garbage collect if enough has been allocated since the last collection
+** to make it worthwhile, usually just the young generation, but everything
+** once the old one has doubled since it was last collected.  Like
+** GarbageCollectStrings, this does nothing while a macro is executing.
+*/
+void GarbageCollectIfDue(void)
+{
+    if (ExecutionDepth > 0 || YoungBytes < GC_ALLOC_TRIGGER) {
+        return;
+    }
+    collectGarbage(OldBytes > 2 * OldBytesAfterFull + GC_ALLOC_TRIGGER);
+}
+
+/*
+** Save and restore execution context to data structure "context"
+*/
+static void saveContext(RestartData *context)
+{
+    context->stack = TheStack;
+    context->stackP = StackP;
+    context->frameP = FrameP;
+    context->pc = PC;
     context->runWindow = InitiatingWindow;
     context->focusWindow = FocusWindow;
 }
@@ -1071,7 +1895,7 @@ static void freeSymbolTable(Symbol *symTab)
     
     while(symTab != NULL) {
     	s = symTab;
-    	free(s->name);
+    	RefStringFree(s->name);
     	symTab = s->next;
     	NEditFree(s);
     }    
@@ -1095,6 +1919,7 @@ static void freeSymbolTable(Symbol *symTab)
 	return execError(StackUnderflowMsg, ""); \
     --StackP; \
     if (StackP->tag == STRING_TAG) { \
+    	terminateString(StackP); \
     	if (!StringToNum(StackP->val.str.rep, &number)) \
     	    return execError(StringToNumberMsg, ""); \
     } else if (StackP->tag == INT_TAG) \
@@ -1109,8 +1934,22 @@ static void freeSymbolTable(Symbol *symTab)
     if (StackP->tag == INT_TAG) { \
     	string = AllocString(TYPE_INT_STR_SIZE(int)); \
     	sprintf(string, "%d", StackP->val.n); \
-    } else if (StackP->tag == STRING_TAG) \
+    } else if (StackP->tag == STRING_TAG) { \
+    	terminateString(StackP); \
         string = StackP->val.str.rep; \
+    } else \
+        return(execError("can't convert array to string", NULL));
+
+#define POP_NSTRING(string) \
+    if (StackP == TheStack) \
+	return execError(StackUnderflowMsg, ""); \
+    --StackP; \
+    if (StackP->tag == INT_TAG) { \
+    	string.rep = AllocString(TYPE_INT_STR_SIZE(int)); \
+    	sprintf(string.rep, "%d", StackP->val.n); \
+    	string.len = strlen(string.rep); \
+    } else if (StackP->tag == STRING_TAG) \
+        string = StackP->val.str; \
     else \
         return(execError("can't convert array to string", NULL));
    
@@ -1120,6 +1959,7 @@ static void freeSymbolTable(Symbol *symTab)
         sprintf(string, "%d", (StackP - peekIndex - 1)->val.n); \
     } \
     else if ((StackP - peekIndex - 1)->tag == STRING_TAG) { \
+        terminateString(StackP - peekIndex - 1); \
         string = (StackP - peekIndex - 1)->val.str.rep; \
     } \
     else { \
@@ -1128,6 +1968,7 @@ static void freeSymbolTable(Symbol *symTab)
 
 #define PEEK_INT(number, peekIndex) \
     if ((StackP - peekIndex - 1)->tag == STRING_TAG) { \
+        terminateString(StackP - peekIndex - 1); \
         if (!StringToNum((StackP - peekIndex - 1)->val.str.rep, &number)) { \
     	    return execError(StringToNumberMsg, ""); \
         } \
@@ -1280,7 +2121,8 @@ static int pushArgArray(void)
 }
 
 /*
-** Push an array (by reference) onto the stack
+** Push an array (by reference) onto the stack, to have elements assigned to
+** or deleted from it
 ** Before: Prog->  [ArraySym], makeEmpty, next, ...
 **         TheStack-> next, ...
 ** After:  Prog->  ArraySym, makeEmpty, [next], ...
@@ -1321,6 +2163,18 @@ static int pushArraySymVal(void)
         return execError("variable not set: %s", sym->name);
     }
 
+    /* the array is about to be changed, so it must be the variable's own */
+    if (dataPtr->tag == ARRAY_TAG) {
+        int errNum = unshareArray(dataPtr);
+        if (errNum != STAT_OK) {
+            return errNum;
+        }
+        if (++ArrayPathMark == 0) {
+            ++ArrayPathMark;
+        }
+        ARRAY_HEADER(dataPtr->val.arrayPtr)->pathMark = ArrayPathMark;
+    }
+
     PUSH(*dataPtr)
 
     return STAT_OK;
@@ -1628,6 +2482,10 @@ static int eq(void)
 
     POP(v1)
     POP(v2)
+    if (v1.tag == STRING_TAG)
+        terminateString(&v1);
+    if (v2.tag == STRING_TAG)
+        terminateString(&v2);
     if (v1.tag == INT_TAG && v2.tag == INT_TAG) {
         v1.val.n = v1.val.n == v2.val.n;
     }
@@ -1865,23 +2723,87 @@ static int power(void)
 */
 static int concat(void)
 {
-    char *s1, *s2, *out;
-    int len1, len2;
+    NString s1, s2;
+    StringBuilder *b;
+    char *out;
+    int len, size;
 
     DISASM_RT(PC-1, 1);
     STACKDUMP(2, 3);
 
-    POP_STRING(s2)
-    POP_STRING(s1)
-    len1 = strlen(s1);
-    len2 = strlen(s2);
-    out = AllocString(len1 + len2 + 1);
-    strncpy(out, s1, len1);
-    strcpy(&out[len1], s2);
-    PUSH_STRING(out, len1 + len2)
+    POP_NSTRING(s2)
+    POP_NSTRING(s1)
+    len = s1.len + s2.len;
+    b = findStringBuilder(s1.rep);
+
+    /* append in place if s1 is the longest string in its buffer so far,
+       and there's room for s2 */
+    if (b != NULL && b->len == s1.len && len <= b->size) {
+        memcpy(&s1.rep[s1.len], s2.rep, s2.len);
+        s1.rep[len] = '\0';
+        b->len = len;
+        PUSH_STRING(s1.rep, len)
+        return STAT_OK;
+    }
+
+    /* otherwise make a new string.  If s1 was built by concatenation too,
+       more is likely to follow, so leave room for it */
+    size = b != NULL ? 2 * len : len;
+    out = AllocString(size + 1);
+    memcpy(out, s1.rep, s1.len);
+    memcpy(&out[s1.len], s2.rep, s2.len);
+    out[len] = '\0';
+    addStringBuilder(b, out, len, size);
+    PUSH_STRING(out, len)
     return STAT_OK;
 }
 
+/*
+** Find the buffer of string rep among the concatenation results, and move
+** it to the front of the list.  Returns NULL if it isn't there.
+*/
+static StringBuilder *findStringBuilder(const char *rep)
+{
+    StringBuilder found;
+    int i;
+
+    for (i = 0; i < N_STRING_BUILDERS; i++) {
+        if (StringBuilders[i].rep == rep) {
+            found = StringBuilders[i];
+            memmove(&StringBuilders[1], &StringBuilders[0],
+                    i * sizeof(StringBuilder));
+            StringBuilders[0] = found;
+            return &StringBuilders[0];
+        }
+    }
+    return NULL;
+}
+
+/*
+** Remember a new concatenation result at the front of the list, replacing
+** b, the buffer it was built from, or the least recently used one
+*/
+static void addStringBuilder(StringBuilder *b, char *rep, int len, int size)
+{
+    if (b == NULL)
+        b = &StringBuilders[N_STRING_BUILDERS - 1];
+    memmove(&StringBuilders[1], &StringBuilders[0],
+            (b - StringBuilders) * sizeof(StringBuilder));
+    StringBuilders[0].rep = rep;
+    StringBuilders[0].len = len;
+    StringBuilders[0].size = size;
+}
+
+/*
+** Make sure the string in dv is null terminated, by copying it if it has
+** been extended in place (see StringBuilders)
+*/
+static void terminateString(DataValue *dv)
+{
+    if (dv->val.str.rep[dv->val.str.len] != '\0')
+        dv->val.str.rep = AllocStringNCpy(dv->val.str.rep, dv->val.str.len);
+}
+
 /*
 ** Call a subroutine or function (user defined or built-in).  Args are the
 ** subroutine's symbol, and the number of arguments which have been pushed
@@ -1923,6 +2845,9 @@ static int callSubroutine(void)
 
         /* "pop" stack back to the first argument in the call stack */
     	StackP -= nArgs;
+    	for (i = 0; i < nArgs; i++)
+    	    if (StackP[i].tag == STRING_TAG)
+    	    	terminateString(&StackP[i]);
 
     	/* Call the function and check for preemption */
     	PreemptRequest = False;
@@ -2166,12 +3091,210 @@ static int branchNever(void)
     return STAT_OK;
 }
 
+/*
+** Superinstructions (see optimizeProgram).  Each is followed by the
+** operands and instructions of the sequence it replaces, which it runs in
+** one go when the values involved are simple enough, and otherwise leaves
+** to run one by one, after doing the work of the PUSH_SYM it replaced.
+**
+** Compare two integer variables or constants, and branch if false
+** Before: Prog->  [symA], PUSH_SYM, symB, cmpOp, BRANCH_FALSE, branchDest, next
+** After:  either: Prog->  ..., branchDest, [next], ...
+** After:  or:     Prog->  ..., branchDest, next, ..., (branchdest)[next]
+*/
+static int compareBranch(void)
+{
+    DataValue *v1, *v2;
+    int (*cmpOp)(void);
+    int result;
+    
+    DISASM_RT(PC-1, 7);
+    STACKDUMP(0, 3);
+
+    v1 = simpleSymValue(PC->sym);
+    v2 = simpleSymValue((PC+2)->sym);
+    if (v1 == NULL || v2 == NULL || v1->tag != INT_TAG || v2->tag != INT_TAG) {
+        return pushSymVal();
+    }
+    cmpOp = (PC+3)->func;
+    if (cmpOp == gt) {
+        result = v1->val.n > v2->val.n;
+    } else if (cmpOp == lt) {
+        result = v1->val.n < v2->val.n;
+    } else if (cmpOp == ge) {
+        result = v1->val.n >= v2->val.n;
+    } else if (cmpOp == le) {
+        result = v1->val.n <= v2->val.n;
+    } else if (cmpOp == eq) {
+        result = v1->val.n == v2->val.n;
+    } else {
+        result = v1->val.n != v2->val.n;
+    }
+    PC += 5;
+    if (result) {
+        PC++;
+    } else {
+        PC += PC->value;
+    }
+    return STAT_OK;
+}
+
+/*
+** Increment or decrement an integer variable in place
+** Before: Prog->  [sym], INCR/DECR, ASSIGN, sym, next, ...
+** After:  Prog->  sym, INCR/DECR, ASSIGN, sym, [next], ...
+*/
+static int incrSym(void)
+{
+    Symbol *sym;
+    DataValue *dataPtr;
+    
+    DISASM_RT(PC-1, 5);
+    STACKDUMP(0, 3);
+
+    sym = PC->sym;
+    if (sym->type == LOCAL_SYM) {
+        dataPtr = &FP_GET_SYM_VAL(FrameP, sym);
+    } else if (sym->type == GLOBAL_SYM) {
+        dataPtr = &sym->value;
+    } else {
+        return pushSymVal();
+    }
+    if (dataPtr->tag != INT_TAG) {
+        return pushSymVal();
+    }
+    if ((PC+1)->func == increment) {
+        dataPtr->val.n++;
+    } else {
+        dataPtr->val.n--;
+    }
+    PC += 4;
+    return STAT_OK;
+}
+
+/*
+** Assign an element of an array variable, indexed by a variable or
+** constant, to a variable
+** Before: Prog->  [arraySym], PUSH_SYM, keySym, ARRAY_REF, 1, ASSIGN, sym, next
+** After:  Prog->  arraySym, ..., ASSIGN, sym, [next], ...
+*/
+static int arrayElemAssign(void)
+{
+    DataValue *arrayVal, *keyVal, *dataPtr, value;
+    SparseArrayEntry *entry;
+    Symbol *sym;
+    char *keyString, keyBuf[TYPE_INT_STR_SIZE(int)];
+    
+    DISASM_RT(PC-1, 8);
+    STACKDUMP(0, 3);
+
+    arrayVal = simpleSymValue(PC->sym);
+    keyVal = simpleSymValue((PC+2)->sym);
+    sym = (PC+6)->sym;
+    if (arrayVal == NULL || keyVal == NULL || arrayVal->tag != ARRAY_TAG ||
+            (sym->type != LOCAL_SYM && sym->type != GLOBAL_SYM)) {
+        return pushSymVal();
+    }
+    if (keyVal->tag == INT_TAG) {
+        sprintf(keyBuf, "%d", keyVal->val.n);
+        keyString = keyBuf;
+    } else if (keyVal->tag == STRING_TAG) {
+        value = *keyVal;
+        terminateString(&value);
+        keyString = value.val.str.rep;
+    } else {
+        return pushSymVal();
+    }
+    entry = arrayFind(arrayVal->val.arrayPtr, keyString);
+    if (entry == NULL) {
+        return pushSymVal();
+    }
+    value = entry->value;
+    if (value.tag == STRING_TAG) {
+        terminateString(&value);
+    }
+    if (sym->type == LOCAL_SYM) {
+        dataPtr = &FP_GET_SYM_VAL(FrameP, sym);
+    } else {
+        dataPtr = &sym->value;
+    }
+    PC += 7;
+    if (value.tag == ARRAY_TAG) {
+        return ArrayCopy(dataPtr, &value);
+    }
+    *dataPtr = value;
+    return STAT_OK;
+}
+
+/*
+** Return a pointer to the value of a variable or constant, or NULL if sym
+** is some other kind of symbol, whose value takes more work to get
+*/
+static DataValue *simpleSymValue(Symbol *sym)
+{
+    if (sym->type == LOCAL_SYM) {
+        return &FP_GET_SYM_VAL(FrameP, sym);
+    } else if (sym->type == GLOBAL_SYM || sym->type == CONST_SYM) {
+        return &sym->value;
+    }
+    return NULL;
+}
+
+/*
+** copy an array, lazily: dstArray is made to refer to the same nodes as
+** srcArray, and the array is marked as shared.  Whichever owner changes it
+** first then gets a copy of its own from unshareArray, so arrays which are
+** only passed around and read are never duplicated
+*/
+int ArrayCopy(DataValue *dstArray, DataValue *srcArray)
+{
+    dstArray->tag = ARRAY_TAG;
+    dstArray->val.arrayPtr = srcArray->val.arrayPtr;
+    if (dstArray->val.arrayPtr) {
+        ARRAY_HEADER(dstArray->val.arrayPtr)->shared = 1;
+    }
+    return(STAT_OK);
+}
+
+/*
+** give the owner of a shared array (a variable, or an element of an array
+** which is not itself shared) its own copy, before it is changed.  The copy
+** is one level deep: arrays nested in it become shared in turn, and are
+** copied only if they too are changed.  The original stays marked as shared,
+** since there is no telling how many other owners it still has
+*/
+static int unshareArray(DataValue *theArray)
+{
+    DataValue copy;
+    SparseArrayEntry *srcIter;
+
+    /* built-ins return empty arrays without any nodes */
+    if (theArray->val.arrayPtr == NULL) {
+        theArray->val.arrayPtr = ArrayNew();
+        return(STAT_OK);
+    }
+    if (!ARRAY_HEADER(theArray->val.arrayPtr)->shared) {
+        return(STAT_OK);
+    }
+
+    copy.tag = ARRAY_TAG;
+    copy.val.arrayPtr = ArrayNew();
+    for (srcIter = arrayIterateFirst(theArray); srcIter != NULL;
+            srcIter = arrayIterateNext(srcIter)) {
+        if (!ArrayInsert(&copy, srcIter->key, &srcIter->value)) {
+            return(execError("array copy failed", NULL));
+        }
+    }
+    *theArray = copy;
+    return(STAT_OK);
+}
+
 /*
 ** recursively copy(duplicate) the sparse array nodes of an array
 ** this does not duplicate the key/node data since they are never
 ** modified, only replaced
 */
-int ArrayCopy(DataValue *dstArray, DataValue *srcArray)
+static int arrayDeepCopy(DataValue *dstArray, DataValue *srcArray)
 {
     SparseArrayEntry *srcIter;
     
@@ -2184,7 +3307,7 @@ int ArrayCopy(DataValue *dstArray, DataValue *srcArray)
             int errNum;
             DataValue tmpArray;
             
-            errNum = ArrayCopy(&tmpArray, &srcIter->value);
+            errNum = arrayDeepCopy(&tmpArray, &srcIter->value);
             if (errNum != STAT_OK) {
                 return(errNum);
             }
@@ -2209,14 +3332,38 @@ int ArrayCopy(DataValue *dstArray, DataValue *srcArray)
 ** the number of arguments to an array
 ** I really need to optimize the size approximation rather than assuming
 ** a worst case size for every integer argument
+** keys which are only looked up need not outlive the instruction: if keyBuf
+** (of size TYPE_INT_STR_SIZE(int)) is given, a single subscript is used
+** without allocating a copy of it
 */
-static int makeArrayKeyFromArgs(int nArgs, char **keyString, int leaveParams)
+static int makeArrayKeyFromArgs(int nArgs, char **keyString, int leaveParams,
+        char *keyBuf)
 {
     DataValue tmpVal;
     int sepLen = strlen(ARRAY_DIM_SEP);
     int keyLength = 0;
+    char *keyEnd;
     int i;
 
+    if (keyBuf != NULL && nArgs == 1) {
+        PEEK(tmpVal, 0)
+        if (tmpVal.tag == INT_TAG) {
+            sprintf(keyBuf, "%d", tmpVal.val.n);
+            *keyString = keyBuf;
+        }
+        else if (tmpVal.tag == STRING_TAG) {
+            terminateString(&tmpVal);
+            *keyString = tmpVal.val.str.rep;
+        }
+        else {
+            return(execError("can only index array with string or int.", NULL));
+        }
+        if (!leaveParams) {
+            POP(tmpVal)
+        }
+        return(STAT_OK);
+    }
+
     keyLength = sepLen * (nArgs - 1);
     for (i = nArgs - 1; i >= 0; --i) {
         PEEK(tmpVal, i)
@@ -2231,22 +3378,25 @@ static int makeArrayKeyFromArgs(int nArgs, char **keyString, int leaveParams)
         }
     }
     *keyString = AllocString(keyLength + 1);
-    (*keyString)[0] = 0;
+    keyEnd = *keyString;
     for (i = nArgs - 1; i >= 0; --i) {
         if (i != nArgs - 1) {
-            strcat(*keyString, ARRAY_DIM_SEP);
+            memcpy(keyEnd, ARRAY_DIM_SEP, sepLen);
+            keyEnd += sepLen;
         }
         PEEK(tmpVal, i)
         if (tmpVal.tag == INT_TAG) {
-            sprintf(&((*keyString)[strlen(*keyString)]), "%d", tmpVal.val.n);
+            keyEnd += sprintf(keyEnd, "%d", tmpVal.val.n);
         }
         else if (tmpVal.tag == STRING_TAG) {
-            strcat(*keyString, tmpVal.val.str.rep);
+            memcpy(keyEnd, tmpVal.val.str.rep, tmpVal.val.str.len);
+            keyEnd += tmpVal.val.str.len;
         }
         else {
             return(execError("can only index array with string or int.", NULL));
         }
     }
+    *keyEnd = '\0';
     if (!leaveParams) {
         for (i = nArgs - 1; i >= 0; --i) {
             POP(tmpVal)
@@ -2261,10 +3411,17 @@ static int makeArrayKeyFromArgs(int nArgs, char **keyString, int leaveParams)
 */
 static rbTreeNode *arrayEmptyAllocator(void)
 {
-    SparseArrayEntry *newNode = allocateSparseArrayEntry();
+    SparseArrayEntry *newNode =
+            allocateSparseArrayEntry(sizeof(ArrayHeaderWrapper));
     if (newNode) {
         newNode->key = NULL;
         newNode->value.tag = NO_TAG;
+        newNode->hashNext = NULL;
+        ARRAY_HEADER(newNode)->shared = 0;
+        ARRAY_HEADER(newNode)->pathMark = 0;
+        ARRAY_HEADER(newNode)->nBuckets = 0;
+        ARRAY_HEADER(newNode)->buckets = NULL;
+        ARRAY_HEADER(newNode)->remembered = 0;
     }
     return((rbTreeNode *)newNode);
 }
@@ -2275,10 +3432,12 @@ static rbTreeNode *arrayEmptyAllocator(void)
 */
 static rbTreeNode *arrayAllocateNode(rbTreeNode *src)
 {
-    SparseArrayEntry *newNode = allocateSparseArrayEntry();
+    SparseArrayEntry *newNode =
+            allocateSparseArrayEntry(sizeof(SparseArrayEntryWrapper));
     if (newNode) {
         newNode->key = ((SparseArrayEntry *)src)->key;
         newNode->value = ((SparseArrayEntry *)src)->value;
+        newNode->hashNext = NULL;
     }
     return((rbTreeNode *)newNode);
 }
@@ -2320,35 +3479,133 @@ SparseArrayEntry *ArrayNew(void)
 	return((SparseArrayEntry *)rbTreeNew(arrayEmptyAllocator));
 }
 
+/*
+** find the node of an array whose key matches keyStr, through the hash
+** index if the array has one, or else by searching the tree
+*/
+static SparseArrayEntry *arrayFind(SparseArrayEntry *arrayPtr,
+        const char *keyStr)
+{
+    ArrayHeaderWrapper *header;
+    SparseArrayEntry *entry, searchEntry;
+
+    if (arrayPtr == NULL) {
+        return(NULL);
+    }
+    header = ARRAY_HEADER(arrayPtr);
+    if (header->nBuckets == 0) {
+        searchEntry.key = (char *)keyStr;
+        return((SparseArrayEntry *)rbTreeFind((rbTreeNode *)arrayPtr,
+                (rbTreeNode *)&searchEntry, arrayEntryCompare));
+    }
+    for (entry = header->buckets[StringHashAddr(keyStr) % header->nBuckets];
+            entry != NULL; entry = entry->hashNext) {
+        if (strcmp(entry->key, keyStr) == 0) {
+            return(entry);
+        }
+    }
+    return(NULL);
+}
+
+/*
+** (re)build the hash index of an array with nBuckets buckets
+*/
+static void arrayHashRebuild(SparseArrayEntry *arrayPtr, int nBuckets)
+{
+    ArrayHeaderWrapper *header = ARRAY_HEADER(arrayPtr);
+    SparseArrayEntry *entry, **bucket;
+
+    NEditFree(header->buckets);
+    header->buckets = (SparseArrayEntry **)NEditMalloc(
+            nBuckets * sizeof(SparseArrayEntry *));
+    memset(header->buckets, 0, nBuckets * sizeof(SparseArrayEntry *));
+    header->nBuckets = nBuckets;
+    for (entry = (SparseArrayEntry *)rbTreeBegin((rbTreeNode *)arrayPtr);
+            entry != NULL;
+            entry = (SparseArrayEntry *)rbTreeNext((rbTreeNode *)entry)) {
+        bucket = &header->buckets[StringHashAddr(entry->key) % nBuckets];
+        entry->hashNext = *bucket;
+        *bucket = entry;
+    }
+}
+
+/*
+** unlink a node of an array from its hash index, if there is one
+*/
+static void arrayHashRemove(SparseArrayEntry *arrayPtr,
+        SparseArrayEntry *entry)
+{
+    ArrayHeaderWrapper *header = ARRAY_HEADER(arrayPtr);
+    SparseArrayEntry **link;
+
+    if (header->nBuckets == 0) {
+        return;
+    }
+    for (link = &header->buckets[StringHashAddr(entry->key) % header->nBuckets];
+            *link != NULL; link = &(*link)->hashNext) {
+        if (*link == entry) {
+            *link = entry->hashNext;
+            return;
+        }
+    }
+}
+
 /*
 ** insert a DataValue into an array, allocate the array if needed
 ** keyStr must be a string that was allocated with AllocString()
+** an array inserted as a value becomes shared (see ArrayCopy), since
+** whatever the caller took it from still refers to it
 */
 Boolean ArrayInsert(DataValue* theArray, char* keyStr, DataValue* theValue)
 {
-    SparseArrayEntry tmpEntry;
+    SparseArrayEntry tmpEntry, *entry;
+    ArrayHeaderWrapper *header;
     rbTreeNode *insertedNode;
-
-    tmpEntry.key = keyStr;
-    tmpEntry.value = *theValue;
+    int size;
 
     if (theArray->val.arrayPtr == NULL) {
         theArray->val.arrayPtr = ArrayNew();
     }
 
-    if (theArray->val.arrayPtr != NULL) {
-        insertedNode = rbTreeInsert((rbTreeNode*) (theArray->val.arrayPtr),
-                (rbTreeNode *)&tmpEntry, arrayEntryCompare, arrayAllocateNode,
-                arrayEntryCopyToNode);
+    if (theArray->val.arrayPtr == NULL) {
+        return False;
+    }
+    rememberArray(theArray->val.arrayPtr);
+
+    if (theValue->tag == ARRAY_TAG && theValue->val.arrayPtr != NULL) {
+        ARRAY_HEADER(theValue->val.arrayPtr)->shared = 1;
+    }
 
-        if (insertedNode) {
-            return True;
-        } else {
-            return False;
-        }
+    entry = arrayFind(theArray->val.arrayPtr, keyStr);
+    if (entry) {
+        entry->value = *theValue;
+        return True;
     }
 
-    return False;
+    tmpEntry.key = keyStr;
+    tmpEntry.value = *theValue;
+    insertedNode = rbTreeInsert((rbTreeNode*) (theArray->val.arrayPtr),
+            (rbTreeNode *)&tmpEntry, arrayEntryCompare, arrayAllocateNode,
+            arrayEntryCopyToNode);
+    if (!insertedNode) {
+        return False;
+    }
+
+    /* keep the hash index at no more than one entry per bucket */
+    header = ARRAY_HEADER(theArray->val.arrayPtr);
+    size = rbTreeSize((rbTreeNode *)theArray->val.arrayPtr);
+    if (size > header->nBuckets && size >= ARRAY_HASH_MIN) {
+        arrayHashRebuild(theArray->val.arrayPtr,
+                header->nBuckets == 0 ? 2 * ARRAY_HASH_MIN :
+                2 * header->nBuckets);
+    }
+    else if (header->nBuckets != 0) {
+        entry = (SparseArrayEntry *)insertedNode;
+        entry->hashNext =
+                header->buckets[StringHashAddr(keyStr) % header->nBuckets];
+        header->buckets[StringHashAddr(keyStr) % header->nBuckets] = entry;
+    }
+    return True;
 }
 
 /*
@@ -2356,12 +3613,13 @@ Boolean ArrayInsert(DataValue* theArray, char* keyStr, DataValue* theValue)
 */
 void ArrayDelete(DataValue *theArray, char *keyStr)
 {
-    SparseArrayEntry searchEntry;
+    SparseArrayEntry *entry;
 
-    if (theArray->val.arrayPtr) {
-        searchEntry.key = keyStr;
-        rbTreeDelete((rbTreeNode *)theArray->val.arrayPtr, (rbTreeNode *)&searchEntry,
-                    arrayEntryCompare, arrayDisposeNode);
+    entry = arrayFind(theArray->val.arrayPtr, keyStr);
+    if (entry) {
+        arrayHashRemove(theArray->val.arrayPtr, entry);
+        rbTreeDeleteNode((rbTreeNode *)theArray->val.arrayPtr,
+                (rbTreeNode *)entry, arrayDisposeNode);
     }
 }
 
@@ -2371,6 +3629,7 @@ void ArrayDelete(DataValue *theArray, char *keyStr)
 void ArrayDeleteAll(DataValue *theArray)
 {
     if (theArray->val.arrayPtr) {
+        ArrayHeaderWrapper *header = ARRAY_HEADER(theArray->val.arrayPtr);
         rbTreeNode *iter = rbTreeBegin((rbTreeNode *)theArray->val.arrayPtr);
         while (iter) {
             rbTreeNode *nextIter = rbTreeNext(iter);
@@ -2379,6 +3638,9 @@ void ArrayDeleteAll(DataValue *theArray)
 
             iter = nextIter;
         }
+        NEditFree(header->buckets);
+        header->buckets = NULL;
+        header->nBuckets = 0;
     }
 }
 
@@ -2400,17 +3662,14 @@ unsigned ArraySize(DataValue* theArray)
 */
 Boolean ArrayGet(DataValue* theArray, char* keyStr, DataValue* theValue)
 {
-    SparseArrayEntry searchEntry;
-    rbTreeNode *foundNode;
-
-    if (theArray->val.arrayPtr) {
-        searchEntry.key = keyStr;
-        foundNode = rbTreeFind((rbTreeNode*) theArray->val.arrayPtr,
-                (rbTreeNode*) &searchEntry, arrayEntryCompare);
-        if (foundNode) {
-            *theValue = ((SparseArrayEntry*) foundNode)->value;
-            return True;
-        }
+    SparseArrayEntry *foundNode;
+
+    foundNode = arrayFind(theArray->val.arrayPtr, keyStr);
+    if (foundNode) {
+        *theValue = foundNode->value;
+        if (theValue->tag == STRING_TAG)
+            terminateString(theValue);
+        return True;
     }
 
     return False;
@@ -2459,6 +3718,7 @@ static int arrayRef(void)
     int errNum;
     DataValue srcArray, valueItem;
     char *keyString = NULL;
+    char keyBuf[TYPE_INT_STR_SIZE(int)];
     int nDim;
     
     nDim = PC->value;
@@ -2468,7 +3728,7 @@ static int arrayRef(void)
     STACKDUMP(nDim, 3);
 
     if (nDim > 0) {
-        errNum = makeArrayKeyFromArgs(nDim, &keyString, 0);
+        errNum = makeArrayKeyFromArgs(nDim, &keyString, 0, keyBuf);
         if (errNum != STAT_OK) {
             return(errNum);
         }
@@ -2497,6 +3757,74 @@ static int arrayRef(void)
     }
 }
 
+/*
+** evaluate an element of an array which is on its way to being changed
+** (a[i] in a[i][j] = k or delete a[i][j]) and push the result onto the stack.
+** An array found there is first made the element's own, as pushArraySymVal
+** does for variables, so that changing it can't affect other owners
+**
+** Before: Prog->  [nDim], next, ...
+**         TheStack-> indnDim, ... ind1, ArraySym, next, ...
+** After:  Prog->  nDim, [next], ...
+**         TheStack-> indexedArrayVal, next, ...
+*/
+static int arrayRefLv(void)
+{
+    int errNum;
+    DataValue srcArray, valueItem;
+    SparseArrayEntry *entry;
+    char *keyString = NULL;
+    char keyBuf[TYPE_INT_STR_SIZE(int)];
+    int nDim;
+    
+    nDim = PC->value;
+    PC++;
+
+    DISASM_RT(PC-2, 2);
+    STACKDUMP(nDim, 3);
+
+    if (nDim > 0) {
+        errNum = makeArrayKeyFromArgs(nDim, &keyString, 0, keyBuf);
+        if (errNum != STAT_OK) {
+            return(errNum);
+        }
+
+        POP(srcArray)
+        if (srcArray.tag != ARRAY_TAG) {
+            return(execError("operator [] on non-array", NULL));
+        }
+        entry = arrayFind(srcArray.val.arrayPtr, keyString);
+        if (entry == NULL) {
+            return(execError("referenced array value not in array: %s", keyString));
+        }
+        if (entry->value.tag == ARRAY_TAG) {
+            rememberArray(srcArray.val.arrayPtr);
+            errNum = unshareArray(&entry->value);
+            if (errNum != STAT_OK) {
+                return(errNum);
+            }
+            ARRAY_HEADER(entry->value.val.arrayPtr)->pathMark =
+                    ARRAY_HEADER(srcArray.val.arrayPtr)->pathMark;
+        }
+        valueItem = entry->value;
+        if (valueItem.tag == STRING_TAG) {
+            terminateString(&valueItem);
+        }
+        PUSH(valueItem)
+        return(STAT_OK);
+    }
+    else {
+        POP(srcArray)
+        if (srcArray.tag == ARRAY_TAG) {
+            PUSH_INT(ArraySize(&srcArray))
+            return(STAT_OK);
+        }
+        else {
+            return(execError("operator [] on non-array", NULL));
+        }
+    }
+}
+
 /*
 ** assign to an array element of a referenced array on the stack
 **
@@ -2521,7 +3849,7 @@ static int arrayAssign(void)
     if (nDim > 0) {
         POP(srcValue)
 
-        errNum = makeArrayKeyFromArgs(nDim, &keyString, 0);
+        errNum = makeArrayKeyFromArgs(nDim, &keyString, 0, NULL);
         if (errNum != STAT_OK) {
             return(errNum);
         }
@@ -2531,10 +3859,16 @@ static int arrayAssign(void)
         if (dstArray.tag != ARRAY_TAG && dstArray.tag != NO_TAG) {
             return(execError("cannot assign array element of non-array", NULL));
         }
-        if (srcValue.tag == ARRAY_TAG) {
+        /* Arrays are otherwise shared (by ArrayInsert), but one which
+           contains the element being assigned (as in a[i][j] = a) would
+           then contain itself.  Give the element a copy as it was before */
+        if (srcValue.tag == ARRAY_TAG && srcValue.val.arrayPtr != NULL &&
+                dstArray.tag == ARRAY_TAG && dstArray.val.arrayPtr != NULL &&
+                ARRAY_HEADER(srcValue.val.arrayPtr)->pathMark ==
+                ARRAY_HEADER(dstArray.val.arrayPtr)->pathMark) {
             DataValue arrayCopyValue;
             
-            errNum = ArrayCopy(&arrayCopyValue, &srcValue);
+            errNum = arrayDeepCopy(&arrayCopyValue, &srcValue);
             srcValue = arrayCopyValue;
             if (errNum != STAT_OK) {
                 return(errNum);
@@ -2563,6 +3897,7 @@ static int arrayRefAndAssignSetup(void)
     int errNum;
     DataValue srcArray, valueItem, moveExpr;
     char *keyString = NULL;
+    char keyBuf[TYPE_INT_STR_SIZE(int)];
     int binaryOp, nDim;
     
     binaryOp = PC->value;
@@ -2578,7 +3913,7 @@ static int arrayRefAndAssignSetup(void)
     }
     
     if (nDim > 0) {
-        errNum = makeArrayKeyFromArgs(nDim, &keyString, 1);
+        errNum = makeArrayKeyFromArgs(nDim, &keyString, 1, keyBuf);
         if (errNum != STAT_OK) {
             return(errNum);
         }
@@ -2636,7 +3971,9 @@ static int beginArrayIter(void)
         return(execError("bad temporary iterator: %s",  iterator->name));
     }
 
-    iteratorValPtr->tag = INT_TAG;
+    /* the iterator refers to a node, which garbage collection tells from
+       the root of an array by its key */
+    iteratorValPtr->tag = ARRAY_TAG;
     if (arrayVal.tag != ARRAY_TAG) {
         return(execError("can't iterate non-array", NULL));
     }
@@ -2778,6 +4115,7 @@ static int deleteArrayElement(void)
 {
     DataValue theArray;
     char *keyString = NULL;
+    char keyBuf[TYPE_INT_STR_SIZE(int)];
     int nDim;
 
     nDim = PC->value;
@@ -2789,7 +4127,7 @@ static int deleteArrayElement(void)
     if (nDim > 0) {
         int errNum;
 
-        errNum = makeArrayKeyFromArgs(nDim, &keyString, 0);
+        errNum = makeArrayKeyFromArgs(nDim, &keyString, 0, keyBuf);
         if (errNum != STAT_OK) {
             return(errNum);
         }
@@ -2867,6 +4205,332 @@ int StringToNum(const char *string, int *number)
     return True;
 }
 
+/*
+** Turn the macro profiler on or off.  Collected statistics are kept when
+** profiling is turned off.  A macro which is running when the profiler is
+** turned on is profiled from its next TIME_CHECK_INTERVAL instructions on.
+*/
+void SetMacroProfiling(int state)
+{
+    ProfileMacros = state;
+}
+
+int GetMacroProfiling(void)
+{
+    return ProfileMacros;
+}
+
+/*
+** Clear the statistics collected by the macro profiler
+*/
+void ResetMacroProfile(void)
+{
+    ProgramProfile *profile;
+    SubrProfile *subr;
+    
+    while (ProgramProfiles != NULL) {
+        profile = ProgramProfiles;
+        ProgramProfiles = profile->next;
+        if (profile->prog != NULL)
+            profile->prog->profile = NULL;
+        RefStringFree(profile->name);
+        NEditFree(profile->lines);
+        NEditFree(profile);
+    }
+    while (SubrProfiles != NULL) {
+        subr = SubrProfiles;
+        SubrProfiles = subr->next;
+        NEditFree(subr);
+    }
+}
+
+/*
+** Create a textual report of the statistics collected by the macro
+** profiler, sorted by the time spent: first the cost of each program (a
+** macro function, or the code outside of functions in a macro file, see
+** SetProgramSource) and of each built-in routine called, then that of each
+** source line.  Returns an allocated string, to be freed by the caller with
+** NEditFree.
+*/
+char *MacroProfileReport(void)
+{
+    ProfileRow *functions = NULL, *lines = NULL, *row;
+    SubrProfile *subr;
+    int i, nFunctions, nLines;
+    char *report, *outPtr, name[MACRO_PROFILE_LINE_LEN];
+    char count[TYPE_INT_STR_SIZE(unsigned long)];
+    
+    nFunctions = addProgramRows(&functions, 0, False);
+    for (subr = SubrProfiles; subr != NULL; subr = subr->next) {
+        functions = (ProfileRow *)NEditRealloc(functions,
+                sizeof(ProfileRow) * (nFunctions + 1));
+        row = &functions[nFunctions++];
+        row->name = subr->sym->name;
+        row->line = 0;
+        row->builtIn = True;
+        row->calls = subr->counts.count;
+        row->counts = subr->counts;
+    }
+    nFunctions = mergeProfileRows(functions, nFunctions);
+    nLines = mergeProfileRows(lines, addProgramRows(&lines, 0, True));
+    
+    /* Header (2 lines), two tables with column headings (2 lines each) and
+       one line per function or source line, none of which can be longer
+       than MACRO_PROFILE_LINE_LEN */
+    report = outPtr = (char *)NEditMalloc((nFunctions + nLines + 7) *
+            MACRO_PROFILE_LINE_LEN);
+    outPtr += sprintf(outPtr, "Macro profile%s\n\n",
+            ProfileMacros ? "" : " (profiling is off)");
+    outPtr += sprintf(outPtr, "%-32s %10s %12s %12s %10s\n",
+            "Function", "Calls", "Instructions", "Bytes", "Time (ms)");
+    outPtr += sprintf(outPtr, "%-32s %10s %12s %12s %10s\n",
+            "--------", "-----", "------------", "-----", "---------");
+    for (i = 0; i < nFunctions; i++) {
+        row = &functions[i];
+        if (row->builtIn)
+            strcpy(count, "-");
+        else
+            sprintf(count, "%lu", row->counts.count);
+        outPtr += sprintf(outPtr, "%-32s %10lu %12s %12lu %10.2f\n",
+                rowName(row, name, 32), row->calls, count,
+                row->counts.bytes, rowMsecs(row));
+    }
+    outPtr += sprintf(outPtr, "\n%-32s %12s %12s %10s\n",
+            "Line", "Instructions", "Bytes", "Time (ms)");
+    outPtr += sprintf(outPtr, "%-32s %12s %12s %10s\n",
+            "----", "------------", "-----", "---------");
+    for (i = 0; i < nLines; i++) {
+        row = &lines[i];
+        outPtr += sprintf(outPtr, "%-32s %12lu %12lu %10.2f\n",
+                rowName(row, name, 32), row->counts.count,
+                row->counts.bytes, rowMsecs(row));
+    }
+    NEditFree(functions);
+    NEditFree(lines);
+    return report;
+}
+
+/*
+** Add a row to *rows for each profiled program, or if "lines" is True, for
+** each source line of one which was executed.  Returns the number of rows
+*/
+static int addProgramRows(ProfileRow **rows, int nRows, int lines)
+{
+    ProgramProfile *profile;
+    ProfileRow *row;
+    int i;
+    
+    for (profile = ProgramProfiles; profile != NULL; profile = profile->next) {
+        for (i = 0; i < profile->nLines; i++) {
+            if (lines && profile->lines[i].count == 0)
+                continue;
+            if (lines || i == 0) {
+                *rows = (ProfileRow *)NEditRealloc(*rows,
+                        sizeof(ProfileRow) * (nRows + 1));
+                row = &(*rows)[nRows++];
+                row->name = profile->name;
+                row->line = lines ? profile->firstLine + i : 0;
+                row->builtIn = False;
+                row->calls = profile->calls;
+                memset(&row->counts, 0, sizeof(ProfileCounts));
+            }
+            row->counts.count += profile->lines[i].count;
+            row->counts.bytes += profile->lines[i].bytes;
+            row->counts.seconds += profile->lines[i].seconds;
+        }
+    }
+    return nRows;
+}
+
+/*
+** Sum up rows with the same name and line, which come from programs
+** defined more than once, and sort the rows by decreasing time.  Returns
+** the new number of rows.
+*/
+static int mergeProfileRows(ProfileRow *rows, int nRows)
+{
+    int i, n = 0;
+    
+    if (nRows == 0)
+        return 0;
+    qsort(rows, nRows, sizeof(ProfileRow), compareRowNames);
+    for (i = 1; i < nRows; i++) {
+        if (compareRowNames(&rows[n], &rows[i]) == 0) {
+            rows[n].calls += rows[i].calls;
+            rows[n].counts.count += rows[i].counts.count;
+            rows[n].counts.bytes += rows[i].counts.bytes;
+            rows[n].counts.seconds += rows[i].counts.seconds;
+        } else
+            rows[++n] = rows[i];
+    }
+    qsort(rows, n + 1, sizeof(ProfileRow), compareRowTimes);
+    return n + 1;
+}
+
+static int compareRowNames(const void *r1, const void *r2)
+{
+    const ProfileRow *row1 = (const ProfileRow *)r1;
+    const ProfileRow *row2 = (const ProfileRow *)r2;
+    int result;
+    
+    if (row1->builtIn != row2->builtIn)
+        return row1->builtIn - row2->builtIn;
+    if (row1->name == NULL || row2->name == NULL)
+        result = (row1->name != NULL) - (row2->name != NULL);
+    else
+        result = strcmp(row1->name, row2->name);
+    return result != 0 ? result : row1->line - row2->line;
+}
+
+/*
+** qsort comparison function for sorting profile rows by decreasing time
+*/
+static int compareRowTimes(const void *r1, const void *r2)
+{
+    double t1 = ((const ProfileRow *)r1)->counts.seconds;
+    double t2 = ((const ProfileRow *)r2)->counts.seconds;
+    
+    return t1 < t2 ? 1 : (t1 > t2 ? -1 : 0);
+}
+
+/*
+** Write the name of a report row (name:line for a source line) to buf,
+** keeping only its last maxLen characters, so that the line number, and
+** the file name at the end of a long path, survive.  Returns buf
+*/
+static char *rowName(ProfileRow *row, char *buf, int maxLen)
+{
+    const char *name = row->name == NULL ? "(macro)" : row->name;
+    char lineStr[TYPE_INT_STR_SIZE(int) + 1];
+    int len;
+    
+    if (row->line != 0)
+        sprintf(lineStr, ":%d", row->line);
+    else
+        *lineStr = '\0';
+    len = strlen(name) + strlen(lineStr);
+    if (len > maxLen)
+        name += len - maxLen;
+    sprintf(buf, "%s%s", name, lineStr);
+    return buf;
+}
+
+/*
+** Return the time spent in a report row in milliseconds, capped so that it
+** fits in the report line
+*/
+static double rowMsecs(ProfileRow *row)
+{
+    double msecs = row->counts.seconds * 1000.;
+    
+    return msecs < MAX_PROFILE_MSECS ? msecs : MAX_PROFILE_MSECS;
+}
+
+/*
+** Charge an instruction which was just executed with the time it took and
+** the bytes it allocated, and count the calls of subroutines
+*/
+static void profileInstruction(Inst *inst, double seconds, long bytes)
+{
+    Program *prog;
+    ProgramProfile *profile;
+    ProfileCounts *counts;
+    SubrProfile *subr;
+    Symbol *sym;
+    
+    /* the program may have been freed (redefined) by the instruction */
+    if ((prog = programAt(inst)) == NULL)
+        return;
+    if (bytes < 0)
+        bytes = 0;
+    profile = programProfile(prog);
+    counts = &profile->lines[prog->lines[inst - prog->code] -
+            profile->firstLine];
+    counts->count++;
+    counts->bytes += bytes;
+    counts->seconds += seconds;
+    
+    if (inst->func != callSubroutine)
+        return;
+    sym = inst[1].sym;
+    if (sym->type == MACRO_FUNCTION_SYM) {
+        programProfile(sym->value.val.prog)->calls++;
+    } else if (sym->type == C_FUNCTION_SYM ||
+            sym->type == ACTION_ROUTINE_SYM) {
+        for (subr = SubrProfiles; subr != NULL; subr = subr->next)
+            if (subr->sym == sym)
+                break;
+        if (subr == NULL) {
+            subr = (SubrProfile *)NEditMalloc(sizeof(SubrProfile));
+            memset(&subr->counts, 0, sizeof(ProfileCounts));
+            subr->sym = sym;
+            subr->next = SubrProfiles;
+            SubrProfiles = subr;
+        }
+        subr->counts.count++;
+        subr->counts.bytes += bytes;
+        subr->counts.seconds += seconds;
+    }
+}
+
+/*
+** Find the program which instruction inst belongs to.  It is moved to the
+** front of the list of programs, since the next instruction is most likely
+** to come from the same one
+*/
+static Program *programAt(Inst *inst)
+{
+    Program *prog;
+    
+    for (prog = AllPrograms; prog != NULL; prog = prog->next)
+        if (inst >= prog->code && inst < prog->code + prog->length)
+            break;
+    if (prog != NULL && prog != AllPrograms) {
+        prog->prev->next = prog->next;
+        if (prog->next != NULL)
+            prog->next->prev = prog->prev;
+        prog->prev = NULL;
+        prog->next = AllPrograms;
+        AllPrograms->prev = prog;
+        AllPrograms = prog;
+    }
+    return prog;
+}
+
+/*
+** Return the statistics of program prog, creating them if it hasn't been
+** profiled yet
+*/
+static ProgramProfile *programProfile(Program *prog)
+{
+    ProgramProfile *profile;
+    int i, firstLine, lastLine;
+    
+    if (prog->profile != NULL)
+        return prog->profile;
+    
+    firstLine = lastLine = prog->length > 0 ? prog->lines[0] : 1;
+    for (i = 1; i < prog->length; i++) {
+        if (prog->lines[i] < firstLine)
+            firstLine = prog->lines[i];
+        else if (prog->lines[i] > lastLine)
+            lastLine = prog->lines[i];
+    }
+    profile = (ProgramProfile *)NEditMalloc(sizeof(ProgramProfile));
+    profile->prog = prog;
+    profile->name = prog->name == NULL ? NULL : RefStringDup(prog->name);
+    profile->calls = 0;
+    profile->firstLine = firstLine;
+    profile->nLines = lastLine - firstLine + 1;
+    profile->lines = (ProfileCounts *)NEditMalloc(sizeof(ProfileCounts) *
+            profile->nLines);
+    memset(profile->lines, 0, sizeof(ProfileCounts) * profile->nLines);
+    profile->next = ProgramProfiles;
+    ProgramProfiles = profile;
+    prog->profile = profile;
+    return profile;
+}
+
 #ifdef DEBUG_DISASSEMBLER   /* dumping values in disassembly or stack dump */
 static void dumpVal(DataValue dv)
 {
@@ -2956,7 +4620,11 @@ static void disasm(Inst *inst, int nInstr)
         "ARRAY_REF_ASSIGN_SETUP",       /* arrayRefAndAssignSetup */
         "PUSH_ARG",                     /* $arg[expr] */
         "PUSH_ARG_COUNT",               /* $arg[] */
-        "PUSH_ARG_ARRAY"                /* $arg */
+        "PUSH_ARG_ARRAY",               /* $arg */
+        "ARRAY_REF_LV",                 /* arrayRefLv */
+        "COMPARE_BRANCH",               /* compareBranch */
+        "INCR_SYM",                     /* incrSym */
+        "ARRAY_ELEM_ASSIGN"             /* arrayElemAssign */
     };
     int i, j;
     
@@ -2966,7 +4634,9 @@ static void disasm(Inst *inst, int nInstr)
         for (j = 0; j < N_OPS; ++j) {
             if (inst[i].func == OpFns[j]) {
                 printf("%22s ", opNames[j]);
-                if (j == OP_PUSH_SYM || j == OP_ASSIGN) {
+                if (j == OP_PUSH_SYM || j == OP_ASSIGN ||
+                        j == OP_COMPARE_BRANCH || j == OP_INCR_SYM ||
+                        j == OP_ARRAY_ELEM_ASSIGN) {
                     Symbol *sym = inst[i+1].sym;
                     printf("%s", sym->name);
                     if (sym->value.tag == STRING_TAG &&
@@ -2997,7 +4667,7 @@ static void disasm(Inst *inst, int nInstr)
                     i += 3;
                 }
                 else if (j == OP_ARRAY_REF || j == OP_ARRAY_DELETE ||
-                            j == OP_ARRAY_ASSIGN) {
+                            j == OP_ARRAY_ASSIGN || j == OP_ARRAY_REF_LV) {
                     printf("nDim=%d", inst[i+1].value);
                     ++i;
                 }
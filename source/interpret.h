@@ -38,7 +38,7 @@
 
 enum symTypes {CONST_SYM, GLOBAL_SYM, LOCAL_SYM, ARG_SYM, PROC_VALUE_SYM,
     	C_FUNCTION_SYM, MACRO_FUNCTION_SYM, ACTION_ROUTINE_SYM};
-#define N_OPS 43
+#define N_OPS 47
 enum operations {OP_RETURN_NO_VAL, OP_RETURN, OP_PUSH_SYM, OP_DUP, OP_ADD,
     OP_SUB, OP_MUL, OP_DIV, OP_MOD, OP_NEGATE, OP_INCR, OP_DECR, OP_GT, OP_LT,
     OP_GE, OP_LE, OP_EQ, OP_NE, OP_BIT_AND, OP_BIT_OR, OP_AND, OP_OR, OP_NOT,
@@ -46,7 +46,9 @@ enum operations {OP_RETURN_NO_VAL, OP_RETURN, OP_PUSH_SYM, OP_DUP, OP_ADD,
     OP_BRANCH_TRUE, OP_BRANCH_FALSE, OP_BRANCH_NEVER, OP_ARRAY_REF,
     OP_ARRAY_ASSIGN, OP_BEGIN_ARRAY_ITER, OP_ARRAY_ITER, OP_IN_ARRAY,
     OP_ARRAY_DELETE, OP_PUSH_ARRAY_SYM, OP_ARRAY_REF_ASSIGN_SETUP, OP_PUSH_ARG,
-    OP_PUSH_ARG_COUNT, OP_PUSH_ARG_ARRAY};
+    OP_PUSH_ARG_COUNT, OP_PUSH_ARG_ARRAY, OP_ARRAY_REF_LV,
+    /* superinstructions, not generated by the parser (see optimizeProgram) */
+    OP_COMPARE_BRANCH, OP_INCR_SYM, OP_ARRAY_ELEM_ASSIGN};
 
 enum typeTags {NO_TAG, INT_TAG, STRING_TAG, ARRAY_TAG};
 
@@ -91,6 +93,7 @@ typedef struct SparseArrayEntryTag {
     rbTreeNode nodePtrs; /* MUST BE FIRST ENTRY */
     char *key;
     DataValue value;
+    struct SparseArrayEntryTag *hashNext; /* next entry in its hash bucket */
 } SparseArrayEntry;
 
 /* symbol table entry */
@@ -104,16 +107,28 @@ typedef struct SymbolRec {
 typedef struct ProgramTag {
     Symbol *localSymList;
     Inst *code;
+    int length;			/* number of locations in code */
+    int *lines;			/* source line of each location in code */
+    const char *name;		/* where the source came from (for the
+    				   profiler), or NULL */
+    struct ProgramProfileTag *profile; /* statistics collected by the
+    				   profiler, if it has run the program */
+    struct ProgramTag *prev, *next; /* list of all programs */
 } Program;
 
 /* Information needed to re-start a preempted macro */
-typedef struct {
+typedef struct RestartDataTag {
     DataValue *stack;
     DataValue *stackP;
     DataValue *frameP;
     Inst *pc;
     WindowInfo *runWindow;
     WindowInfo *focusWindow;
+    double sliceStart;		/* when the current time slice started
+    				   (GetWallClock) */
+    int sliceLength;		/* its length in milliseconds */
+    struct RestartDataTag *next; /* list of all contexts, whose stacks are
+    				   traced by garbage collection */
 } RestartData;
 
 void InitMacroGlobals(void);
@@ -142,6 +157,8 @@ Symbol *InstallStringConstSymbol(const char *str);
 Symbol *LookupSymbol(const char *name);
 Symbol *InstallSymbol(const char *name, enum symTypes type, DataValue value);
 Program *FinishCreatingProgram(void);
+void SetSourceLine(int line);
+void SetProgramSource(Program *prog, const char *name, int firstLine);
 void SwapCode(Inst *start, Inst *boundary, Inst *end);
 void StartLoopAddrList(void);
 int AddBreakAddr(Inst *addr);
@@ -164,9 +181,14 @@ int AllocNString(NString *string, int length);
 int AllocNStringNCpy(NString *string, const char *s, int length);
 int AllocNStringCpy(NString *string, const char *s);
 void GarbageCollectStrings(void);
+void GarbageCollectIfDue(void);
 void FreeRestartData(RestartData *context);
 Symbol *PromoteToGlobal(Symbol *sym);
 void FreeProgram(Program *prog);
+void SetMacroProfiling(int state);
+int GetMacroProfiling(void);
+void ResetMacroProfile(void);
+char *MacroProfileReport(void);
 void ModifyReturnedValue(RestartData *context, DataValue dv);
 WindowInfo *MacroRunWindow(void);
 WindowInfo *MacroFocusWindow(void);
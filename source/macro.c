@@ -63,8 +63,8 @@
 #include <string.h>
 #include <ctype.h>
 #include <errno.h>
-#ifdef VMS
 #include <limits.h>
+#ifdef VMS
 #include "../util/VMSparam.h"
 #include <types.h>
 #include <stat.h>
@@ -141,6 +141,16 @@ static void repeatApplyCB(Widget w, XtPointer clientData, XtPointer callData);
 static int doRepeatDialogAction(repeatDialog *rd, XEvent *event);
 static void repeatCancelCB(Widget w, XtPointer clientData, XtPointer callData);
 static void repeatDestroyCB(Widget w, XtPointer clientData, XtPointer callData);
+static void profileEnableCB(Widget w, XtPointer clientData,
+        XtPointer callData);
+static void profileRefreshCB(Widget w, XtPointer clientData,
+        XtPointer callData);
+static void profileResetCB(Widget w, XtPointer clientData, XtPointer callData);
+static void profileCloseCB(Widget w, XtPointer clientData, XtPointer callData);
+static void profileDestroyCB(Widget w, XtPointer clientData,
+        XtPointer callData);
+static void updateProfileReport(void);
+static int countLines(const char *from, const char *to);
 static void learnActionHook(Widget w, XtPointer clientData, String actionName,
 	XEvent *event, String *params, Cardinal *numParams);
 static void lastActionHook(Widget w, XtPointer clientData, String actionName,
@@ -356,6 +366,7 @@ static int strCaseCmp(char *str1, char *str2);
 static int readIntArg(DataValue dv, int *result, char **errMsg);
 static int readStringArg(DataValue dv, char **result, char *stringStorage,
     	char **errMsg);
+static int stringArgLength(DataValue dv, const char *string);
 /* DISABLED FOR 5.4
 static int backlightStringMV(WindowInfo *window, DataValue *argList,
 	int nArgs, DataValue *result, char **errMsg);
@@ -406,6 +417,17 @@ static int getStyleAtPosMS(WindowInfo *window, DataValue *argList, int nArgs,
         DataValue *result, char **errMsg);
 static int filenameDialogMS(WindowInfo* window, DataValue* argList, int nArgs,
         DataValue* result, char** errMsg);
+static int highlightProfilingMS(WindowInfo *window, DataValue *argList,
+        int nArgs, DataValue *result, char **errMsg);
+static int getHighlightProfileMS(WindowInfo *window, DataValue *argList,
+        int nArgs, DataValue *result, char **errMsg);
+static int getRedisplayStatisticsMS(WindowInfo *window, DataValue *argList,
+        int nArgs, DataValue *result, char **errMsg);
+static int macroProfilingMS(WindowInfo *window, DataValue *argList,
+        int nArgs, DataValue *result, char **errMsg);
+static int macroProfileReportMS(WindowInfo *window, DataValue *argList,
+        int nArgs, DataValue *result, char **errMsg);
+static int clipToInt(unsigned long n);
 
 /* Built-in subroutines and variables for the macro language */
 static BuiltInSubr MacroSubrs[] = {lengthMS, getRangeMS, tPrintMS,
@@ -424,7 +446,9 @@ static BuiltInSubr MacroSubrs[] = {lengthMS, getRangeMS, tPrintMS,
         rangesetSetColorMS, rangesetSetNameMS, rangesetSetModeMS,
         rangesetGetByNameMS,
         getPatternByNameMS, getPatternAtPosMS,
-        getStyleByNameMS, getStyleAtPosMS, filenameDialogMS
+        getStyleByNameMS, getStyleAtPosMS, filenameDialogMS,
+        highlightProfilingMS, getHighlightProfileMS, getRedisplayStatisticsMS,
+        macroProfilingMS, macroProfileReportMS
     };
 #define N_MACRO_SUBRS (sizeof MacroSubrs/sizeof *MacroSubrs)
 static const char *MacroSubrNames[N_MACRO_SUBRS] = {"length", "get_range", "t_print",
@@ -443,7 +467,9 @@ static const char *MacroSubrNames[N_MACRO_SUBRS] = {"length", "get_range", "t_pr
         "rangeset_set_color", "rangeset_set_name", "rangeset_set_mode",
         "rangeset_get_by_name",
         "get_pattern_by_name", "get_pattern_at_pos",
-        "get_style_by_name", "get_style_at_pos", "filename_dialog"
+        "get_style_by_name", "get_style_at_pos", "filename_dialog",
+        "highlight_profiling", "get_highlight_profile",
+        "get_redisplay_statistics", "macro_profiling", "macro_profile_report"
     };
 static BuiltInSubr SpecialVars[] = {cursorMV, lineMV, columnMV,
         fileNameMV, filePathMV, lengthMV, selectionStartMV, selectionEndMV,
@@ -524,6 +550,13 @@ static XtActionHookId MacroRecordActionHook = 0;
 /* Window where macro recording is taking place */
 static WindowInfo *MacroRecordWindow = NULL;
 
+/* Macro profiler report dialog information */
+static struct {
+    Widget form;
+    Widget textW;
+    Widget enableW;
+} ProfileDialog = {NULL, NULL, NULL};
+
 /* Arrays for translating escape characters in escapeStringChars */
 static char ReplaceChars[] = "\\\"ntbrfav";
 static char EscapeChars[] = "\\\"\n\t\b\r\f\a\v";
@@ -841,8 +874,9 @@ int CheckMacroString(Widget dialogParent, char *string, const char *errIn,
 static int readCheckMacroString(Widget dialogParent, char *string,
 	WindowInfo *runWindow, const char *errIn, char **errPos)
 {
-    char *stoppedAt, *inPtr, *namePtr, *errMsg;
+    char *stoppedAt, *inPtr, *namePtr, *errMsg, *linePtr;
     char subrName[MAX_SYM_LEN];
+    int line = 1;
     Program *prog;
     Symbol *sym;
     DataValue subrPtr;
@@ -850,7 +884,7 @@ static int readCheckMacroString(Widget dialogParent, char *string,
     progStack->top = NULL;
     progStack->size = 0;
 
-    inPtr = string;
+    inPtr = linePtr = string;
     while (*inPtr != '\0') {
     	
     	/* skip over white space and comments */
@@ -889,6 +923,9 @@ static int readCheckMacroString(Widget dialogParent, char *string,
 	    	return ParseError(dialogParent, string, stoppedAt,
 	    	    	errIn, errMsg);
 	    }
+	    line += countLines(linePtr, inPtr);
+	    linePtr = inPtr;
+	    SetProgramSource(prog, subrName, line);
 	    if (runWindow != NULL) {
 		sym = LookupSymbol(subrName);
 		if (sym == NULL) {
@@ -920,6 +957,9 @@ static int readCheckMacroString(Widget dialogParent, char *string,
     	    	return ParseError(dialogParent, string, stoppedAt,
 	    	    	errIn, errMsg);
 	    }
+	    line += countLines(linePtr, inPtr);
+	    linePtr = inPtr;
+	    SetProgramSource(prog, errIn, line);
 
 	    if (runWindow != NULL) {
                 XEvent nextEvent;
@@ -959,6 +999,19 @@ static int readCheckMacroString(Widget dialogParent, char *string,
     return True;
 }
 
+/*
+** Count the newlines between from and to
+*/
+static int countLines(const char *from, const char *to)
+{
+    int n = 0;
+    
+    for (; from < to; from++)
+        if (*from == '\n')
+            n++;
+    return n;
+}
+
 /*
 ** Run a pre-compiled macro, changing the interface state to reflect that
 ** a macro is running, and handling preemption, resumption, and cancellation.
@@ -1178,20 +1231,22 @@ static void finishMacroCmdExecution(WindowInfo *window)
 }
 
 /*
-** Do garbage collection of strings if there are no macros currently
-** executing.  NEdit's macro language GC strategy is to call this routine
-** whenever a macro completes.  If other macros are still running (preempted
-** or waiting for a shell command or dialog), this does nothing and therefore
-** defers GC to the completion of the last macro out.
+** Do garbage collection of strings and arrays, if enough has been allocated
+** since the last collection.  NEdit's macro language GC strategy is to call
+** this routine whenever a macro completes, and between the time slices of
+** long running ones.  Other macros which are still running (preempted or
+** waiting for a shell command or dialog) are suspended at these points,
+** and what their saved stacks refer to is kept, but this does nothing from
+** within a smart-indent macro, which runs to completion.
 */
 void SafeGC(void)
 {
     WindowInfo *win;
     
     for (win=WindowList; win!=NULL; win=win->next)
-	if (win->macroCmdData != NULL || InSmartIndentMacros(win))
+	if (InSmartIndentMacros(win))
 	    return;
-    GarbageCollectStrings();
+    GarbageCollectIfDue();
 }
 
 /*
@@ -1221,6 +1276,7 @@ void DoMacro(WindowInfo *window, const char *macro, const char *errInName)
     	return;
     }
     NEditFree(tMacro);
+    SetProgramSource(prog, errInName, 1);
 
     /* run the executable program (prog is freed upon completion) */
     runMacro(window, prog);
@@ -1440,6 +1496,155 @@ static void repeatDestroyCB(Widget w, XtPointer clientData, XtPointer callData)
     NEditFree(rd);
 }
 
+/*
+** Present a dialog reporting the cost of the macro functions, built-in
+** routines, and source lines executed while the macro profiler was on.
+** The dialog allows turning the profiler on and off, and resetting the
+** collected statistics.
+*/
+void MacroProfileDialog(WindowInfo *window)
+{
+#define BORDER 4
+    Arg al[20];
+    int ac;
+    Widget closeBtn, resetBtn, refreshBtn;
+    XmString st1;
+
+    if (ProfileDialog.form != NULL) {
+        updateProfileReport();
+        RaiseDialogWindow(XtParent(ProfileDialog.form));
+        return;
+    }
+
+    ac = 0;
+    XtSetArg(al[ac], XmNautoUnmanage, False); ac++;
+    ProfileDialog.form = CreateFormDialog(window->shell, "macroProfile",
+            al, ac);
+    XtAddCallback(ProfileDialog.form, XmNdestroyCallback, profileDestroyCB,
+            NULL);
+    
+    ProfileDialog.enableW = XtVaCreateManagedWidget("enable",
+            xmToggleButtonWidgetClass, ProfileDialog.form,
+    	    XmNlabelString, st1=XmStringCreateSimple("Collect statistics"),
+    	    XmNmnemonic, 'S',
+    	    XmNset, GetMacroProfiling(),
+    	    XmNleftAttachment, XmATTACH_POSITION,
+    	    XmNleftPosition, 1,
+    	    XmNbottomAttachment, XmATTACH_FORM,
+    	    XmNbottomOffset, BORDER, NULL);
+    XtAddCallback(ProfileDialog.enableW, XmNvalueChangedCallback,
+            profileEnableCB, NULL);
+    XmStringFree(st1);
+
+    closeBtn = XtVaCreateManagedWidget("close", xmPushButtonWidgetClass,
+            ProfileDialog.form,
+    	    XmNlabelString, st1=XmStringCreateSimple("Close"),
+    	    XmNmarginWidth, BUTTON_WIDTH_MARGIN,
+    	    XmNleftAttachment, XmATTACH_POSITION,
+    	    XmNleftPosition, 80,
+    	    XmNrightAttachment, XmATTACH_POSITION,
+    	    XmNrightPosition, 99,
+    	    XmNbottomAttachment, XmATTACH_FORM,
+    	    XmNbottomOffset, BORDER, NULL);
+    XtAddCallback(closeBtn, XmNactivateCallback, profileCloseCB, NULL);
+    XmStringFree(st1);
+
+    resetBtn = XtVaCreateManagedWidget("reset", xmPushButtonWidgetClass,
+            ProfileDialog.form,
+    	    XmNlabelString, st1=XmStringCreateSimple("Reset"),
+    	    XmNmnemonic, 'R',
+    	    XmNleftAttachment, XmATTACH_POSITION,
+    	    XmNleftPosition, 60,
+    	    XmNrightAttachment, XmATTACH_POSITION,
+    	    XmNrightPosition, 79,
+    	    XmNbottomAttachment, XmATTACH_FORM,
+    	    XmNbottomOffset, BORDER, NULL);
+    XtAddCallback(resetBtn, XmNactivateCallback, profileResetCB, NULL);
+    XmStringFree(st1);
+
+    refreshBtn = XtVaCreateManagedWidget("refresh", xmPushButtonWidgetClass,
+            ProfileDialog.form,
+    	    XmNlabelString, st1=XmStringCreateSimple("Refresh"),
+    	    XmNmnemonic, 'f',
+    	    XmNleftAttachment, XmATTACH_POSITION,
+    	    XmNleftPosition, 40,
+    	    XmNrightAttachment, XmATTACH_POSITION,
+    	    XmNrightPosition, 59,
+    	    XmNbottomAttachment, XmATTACH_FORM,
+    	    XmNbottomOffset, BORDER, NULL);
+    XtAddCallback(refreshBtn, XmNactivateCallback, profileRefreshCB, NULL);
+    XmStringFree(st1);
+    
+    ac = 0;
+    XtSetArg(al[ac], XmNrows, 20);  ac++;
+    XtSetArg(al[ac], XmNcolumns, 80);  ac++;
+    XtSetArg(al[ac], XmNeditMode, XmMULTI_LINE_EDIT);  ac++;
+    XtSetArg(al[ac], XmNeditable, False);  ac++;
+    XtSetArg(al[ac], XmNcursorPositionVisible, False);  ac++;
+    XtSetArg(al[ac], XmNtopAttachment, XmATTACH_FORM);  ac++;
+    XtSetArg(al[ac], XmNtopOffset, BORDER);  ac++;
+    XtSetArg(al[ac], XmNleftAttachment, XmATTACH_POSITION);  ac++;
+    XtSetArg(al[ac], XmNleftPosition, 1);  ac++;
+    XtSetArg(al[ac], XmNrightAttachment, XmATTACH_POSITION);  ac++;
+    XtSetArg(al[ac], XmNrightPosition, 99);  ac++;
+    XtSetArg(al[ac], XmNbottomAttachment, XmATTACH_WIDGET);  ac++;
+    XtSetArg(al[ac], XmNbottomWidget, closeBtn);  ac++;
+    XtSetArg(al[ac], XmNbottomOffset, BORDER);  ac++;
+    ProfileDialog.textW = XmCreateScrolledText(ProfileDialog.form,
+            "report", al, ac);
+    AddMouseWheelSupport(ProfileDialog.textW);
+    XtManageChild(ProfileDialog.textW);
+    
+    XtVaSetValues(ProfileDialog.form, XmNcancelButton, closeBtn, NULL);
+    XtVaSetValues(XtParent(ProfileDialog.form), XmNtitle, "Macro Profile",
+            NULL);
+    AddDialogMnemonicHandler(ProfileDialog.form, FALSE);
+    updateProfileReport();
+    ManageDialogCenteredOnPointer(ProfileDialog.form);
+#undef BORDER
+}
+
+static void profileEnableCB(Widget w, XtPointer clientData,
+        XtPointer callData)
+{
+    SetMacroProfiling(XmToggleButtonGetState(w));
+    updateProfileReport();
+}
+
+static void profileRefreshCB(Widget w, XtPointer clientData,
+        XtPointer callData)
+{
+    updateProfileReport();
+}
+
+static void profileResetCB(Widget w, XtPointer clientData, XtPointer callData)
+{
+    ResetMacroProfile();
+    updateProfileReport();
+}
+
+static void profileCloseCB(Widget w, XtPointer clientData, XtPointer callData)
+{
+    XtDestroyWidget(XtParent(ProfileDialog.form));
+}
+
+static void profileDestroyCB(Widget w, XtPointer clientData,
+        XtPointer callData)
+{
+    ProfileDialog.form = NULL;
+}
+
+/*
+** Fill the macro profile dialog with the current statistics
+*/
+static void updateProfileReport(void)
+{
+    char *report = MacroProfileReport();
+    
+    XmTextSetString(ProfileDialog.textW, report);
+    NEditFree(report);
+}
+
 /*
 ** Dispatches a macro to which repeats macro command in "command", either
 ** an integer number of times ("how" == positive integer), or within a
@@ -1745,6 +1950,9 @@ static Boolean continueWorkProc(XtPointer clientData)
     /* Macro exceeded time slice, re-schedule it */
     if (stat != MACRO_TIME_LIMIT)
     	return True; /* shouldn't happen */
+    
+    /* Collect the garbage of macros which run for a long time */
+    SafeGC();
     return False;
 }
 
@@ -1813,7 +2021,7 @@ static int lengthMS(WindowInfo *window, DataValue *argList, int nArgs,
     if (!readStringArg(argList[0], &string, stringStorage, errMsg))
 	return False;
     result->tag = INT_TAG;
-    result->val.n = strlen(string);
+    result->val.n = stringArgLength(argList[0], string);
     return True;
 }
 
@@ -2191,7 +2399,7 @@ static int substringMS(WindowInfo *window, DataValue *argList, int nArgs,
     	return False;
     if (!readIntArg(argList[1], &from, errMsg))
     	return False;
-    length = to = strlen(string);
+    length = to = stringArgLength(argList[0], string);
     if (nArgs == 3)
         if (!readIntArg(argList[2], &to, errMsg))
             return False;
@@ -2220,7 +2428,7 @@ static int toupperMS(WindowInfo *window, DataValue *argList, int nArgs,
     	return wrongNArgsErr(errMsg);
     if (!readStringArg(argList[0], &string, stringStorage, errMsg))
     	return False;
-    length = strlen(string);
+    length = stringArgLength(argList[0], string);
     
     /* Allocate a new string and copy an uppercased version of the string it */
     result->tag = STRING_TAG;
@@ -2241,7 +2449,7 @@ static int tolowerMS(WindowInfo *window, DataValue *argList, int nArgs,
     	return wrongNArgsErr(errMsg);
     if (!readStringArg(argList[0], &string, stringStorage, errMsg))
     	return False;
-    length = strlen(string);
+    length = stringArgLength(argList[0], string);
     
     /* Allocate a new string and copy an lowercased version of the string it */
     result->tag = STRING_TAG;
@@ -2435,7 +2643,7 @@ static int writeOrAppendFile(int append, WindowInfo *window,
     }
     
     /* write the string to the file */
-    fwrite(string, sizeof(char), strlen(string), fp);
+    fwrite(string, sizeof(char), stringArgLength(argList[0], string), fp);
     if (ferror(fp)) {
 	fclose(fp);
 	result->tag = INT_TAG;
@@ -4076,8 +4284,7 @@ static int lineMV(WindowInfo *window, DataValue *argList, int nArgs,
 
     result->tag = INT_TAG;
     cursorPos = TextGetCursorPos(window->lastFocus);
-    if (!TextPosToLineAndCol(window->lastFocus, cursorPos, &line, &colNum))
-    	line = BufCountLines(window->buffer, 0, cursorPos) + 1;
+    TextPosToLineAndCol(window->lastFocus, cursorPos, &line, &colNum);
     result->val.n = line;
     return True;
 }
@@ -5679,6 +5886,197 @@ static int getPatternAtPosMS(WindowInfo *window, DataValue *argList, int nArgs,
         HighlightStyleOfCode(window, patCode), bufferPos);
 }
 
+/*
+** Controls the highlight pattern profiler.  The single parameter is one of
+** "on" (start collecting statistics), "off" (stop collecting statistics) or
+** "reset" (clear the statistics collected for the current window).
+*/
+static int highlightProfilingMS(WindowInfo *window, DataValue *argList,
+        int nArgs, DataValue *result, char **errMsg)
+{
+    char stringStorage[1][TYPE_INT_STR_SIZE(int)];
+    char *mode;
+
+    if (nArgs != 1) {
+        return wrongNArgsErr(errMsg);
+    }
+    if (!readStringArg(argList[0], &mode, stringStorage[0], errMsg)) {
+        M_FAILURE("First parameter is not a string in %s");
+    }
+
+    if (!strcmp(mode, "on")) {
+        SetHighlightProfiling(True);
+    } else if (!strcmp(mode, "off")) {
+        SetHighlightProfiling(False);
+    } else if (!strcmp(mode, "reset")) {
+        ResetHighlightProfile(window);
+    } else {
+        M_FAILURE("Invalid mode (must be \"on\", \"off\" or \"reset\") in %s");
+    }
+
+    result->tag = NO_TAG;
+    return True;
+}
+
+/*
+** Returns an array containing the statistics collected by the highlight
+** pattern profiler for the current window, indexed by pattern name.  Each
+** element is an array with the following keys:
+**      ["pass"]        1 or 2 (deferred pattern)
+**      ["attempts"]    Number of times the pattern's own expressions were run
+**      ["matches"]     Number of times the pattern's start expression matched
+**      ["bytes"]       Number of characters scanned by the attempts
+**      ["time"]        Microseconds spent in the attempts
+*/
+static int getHighlightProfileMS(WindowInfo *window, DataValue *argList,
+        int nArgs, DataValue *result, char **errMsg)
+{
+    highlightProfileEntry *entries;
+    DataValue element, DV;
+    int i, nEntries;
+    double usecs;
+
+    if (nArgs != 0) {
+        return wrongNArgsErr(errMsg);
+    }
+
+    result->tag = ARRAY_TAG;
+    result->val.arrayPtr = ArrayNew();
+
+    nEntries = GetHighlightProfile(window, &entries);
+    for (i = 0; i < nEntries; i++) {
+        element.tag = ARRAY_TAG;
+        element.val.arrayPtr = ArrayNew();
+
+        /* the following array entries will be integers, which are clipped
+           to the range of the macro language's integer type */
+        DV.tag = INT_TAG;
+        DV.val.n = entries[i].pass;
+        if (!ArrayInsert(&element, PERM_ALLOC_STR("pass"), &DV)) {
+            NEditFree(entries);
+            M_ARRAY_INSERT_FAILURE();
+        }
+        DV.val.n = clipToInt(entries[i].attempts);
+        if (!ArrayInsert(&element, PERM_ALLOC_STR("attempts"), &DV)) {
+            NEditFree(entries);
+            M_ARRAY_INSERT_FAILURE();
+        }
+        DV.val.n = clipToInt(entries[i].matches);
+        if (!ArrayInsert(&element, PERM_ALLOC_STR("matches"), &DV)) {
+            NEditFree(entries);
+            M_ARRAY_INSERT_FAILURE();
+        }
+        DV.val.n = clipToInt(entries[i].bytes);
+        if (!ArrayInsert(&element, PERM_ALLOC_STR("bytes"), &DV)) {
+            NEditFree(entries);
+            M_ARRAY_INSERT_FAILURE();
+        }
+        usecs = entries[i].seconds * 1e6;
+        DV.val.n = usecs < INT_MAX ? (int)usecs : INT_MAX;
+        if (!ArrayInsert(&element, PERM_ALLOC_STR("time"), &DV)) {
+            NEditFree(entries);
+            M_ARRAY_INSERT_FAILURE();
+        }
+
+        if (!ArrayInsert(result, AllocStringCpy(entries[i].name), &element)) {
+            NEditFree(entries);
+            M_ARRAY_INSERT_FAILURE();
+        }
+    }
+    NEditFree(entries);
+    return True;
+}
+
+/*
+** Controls the macro profiler.  The single parameter is one of "on" (start
+** collecting statistics), "off" (stop collecting statistics) or "reset"
+** (clear the statistics collected so far).
+*/
+static int macroProfilingMS(WindowInfo *window, DataValue *argList,
+        int nArgs, DataValue *result, char **errMsg)
+{
+    char stringStorage[1][TYPE_INT_STR_SIZE(int)];
+    char *mode;
+
+    if (nArgs != 1) {
+        return wrongNArgsErr(errMsg);
+    }
+    if (!readStringArg(argList[0], &mode, stringStorage[0], errMsg)) {
+        M_FAILURE("First parameter is not a string in %s");
+    }
+
+    if (!strcmp(mode, "on")) {
+        SetMacroProfiling(True);
+    } else if (!strcmp(mode, "off")) {
+        SetMacroProfiling(False);
+    } else if (!strcmp(mode, "reset")) {
+        ResetMacroProfile();
+    } else {
+        M_FAILURE("Invalid mode (must be \"on\", \"off\" or \"reset\") in %s");
+    }
+
+    result->tag = NO_TAG;
+    return True;
+}
+
+/*
+** Returns the report of the macro profiler, as shown by the Macro Profile
+** dialog
+*/
+static int macroProfileReportMS(WindowInfo *window, DataValue *argList,
+        int nArgs, DataValue *result, char **errMsg)
+{
+    char *report;
+
+    if (nArgs != 0) {
+        return wrongNArgsErr(errMsg);
+    }
+
+    report = MacroProfileReport();
+    result->tag = STRING_TAG;
+    AllocNStringCpy(&result->val.str, report);
+    NEditFree(report);
+    M_STR_ALLOC_ASSERT((*result));
+    return True;
+}
+
+/*
+** Returns an array with the redisplay statistics of the current pane:
+**      ["requested"]   Number of lines redraws were requested for after
+**                      buffer modifications
+**      ["painted"]     Number of lines actually painted for these requests
+*/
+static int getRedisplayStatisticsMS(WindowInfo *window, DataValue *argList,
+        int nArgs, DataValue *result, char **errMsg)
+{
+    unsigned long requested, painted;
+    DataValue DV;
+
+    if (nArgs != 0) {
+        return wrongNArgsErr(errMsg);
+    }
+
+    TextGetRedisplayCounts(window->lastFocus, &requested, &painted);
+    result->tag = ARRAY_TAG;
+    result->val.arrayPtr = ArrayNew();
+
+    DV.tag = INT_TAG;
+    DV.val.n = clipToInt(requested);
+    if (!ArrayInsert(result, PERM_ALLOC_STR("requested"), &DV)) {
+        M_ARRAY_INSERT_FAILURE();
+    }
+    DV.val.n = clipToInt(painted);
+    if (!ArrayInsert(result, PERM_ALLOC_STR("painted"), &DV)) {
+        M_ARRAY_INSERT_FAILURE();
+    }
+    return True;
+}
+
+static int clipToInt(unsigned long n)
+{
+    return n > INT_MAX ? INT_MAX : (int)n;
+}
+
 static int wrongNArgsErr(char **errMsg)
 {
     *errMsg = "Wrong number of arguments to function %s";
@@ -5769,3 +6167,12 @@ static int readStringArg(DataValue dv, char **result, char *stringStorage,
     *errMsg = "%s called with unknown object";
     return False;
 }
+
+/*
+** Get the length of a string read by readStringArg from argument dv,
+** without scanning it when it is a string value
+*/
+static int stringArgLength(DataValue dv, const char *string)
+{
+    return dv.tag == STRING_TAG ? (int)dv.val.str.len : (int)strlen(string);
+}
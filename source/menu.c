@@ -291,6 +291,8 @@ static void repeatDialogAP(Widget w, XEvent *event, String *args,
 	Cardinal *nArgs);
 static void repeatMacroAP(Widget w, XEvent *event, String *args,
     	Cardinal *nArgs);
+static void macroProfileDialogAP(Widget w, XEvent *event, String *args,
+	Cardinal *nArgs);
 static void markAP(Widget w, XEvent *event, String *args, Cardinal *nArgs);
 static void markDialogAP(Widget w, XEvent *event, String *args,
 	Cardinal *nArgs);
@@ -560,6 +562,7 @@ static XtActionsRec Actions[] = {
     {"end_of_selection", endOfSelectionAP},
     {"repeat_macro", repeatMacroAP},
     {"repeat_dialog", repeatDialogAP},
+    {"macro_profile_dialog", macroProfileDialogAP},
     {"raise_window", raiseWindowAP},
     {"focus_pane", focusPaneAP},
     {"set_statistics_line", setStatisticsLineAP},
@@ -1193,6 +1196,9 @@ Widget CreateMenuBar(Widget parent, WindowInfo *window)
     window->repeatItem = createMenuItem(menuPane, "repeat",
     	    "Repeat...", 'R', doActionCB, "repeat_dialog", SHORT);
     XtVaSetValues(window->repeatItem, XmNuserData, PERMANENT_MENU_ITEM, NULL);
+    btn = createMenuItem(menuPane, "macroProfile", "Macro Profile...", 'P',
+    	    doActionCB, "macro_profile_dialog", FULL);
+    XtVaSetValues(btn, XmNuserData, PERMANENT_MENU_ITEM, NULL);
     btn = createMenuSeparator(menuPane, "sep1", SHORT);
     XtVaSetValues(btn, XmNuserData, PERMANENT_MENU_ITEM, NULL);
 
@@ -3361,9 +3367,7 @@ static void gotoAP(Widget w, XEvent *event, String *args, Cardinal *nArgs)
     /* User specified column, but not line number */
     if (lineNum == -1) {
         position = TextGetCursorPos(w);
-        if (TextPosToLineAndCol(w, position, &lineNum, &curCol) == False) {
-            return;
-        }
+        TextPosToLineAndCol(w, position, &lineNum, &curCol);
     } else if ( column == -1 ) {
         /* User didn't specify a column */
         SelectNumberedLine(WidgetToWindow(w), lineNum);
@@ -3397,6 +3401,12 @@ static void repeatDialogAP(Widget w, XEvent *event, String *args,
     RepeatDialog(WidgetToWindow(w));
 }
 
+static void macroProfileDialogAP(Widget w, XEvent *event, String *args,
+	Cardinal *nArgs)
+{
+    MacroProfileDialog(WidgetToWindow(w));
+}
+
 static void repeatMacroAP(Widget w, XEvent *event, String *args,
     	Cardinal *nArgs)
 {
@@ -82,9 +82,12 @@
    mation is retained.  Normally, the list is kept between UNDO_OP_LIMIT and
    UNDO_OP_TRIMTO in length (when the list reaches UNDO_OP_LIMIT, it is
    trimmed to UNDO_OP_TRIMTO then allowed to grow back to UNDO_OP_LIMIT).
-   When there are very large amounts of saved text held in the list,
-   UNDO_WORRY_LIMIT and UNDO_PURGE_LIMIT take over and cause the list to
-   be trimmed back further to keep its size down. */
+   When the saved text exceeds the undoMemoryBudget resource, the text of
+   the oldest records is moved to a temporary file (see undo.c), and the
+   list is only trimmed when that grows past UNDO_SPILL_LIMIT.  If the
+   budget is zero or the file can't be written, UNDO_WORRY_LIMIT and
+   UNDO_PURGE_LIMIT take over and cause the list to be trimmed back further
+   to keep its size down. */
 #define UNDO_PURGE_LIMIT 15000000 /* If undo list gets this large (in bytes),
 				     trim it to length of UNDO_PURGE_TRIMTO */
 #define UNDO_PURGE_TRIMTO 1	  /* Amount to trim the undo list in a purge */
@@ -95,6 +98,8 @@
 #define UNDO_OP_LIMIT 400	  /* normal limit for length of undo list */
 #define UNDO_OP_TRIMTO 200	  /* size undo list is normally trimmed to
 				     when it exceeds UNDO_OP_TRIMTO in length */
+#define UNDO_SPILL_LIMIT 200000000 /* maximum amount of undo text (in bytes)
+				     a window may keep in the temporary file */
 #ifdef SGI_CUSTOM
 #define MAX_SHORTENED_ITEMS 100   /* max. number of items excluded in short- */
 #endif	    	    	    	  /*     menus mode */
@@ -104,6 +109,8 @@ typedef enum {NO_WRAP, NEWLINE_WRAP, CONTINUOUS_WRAP} WrapStyle;
 typedef enum {NO_FLASH, FLASH_DELIMIT, FLASH_RANGE} ShowMatchingStyle;
 enum virtKeyOverride { VIRT_KEY_OVERRIDE_NEVER, VIRT_KEY_OVERRIDE_AUTO,
                        VIRT_KEY_OVERRIDE_ALWAYS };
+/* what the backup journal of a window is relative to (see file.c) */
+enum journalStates {JOURNAL_NONE, JOURNAL_ON_FILE, JOURNAL_ON_BACKUP};
 
 /*  This enum must be kept in parallel to the array TruncSubstitutionModes[]
     in preferences.c  */
@@ -163,8 +170,15 @@ typedef struct _UndoInfo {
     int		type;
     int		startPos;
     int		endPos;
-    int 	oldLen;
+    int 	oldLen;			/* length of oldText + 1, or 0 */
     char	*oldText;
+    char	*oldTextBuf;		/* allocated memory holding oldText,
+    					   which may leave room on either side
+    					   for coalescing deletions */
+    int		oldTextBufSize;
+    long	spillPos;		/* position of the saved text in the
+    					   undo spill file, or -1 if oldText
+    					   holds it in memory */
     char	inUndo;			/* flag to indicate undo command on
     					   this record in progress.  Redirects
     					   SaveUndoInfo to save the next mod-
@@ -469,9 +483,17 @@ typedef struct _WindowInfo {
     int		autoSaveCharCount;	/* count of single characters typed
     					   since last backup file generated */
     int		autoSaveOpCount;	/* count of editing operations "" */
+    char	*journalText;		/* changes not yet written to the
+    					   backup journal */
+    int		journalTextLen;		/* length of journalText */
+    int		journalTextSize;	/* allocated size of journalText */
+    int		journalState;		/* enum journalStates */
+    long	journalSize;		/* length of backup journal on disk */
     int		undoOpCount;		/* count of stored undo operations */
     int		undoMemUsed;		/* amount of memory (in bytes)
     					   dedicated to the undo list */
+    int		undoDiskUsed;		/* amount of undo text (in bytes)
+    					   moved to the undo spill file */
     char	fontName[MAX_FONT_LEN];	/* names of the text fonts in use */
     char	italicFontName[MAX_FONT_LEN];
     char	boldFontName[MAX_FONT_LEN];
@@ -47,6 +47,8 @@ static Symbol *matchesActionRoutine(char **inPtr);
 
 static char *ErrMsg;
 static char *InPtr;
+static char *LinePtr;	/* how far InPtr has been scanned for newlines */
+static int LineNum;	/* source line number of LinePtr */
 extern Inst *LoopStack[]; /* addresses of break, cont stmts */
 extern Inst **LoopStackPtr;  /*  to fill at the end of a loop */
 
@@ -290,14 +292,14 @@ initarraylv:    SYMBOL {
                     ADD_OP(OP_PUSH_ARRAY_SYM); ADD_SYM($1); ADD_IMMED(1);
                 }
                 | initarraylv '[' arglist ']' {
-                    ADD_OP(OP_ARRAY_REF); ADD_IMMED($3);
+                    ADD_OP(OP_ARRAY_REF_LV); ADD_IMMED($3);
                 }
                 ;
 arraylv:    SYMBOL {
                 ADD_OP(OP_PUSH_ARRAY_SYM); ADD_SYM($1); ADD_IMMED(0);
             }
             | arraylv '[' arglist ']' {
-                ADD_OP(OP_ARRAY_REF); ADD_IMMED($3);
+                ADD_OP(OP_ARRAY_REF_LV); ADD_IMMED($3);
             }
             ;
 arrayexpr:  numexpr {
@@ -458,7 +460,8 @@ Program *ParseMacro(char *expr, char **msg, char **stoppedAt)
     /* call yyparse to parse the string and check for success.  If the parse
        failed, return the error message and string index (the grammar aborts
        parsing at the first error) */
-    InPtr = expr;
+    InPtr = LinePtr = expr;
+    LineNum = 1;
     if (yyparse()) {
         *msg = ErrMsg;
         *stoppedAt = InPtr;
@@ -507,6 +510,13 @@ static int yylex(void)
             break;
     }
 
+    /* tell the code generator which line the token, and the code which is
+       created for it, come from */
+    for (; LinePtr < InPtr; LinePtr++)
+        if (*LinePtr == '\n')
+            LineNum++;
+    SetSourceLine(LineNum);
+
 
     /* return end of input at the end of the string */
     if (*InPtr == '\0') {
@@ -62,6 +62,8 @@ static Symbol *matchesActionRoutine(char **inPtr);
 
 static char *ErrMsg;
 static char *InPtr;
+static char *LinePtr;	/* how far InPtr has been scanned for newlines */
+static int LineNum;	/* source line number of LinePtr */
 extern Inst *LoopStack[]; /* addresses of break, cont stmts */
 extern Inst **LoopStackPtr;  /*  to fill at the end of a loop */
 
@@ -754,7 +756,8 @@ Program *ParseMacro(char *expr, char **msg, char **stoppedAt)
     /* call yyparse to parse the string and check for success.  If the parse
        failed, return the error message and string index (the grammar aborts
        parsing at the first error) */
-    InPtr = expr;
+    InPtr = LinePtr = expr;
+    LineNum = 1;
     if (yyparse()) {
         *msg = ErrMsg;
         *stoppedAt = InPtr;
@@ -803,6 +806,13 @@ static int yylex(void)
             break;
     }
 
+    /* tell the code generator which line the token, and the code which is
+       created for it, come from */
+    for (; LinePtr < InPtr; LinePtr++)
+        if (*LinePtr == '\n')
+            LineNum++;
+    SetSourceLine(LineNum);
+
 
     /* return end of input at the end of the string */
     if (*InPtr == '\0') {
@@ -1606,7 +1616,7 @@ break;
 case 57:
 #line 294 "parse.y"
 {
-                    ADD_OP(OP_ARRAY_REF); ADD_IMMED(yyvsp[-1].nArgs);
+                    ADD_OP(OP_ARRAY_REF_LV); ADD_IMMED(yyvsp[-1].nArgs);
                 }
 break;
 case 58:
@@ -1618,7 +1628,7 @@ break;
 case 59:
 #line 301 "parse.y"
 {
-                ADD_OP(OP_ARRAY_REF); ADD_IMMED(yyvsp[-1].nArgs);
+                ADD_OP(OP_ARRAY_REF_LV); ADD_IMMED(yyvsp[-1].nArgs);
             }
 break;
 case 60:
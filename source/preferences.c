@@ -177,6 +177,25 @@ typedef struct {
 } languageModeRec;
 static languageModeRec *LanguageModes[MAX_LANGUAGE_MODES];
 
+/* Language mode recognition information, indexed for fast lookup when
+   files are opened.  Built on first use from LanguageModes, and discarded
+   (by invalidateModeRecognition) whenever the language mode list changes */
+#define EXT_HASH_SIZE 251
+typedef struct extIndexEntry {
+    const char *ext;
+    int len;
+    int mode;
+    struct extIndexEntry *next;
+} extIndexEntry;
+static struct {
+    int valid;
+    regexp *recognizers[MAX_LANGUAGE_MODES]; /* per mode, NULL if none */
+    regexp *anyRecognizer;  /* all of the above, to rule them out at once */
+    extIndexEntry *extTable[EXT_HASH_SIZE];
+    int *extLengths;        /* distinct extension lengths */
+    int nExtLengths;
+} ModeRecognition;
+
 /* Language mode dialog information */
 static struct {
     Widget shell;
@@ -320,6 +339,8 @@ static struct prefData {
     char colorNames[NUM_COLORS][MAX_COLOR_LEN];
     char tooltipBgColor[MAX_COLOR_LEN];
     int  undoModifiesSelection;
+    int  undoMemoryBudget;	/* kilobytes of undo text kept in memory */
+    int  macroTimeSlice;	/* ms a macro runs before yielding to X */
     int  focusOnRaise;
     Boolean honorSymlinks;
     int truncSubstitution;
@@ -1065,6 +1086,10 @@ static PrefDescripRec PrefDescrip[] = {
 	PrefData.titleFormat, (void *)sizeof(PrefData.titleFormat), True},
     {"undoModifiesSelection", "UndoModifiesSelection", PREF_BOOLEAN,
         "True", &PrefData.undoModifiesSelection, NULL, False},
+    {"undoMemoryBudget", "UndoMemoryBudget", PREF_INT, "1024",
+        &PrefData.undoMemoryBudget, NULL, False},
+    {"macroTimeSlice", "MacroTimeSlice", PREF_INT, "10",
+        &PrefData.macroTimeSlice, NULL, False},
     {"focusOnRaise", "FocusOnRaise", PREF_BOOLEAN,
             "False", &PrefData.focusOnRaise, NULL, False},
     {"forceOSConversion", "ForceOSConversion", PREF_BOOLEAN, "True",
@@ -1201,6 +1226,9 @@ static void cursorFgModifiedCB(Widget w, XtPointer clientData,
         XtPointer callData);
 
 static int matchLanguageMode(WindowInfo *window);
+static void buildModeRecognition(void);
+static void invalidateModeRecognition(void);
+static unsigned hashExtension(const char *ext, int len);
 static int loadLanguageModesString(char *inString, int fileVer);
 static char *writeLanguageModesString(void);
 static char *createExtString(char **extensions, int nExtensions);
@@ -2162,6 +2190,16 @@ Boolean GetPrefUndoModifiesSelection(void)
     return (Boolean)PrefData.undoModifiesSelection;
 }
 
+int GetPrefUndoMemoryBudget(void)
+{
+    return PrefData.undoMemoryBudget;
+}
+
+int GetPrefMacroTimeSlice(void)
+{
+    return PrefData.macroTimeSlice;
+}
+
 Boolean GetPrefFocusOnRaise(void)
 {
     return (Boolean)PrefData.focusOnRaise;
@@ -3410,6 +3448,7 @@ static int updateLMList(void)
     }
     
     /* Replace the old language mode list with the new one from the dialog */
+    invalidateModeRecognition();
     for (i=0; i<NLanguageModes; i++)
     	freeLanguageModeRec(LanguageModes[i]);
     for (i=0; i<LMDialog.nLanguageModes; i++)
@@ -4514,20 +4553,27 @@ static void reapplyLanguageMode(WindowInfo *window, int mode, int forceDefaults)
 */
 static int matchLanguageMode(WindowInfo *window)
 {
-    char *ext, *first200;
-    int i, j, fileNameLen, extLen, beginPos, endPos, start;
+    char *first200;
+    int i, fileNameLen, extLen, start, mode;
     const char *versionExtendedPath;
+    extIndexEntry *entry;
+
+    if (!ModeRecognition.valid)
+    	buildModeRecognition();
 
     /*... look for an explicit mode statement first */
     
-    /* Do a regular expression search on for recognition pattern */
+    /* Do a regular expression search on for recognition pattern.  Most files
+       match none of them, which the combined expression (when available)
+       finds out in a single pass, otherwise the first matching mode wins */
     first200 = BufGetRange(window->buffer, 0, 200);
-    for (i=0; i<NLanguageModes; i++) {
-    	if (LanguageModes[i]->recognitionExpr != NULL) {
-    	    if (SearchString(first200, LanguageModes[i]->recognitionExpr,
-    	    	    SEARCH_FORWARD, SEARCH_REGEX, False, 0, &beginPos,
-    	    	    &endPos, NULL, NULL, NULL))
-            {
+    if (ModeRecognition.anyRecognizer == NULL ||
+    	    ExecRE(ModeRecognition.anyRecognizer, first200, NULL, False, '\0',
+    	    '\0', NULL, first200, NULL)) {
+    	for (i=0; i<NLanguageModes; i++) {
+    	    if (ModeRecognition.recognizers[i] != NULL &&
+    	    	    ExecRE(ModeRecognition.recognizers[i], first200, NULL,
+    	    	    False, '\0', '\0', NULL, first200, NULL)) {
 		NEditFree(first200);
     	    	return i;
 	    }
@@ -4546,24 +4592,143 @@ static int matchLanguageMode(WindowInfo *window)
     if ((versionExtendedPath = GetClearCaseVersionExtendedPath(window->filename)) != NULL)
         fileNameLen = versionExtendedPath - window->filename;
 #endif
-    for (i=0; i<NLanguageModes; i++) {
-    	for (j=0; j<LanguageModes[i]->nExtensions; j++) {
-    	    ext = LanguageModes[i]->extensions[j];
-    	    extLen = strlen(ext);
-    	    start = fileNameLen - extLen;
+
+    /* Extensions are matched against the end of the file name, so look up
+       each length of extension in use.  Modes earlier in the list win */
+    mode = PLAIN_LANGUAGE_MODE;
+    for (i=0; i<ModeRecognition.nExtLengths; i++) {
+    	extLen = ModeRecognition.extLengths[i];
+    	start = fileNameLen - extLen;
+    	if (start < 0)
+    	    continue;
+    	for (entry = ModeRecognition.extTable[hashExtension(
+    	    	&window->filename[start], extLen)];
+    	    	entry != NULL; entry = entry->next) {
+    	    if (entry->len == extLen &&
+    	    	    (mode == PLAIN_LANGUAGE_MODE || entry->mode < mode) &&
 #if defined(__VMS) && (__VMS_VER >= 70200000) 
-          /* VMS v7.2 has case-preserving filenames */
-            if (start >= 0 && !strncasecmp(&window->filename[start], ext, extLen))
-               return i;
+                /* VMS v7.2 has case-preserving filenames */
+    	    	    !strncasecmp(&window->filename[start], entry->ext, extLen))
 #else
-            if (start >= 0 && !strncmp(&window->filename[start], ext, extLen))  
-                return i;
+    	    	    !strncmp(&window->filename[start], entry->ext, extLen))
 #endif
+    	    	mode = entry->mode;
     	}
     }
+    return mode;
+}
 
-    /* no appropriate mode was found */
-    return PLAIN_LANGUAGE_MODE;
+/*
+** Compile the recognition expressions and index the file extensions of the
+** language modes in LanguageModes, for matchLanguageMode
+*/
+static void buildModeRecognition(void)
+{
+    int i, j, k, len, combine = True, combinedLen = 0;
+    char *compileMsg, *combined, *c;
+    extIndexEntry *entry;
+    unsigned bucket;
+    
+    invalidateModeRecognition();
+    
+    /* Compile the recognition expressions individually, and, unless one of
+       them uses back-references (whose numbers would change), combined into
+       a single alternation */
+    for (i=0; i<NLanguageModes; i++) {
+    	c = LanguageModes[i]->recognitionExpr;
+    	if (c == NULL)
+    	    continue;
+    	ModeRecognition.recognizers[i] = CompileRE(c, &compileMsg,
+    	    	REDFLT_STANDARD);
+    	if (ModeRecognition.recognizers[i] == NULL)
+    	    continue;
+    	combinedLen += strlen(c) + 5;
+    	for (; *c != '\0'; c++) {
+    	    if (*c == '\\' && *++c >= '1' && *c <= '9')
+    	    	combine = False;
+    	    if (*c == '\0')
+    	    	break;
+    	}
+    }
+    if (combine && combinedLen > 0) {
+    	combined = c = (char *)NEditMalloc(combinedLen + 1);
+    	for (i=0; i<NLanguageModes; i++) {
+    	    if (ModeRecognition.recognizers[i] == NULL)
+    	    	continue;
+    	    if (c != combined)
+    	    	*c++ = '|';
+    	    c += sprintf(c, "(?:%s)", LanguageModes[i]->recognitionExpr);
+    	}
+    	ModeRecognition.anyRecognizer = CompileRE(combined, &compileMsg,
+    	    	REDFLT_STANDARD);
+    	NEditFree(combined);
+    }
+    
+    /* Hash the extensions, and collect the distinct extension lengths */
+    for (i=0, k=0; i<NLanguageModes; i++)
+    	k += LanguageModes[i]->nExtensions;
+    ModeRecognition.extLengths = (int *)NEditMalloc(sizeof(int) * (k + 1));
+    for (i=0; i<NLanguageModes; i++) {
+    	for (j=0; j<LanguageModes[i]->nExtensions; j++) {
+    	    len = strlen(LanguageModes[i]->extensions[j]);
+    	    entry = (extIndexEntry *)NEditMalloc(sizeof(extIndexEntry));
+    	    entry->ext = LanguageModes[i]->extensions[j];
+    	    entry->len = len;
+    	    entry->mode = i;
+    	    bucket = hashExtension(entry->ext, len);
+    	    entry->next = ModeRecognition.extTable[bucket];
+    	    ModeRecognition.extTable[bucket] = entry;
+    	    for (k=0; k<ModeRecognition.nExtLengths; k++)
+    	    	if (ModeRecognition.extLengths[k] == len)
+    	    	    break;
+    	    if (k == ModeRecognition.nExtLengths)
+    	    	ModeRecognition.extLengths[ModeRecognition.nExtLengths++] = len;
+    	}
+    }
+    ModeRecognition.valid = True;
+}
+
+/*
+** Discard the language mode recognition information built by
+** buildModeRecognition, which must be done before any change to the
+** language mode list
+*/
+static void invalidateModeRecognition(void)
+{
+    extIndexEntry *entry, *next;
+    int i;
+    
+    for (i=0; i<MAX_LANGUAGE_MODES; i++) {
+    	NEditFree(ModeRecognition.recognizers[i]);
+    	ModeRecognition.recognizers[i] = NULL;
+    }
+    NEditFree(ModeRecognition.anyRecognizer);
+    ModeRecognition.anyRecognizer = NULL;
+    for (i=0; i<EXT_HASH_SIZE; i++) {
+    	for (entry=ModeRecognition.extTable[i]; entry!=NULL; entry=next) {
+    	    next = entry->next;
+    	    NEditFree(entry);
+    	}
+    	ModeRecognition.extTable[i] = NULL;
+    }
+    NEditFree(ModeRecognition.extLengths);
+    ModeRecognition.extLengths = NULL;
+    ModeRecognition.nExtLengths = 0;
+    ModeRecognition.valid = False;
+}
+
+static unsigned hashExtension(const char *ext, int len)
+{
+    unsigned hash = 0;
+    
+    while (len-- > 0) {
+#if defined(__VMS) && (__VMS_VER >= 70200000) 
+    	hash = hash * 31 + (unsigned char)tolower((unsigned char)*ext++);
+#else
+    	hash = hash * 31 + (unsigned char)*ext++;
+#endif
+    }
+    return hash % EXT_HASH_SIZE;
 }
 
 static int loadLanguageModesString(char *inString, int fileVer)
@@ -4678,6 +4843,7 @@ static int loadLanguageModesString(char *inString, int fileVer)
     	    return modeError(lm, inString, inPtr, errMsg);
     	
    	/* pattern set was read correctly, add/replace it in the list */
+   	invalidateModeRecognition();
    	for (i=0; i<NLanguageModes; i++) {
 	    if (!strcmp(LanguageModes[i]->name, lm->name)) {
 		freeLanguageModeRec(LanguageModes[i]);
@@ -206,6 +206,8 @@ int GetPrefOpenInTab(void);
 void SetPrefUndoModifiesSelection(Boolean);
 void SetPrefOpenInTab(int state);
 Boolean GetPrefUndoModifiesSelection(void);
+int GetPrefUndoMemoryBudget(void);
+int GetPrefMacroTimeSlice(void);
 Boolean GetPrefFocusOnRaise(void);
 Boolean GetPrefHonorSymlinks(void);
 Boolean GetPrefForceOSConversion(void);
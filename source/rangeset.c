@@ -1077,6 +1077,45 @@ int RangesetIndex1ofPos(RangesetTable *table, int pos, int needs_color)
 
 /* -------------------------------------------------------------------------- */
 
+/*
+** Fill indexes[0 .. end-start-1] with the values RangesetIndex1ofPos() would
+** return for the positions start to end-1, by walking the ranges of each
+** rangeset which overlap the span, rather than looking up every position.
+*/
+
+void RangesetIndex1ofRange(RangesetTable *table, int start, int end,
+	int needs_color, unsigned char *indexes)
+{
+    int i, r, n, s, e, *ranges;
+    Rangeset *rangeset;
+
+    if (end <= start)
+	return;
+    memset(indexes, 0, end - start);
+    if (!table)
+	return;
+
+    /* paint from the deepest rangeset up, so the first in depth order wins */
+    for (i = table->n_set - 1; i >= 0; i--) {
+	rangeset = &table->set[(int)table->order[i]];
+	if (needs_color && !(rangeset->color_set >= 0 && rangeset->color_name))
+	    continue;
+	n = rangeset->n_ranges * 2;
+	if (n == 0)
+	    continue;
+	ranges = (int *)rangeset->ranges;	/* { s1,e1, s2,e2, s3,e3,... } */
+	for (r = at_or_before(ranges, 0, n, start) & ~1;
+		r < n && ranges[r] < end; r += 2) {
+	    s = ranges[r] > start ? ranges[r] : start;
+	    e = ranges[r + 1] < end ? ranges[r + 1] : end;
+	    if (e > s)
+		memset(&indexes[s - start], table->order[i] + 1, e - s);
+	}
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
 /*
 ** Assign a color name to a rangeset via the rangeset table.
 */
@@ -68,6 +68,8 @@ void RangesetTableUpdatePos(RangesetTable *table, int pos, int n_ins, int n_del)
 void RangesetBufModifiedCB(int pos, int nInserted, int nDeleted, int nRestyled,
 	const char *deletedText, void *cbArg);
 int RangesetIndex1ofPos(RangesetTable *table, int pos, int needs_color);
+void RangesetIndex1ofRange(RangesetTable *table, int start, int end,
+	int needs_color, unsigned char *indexes);
 int RangesetAssignColorName(Rangeset *rangeset, char *color_name);
 int RangesetAssignColorPixel(Rangeset *rangeset, Pixel color, int ok);
 char *RangesetGetName(Rangeset *rangeset);
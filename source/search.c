@@ -391,53 +391,18 @@ static void initToggleButtons(int searchType, Widget regexToggle,
 */
 static int selectionSpansMultipleLines(WindowInfo *window)
 {
-    int selStart, selEnd, isRect, rectStart, rectEnd, lineStartStart,
-        lineStartEnd;
-    int lineWidth;
+    int selStart, selEnd, isRect, rectStart, rectEnd;
     textDisp *textD;
     
     if (!BufGetSelectionPos(window->buffer, &selStart, &selEnd, &isRect,
     	    &rectStart, &rectEnd))
     	return FALSE;
 
-    /* This is kind of tricky. The perception of a line depends on the
-       line wrap mode being used. So in theory, we should take into 
-       account the layout of the text on the screen. However, the 
-       routine to calculate a line number for a given character position
-       (TextDPosToLineAndCol) only works for displayed lines, so we cannot
-       use it. Therefore, we use this simple heuristic:
-        - If a newline is found between the start and end of the selection,
-	  we obviously have a multi-line selection.
-	- If no newline is found, but the distance between the start and the
-          end of the selection is larger than the number of characters 
-	  displayed on a line, and we're in continuous wrap mode,
-	  we also assume a multi-line selection.
-    */
-     
-    lineStartStart = BufStartOfLine(window->buffer, selStart);
-    lineStartEnd = BufStartOfLine(window->buffer, selEnd);
-    /* If the line starts differ, we have a "\n" in between. */
-    if (lineStartStart != lineStartEnd ) 
-	return TRUE;     
-    
-    if (window->wrapMode != CONTINUOUS_WRAP)
-	return FALSE; /* Same line */
-	    
-    /* Estimate the number of characters on a line */
+    /* The perception of a line depends on the line wrap mode being used,
+       so count the lines as they are laid out on the screen: in continuous
+       wrap mode, a selection crossing a wrap point spans multiple lines */
     textD = ((TextWidget)window->textArea)->text.textD;
-    if (textD->fontStruct->max_bounds.width > 0)
-	lineWidth = textD->width / textD->fontStruct->max_bounds.width;
-    else
-	lineWidth = 1;
-    if (lineWidth < 1) lineWidth = 1; /* Just in case */
-    
-    /* Estimate the numbers of line breaks from the start of the line to
-       the start and ending positions of the selection and compare.*/
-    if ((selStart-lineStartStart)/lineWidth !=
-        (selEnd-lineStartStart)/lineWidth )
-       return TRUE; /* Spans multiple lines */
-       
-    return FALSE; /* Small selection; probably doesn't span lines */
+    return TextDCountLines(textD, selStart, selEnd, False) > 0;
 }
 #endif
 
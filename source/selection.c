@@ -227,10 +227,7 @@ static void gotoCB(Widget widget, XtPointer wi, Atom *sel,
     /* User specified column, but not line number */
     if ( lineNum == -1 ) {
         position = TextGetCursorPos(widget);
-        if (TextPosToLineAndCol(widget, position, &lineNum, &curCol) == False) {
-            XBell(TheDisplay, 0);
-            return;
-        }
+        TextPosToLineAndCol(widget, position, &lineNum, &curCol);
     }
     /* User didn't specify a column */
     else if ( column == -1 ) {
@@ -399,19 +396,16 @@ static void getAnySelectionCB(Widget widget, XtPointer voidresult, Atom *sel,
 
 void SelectNumberedLine(WindowInfo *window, int lineNum)
 {
-    int i, lineStart = 0, lineEnd;
+    int lineStart, lineEnd;
 
-    /* count lines to find the start and end positions for the selection */
+    /* look up the start and end positions for the selection */
     if (lineNum < 1)
     	lineNum = 1;
-    lineEnd = -1;
-    for (i=1; i<=lineNum && lineEnd<window->buffer->length; i++) {
-    	lineStart = lineEnd + 1;
-    	lineEnd = BufEndOfLine(window->buffer, lineStart);
-    }
+    lineStart = BufPosOfLine(window->buffer, lineNum - 1);
     
     /* highlight the line */
-    if (i>lineNum) {
+    if (lineStart != -1) {
+	lineEnd = BufEndOfLine(window->buffer, lineStart);
 	/* Line was found */
 	if (lineEnd < window->buffer->length) {
 	    BufSelect(window->buffer, lineStart, lineEnd+1);
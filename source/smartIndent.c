@@ -754,6 +754,7 @@ void BeginSmartIndent(WindowInfo *window, int warn)
     	    	"newline macro", errMsg);
     	return;
     }
+    SetProgramSource(winData->newlineMacro, "smart indent newline macro", 1);
     if (indentMacros->modMacro == NULL)
     	winData->modMacro = NULL;
     else {
@@ -766,6 +767,7 @@ void BeginSmartIndent(WindowInfo *window, int warn)
     	    	    "smart indent modify macro", errMsg);
     	    return;
     	}
+    	SetProgramSource(winData->modMacro, "smart indent modify macro", 1);
     }
     window->smartIndentData = (void *)winData;
 }
@@ -707,7 +707,9 @@ static XtResource resources[] = {
       sizeof(caddr_t), XtOffset(TextWidget, text.smartIndentCB), XtRCallback,
       NULL},
     {textNcursorVPadding, textCCursorVPadding, XtRCardinal, sizeof(Cardinal),
-      XtOffset(TextWidget, text.cursorVPadding), XmRString, "0"}
+      XtOffset(TextWidget, text.cursorVPadding), XmRString, "0"},
+    {textNbackingStore, textCBackingStore, XmRBoolean, sizeof(Boolean),
+      XtOffset(TextWidget, text.backingStore), XmRString, "False"}
 };
 
 static TextClassRec textClassRec = {
@@ -830,6 +832,8 @@ static void initialize(TextWidget request, TextWidget new)
           new->text.continuousWrap, new->text.wrapMargin,
           new->text.backlightCharTypes, new->text.calltipFGPixel,
           new->text.calltipBGPixel);
+    if (new->text.backingStore)
+    	TextDSetBackingStore(new->text.textD, True);
 
     /* Add mandatory delimiters blank, tab, and newline to the list of
        delimiters.  The memory use scheme here is that new values are
@@ -1017,7 +1021,7 @@ static void redisplay(TextWidget w, XEvent *event, Region region)
 {
     XExposeEvent *e = &event->xexpose;
     
-    TextDRedisplayRect(w->text.textD, e->x, e->y, e->width, e->height);
+    TextDExposeRect(w->text.textD, e->x, e->y, e->width, e->height);
 }
 
 static Bool findGraphicsExposeOrNoExposeEvent(Display *theDisplay, XEvent *event, XPointer arg)
@@ -1127,6 +1131,11 @@ static Boolean setValues(TextWidget current, TextWidget request,
     	TextDSetWrapMode(current->text.textD, new->text.continuousWrap,
     	    	new->text.wrapMargin);
     
+    if (new->text.backingStore != current->text.backingStore) {
+    	TextDSetBackingStore(current->text.textD, new->text.backingStore);
+    	redraw = True;
+    }
+    
     /* When delimiters are changed, copy the memory, so that the caller
        doesn't have to manage it, and add mandatory delimiters blank,
        tab, and newline to the list */
@@ -1264,13 +1273,11 @@ int TextLineAndColToPos(Widget w, int lineNum, int column)
 }
 
 /*
-** Translate a position into a line number (if the position is visible,
-** if it's not, return False
+** Translate a position into a line and column number
 */
-int TextPosToLineAndCol(Widget w, int pos, int *lineNum, int *column)
+void TextPosToLineAndCol(Widget w, int pos, int *lineNum, int *column)
 {
-    return TextDPosToLineAndCol(((TextWidget)w)->text.textD, pos, lineNum,
-    	    column);
+    TextDPosToLineAndCol(((TextWidget)w)->text.textD, pos, lineNum, column);
 }
 
 /*
@@ -1402,6 +1409,13 @@ int TextVisibleWidth(Widget w)
     return(((TextWidget)w)->text.textD->width);
 }
 
+void TextGetRedisplayCounts(Widget w, unsigned long *linesRequested,
+        unsigned long *linesPainted)
+{
+    TextDGetRedisplayCounts(((TextWidget)w)->text.textD, linesRequested,
+            linesPainted);
+}
+
 int TextFirstVisiblePos(Widget w)
 {
     return ((TextWidget)w)->text.textD->firstChar;
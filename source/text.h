@@ -110,6 +110,8 @@
 #define textCEmulateTabs "EmulateTabs"
 #define textNcursorVPadding "cursorVPadding"
 #define textCCursorVPadding "CursorVPadding"
+#define textNbackingStore "backingStore"
+#define textCBackingStore "BackingStore"
 #define textNbacklightCharTypes "backlightCharTypes"
 #define textCBacklightCharTypes "BacklightCharTypes"
 
@@ -140,7 +142,7 @@ typedef struct {
 void TextSetBuffer(Widget w, textBuffer *buffer);
 textBuffer *TextGetBuffer(Widget w);
 int TextLineAndColToPos(Widget w, int lineNum, int column);
-int TextPosToLineAndCol(Widget w, int pos, int *lineNum, int *column);
+void TextPosToLineAndCol(Widget w, int pos, int *lineNum, int *column);
 int TextPosToXY(Widget w, int pos, int *x, int *y);
 int TextGetCursorPos(Widget w);
 void TextSetCursorPos(Widget w, int pos);
@@ -160,6 +162,8 @@ void TextInsertAtCursor(Widget w, char *chars, XEvent *event,
     	int allowPendingDelete, int allowWrap);
 int TextFirstVisiblePos(Widget w);
 int TextLastVisiblePos(Widget w);
+void TextGetRedisplayCounts(Widget w, unsigned long *linesRequested,
+        unsigned long *linesPainted);
 char *TextGetWrapped(Widget w, int startPos, int endPos, int *length);
 XtActionsRec *TextGetActions(int *nActions);
 void ShowHidePointer(TextWidget w, Boolean hidePointer);
@@ -38,6 +38,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
 
 #ifdef HAVE_DEBUG_H
 #include "../debug.h"
@@ -46,6 +47,18 @@
 #define PREFERRED_GAP_SIZE 80	/* Initial size for the buffer gap (empty space
                                    in the buffer where text might be inserted
                                    if the user is typing sequential chars) */
+#define LINE_INDEX_SPACING 16384 /* Minimum distance between the line starts
+                                   recorded in the line index */
+
+/* The line index records the line numbers of line starts spread through the
+   buffer, as they are found when counting lines, so that the line number of
+   a position can be found by counting from the closest one before it.  It is
+   kept up to date across modifications in callModifyCBs */
+struct _LineIndex {
+    int nEntries, nAllocated;
+    int *pos;                   /* recorded line starts, in increasing order */
+    int *line;                  /* their line numbers, counting from 0 */
+};
 
 static void histogramCharacters(const char *string, int length, char hist[256],
 	int init);
@@ -57,6 +70,9 @@ static void deleteRect(textBuffer *buf, int start, int end, int rectStart,
 	int rectEnd, int *replaceLen, int *endPos);
 static void insertCol(textBuffer *buf, int column, int startPos, const char *insText,
 	int *nDeleted, int *nInserted, int *endPos);
+static void replaceRect(textBuffer *buf, int start, int end, int rectStart,
+	int rectEnd, const char *insText, int *nDeleted, int *nInserted,
+	int *endPos);
 static void overlayRect(textBuffer *buf, int startPos, int rectStart,
     	int rectEnd, const char *insText, int *nDeleted, int *nInserted, int *endPos);
 static void insertColInLine(const char *line, const char *insLine, int column, int insWidth,
@@ -93,17 +109,34 @@ static int searchForward(textBuffer *buf, int startPos, char searchChar,
 	int *foundPos);
 static int searchBackward(textBuffer *buf, int startPos, char searchChar,
 	int *foundPos);
-static char *copyLine(const char *text, int *lineLen);
+static void copyLineInto(const char *text, char **line, int *lineSize,
+	int *lineLen);
+static void getLineInto(const textBuffer *buf, int lineStart, int lineEnd,
+	char **line, int *lineSize);
+static void growString(char **string, int *size, int needed);
+static void copyRange(const textBuffer *buf, int start, int end,
+	char *outStr);
 static int countLines(const char *string);
 static int textWidth(const char *text, int tabDist, char nullSubsChar);
 static void findRectSelBoundariesForCopy(textBuffer *buf, int lineStartPos,
 	int rectStart, int rectEnd, int *selStart, int *selEnd);
 static char *realignTabs(const char *text, int origIndent, int newIndent,
 	int tabDist, int useTabs, char nullSubsChar, int *newLength);
+static int copyRealigned(char *outStr, const char *text, int origIndent,
+	int newIndent, int tabDist, int useTabs, char nullSubsChar);
 static char *expandTabs(const char *text, int startIndent, int tabDist,
 	char nullSubsChar, int *newLen);
+static int expandedLength(const char *text, int startIndent, int tabDist,
+	char nullSubsChar);
+static int bufExpandedLength(const textBuffer *buf, int start, int end);
 static char *unexpandTabs(const char *text, int startIndent, int tabDist,
 	char nullSubsChar, int *newLen);
+static LineIndex *getLineIndex(textBuffer *buf);
+static int findLineIndexEntry(LineIndex *index, int pos);
+static int indexLines(textBuffer *buf, int startPos, int startLine,
+	int maxPos, int maxLine, int *endPos);
+static void updateLineIndex(textBuffer *buf, int pos, int nDeleted,
+	int nInserted, const char *deletedText);
 static int max(int i1, int i2);
 static int min(int i1, int i2);
 
@@ -174,6 +207,7 @@ textBuffer *BufCreatePreallocated(int requestedSize)
     {int i; for (i=buf->gapStart; i<buf->gapEnd; i++) buf->buf[i] = '.';}
 #endif
     buf->rangesetTable = NULL;
+    buf->lineIndex = NULL;
     return buf;
 }
 
@@ -193,6 +227,11 @@ void BufFree(textBuffer *buf)
     	NEditFree(buf->preDeleteProcs);
     	NEditFree(buf->preDeleteCbArgs);
     }
+    if (buf->lineIndex != NULL) {
+    	NEditFree(buf->lineIndex->pos);
+    	NEditFree(buf->lineIndex->line);
+    	NEditFree(buf->lineIndex);
+    }
     NEditFree(buf);
 }
 
@@ -285,7 +324,7 @@ void BufSetAll(textBuffer *buf, const char *text)
 char* BufGetRange(const textBuffer* buf, int start, int end)
 {
     char *text;
-    int length, part1Length;
+    int length;
     
     /* Make sure start and end are ok, and allocate memory for returned string.
        If start is bad, return "", if end is bad, adjust it. */
@@ -305,15 +344,7 @@ char* BufGetRange(const textBuffer* buf, int start, int end)
     text = (char*)NEditMalloc(length+1);
     
     /* Copy the text from the buffer to the returned string */
-    if (end <= buf->gapStart) {
-        memcpy(text, &buf->buf[start], length);
-    } else if (start >= buf->gapStart) {
-        memcpy(text, &buf->buf[start+(buf->gapEnd-buf->gapStart)], length);
-    } else {
-        part1Length = buf->gapStart - start;
-        memcpy(text, &buf->buf[start], part1Length);
-        memcpy(&text[part1Length], &buf->buf[buf->gapEnd], length-part1Length);
-    }
+    copyRange(buf, start, end, text);
     text[length] = '\0';
     return text;
 }
@@ -502,9 +533,9 @@ void BufReplaceRect(textBuffer *buf, int start, int end, int rectStart,
 	int rectEnd, const char *text)
 {
     char *deletedText;
-    char *insText=NULL;
-    int i, nInsertedLines, nDeletedLines, insLen, hint;
-    int insertDeleted, insertInserted, deleteInserted;
+    char *insText=NULL, *padText;
+    int i, nInsertedLines, nDeletedLines, insLen;
+    int replaceDeleted, replaceInserted;
     int linesPadded = 0;
     
     /* Make sure start and end refer to complete lines, since the
@@ -534,29 +565,28 @@ void BufReplaceRect(textBuffer *buf, int start, int end, int rectStart,
     	*insPtr = '\0';
     } else if (nDeletedLines < nInsertedLines) {
     	linesPadded = nInsertedLines-nDeletedLines;
+    	padText = (char*)NEditMalloc(linesPadded + 1);
     	for (i=0; i<linesPadded; i++)
-    	    insert(buf, end, "\n");
+    	    padText[i] = '\n';
+    	padText[linesPadded] = '\0';
+    	insert(buf, end, padText);
+    	NEditFree(padText);
     } else /* nDeletedLines == nInsertedLines */ {
     }
     
     /* Save a copy of the text which will be modified for the modify CBs */
     deletedText = BufGetRange(buf, start, end);
     	  
-    /* Delete then insert */
-    deleteRect(buf, start, end, rectStart, rectEnd, &deleteInserted, &hint);
-    if (insText) {
-    	insertCol(buf, rectStart, start, insText, &insertDeleted, &insertInserted,
-    		    &buf->cursorPosHint);
-        NEditFree(insText);
-    }
-    else
-    	insertCol(buf, rectStart, start, text, &insertDeleted, &insertInserted,
-    		    &buf->cursorPosHint);
+    /* Delete and insert in a single pass over the lines */
+    replaceRect(buf, start, end + linesPadded, rectStart, rectEnd,
+    	    insText != NULL ? insText : text, &replaceDeleted,
+    	    &replaceInserted, &buf->cursorPosHint);
+    NEditFree(insText);
     
     /* Figure out how many chars were inserted and call modify callbacks */
-    if (insertDeleted != deleteInserted + linesPadded)
+    if (replaceDeleted != end - start + linesPadded)
     	fprintf(stderr, "NEdit: internal consistency check repl1 failed\n");
-    callModifyCBs(buf, start, end-start, insertInserted, 0, deletedText);
+    callModifyCBs(buf, start, end-start, replaceInserted, 0, deletedText);
     NEditFree(deletedText);
 }
 
@@ -605,7 +635,7 @@ char *BufGetTextInRect(textBuffer *buf, int start, int end,
 	int rectStart, int rectEnd)
 {
     int lineStart, selLeft, selRight, len;
-    char *textOut, *textIn, *outPtr, *retabbedStr;
+    char *textOut, *outPtr, *retabbedStr;
    
     start = BufStartOfLine(buf, start);
     end = BufEndOfLine(buf, end);
@@ -615,11 +645,8 @@ char *BufGetTextInRect(textBuffer *buf, int start, int end,
     while (lineStart <= end) {
         findRectSelBoundariesForCopy(buf, lineStart, rectStart, rectEnd,
         	&selLeft, &selRight);
-        textIn = BufGetRange(buf, selLeft, selRight);
-        len = selRight - selLeft;
-        memcpy(outPtr, textIn, len);
-        NEditFree(textIn);
-        outPtr += len;
+        copyRange(buf, selLeft, selRight, outPtr);
+        outPtr += selRight - selLeft;
         lineStart = BufEndOfLine(buf, selRight) + 1;
         *outPtr++ = '\n';
     }
@@ -629,6 +656,8 @@ char *BufGetTextInRect(textBuffer *buf, int start, int end,
     
     /* If necessary, realign the tabs in the selection as if the text were
        positioned at the left margin */
+    if (rectStart % buf->tabDist == 0)
+    	return textOut;
     retabbedStr = realignTabs(textOut, rectStart, 0, buf->tabDist,
     	    buf->useTabs, buf->nullSubsChar, &len);
     NEditFree(textOut);
@@ -1165,6 +1194,58 @@ int BufCountLines(textBuffer *buf, int startPos, int endPos)
     return lineCount;
 }
 
+/*
+** Return the number of the line containing position "pos" (the number of
+** newlines before it), using the buffer's line index to avoid counting from
+** the start of the buffer
+*/
+int BufLineOfPos(textBuffer *buf, int pos)
+{
+    LineIndex *index = getLineIndex(buf);
+    int i, endPos, startPos = 0, startLine = 0;
+    
+    pos = max(0, min(pos, buf->length));
+    i = findLineIndexEntry(index, pos);
+    if (i >= 0) {
+    	startPos = index->pos[i];
+    	startLine = index->line[i];
+    }
+    return indexLines(buf, startPos, startLine, pos, INT_MAX, &endPos);
+}
+
+/*
+** Return the position of the start of line number "lineNum" (counting from
+** 0, so the position following the lineNum'th newline), or -1 if the buffer
+** has fewer lines.  Like BufLineOfPos, uses the line index to start counting
+** from the closest known line start.
+*/
+int BufPosOfLine(textBuffer *buf, int lineNum)
+{
+    LineIndex *index = getLineIndex(buf);
+    int lo = 0, hi = index->nEntries - 1, mid, endPos;
+    int startPos = 0, startLine = 0;
+    
+    if (lineNum <= 0)
+    	return 0;
+    
+    /* Find the last indexed line start at or before the line */
+    while (lo <= hi) {
+    	mid = (lo + hi) / 2;
+    	if (index->line[mid] <= lineNum)
+    	    lo = mid + 1;
+    	else
+    	    hi = mid - 1;
+    }
+    if (hi >= 0) {
+    	startPos = index->pos[hi];
+    	startLine = index->line[hi];
+    }
+    if (indexLines(buf, startPos, startLine, buf->length, lineNum,
+    	    &endPos) != lineNum)
+    	return -1;
+    return endPos;
+}
+
 /*
 ** Find the first character of the line "nLines" forward from "startPos"
 ** in "buf" and return its position
@@ -1521,8 +1602,8 @@ static void insertCol(textBuffer *buf, int column, int startPos,
         const char *insText, int *nDeleted, int *nInserted, int *endPos)
 {
     int nLines, start, end, insWidth, lineStart, lineEnd;
-    int expReplLen, expInsLen, len, endOffset;
-    char *outStr, *outPtr, *line, *replText, *expText, *insLine;
+    int expReplLen, expInsLen, len, endOffset, lineSize = 0, insLineSize = 0;
+    char *outStr, *outPtr, *line = NULL, *insLine = NULL;
     const char *insPtr;
 
     if (column < 0)
@@ -1542,31 +1623,25 @@ static void insertCol(textBuffer *buf, int column, int startPos,
     nLines = countLines(insText) + 1;
     insWidth = textWidth(insText, buf->tabDist, buf->nullSubsChar);
     end = BufEndOfLine(buf, BufCountForwardNLines(buf, start, nLines-1));
-    replText = BufGetRange(buf, start, end);
-    expText = expandTabs(replText, 0, buf->tabDist, buf->nullSubsChar,
-	    &expReplLen);
-    NEditFree(replText);
-    NEditFree(expText);
-    expText = expandTabs(insText, 0, buf->tabDist, buf->nullSubsChar,
-	    &expInsLen);
-    NEditFree(expText);
+    expReplLen = bufExpandedLength(buf, start, end);
+    expInsLen = expandedLength(insText, 0, buf->tabDist, buf->nullSubsChar);
     outStr = (char*) NEditMalloc(expReplLen + expInsLen +
     	    nLines * (column + insWidth + MAX_EXP_CHAR_LEN) + 1);
     
     /* Loop over all lines in the buffer between start and end inserting
-       text at column, splitting tabs and adding padding appropriately */
+       text at column, splitting tabs and adding padding appropriately.  The
+       line strings are reused from line to line, rather than allocated
+       anew for each one */
     outPtr = outStr;
     lineStart = start;
     insPtr = insText;
     while (True) {
     	lineEnd = BufEndOfLine(buf, lineStart);
-    	line = BufGetRange(buf, lineStart, lineEnd);
-    	insLine = copyLine(insPtr, &len);
+    	getLineInto(buf, lineStart, lineEnd, &line, &lineSize);
+    	copyLineInto(insPtr, &insLine, &insLineSize, &len);
     	insPtr += len;
     	insertColInLine(line, insLine, column, insWidth, buf->tabDist,
     		buf->useTabs, buf->nullSubsChar, outPtr, &len, &endOffset);
-    	NEditFree(line);
-    	NEditFree(insLine);
 #if 0   /* Earlier comments claimed that trailing whitespace could multiply on
         the ends of lines, but insertColInLine looks like it should never
         add space unnecessarily, and this trimming interfered with
@@ -1584,6 +1659,8 @@ static void insertCol(textBuffer *buf, int column, int startPos,
     	    break;
     	insPtr++;
     }
+    NEditFree(line);
+    NEditFree(insLine);
     if (outPtr != outStr)
     	outPtr--; /* trim back off extra newline */
     *outPtr = '\0';
@@ -1608,8 +1685,8 @@ static void insertCol(textBuffer *buf, int column, int startPos,
 static void deleteRect(textBuffer *buf, int start, int end, int rectStart,
 	int rectEnd, int *replaceLen, int *endPos)
 {
-    int nLines, lineStart, lineEnd, len, endOffset;
-    char *outStr, *outPtr, *line, *text, *expText;
+    int nLines, lineStart, lineEnd, len, endOffset, lineSize = 0;
+    char *outStr, *outPtr, *line = NULL;
     
     /* allocate a buffer for the replacement string large enough to hold 
        possibly expanded tabs as well as an additional  MAX_EXP_CHAR_LEN * 2
@@ -1618,10 +1695,7 @@ static void deleteRect(textBuffer *buf, int start, int end, int rectStart,
     start = BufStartOfLine(buf, start);
     end = BufEndOfLine(buf, end);
     nLines = BufCountLines(buf, start, end) + 1;
-    text = BufGetRange(buf, start, end);
-    expText = expandTabs(text, 0, buf->tabDist, buf->nullSubsChar, &len);
-    NEditFree(text);
-    NEditFree(expText);
+    len = bufExpandedLength(buf, start, end);
     outStr = (char*)NEditMalloc(len + nLines * MAX_EXP_CHAR_LEN * 2 + 1);
     
     /* loop over all lines in the buffer between start and end removing
@@ -1630,14 +1704,14 @@ static void deleteRect(textBuffer *buf, int start, int end, int rectStart,
     outPtr = outStr;
     while (lineStart <= buf->length && lineStart <= end) {
     	lineEnd = BufEndOfLine(buf, lineStart);
-    	line = BufGetRange(buf, lineStart, lineEnd);
+    	getLineInto(buf, lineStart, lineEnd, &line, &lineSize);
     	deleteRectFromLine(line, rectStart, rectEnd, buf->tabDist,
     		buf->useTabs, buf->nullSubsChar, outPtr, &len, &endOffset);
-    	NEditFree(line);
 	outPtr += len;
 	*outPtr++ = '\n';
     	lineStart = lineEnd + 1;
     }
+    NEditFree(line);
     if (outPtr != outStr)
     	outPtr--; /* trim back off extra newline */
     *outPtr = '\0';
@@ -1650,6 +1724,81 @@ static void deleteRect(textBuffer *buf, int start, int end, int rectStart,
     NEditFree(outStr);
 }
 
+/*
+** Replace the rectangle between displayed character offsets "rectStart" and
+** "rectEnd" on the lines between "start" and "end" with "insText", without
+** calling the modify callbacks.  "insText" must have the same number of
+** lines as the range.  The result is the same as deleteRect followed by
+** insertCol at "rectStart", but each line is read and rewritten only once,
+** and the range is replaced in the buffer in a single operation.
+** "nDeleted", "nInserted", and "endPos" are returned as for insertCol.
+*/
+static void replaceRect(textBuffer *buf, int start, int end, int rectStart,
+	int rectEnd, const char *insText, int *nDeleted, int *nInserted,
+	int *endPos)
+{
+    int nLines, column, insWidth, lineStart, lineEnd, expReplLen, expInsLen;
+    int len, endOffset, lineSize = 0, insLineSize = 0, delLineSize = 0;
+    char *outStr, *outPtr, *line = NULL, *insLine = NULL, *delLine = NULL;
+    const char *insPtr;
+
+    column = rectStart < 0 ? 0 : rectStart;
+    
+    /* Allocate a buffer for the replacement string, large enough for the
+       result of both deleteRect and insertCol (see the comments there):
+       the expanded text of the range and of the inserted text, plus per line,
+       padding where tabs and control characters cross the edges of the
+       deleted and inserted rectangles, and out to the inserted column and
+       beyond the width of the inserted text */
+    start = BufStartOfLine(buf, start);
+    end = BufEndOfLine(buf, end);
+    nLines = countLines(insText) + 1;
+    insWidth = textWidth(insText, buf->tabDist, buf->nullSubsChar);
+    expReplLen = bufExpandedLength(buf, start, end);
+    expInsLen = expandedLength(insText, 0, buf->tabDist, buf->nullSubsChar);
+    outStr = (char*)NEditMalloc(expReplLen + expInsLen +
+    	    nLines * (column + insWidth + 3 * MAX_EXP_CHAR_LEN) + 1);
+    
+    /* Loop over the lines, removing the old rectangle from each into
+       "delLine", then inserting the corresponding line of "insText" */
+    outPtr = outStr;
+    lineStart = start;
+    insPtr = insText;
+    while (True) {
+    	lineEnd = BufEndOfLine(buf, lineStart);
+    	getLineInto(buf, lineStart, lineEnd, &line, &lineSize);
+    	growString(&delLine, &delLineSize, expandedLength(line, 0,
+    		buf->tabDist, buf->nullSubsChar) + MAX_EXP_CHAR_LEN * 2 + 1);
+    	deleteRectFromLine(line, rectStart, rectEnd, buf->tabDist,
+    		buf->useTabs, buf->nullSubsChar, delLine, &len, &endOffset);
+    	delLine[len] = '\0';
+    	copyLineInto(insPtr, &insLine, &insLineSize, &len);
+    	insPtr += len;
+    	insertColInLine(delLine, insLine, column, insWidth, buf->tabDist,
+    		buf->useTabs, buf->nullSubsChar, outPtr, &len, &endOffset);
+	outPtr += len;
+	*outPtr++ = '\n';
+    	lineStart = lineEnd < buf->length ? lineEnd + 1 : buf->length;
+    	if (*insPtr == '\0')
+    	    break;
+    	insPtr++;
+    }
+    NEditFree(line);
+    NEditFree(insLine);
+    NEditFree(delLine);
+    if (outPtr != outStr)
+    	outPtr--; /* trim back off extra newline */
+    *outPtr = '\0';
+    
+    /* replace the text between start and end with the new stuff */
+    delete(buf, start, end);
+    insert(buf, start, outStr);
+    *nInserted = outPtr - outStr;
+    *nDeleted = end - start;
+    *endPos = start + (outPtr - outStr) - len + endOffset;
+    NEditFree(outStr);
+}
+
 /*
 ** Overlay a rectangular area of text without calling the modify callbacks.
 ** "nDeleted" and "nInserted" return the number of characters deleted and
@@ -1662,8 +1811,8 @@ static void overlayRect(textBuffer *buf, int startPos, int rectStart,
 	int *nDeleted, int *nInserted, int *endPos)
 {
     int nLines, start, end, lineStart, lineEnd;
-    int expInsLen, len, endOffset;
-    char *c, *outStr, *outPtr, *line, *expText, *insLine;
+    int expInsLen, len, endOffset, lineSize = 0, insLineSize = 0;
+    char *c, *outStr, *outPtr, *line = NULL, *insLine = NULL;
     const char *insPtr;
 
     /* Allocate a buffer for the replacement string large enough to hold
@@ -1678,9 +1827,7 @@ static void overlayRect(textBuffer *buf, int startPos, int rectStart,
     start = BufStartOfLine(buf, startPos);
     nLines = countLines(insText) + 1;
     end = BufEndOfLine(buf, BufCountForwardNLines(buf, start, nLines-1));
-    expText = expandTabs(insText, 0, buf->tabDist, buf->nullSubsChar,
-	    &expInsLen);
-    NEditFree(expText);
+    expInsLen = expandedLength(insText, 0, buf->tabDist, buf->nullSubsChar);
     outStr = (char*)NEditMalloc(end-start + expInsLen +
     	    nLines * (rectEnd + MAX_EXP_CHAR_LEN) + 1);
     
@@ -1693,13 +1840,11 @@ static void overlayRect(textBuffer *buf, int startPos, int rectStart,
     insPtr = insText;
     while (True) {
     	lineEnd = BufEndOfLine(buf, lineStart);
-    	line = BufGetRange(buf, lineStart, lineEnd);
-    	insLine = copyLine(insPtr, &len);
+    	getLineInto(buf, lineStart, lineEnd, &line, &lineSize);
+    	copyLineInto(insPtr, &insLine, &insLineSize, &len);
     	insPtr += len;
     	overlayRectInLine(line, insLine, rectStart, rectEnd, buf->tabDist,
 		buf->useTabs, buf->nullSubsChar, outPtr, &len, &endOffset);
-    	NEditFree(line);
-    	NEditFree(insLine);
     	for (c=outPtr+len-1; c>outPtr && (*c == ' ' || *c == '\t'); c--)
     	    len--;
 	outPtr += len;
@@ -1709,6 +1854,8 @@ static void overlayRect(textBuffer *buf, int startPos, int rectStart,
     	    break;
     	insPtr++;
     }
+    NEditFree(line);
+    NEditFree(insLine);
     if (outPtr != outStr)
     	outPtr--; /* trim back off extra newline */
     *outPtr = '\0';
@@ -1734,7 +1881,7 @@ static void insertColInLine(const char *line, const char *insLine,
         int column, int insWidth, int tabDist, int useTabs, char nullSubsChar,
 	char *outStr, int *outLen, int *endOffset)
 {
-    char *c, *outPtr, *retabbedStr;
+    char *c, *outPtr;
     const char *linePtr;
     int indent, toIndent, len, postColIndent;
         
@@ -1780,14 +1927,11 @@ static void insertColInLine(const char *line, const char *insLine,
     /* Copy the text from "insLine" (if any), recalculating the tabs as if
        the inserted string began at column 0 to its new column destination */
     if (*insLine != '\0') {
-	retabbedStr = realignTabs(insLine, 0, indent, tabDist, useTabs,
-		nullSubsChar, &len);
-	for (c=retabbedStr; *c!='\0'; c++) {
-    	    *outPtr++ = *c;
-    	    len = BufCharWidth(*c, indent, tabDist, nullSubsChar);
-    	    indent += len;
-	}
-	NEditFree(retabbedStr);
+	len = copyRealigned(outPtr, insLine, 0, indent, tabDist, useTabs,
+		nullSubsChar);
+	for (c=outPtr; c<outPtr+len; c++)
+    	    indent += BufCharWidth(*c, indent, tabDist, nullSubsChar);
+	outPtr += len;
     }
     
     /* If the original line did not extend past "column", that's all */
@@ -1804,10 +1948,8 @@ static void insertColInLine(const char *line, const char *insLine,
     indent = toIndent;
     
     /* realign tabs for text beyond "column" and write it out */
-    retabbedStr = realignTabs(linePtr, postColIndent, indent, tabDist,
-    	useTabs, nullSubsChar, &len);
-    strcpy(outPtr, retabbedStr);
-    NEditFree(retabbedStr);
+    len = copyRealigned(outPtr, linePtr, postColIndent, indent, tabDist,
+    	useTabs, nullSubsChar);
     *endOffset = outPtr - outStr;
     *outLen = (outPtr - outStr) + len;
 }
@@ -1828,7 +1970,6 @@ static void deleteRectFromLine(const char *line, int rectStart, int rectEnd,
     int indent, preRectIndent, postRectIndent, len;
     const char *c;
     char *outPtr;
-    char *retabbedStr;
     
     /* copy the line up to rectStart */
     outPtr = outStr;
@@ -1866,10 +2007,8 @@ static void deleteRectFromLine(const char *line, int rectStart, int rectEnd,
     /* Copy the rest of the line.  If the indentation has changed, preserve
        the position of non-whitespace characters by converting tabs to
        spaces, then back to tabs with the correct offset */
-    retabbedStr = realignTabs(c, postRectIndent, indent, tabDist, useTabs,
-    	    nullSubsChar, &len);
-    strcpy(outPtr, retabbedStr);
-    NEditFree(retabbedStr);
+    len = copyRealigned(outPtr, c, postRectIndent, indent, tabDist, useTabs,
+    	    nullSubsChar);
     *endOffset = outPtr - outStr;
     *outLen = (outPtr - outStr) + len;
 }
@@ -1888,7 +2027,7 @@ static void overlayRectInLine(const char *line, const char *insLine,
         int rectStart, int rectEnd, int tabDist, int useTabs,
 	char nullSubsChar, char *outStr, int *outLen, int *endOffset)
 {
-    char *c, *outPtr, *retabbedStr;
+    char *c, *outPtr;
     const char *linePtr;
     int inIndent, outIndent, len, postRectIndent;
         
@@ -1948,14 +2087,11 @@ static void overlayRectInLine(const char *line, const char *insLine,
     /* Copy the text from "insLine" (if any), recalculating the tabs as if
        the inserted string began at column 0 to its new column destination */
     if (*insLine != '\0') {
-	retabbedStr = realignTabs(insLine, 0, rectStart, tabDist, useTabs,
-		nullSubsChar, &len);
-	for (c=retabbedStr; *c!='\0'; c++) {
-    	    *outPtr++ = *c;
-    	    len = BufCharWidth(*c, outIndent, tabDist, nullSubsChar);
-    	    outIndent += len;
-	}
-	NEditFree(retabbedStr);
+	len = copyRealigned(outPtr, insLine, 0, rectStart, tabDist, useTabs,
+		nullSubsChar);
+	for (c=outPtr; c<outPtr+len; c++)
+    	    outIndent += BufCharWidth(*c, outIndent, tabDist, nullSubsChar);
+	outPtr += len;
     }
     
     /* If the original line did not extend past "rectStart", that's all */
@@ -2102,6 +2238,8 @@ static void callModifyCBs(textBuffer *buf, int pos, int nDeleted,
 {
     int i;
     
+    if (nDeleted != 0 || nInserted != 0)
+    	updateLineIndex(buf, pos, nDeleted, nInserted, deletedText);
     for (i=0; i<buf->nModifyProcs; i++)
     	(*buf->modifyProcs[i])(pos, nInserted, nDeleted, nRestyled,
     		deletedText, buf->cbArgs[i]);
@@ -2341,22 +2479,193 @@ static int searchBackward(textBuffer *buf, int startPos, char searchChar,
 
 /*
 ** Copy from "text" to end up to but not including newline (or end of "text")
-** and return the copy as the function value, and the length of the line in
-** "lineLen"
+** into "*line", and the length of the line in "lineLen".  "*line" is a string
+** of allocated size "*lineSize" which is grown as necessary and reused
+** between calls, so that routines processing many lines don't allocate a
+** string for each.  The caller frees "*line" when done.
 */
-static char *copyLine(const char *text, int *lineLen)
+static void copyLineInto(const char *text, char **line, int *lineSize,
+	int *lineLen)
 {
     int len = 0;
     const char *c;
-    char *outStr;
     
     for (c=text; *c!='\0' && *c!='\n'; c++)
     	len++;
-    outStr = (char*)NEditMalloc(len + 1);
-    strncpy(outStr, text, len);
-    outStr[len] = '\0';
+    growString(line, lineSize, len + 1);
+    memcpy(*line, text, len);
+    (*line)[len] = '\0';
     *lineLen = len;
-    return outStr;
+}
+
+/*
+** Copy the text of the buffer between "lineStart" and "lineEnd" into
+** "*line", a reusable string of allocated size "*lineSize", as for
+** copyLineInto.  Used in place of BufGetRange by the rectangular operations.
+*/
+static void getLineInto(const textBuffer *buf, int lineStart, int lineEnd,
+	char **line, int *lineSize)
+{
+    growString(line, lineSize, lineEnd - lineStart + 1);
+    copyRange(buf, lineStart, lineEnd, *line);
+    (*line)[lineEnd - lineStart] = '\0';
+}
+
+/*
+** Make sure string "*string", of allocated size "*size", can hold at least
+** "needed" characters, reallocating it (without preserving its contents)
+** if not.
+*/
+static void growString(char **string, int *size, int needed)
+{
+    if (needed <= *size)
+    	return;
+    if (needed < *size * 2)
+    	needed = *size * 2;
+    NEditFree(*string);
+    *string = (char*)NEditMalloc(needed);
+    *size = needed;
+}
+
+/*
+** Copy the text between "start" and "end" in "buf" to "outStr", which must
+** be large enough to hold it.  No terminating null is added.
+*/
+static void copyRange(const textBuffer *buf, int start, int end,
+	char *outStr)
+{
+    int length = end - start, part1Length;
+    
+    if (end <= buf->gapStart) {
+        memcpy(outStr, &buf->buf[start], length);
+    } else if (start >= buf->gapStart) {
+        memcpy(outStr, &buf->buf[start+(buf->gapEnd-buf->gapStart)], length);
+    } else {
+        part1Length = buf->gapStart - start;
+        memcpy(outStr, &buf->buf[start], part1Length);
+        memcpy(&outStr[part1Length], &buf->buf[buf->gapEnd],
+        	length-part1Length);
+    }
+}
+
+/*
+** Return the index of the last entry of the line index at or before "pos",
+** or -1 if there is none
+*/
+static int findLineIndexEntry(LineIndex *index, int pos)
+{
+    int lo = 0, hi = index->nEntries - 1, mid;
+    
+    while (lo <= hi) {
+    	mid = (lo + hi) / 2;
+    	if (index->pos[mid] <= pos)
+    	    lo = mid + 1;
+    	else
+    	    hi = mid - 1;
+    }
+    return hi;
+}
+
+/*
+** Return the line index of a buffer, creating an empty one if it has none
+*/
+static LineIndex *getLineIndex(textBuffer *buf)
+{
+    if (buf->lineIndex == NULL) {
+    	buf->lineIndex = (LineIndex *)NEditMalloc(sizeof(LineIndex));
+    	buf->lineIndex->nEntries = buf->lineIndex->nAllocated = 0;
+    	buf->lineIndex->pos = buf->lineIndex->line = NULL;
+    }
+    return buf->lineIndex;
+}
+
+/*
+** Count lines forward from "startPos", the start of line number "startLine",
+** up to "maxPos" or the start of line "maxLine", whichever comes first, and
+** record line starts passed along the way in the line index (no closer than
+** LINE_INDEX_SPACING to the previous one).  Returns the number of the line
+** reached, and its start in "endPos".  There must not be any index entries
+** between startPos and where counting stops.
+*/
+static int indexLines(textBuffer *buf, int startPos, int startLine,
+	int maxPos, int maxLine, int *endPos)
+{
+    LineIndex *index = buf->lineIndex;
+    int i, pos = startPos, line = startLine, lineStart = startPos;
+    int lastRecorded = startPos, segLen;
+    const char *seg, *newline;
+    
+    i = findLineIndexEntry(index, startPos) + 1;
+    while (pos < maxPos && line < maxLine) {
+    	/* Search the part of the buffer up to maxPos on this side of the gap */
+    	if (pos < buf->gapStart) {
+    	    seg = &buf->buf[pos];
+    	    segLen = min(maxPos, buf->gapStart) - pos;
+    	} else {
+    	    seg = &buf->buf[pos + buf->gapEnd - buf->gapStart];
+    	    segLen = maxPos - pos;
+    	}
+    	newline = (const char *)memchr(seg, '\n', segLen);
+    	if (newline == NULL) {
+    	    pos += segLen;
+    	    continue;
+    	}
+    	pos += newline - seg + 1;
+    	lineStart = pos;
+    	line++;
+    	
+    	if (pos - lastRecorded >= LINE_INDEX_SPACING) {
+    	    if (index->nEntries == index->nAllocated) {
+    		index->nAllocated = index->nAllocated == 0 ? 64 :
+    			index->nAllocated * 2;
+    		index->pos = (int *)NEditRealloc(index->pos,
+    			sizeof(int) * index->nAllocated);
+    		index->line = (int *)NEditRealloc(index->line,
+    			sizeof(int) * index->nAllocated);
+    	    }
+    	    memmove(&index->pos[i+1], &index->pos[i],
+    		    sizeof(int) * (index->nEntries - i));
+    	    memmove(&index->line[i+1], &index->line[i],
+    		    sizeof(int) * (index->nEntries - i));
+    	    index->pos[i] = pos;
+    	    index->line[i] = line;
+    	    index->nEntries++;
+    	    i++;
+    	    lastRecorded = pos;
+    	}
+    }
+    *endPos = lineStart;
+    return line;
+}
+
+/*
+** Update the line index for a modification of the buffer: forget the line
+** starts in the modified text, and move the ones beyond it
+*/
+static void updateLineIndex(textBuffer *buf, int pos, int nDeleted,
+	int nInserted, const char *deletedText)
+{
+    LineIndex *index = buf->lineIndex;
+    int i, j, first, lineDelta;
+    
+    if (index == NULL || index->nEntries == 0)
+    	return;
+    
+    /* Entries after pos, up to and including pos+nDeleted, are gone (the
+       characters before them changed), the ones after that move */
+    first = findLineIndexEntry(index, pos) + 1;
+    for (j=first; j<index->nEntries && index->pos[j]<=pos+nDeleted; j++);
+    if (j == index->nEntries) {
+    	index->nEntries = first;
+    	return;
+    }
+    lineDelta = BufCountLines(buf, pos, pos + nInserted) -
+    	    (nDeleted == 0 ? 0 : countLines(deletedText));
+    for (i=first; j<index->nEntries; i++, j++) {
+    	index->pos[i] = index->pos[j] + nInserted - nDeleted;
+    	index->line[i] = index->line[j] + lineDelta;
+    }
+    index->nEntries = i;
 }
 
 /*
@@ -2479,6 +2788,30 @@ static char *realignTabs(const char *text, int origIndent, int newIndent,
     return outStr;
 }    
 
+/*
+** Write "text" to "outStr", with its tabs realigned as by realignTabs, and
+** return the number of characters written (not counting the terminating
+** null).  When the tab alignment doesn't change, the text is copied directly,
+** without the intermediate string that realignTabs would allocate.
+*/
+static int copyRealigned(char *outStr, const char *text, int origIndent,
+	int newIndent, int tabDist, int useTabs, char nullSubsChar)
+{
+    char *retabbedStr;
+    int len;
+    
+    if (origIndent % tabDist == newIndent % tabDist) {
+    	len = strlen(text);
+    	memcpy(outStr, text, len + 1);
+    	return len;
+    }
+    retabbedStr = realignTabs(text, origIndent, newIndent, tabDist, useTabs,
+    	    nullSubsChar, &len);
+    memcpy(outStr, retabbedStr, len + 1);
+    NEditFree(retabbedStr);
+    return len;
+}
+
 /*
 ** Expand tabs to spaces for a block of text.  The additional parameter
 ** "startIndent" if nonzero, indicates that the text is a rectangular selection
@@ -2489,23 +2822,10 @@ static char *expandTabs(const char *text, int startIndent, int tabDist,
 {
     char *outStr, *outPtr;
     const char *c;
-    int indent, len, outLen = 0;
+    int indent, len, outLen;
 
     /* rehearse the expansion to figure out length for output string */
-    indent = startIndent;
-    for (c=text; *c!='\0'; c++) {
-    	if (*c == '\t') {
-    	    len = BufCharWidth(*c, indent, tabDist, nullSubsChar);
-    	    outLen += len;
-    	    indent += len;
-    	} else if (*c == '\n') {
-    	    indent = startIndent;
-    	    outLen++;
-    	} else {
-    	    indent += BufCharWidth(*c, indent, tabDist, nullSubsChar);
-    	    outLen++;
-    	}
-    }
+    outLen = expandedLength(text, startIndent, tabDist, nullSubsChar);
     
     /* do the expansion */
     outStr = (char*)NEditMalloc(outLen+1);
@@ -2529,6 +2849,62 @@ static char *expandTabs(const char *text, int startIndent, int tabDist,
     return outStr;
 }
 
+/*
+** Return the length that "text" would have with its tabs expanded (as by
+** expandTabs), without actually doing the expansion
+*/
+static int expandedLength(const char *text, int startIndent, int tabDist,
+	char nullSubsChar)
+{
+    const char *c;
+    int indent, len, outLen = 0;
+
+    indent = startIndent;
+    for (c=text; *c!='\0'; c++) {
+    	if (*c == '\t') {
+    	    len = BufCharWidth(*c, indent, tabDist, nullSubsChar);
+    	    outLen += len;
+    	    indent += len;
+    	} else if (*c == '\n') {
+    	    indent = startIndent;
+    	    outLen++;
+    	} else {
+    	    indent += BufCharWidth(*c, indent, tabDist, nullSubsChar);
+    	    outLen++;
+    	}
+    }
+    return outLen;
+}
+
+/*
+** Return the length that the text between "start" and "end" in "buf" would
+** have with its tabs expanded, measured directly in the buffer, rather
+** than from a copy
+*/
+static int bufExpandedLength(const textBuffer *buf, int start, int end)
+{
+    int pos, indent = 0, len, outLen = 0;
+    char c;
+    
+    for (pos=start; pos<end; pos++) {
+    	c = pos < buf->gapStart ? buf->buf[pos] :
+    	    	buf->buf[pos + buf->gapEnd - buf->gapStart];
+    	if (c == '\t') {
+    	    len = BufCharWidth(c, indent, buf->tabDist, buf->nullSubsChar);
+    	    outLen += len;
+    	    indent += len;
+    	} else if (c == '\n') {
+    	    indent = 0;
+    	    outLen++;
+    	} else {
+    	    indent += BufCharWidth(c, indent, buf->tabDist,
+    	    	    buf->nullSubsChar);
+    	    outLen++;
+    	}
+    }
+    return outLen;
+}
+
 /*
 ** Convert sequences of spaces into tabs.  The threshold for conversion is
 ** when 3 or more spaces can be converted into a single tab, this avoids
@@ -32,6 +32,7 @@
 #define MAX_EXP_CHAR_LEN 20
 
 typedef struct _RangesetTable RangesetTable;
+typedef struct _LineIndex LineIndex;
 
 typedef struct {
     char selected;          /* True if the selection is active */
@@ -81,6 +82,9 @@ typedef struct _textBuffer {
 				   use it */
     RangesetTable *rangesetTable;
 				/* current range sets */
+    LineIndex *lineIndex;	/* line numbers of some line starts, for finding
+    				   line numbers without counting from the start
+    				   (shared by all displays of the buffer) */
 } textBuffer;
 
 textBuffer *BufCreate(void);
@@ -158,6 +162,8 @@ int BufCountDispChars(const textBuffer* buf, int lineStartPos,
         int targetPos);
 int BufCountForwardDispChars(textBuffer *buf, int lineStartPos, int nChars);
 int BufCountLines(textBuffer *buf, int startPos, int endPos);
+int BufLineOfPos(textBuffer *buf, int pos);
+int BufPosOfLine(textBuffer *buf, int lineNum);
 int BufCountForwardNLines(const textBuffer* buf, int startPos,
         unsigned nLines);
 int BufCountBackwardNLines(textBuffer *buf, int startPos, int nLines);
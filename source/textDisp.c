@@ -102,11 +102,38 @@
    stack in the redisplayLine routine for drawing strings */
 #define MAX_DISP_LINE_LEN 1000
 
+/* Very long lines get display column checkpoints (see findLineCheckpoint),
+   every LINE_CHECKPOINT_INTERVAL characters, once something needs to look
+   further into them than LONG_LINE_LEN characters or columns.  Checkpoints
+   are kept for up to N_CHECKPOINT_LINES lines per text buffer */
+#define LINE_CHECKPOINT_INTERVAL 512
+#define LONG_LINE_LEN 4096
+#define N_CHECKPOINT_LINES 8
+
+/* Counting lines over more than LONG_COUNT_LEN characters is done with the
+   buffer's line index (see BufLineOfPos) rather than by scanning */
+#define LONG_COUNT_LEN 65536
+
+/* Longest time (in milliseconds) redisplay after buffer modifications waits
+   for the event queue to drain before painting anyway */
+#define REDISPLAY_FRAME_MS 20
+
 /* Macro for getting the TextPart from a textD */
 #define TEXT_OF_TEXTD(t)    (((TextWidget)((t)->w))->text)
 
 enum positionTypes {CURSOR_POS, CHARACTER_POS};
 
+/* Character widths of the fonts of a text display, so measuring text (which
+   in proportional fonts is done for every character drawn, clicked on, or
+   wrapped) doesn't have to go through XTextWidth */
+typedef struct _fontWidths {
+    int nFonts;
+    XFontStruct **fonts;        /* the distinct fonts of the display */
+    short (*widths)[256];       /* widths of all characters in each of them */
+    short **styleWidths;        /* widths in the primary font (entry 0) and
+                                   the font of each style (entry i+1) */
+} fontWidths;
+
 static void updateLineStarts(textDisp *textD, int pos, int charsInserted,
         int charsDeleted, int linesInserted, int linesDeleted, int *scrolled);
 static void offsetLineStarts(textDisp *textD, int newTopLineNum);
@@ -122,6 +149,11 @@ static void clearRect(textDisp *textD, GC gc, int x, int y,
 static void drawCursor(textDisp *textD, int x, int y);
 static int styleOfPos(textDisp *textD, int lineStartPos,
         int lineLen, int lineIndex, int dispIndex, int thisChar);
+static int *lineStyles(textDisp *textD, int lineStartPos, int lineLen,
+        const char *lineStr);
+static int lineStyleOf(textDisp *textD, const int *styles, int segStart,
+        int segEnd, int lineStartPos, int lineLen, int lineIndex,
+        int dispIndex, int thisChar);
 static int stringWidth(const textDisp* textD, const char* string,
         int length, int style);
 static int inSelection(selection *sel, int pos, int lineStartPos,
@@ -164,6 +196,51 @@ static void wrappedLineCounter(const textDisp* textD, const textBuffer* buf,
         int startPos, int maxPos, int maxLines,
         Boolean startPosIsLineStart, int styleBufOffset,
         int* retPos, int* retLines, int* retLineStart, int* retLineEnd);
+static int cachedWrappedLineCounter(const textDisp* textD,
+        const textBuffer* buf, int startPos, int maxPos, int maxLines,
+        Boolean startPosIsLineStart, int styleBufOffset,
+        int* retPos, int* retLines, int* retLineStart, int* retLineEnd);
+struct _lineCheckpointIndex;
+static void attachSharedLayout(textDisp *textD);
+static void detachSharedLayout(textDisp *textD);
+static void sharedLayoutModifiedCB(int pos, int nInserted, int nDeleted,
+	int nRestyled, const char *deletedText, void *cbArg);
+static struct _wrapCache *getWrapCache(const textDisp *textD);
+static void releaseWrapCache(textDisp *textD);
+static int wrapCacheLineStart(struct _wrapCache *cache, int index);
+static int findWrapCacheLine(struct _wrapCache *cache, int pos);
+static int lookupWrapCacheLine(const textDisp *textD, int lineStart);
+static void measureWrapCacheLine(const textDisp *textD,
+        struct _wrapCache *cache, int index);
+static void invalidateWrapCacheLine(struct _wrapCache *cache, int index,
+        int pos);
+static void normalizeWrapCache(struct _wrapCache *cache);
+static void updateWrapCache(struct _wrapCache *cache, int pos,
+	int nInserted, int nDeleted);
+static void freeWrapCache(struct _wrapCache *cache);
+static int findLineCheckpoint(textDisp *textD, int lineStartPos, int lineLen,
+        int maxIndex, int maxColumn, int *column);
+static int lineColumn(textDisp *textD, int lineStartPos, int pos);
+static int lineColumnToPos(textDisp *textD, int lineStartPos, int column);
+static void updateLineCheckpoints(struct _lineCheckpointIndex *index,
+	int pos, int nInserted, int nDeleted);
+static void freeLineCheckpoints(struct _lineCheckpointIndex *index);
+static void scheduleRedisplay(textDisp *textD, int start, int end,
+        Boolean all, Boolean lineNums);
+static void adjustScheduledRedisplay(textDisp *textD, int pos, int nInserted,
+        int nDeleted);
+static int countVisibleLines(textDisp *textD, int start, int end);
+static void flushRedisplay(textDisp *textD);
+static Boolean redisplayWorkProc(XtPointer clientData);
+static void redisplayTimerProc(XtPointer clientData, XtIntervalId *id);
+static void cancelRedisplay(textDisp *textD);
+static Drawable textDrawable(textDisp *textD);
+static void resetBackingStore(textDisp *textD);
+static void freeBackingStore(textDisp *textD);
+static void copyFromBackingStore(textDisp *textD, int left, int top,
+        int width, int height);
+static void scrollBackingStore(textDisp *textD, int srcX, int srcY, int width,
+        int height, int dstX, int dstY, int lineDelta);
 static void findLineEnd(textDisp *textD, int startPos, int startPosIsLineStart,
         int *lineEnd, int *nextLineStart);
 static int wrapUsesCharacter(textDisp *textD, int lineEndPos);
@@ -171,9 +248,10 @@ static void hideOrShowHScrollBar(textDisp *textD);
 static int rangeTouchesRectSel(selection *sel, int rangeStart, int rangeEnd);
 static void extendRangeForStyleMods(textDisp *textD, int *start, int *end);
 static int getAbsTopLineNum(textDisp *textD);
-static void offsetAbsLineNum(textDisp *textD, int oldFirstChar);
 static int maintainingAbsTopLineNum(textDisp *textD);
 static void resetAbsLineNum(textDisp *textD);
+static void setFontWidths(textDisp *textD);
+static void freeFontWidths(textDisp *textD);
 static int measurePropChar(const textDisp* textD, char c,
         int colNum, int pos);
 static Pixel allocBGColor(Widget w, char *colorName, int *ok);
@@ -222,9 +300,11 @@ textDisp *TextDCreate(Widget widget, Widget hScrollBar, Widget vScrollBar,
     textD->descent = fontStruct->descent;
     textD->fixedFontWidth = fontStruct->min_bounds.width ==
     	    fontStruct->max_bounds.width ? fontStruct->min_bounds.width : -1;
+    textD->fontWidths = NULL;
     textD->styleBuffer = NULL;
     textD->styleTable = NULL;
     textD->nStyles = 0;
+    setFontWidths(textD);
     textD->bgPixel = bgPixel;
     textD->fgPixel = fgPixel;
     textD->selectFGPixel = selectFGPixel;
@@ -246,6 +326,19 @@ textDisp *TextDCreate(Widget widget, Widget hScrollBar, Widget vScrollBar,
     textD->cursorFGGC = XtGetGC(widget, GCForeground, &gcValues);
     textD->lineStarts = (int *)NEditMalloc(sizeof(int) * textD->nVisibleLines);
     textD->lineStarts[0] = 0;
+    textD->layout = NULL;
+    textD->wrapCache = NULL;
+    textD->redisplayStart = textD->redisplayEnd = -1;
+    textD->redisplayAll = False;
+    textD->redisplayLineNums = False;
+    textD->redisplayProcID = 0;
+    textD->redisplayTimerID = 0;
+    textD->linesRequested = textD->linesPainted = 0;
+    textD->backingStore = None;
+    textD->backingGC = NULL;
+    textD->backingWidth = textD->backingHeight = 0;
+    textD->backingLineValid = NULL;
+    textD->nBackingLines = 0;
     textD->calltipW = NULL;
     textD->calltipShell = NULL;
     textD->calltip.ID = 0;
@@ -271,6 +364,7 @@ textDisp *TextDCreate(Widget widget, Widget hScrollBar, Widget vScrollBar,
     /* Attach the callback to the text buffer for receiving modification
        information */
     if (buffer != NULL) {
+	attachSharedLayout(textD);
 	BufAddModifyCB(buffer, bufModifiedCB, textD);
 	BufAddPreDeleteCB(buffer, bufPreDeleteCB, textD);
     }
@@ -319,6 +413,10 @@ void TextDFree(textDisp *textD)
     releaseGC(textD->w, textD->styleGC);
     releaseGC(textD->w, textD->lineNumGC);
     NEditFree(textD->lineStarts);
+    freeFontWidths(textD);
+    detachSharedLayout(textD);
+    cancelRedisplay(textD);
+    freeBackingStore(textD);
     while (TextDPopGraphicExposeQueueEntry(textD)) {
     }
     NEditFree(textD->bgClassPixel);
@@ -341,7 +439,9 @@ void TextDSetBuffer(textDisp *textD, textBuffer *buffer)
     
     /* Add the buffer to the display, and attach a callback to the buffer for
        receiving modification information when the buffer contents change */
+    detachSharedLayout(textD);
     textD->buffer = buffer;
+    attachSharedLayout(textD);
     BufAddModifyCB(buffer, bufModifiedCB, textD);
     BufAddPreDeleteCB(buffer, bufPreDeleteCB, textD);
     
@@ -468,6 +568,7 @@ void TextDSetFont(textDisp *textD, XFontStruct *fontStruct)
        font changes, must be re-allocated to change it). Unfortunately,
        this requres recovering all of the colors from the existing GCs */
     textD->fontStruct = fontStruct;
+    setFontWidths(textD);
     XGetGCValues(display, textD->gc, GCForeground|GCBackground, &values);
     fgPixel = values.foreground;
     bgPixel = values.background;
@@ -561,13 +662,12 @@ void TextDResize(textDisp *textD, int width, int height)
        lines in the buffer, and can leave the top line number incorrect, and
        the top character no longer pointing at a valid line start */
     if (textD->continuousWrap && textD->wrapMargin==0 && width!=oldWidth) {
-        int oldFirstChar = textD->firstChar;
         textD->nBufferLines = TextDCountLines(textD, 0, textD->buffer->length,
                 True);
         textD->firstChar = TextDStartOfLine(textD, textD->firstChar);
         textD->topLineNum = TextDCountLines(textD, 0, textD->firstChar, True)+1;
         redrawAll = True;
-        offsetAbsLineNum(textD, oldFirstChar);
+        resetAbsLineNum(textD);
     }
  
     /* reallocate and update the line starts array, which may have changed
@@ -581,6 +681,10 @@ void TextDResize(textDisp *textD, int width, int height)
     calcLineStarts(textD, 0, newVisibleLines);
     calcLastChar(textD);
     
+    /* The backing store no longer matches the line layout */
+    if (textD->backingStore != None)
+    	resetBackingStore(textD);
+    
     /* if the window became shorter, there may be partially drawn
        text left at the bottom edge, which must be cleaned up */
     if (canRedraw && oldVisibleLines>newVisibleLines && exactHeight!=height)
@@ -646,6 +750,38 @@ void TextDRedisplayRect(textDisp *textD, int left, int top, int width,
 	redrawLineNumbers(textD, False);
 }
 
+/*
+** Refresh a rectangle of the text display which was exposed (in coordinates
+** of the text drawing window).  With a backing store, lines whose image is
+** held in it are copied from there instead of being drawn again.
+*/
+void TextDExposeRect(textDisp *textD, int left, int top, int width,
+	int height)
+{
+    int x, y, fontHeight = textD->ascent + textD->descent;
+    
+    if (textD->backingStore == None) {
+    	TextDRedisplayRect(textD, left, top, width, height);
+    	return;
+    }
+    
+    /* Bring the backing store up to date with pending redisplay requests
+       from buffer modifications, before copying anything from it */
+    flushRedisplay(textD);
+    resetClipRectangles(textD);
+    copyFromBackingStore(textD, left, top, width, height);
+    
+    /* The cursor is not part of the backing store, draw it again if its
+       line was exposed */
+    if (textD->cursorOn && TextDPositionToXY(textD, textD->cursorPos, &x, &y)
+    	    && y + fontHeight > top && y - fontHeight < top + height)
+    	textDRedisplayRange(textD, textD->cursorPos-1, textD->cursorPos+1);
+    
+    /* draw the line numbers if exposed area includes them */
+    if (textD->lineNumWidth != 0 && left <= textD->lineNumLeft + textD->lineNumWidth)
+	redrawLineNumbers(textD, False);
+}
+
 /*
 ** Refresh all of the text between buffer positions "start" and "end"
 ** not including the character at the position "end".
@@ -955,22 +1091,19 @@ void TextDXYToUnconstrainedPosition(textDisp *textD, int x, int y, int *row,
 int TextDLineAndColToPos(textDisp *textD, int lineNum, int column)
 {
     int i, lineEnd, charIndex, outIndex;
-    int lineStart=0, charLen=0;
+    int lineStart, charLen=0;
     char *lineStr, expandedChar[MAX_EXP_CHAR_LEN];
 
-    /* Count lines */
+    /* Look up the line */
     if (lineNum < 1)
         lineNum = 1;
-    lineEnd = -1;
-    for (i=1; i<=lineNum && lineEnd<textD->buffer->length; i++) {
-        lineStart = lineEnd + 1;
-        lineEnd = BufEndOfLine(textD->buffer, lineStart);
-    }
+    lineStart = BufPosOfLine(textD->buffer, lineNum - 1);
 
     /* If line is beyond end of buffer, position at last character in buffer */
-    if ( lineNum >= i ) {
-      return lineEnd;
+    if (lineStart == -1) {
+      return textD->buffer->length;
     }
+    lineEnd = BufEndOfLine(textD->buffer, lineStart);
 
     /* Start character index at zero */
     charIndex=0;
@@ -1012,7 +1145,7 @@ int TextDLineAndColToPos(textDisp *textD, int lineNum, int column)
 */
 int TextDPositionToXY(textDisp *textD, int pos, int *x, int *y)
 {
-    int charIndex, lineStartPos, fontHeight, lineLen;
+    int charIndex, lineStartPos, fontHeight, lineLen, segStart, segEnd;
     int visLineNum, charLen, outIndex, xStep, charStyle;
     char *lineStr, expandedChar[MAX_EXP_CHAR_LEN];
     
@@ -1036,17 +1169,28 @@ int TextDPositionToXY(textDisp *textD, int pos, int *x, int *y)
     	return True;
     }
     lineLen = visLineLength(textD, visLineNum);
-    lineStr = BufGetRange(textD->buffer, lineStartPos, lineStartPos + lineLen);
     
     /* Step through character positions from the beginning of the line
-       to "pos" to calculate the x coordinate */
+       to "pos" to calculate the x coordinate.  In long lines drawn in a
+       fixed width font, start from the closest column checkpoint instead */
     xStep = textD->left - textD->horizOffset;
     outIndex = 0;
-    for(charIndex=0; charIndex<pos-lineStartPos; charIndex++) {
-    	charLen = BufExpandCharacter(lineStr[charIndex], outIndex, expandedChar,
-    		textD->buffer->tabDist, textD->buffer->nullSubsChar);
+    segStart = 0;
+    segEnd = lineLen;
+    if (lineLen >= LONG_LINE_LEN && textD->fixedFontWidth != -1) {
+    	segStart = findLineCheckpoint(textD, lineStartPos, lineLen,
+    		pos - lineStartPos, -1, &outIndex);
+    	segEnd = min(lineLen, pos - lineStartPos);
+    	xStep += outIndex * textD->fixedFontWidth;
+    }
+    lineStr = BufGetRange(textD->buffer, lineStartPos + segStart,
+    	    lineStartPos + segEnd);
+    for(charIndex=segStart; charIndex<pos-lineStartPos; charIndex++) {
+    	charLen = BufExpandCharacter(lineStr[charIndex-segStart], outIndex,
+    		expandedChar, textD->buffer->tabDist,
+    		textD->buffer->nullSubsChar);
    	charStyle = styleOfPos(textD, lineStartPos, lineLen, charIndex,
-   	    	outIndex, lineStr[charIndex]);
+   	    	outIndex, lineStr[charIndex-segStart]);
     	xStep += stringWidth(textD, expandedChar, charLen, charStyle);
     	outIndex += charLen;
     }
@@ -1056,14 +1200,12 @@ int TextDPositionToXY(textDisp *textD, int pos, int *x, int *y)
 }
 
 /*
-** If the text widget is maintaining a line number count appropriate to "pos"
-** return the line and column numbers of pos, otherwise return False.  If
-** continuous wrap mode is on, returns the absolute line number (as opposed to
-** the wrapped line number which is used for scrolling).  THIS ROUTINE ONLY
-** WORKS FOR DISPLAYED LINES AND, IN CONTINUOUS WRAP MODE, ONLY WHEN THE
-** ABSOLUTE LINE NUMBER IS BEING MAINTAINED.  Otherwise, it returns False.
+** Return the line and column numbers of "pos".  If continuous wrap mode is
+** on, returns the absolute line number (as opposed to the wrapped line number
+** which is used for scrolling).  Lines which are displayed are counted from
+** the top of the display, others are looked up in the buffer's line index.
 */
-int TextDPosToLineAndCol(textDisp *textD, int pos, int *lineNum, int *column)
+void TextDPosToLineAndCol(textDisp *textD, int pos, int *lineNum, int *column)
 {
     textBuffer *buf = textD->buffer;
     
@@ -1071,21 +1213,24 @@ int TextDPosToLineAndCol(textDisp *textD, int pos, int *lineNum, int *column)
        maintained separately, as needed.  Only return it if we're actually
        keeping track of it and pos is in the displayed text */
     if (textD->continuousWrap) {
-	if (!maintainingAbsTopLineNum(textD) || pos < textD->firstChar ||
-		pos > textD->lastChar)
-	    return False;
-	*lineNum = textD->absTopLineNum + BufCountLines(buf,
-		textD->firstChar, pos);
-	*column = BufCountDispChars(buf, BufStartOfLine(buf, pos), pos);
-	return True;
+	if (maintainingAbsTopLineNum(textD) && pos >= textD->firstChar &&
+		pos <= textD->lastChar)
+	    *lineNum = textD->absTopLineNum + BufCountLines(buf,
+		    textD->firstChar, pos);
+	else
+	    *lineNum = BufLineOfPos(buf, pos) + 1;
+	*column = lineColumn(textD, BufStartOfLine(buf, pos), pos);
+	return;
     }
 
-    /* Only return the data if pos is within the displayed text */
-    if (!posToVisibleLineNum(textD, pos, lineNum))
-	return False;
-    *column = BufCountDispChars(buf, textD->lineStarts[*lineNum], pos);
+    /* Count displayed lines from the top line, others from the line index */
+    if (!posToVisibleLineNum(textD, pos, lineNum)) {
+	*lineNum = BufLineOfPos(buf, pos) + 1;
+	*column = lineColumn(textD, BufStartOfLine(buf, pos), pos);
+	return;
+    }
+    *column = lineColumn(textD, textD->lineStarts[*lineNum], pos);
     *lineNum += textD->topLineNum;
-    return True;
 }
 
 /*
@@ -1239,7 +1384,7 @@ int TextDPreferredColumn(textDisp *textD, int *visLineNum, int *lineStartPos)
     /* Decide what column to move to, if there's a preferred column use that */
     column = (textD->cursorPreferredCol >= 0)
             ? textD->cursorPreferredCol
-            : BufCountDispChars(textD->buffer, *lineStartPos, textD->cursorPos);
+            : lineColumn(textD, *lineStartPos, textD->cursorPos);
     return(column);
 }
 
@@ -1251,7 +1396,7 @@ int TextDPosOfPreferredCol(textDisp *textD, int column, int lineStartPos)
 {
     int newPos;
 
-    newPos = BufCountForwardDispChars(textD->buffer, lineStartPos, column);
+    newPos = lineColumnToPos(textD, lineStartPos, column);
     if (textD->continuousWrap) {
         newPos = min(newPos, TextDEndOfLine(textD, lineStartPos, True));
     }
@@ -1298,7 +1443,7 @@ int TextDMoveUp(textDisp *textD, int absolute)
     /* Decide what column to move to, if there's a preferred column use that */
     column = textD->cursorPreferredCol >= 0
             ? textD->cursorPreferredCol
-            : BufCountDispChars(textD->buffer, lineStartPos, textD->cursorPos);
+            : lineColumn(textD, lineStartPos, textD->cursorPos);
     
     /* count forward from the start of the previous line to reach the column */
     if (absolute) {
@@ -1309,7 +1454,7 @@ int TextDMoveUp(textDisp *textD, int absolute)
         prevLineStartPos = TextDCountBackwardNLines(textD, lineStartPos, 1);
     }
 
-    newPos = BufCountForwardDispChars(textD->buffer, prevLineStartPos, column);
+    newPos = lineColumnToPos(textD, prevLineStartPos, column);
     if (textD->continuousWrap && !absolute)
     	newPos = min(newPos, TextDEndOfLine(textD, prevLineStartPos, True));
     
@@ -1342,14 +1487,14 @@ int TextDMoveDown(textDisp *textD, int absolute)
 
     column = textD->cursorPreferredCol >= 0
             ? textD->cursorPreferredCol
-            : BufCountDispChars(textD->buffer, lineStartPos, textD->cursorPos);
+            : lineColumn(textD, lineStartPos, textD->cursorPos);
 
     if (absolute)
         nextLineStartPos = BufCountForwardNLines(textD->buffer, lineStartPos, 1);
     else
         nextLineStartPos = TextDCountForwardNLines(textD, lineStartPos, 1, True);
 
-    newPos = BufCountForwardDispChars(textD->buffer, nextLineStartPos, column);
+    newPos = lineColumnToPos(textD, nextLineStartPos, column);
 
     if (textD->continuousWrap && !absolute) {
         newPos = min(newPos, TextDEndOfLine(textD, nextLineStartPos, True));
@@ -1372,9 +1517,14 @@ int TextDCountLines(textDisp *textD, int startPos, int endPos,
 {
     int retLines, retPos, retLineStart, retLineEnd;
     
-    /* If we're not wrapping use simple (and more efficient) BufCountLines */
-    if (!textD->continuousWrap)
+    /* If we're not wrapping use simple (and more efficient) BufCountLines,
+       or for long stretches, the line index shared by all displays */
+    if (!textD->continuousWrap) {
+    	if (endPos - startPos > LONG_COUNT_LEN)
+    	    return BufLineOfPos(textD->buffer, endPos) -
+    		    BufLineOfPos(textD->buffer, startPos);
     	return BufCountLines(textD->buffer, startPos, endPos);
+    }
     
     wrappedLineCounter(textD, textD->buffer, startPos, endPos, INT_MAX,
 	    startPosIsLineStart, 0, &retPos, &retLines, &retLineStart,
@@ -1523,9 +1673,12 @@ static void bufModifiedCB(int pos, int nInserted, int nDeleted,
     int scrolled, origCursorPos = textD->cursorPos;
     int wrapModStart, wrapModEnd;
  
-    /* buffer modification cancels vertical cursor motion column */
-    if (nInserted != 0 || nDeleted != 0)
+    /* buffer modification cancels vertical cursor motion column, and moves
+       text which is still waiting to be redrawn */
+    if (nInserted != 0 || nDeleted != 0) {
     	textD->cursorPreferredCol = -1;
+    	adjustScheduledRedisplay(textD, pos, nInserted, nDeleted);
+    }
     
     /* Count the number of lines inserted and deleted, and in the case
        of continuous wrap mode, how much has changed */
@@ -1584,11 +1737,12 @@ static void bufModifiedCB(int pos, int nInserted, int nDeleted,
     	    textD->cursorPos += nInserted - nDeleted;
     }
 
-    /* If the changes caused scrolling, re-paint everything and we're done. */
+    /* If the changes caused scrolling, re-paint everything and we're done.
+       Painting is left to the redisplay scheduler, so a burst of
+       modifications is only drawn once */
     if (scrolled) {
     	blankCursorProtrusions(textD);
-    	TextDRedisplayRect(textD, 0, textD->top, textD->width + textD->left,
-		textD->height);
+    	scheduleRedisplay(textD, 0, 0, True, False);
         if (textD->styleBuffer) {/* See comments in extendRangeForStyleMods */
     	    textD->styleBuffer->primary.selected = False;
             textD->styleBuffer->primary.zeroWidth = False;
@@ -1619,12 +1773,13 @@ static void bufModifiedCB(int pos, int nInserted, int nDeleted,
            have changed. If only one line is altered, line numbers cannot
            be affected (the insertion or removal of a line break always 
            results in at least two lines being redrawn). */
-	if (linesInserted > 1) redrawLineNumbers(textD, False);
+	if (linesInserted > 1)
+	    scheduleRedisplay(textD, 0, 0, False, True);
     } else { /* linesInserted != linesDeleted */
     	endDispPos = textD->lastChar + 1;
     	if (origCursorPos >= pos)
     	    blankCursorProtrusions(textD);
-	redrawLineNumbers(textD, False);
+	scheduleRedisplay(textD, 0, 0, False, True);
     }
     
     /* If there is a style buffer, check if the modification caused additional
@@ -1634,8 +1789,308 @@ static void bufModifiedCB(int pos, int nInserted, int nDeleted,
     if (textD->styleBuffer)
     	extendRangeForStyleMods(textD, &startDispPos, &endDispPos);
     
-    /* Redisplay computed range */
-    textDRedisplayRange(textD, startDispPos, endDispPos);
+    /* Redisplay computed range (once the event queue drains) */
+    scheduleRedisplay(textD, startDispPos, endDispPos, False, False);
+}
+
+/*
+** Redisplay scheduler.
+**
+** Buffer modifications don't repaint the text right away.  The range of text
+** to redraw is accumulated (as the union of the ranges requested), along
+** with whether the line numbers or the whole display need to be redrawn,
+** and painted once the event queue drains (or after REDISPLAY_FRAME_MS, if
+** events keep coming), so that shell output arriving in small pieces, macro
+** loops, or auto-repeating keys don't paint the same lines over and over.
+** The number of lines requested and painted are counted, for
+** TextDGetRedisplayCounts.
+*/
+static void scheduleRedisplay(textDisp *textD, int start, int end,
+        Boolean all, Boolean lineNums)
+{
+    XtAppContext context = XtWidgetToApplicationContext(textD->w);
+
+    if (all) {
+    	textD->redisplayAll = True;
+    	textD->linesRequested += textD->nVisibleLines;
+    } else if (lineNums) {
+    	textD->redisplayLineNums = True;
+    } else {
+    	if (textD->redisplayStart == -1) {
+    	    textD->redisplayStart = start;
+    	    textD->redisplayEnd = end;
+    	} else {
+    	    textD->redisplayStart = min(textD->redisplayStart, start);
+    	    textD->redisplayEnd = max(textD->redisplayEnd, end);
+    	}
+    	textD->linesRequested += countVisibleLines(textD, start, end);
+    }
+    
+    if (textD->redisplayProcID == 0)
+    	textD->redisplayProcID = XtAppAddWorkProc(context, redisplayWorkProc,
+    		textD);
+    if (textD->redisplayTimerID == 0)
+    	textD->redisplayTimerID = XtAppAddTimeOut(context, REDISPLAY_FRAME_MS,
+    		redisplayTimerProc, textD);
+}
+
+/*
+** Move the range of text waiting to be redrawn along with a buffer
+** modification
+*/
+static void adjustScheduledRedisplay(textDisp *textD, int pos, int nInserted,
+        int nDeleted)
+{
+    int delta = nInserted - nDeleted;
+    
+    if (textD->redisplayStart == -1)
+    	return;
+    if (textD->redisplayStart > pos)
+    	textD->redisplayStart = textD->redisplayStart >= pos + nDeleted ?
+    		textD->redisplayStart + delta : pos;
+    if (textD->redisplayEnd > pos)
+    	textD->redisplayEnd = textD->redisplayEnd >= pos + nDeleted ?
+    		textD->redisplayEnd + delta : pos + nInserted;
+}
+
+/*
+** Count the displayed lines which the text from start to end touches (as
+** textDRedisplayRange would redraw them)
+*/
+static int countVisibleLines(textDisp *textD, int start, int end)
+{
+    int startLine = 0, lastLine = textD->nVisibleLines - 1;
+    
+    if (end < textD->firstChar || (start > textD->lastChar &&
+    	    !emptyLinesVisible(textD)))
+        return 0;
+    if (start > textD->firstChar && !posToVisibleLineNum(textD, start,
+    	    &startLine))
+    	startLine = textD->nVisibleLines - 1;
+    if (end < textD->lastChar && !posToVisibleLineNum(textD, end, &lastLine))
+    	lastLine = textD->nVisibleLines - 1;
+    return max(0, lastLine - startLine + 1);
+}
+
+/*
+** Paint everything the redisplay scheduler has accumulated
+*/
+static void flushRedisplay(textDisp *textD)
+{
+    int start = textD->redisplayStart, end = textD->redisplayEnd;
+    
+    cancelRedisplay(textD);
+    if (textD->redisplayAll) {
+    	textD->linesPainted += textD->nVisibleLines;
+    	textD->redisplayAll = False;
+    	textD->redisplayLineNums = False;
+    	textD->redisplayStart = textD->redisplayEnd = -1;
+    	TextDRedisplayRect(textD, 0, textD->top, textD->width + textD->left,
+		textD->height);
+    	return;
+    }
+    if (start != -1) {
+    	textD->linesPainted += countVisibleLines(textD, start, end);
+    	textD->redisplayStart = textD->redisplayEnd = -1;
+    	textDRedisplayRange(textD, start, end);
+    }
+    if (textD->redisplayLineNums) {
+    	textD->redisplayLineNums = False;
+    	redrawLineNumbers(textD, False);
+    }
+}
+
+static Boolean redisplayWorkProc(XtPointer clientData)
+{
+    textDisp *textD = (textDisp *)clientData;
+    
+    textD->redisplayProcID = 0;
+    flushRedisplay(textD);
+    return True;
+}
+
+static void redisplayTimerProc(XtPointer clientData, XtIntervalId *id)
+{
+    textDisp *textD = (textDisp *)clientData;
+    
+    textD->redisplayTimerID = 0;
+    flushRedisplay(textD);
+}
+
+/*
+** Remove the work proc and timer of the redisplay scheduler (but not the
+** accumulated redisplay requests)
+*/
+static void cancelRedisplay(textDisp *textD)
+{
+    if (textD->redisplayProcID != 0) {
+    	XtRemoveWorkProc(textD->redisplayProcID);
+    	textD->redisplayProcID = 0;
+    }
+    if (textD->redisplayTimerID != 0) {
+    	XtRemoveTimeOut(textD->redisplayTimerID);
+    	textD->redisplayTimerID = 0;
+    }
+}
+
+/*
+** Return the number of lines redraws were requested for after buffer
+** modifications, and the number of lines actually painted for them (after
+** combining requests made in quick succession)
+*/
+void TextDGetRedisplayCounts(textDisp *textD, unsigned long *linesRequested,
+        unsigned long *linesPainted)
+{
+    *linesRequested = textD->linesRequested;
+    *linesPainted = textD->linesPainted;
+}
+
+/*
+** Turn the backing store of the text display on or off.  With a backing
+** store, text is drawn in an off-screen pixmap, and copied to the window a
+** line at a time.  Exposures are then served by copying the exposed lines
+** from the pixmap, and scrolling moves the text image within the pixmap,
+** even when the window is partially obscured.  Over slow connections to the
+** X server, this saves sending the drawing requests for the text again.
+** The cost is the memory for the pixmap in the X server.
+*/
+void TextDSetBackingStore(textDisp *textD, int state)
+{
+    if (state && textD->backingStore == None)
+    	resetBackingStore(textD);
+    else if (!state && textD->backingStore != None)
+    	freeBackingStore(textD);
+}
+
+/*
+** Return the drawable text is drawn in: the backing store if there is one,
+** otherwise the window
+*/
+static Drawable textDrawable(textDisp *textD)
+{
+    return textD->backingStore != None ? textD->backingStore :
+    	    XtWindow(textD->w);
+}
+
+/*
+** (Re-)create the backing store for the current size of the text display,
+** with no line images in it yet.  The pixmap uses the same coordinates as
+** the window.
+*/
+static void resetBackingStore(textDisp *textD)
+{
+    Display *display = XtDisplay(textD->w);
+    XGCValues values;
+    int i, depth, width, height;
+    
+    width = max(1, textD->left + textD->width);
+    height = max(1, textD->top + textD->height);
+    if (textD->backingStore == None || width != textD->backingWidth ||
+    	    height != textD->backingHeight) {
+    	if (textD->backingStore != None)
+    	    XFreePixmap(display, textD->backingStore);
+	XtVaGetValues(textD->w, XmNdepth, &depth, NULL);
+    	textD->backingStore = XCreatePixmap(display,
+    		RootWindowOfScreen(XtScreen(textD->w)), width, height, depth);
+    	textD->backingWidth = width;
+    	textD->backingHeight = height;
+    	if (textD->backingGC == NULL) {
+    	    values.graphics_exposures = False;
+    	    textD->backingGC = XCreateGC(display, textD->backingStore,
+    		    GCGraphicsExposures, &values);
+    	}
+    }
+    if (textD->nBackingLines != textD->nVisibleLines) {
+    	NEditFree(textD->backingLineValid);
+    	textD->nBackingLines = textD->nVisibleLines;
+    	textD->backingLineValid = (char *)NEditMalloc(textD->nBackingLines);
+    }
+    for (i=0; i<textD->nBackingLines; i++)
+    	textD->backingLineValid[i] = False;
+}
+
+static void freeBackingStore(textDisp *textD)
+{
+    if (textD->backingStore != None)
+    	XFreePixmap(XtDisplay(textD->w), textD->backingStore);
+    if (textD->backingGC != NULL)
+    	XFreeGC(XtDisplay(textD->w), textD->backingGC);
+    NEditFree(textD->backingLineValid);
+    textD->backingStore = None;
+    textD->backingGC = NULL;
+    textD->backingWidth = textD->backingHeight = 0;
+    textD->backingLineValid = NULL;
+    textD->nBackingLines = 0;
+}
+
+/*
+** Show a rectangle of the text display (in window coordinates) from the
+** backing store, copying runs of lines held in it in one request each, and
+** drawing the others (which puts them in the backing store as well)
+*/
+static void copyFromBackingStore(textDisp *textD, int left, int top,
+        int width, int height)
+{
+    int line, firstLine, lastLine, runStart = -1, y1, y2, valid;
+    int fontHeight = textD->ascent + textD->descent;
+    int right = min(left + width, textD->left + textD->width);
+    
+    left = max(left, textD->left);
+    if (left >= right || XtWindow(textD->w) == 0)
+    	return;
+    firstLine = max(0, (top - textD->top - fontHeight + 1) / fontHeight);
+    lastLine = (top + height - textD->top) / fontHeight;
+    for (line=firstLine; line<=lastLine+1; line++) {
+    	valid = line <= lastLine && line < textD->nBackingLines &&
+    		textD->backingLineValid[line];
+    	if (valid) {
+    	    if (runStart == -1)
+    		runStart = line;
+    	    continue;
+    	}
+    	if (runStart != -1) {
+    	    y1 = max(top, textD->top + runStart * fontHeight);
+    	    y2 = min(top + height, textD->top + line * fontHeight);
+    	    if (y1 < y2)
+    		XCopyArea(XtDisplay(textD->w), textD->backingStore,
+    			XtWindow(textD->w), textD->backingGC, left, y1,
+    			right - left, y2 - y1, left, y1);
+    	    runStart = -1;
+    	}
+    	if (line <= lastLine)
+    	    redisplayLine(textD, line, left, right, 0, INT_MAX);
+    }
+}
+
+/*
+** Move the part of the text image in the backing store which is still
+** displayed after scrolling by "lineDelta" lines, and keep track of which
+** line images moved along with it
+*/
+static void scrollBackingStore(textDisp *textD, int srcX, int srcY, int width,
+        int height, int dstX, int dstY, int lineDelta)
+{
+    int i, n = textD->nBackingLines;
+    char *valid = textD->backingLineValid;
+    
+    if (width > 0 && height > 0)
+    	XCopyArea(XtDisplay(textD->w), textD->backingStore,
+    		textD->backingStore, textD->backingGC, srcX, srcY, width,
+    		height, dstX, dstY);
+    if (lineDelta >= n || lineDelta <= -n) {
+    	for (i=0; i<n; i++)
+    	    valid[i] = False;
+    } else if (lineDelta > 0) {
+    	for (i=n-1; i>=lineDelta; i--)
+    	    valid[i] = valid[i-lineDelta];
+    	for (; i>=0; i--)
+    	    valid[i] = False;
+    } else if (lineDelta < 0) {
+    	for (i=0; i<n+lineDelta; i++)
+    	    valid[i] = valid[i-lineDelta];
+    	for (; i<n; i++)
+    	    valid[i] = False;
+    }
 }
 
 /*
@@ -1667,21 +2122,6 @@ static int getAbsTopLineNum(textDisp *textD)
     return 0;
 }
 
-/*
-** Re-calculate absolute top line number for a change in scroll position.
-*/
-static void offsetAbsLineNum(textDisp *textD, int oldFirstChar)
-{
-    if (maintainingAbsTopLineNum(textD)) {
-	if (textD->firstChar < oldFirstChar)
-	    textD->absTopLineNum -= BufCountLines(textD->buffer,
-		    textD->firstChar, oldFirstChar);
-	else
-	    textD->absTopLineNum += BufCountLines(textD->buffer,
-		    oldFirstChar, textD->firstChar);
-    }
-}
-
 /*
 ** Return true if a separate absolute top line number is being maintained
 ** (for displaying line numbers or showing in the statistics line).
@@ -1693,14 +2133,15 @@ static int maintainingAbsTopLineNum(textDisp *textD)
 }
 
 /*
-** Count lines from the beginning of the buffer to reestablish the
-** absolute (non-wrapped) top line number.  If mode is not continuous wrap,
-** or the number is not being maintained, does nothing.
+** Look up the absolute (non-wrapped) top line number in the buffer's line
+** index, after a scroll or a change before the top of the display.  If mode
+** is not continuous wrap, or the number is not being maintained, does nothing.
 */
 static void resetAbsLineNum(textDisp *textD)
 {
-    textD->absTopLineNum = 1;
-    offsetAbsLineNum(textD, 0);
+    if (maintainingAbsTopLineNum(textD))
+	textD->absTopLineNum = BufLineOfPos(textD->buffer,
+		textD->firstChar) + 1;
 }
 
 /*
@@ -1756,9 +2197,11 @@ static void redisplayLine(textDisp *textD, int visLineNum, int leftClip,
     int stdCharWidth, charWidth, startIndex, charStyle, style;
     int charLen, outStartIndex, outIndex, cursorX = 0, hasCursor = False;
     int dispIndexOffset, cursorPos = textD->cursorPos, y_orig;
+    int segStart = 0, segEnd = 0, segStartColumn = 0;
     char expandedChar[MAX_EXP_CHAR_LEN], outStr[MAX_DISP_LINE_LEN];
     char *lineStr, *outPtr;
     char baseChar;
+    int *styles;
 
     /* If line is not displayed, skip it */
     if (visLineNum < 0 || visLineNum >= textD->nVisibleLines)
@@ -1776,15 +2219,30 @@ static void redisplayLine(textDisp *textD, int visLineNum, int leftClip,
     fontHeight = textD->ascent + textD->descent;
     y = textD->top + visLineNum * fontHeight;
 
-    /* Get the text, length, and  buffer position of the line to display */
+    /* Get the text, length, and  buffer position of the line to display.
+       Of long lines drawn in a fixed width font, only get the part which can
+       show up between the clipping limits: the first character drawn is less
+       than a checkpoint interval beyond the last checkpoint before it, and
+       every character drawn takes at least one column */
     lineStartPos = textD->lineStarts[visLineNum];
     if (lineStartPos == -1) {
     	lineLen = 0;
     	lineStr = NULL;
     } else {
 	lineLen = visLineLength(textD, visLineNum);
-	lineStr = BufGetRange(buf, lineStartPos, lineStartPos + lineLen);
+	segEnd = lineLen;
+	if (lineLen >= LONG_LINE_LEN && textD->fixedFontWidth != -1) {
+	    segStart = findLineCheckpoint(textD, lineStartPos, lineLen,
+	    	    leftCharIndex, (leftClip - textD->left + textD->horizOffset
+	    	    - 1) / textD->fixedFontWidth, &segStartColumn);
+	    segEnd = min(lineLen, segStart + LINE_CHECKPOINT_INTERVAL +
+	    	    (rightClip - leftClip) / textD->fixedFontWidth + 2);
+	}
+	lineStr = BufGetRange(buf, lineStartPos + segStart,
+		lineStartPos + segEnd);
     }
+    styles = lineStyles(textD, lineStartPos + segStart, segEnd - segStart,
+    	    lineStr);
     
     /* Space beyond the end of the line is still counted in units of characters
        of a standardized character width (this is done mostly because style
@@ -1795,6 +2253,7 @@ static void redisplayLine(textDisp *textD, int visLineNum, int leftClip,
     if (stdCharWidth <= 0) {
     	fprintf(stderr, "nedit: Internal Error, bad font measurement\n");
     	NEditFree(lineStr);
+    	NEditFree(styles);
     	return;
     }
     
@@ -1818,16 +2277,19 @@ static void redisplayLine(textDisp *textD, int visLineNum, int leftClip,
        character position that's not clipped, and the x coordinate for drawing
        that character */
     x = textD->left - textD->horizOffset;
-    outIndex = 0;
+    if (segStartColumn != 0)
+    	x += segStartColumn * textD->fixedFontWidth;
+    outIndex = segStartColumn;
 
-    for (charIndex = 0; ; charIndex++) {
+    for (charIndex = segStart; ; charIndex++) {
         baseChar = '\0';
         charLen = charIndex >= lineLen
                 ? 1
-                : BufExpandCharacter(baseChar = lineStr[charIndex], outIndex,
-                        expandedChar, buf->tabDist, buf->nullSubsChar);
-    	style = styleOfPos(textD, lineStartPos, lineLen, charIndex,
-                outIndex + dispIndexOffset, baseChar);
+                : BufExpandCharacter(baseChar = lineStr[charIndex - segStart],
+                        outIndex, expandedChar, buf->tabDist,
+                        buf->nullSubsChar);
+    	style = lineStyleOf(textD, styles, segStart, segEnd, lineStartPos,
+                lineLen, charIndex, outIndex + dispIndexOffset, baseChar);
         charWidth = charIndex >= lineLen
                 ? stdCharWidth
                 : stringWidth(textD, expandedChar, charLen, style);
@@ -1866,13 +2328,15 @@ static void redisplayLine(textDisp *textD, int visLineNum, int leftClip,
         baseChar = '\0';
      	charLen = charIndex >= lineLen
                 ? 1
-                : BufExpandCharacter(baseChar = lineStr[charIndex], outIndex,
-                        expandedChar, buf->tabDist, buf->nullSubsChar);
-   	charStyle = styleOfPos(textD, lineStartPos, lineLen, charIndex,
-                outIndex + dispIndexOffset, baseChar);
+                : BufExpandCharacter(baseChar = lineStr[charIndex - segStart],
+                        outIndex, expandedChar, buf->tabDist,
+                        buf->nullSubsChar);
+   	charStyle = lineStyleOf(textD, styles, segStart, segEnd, lineStartPos,
+                lineLen, charIndex, outIndex + dispIndexOffset, baseChar);
    	for (i = 0; i < charLen; i++) {
-            if (i != 0 && charIndex < lineLen && lineStr[charIndex] == '\t') {
-                charStyle = styleOfPos(textD, lineStartPos, lineLen, charIndex,
+            if (i != 0 && charIndex < lineLen && baseChar == '\t') {
+                charStyle = lineStyleOf(textD, styles, segStart, segEnd,
+                        lineStartPos, lineLen, charIndex,
                         outIndex + dispIndexOffset, '\t');
             }
 
@@ -1904,6 +2368,24 @@ static void redisplayLine(textDisp *textD, int visLineNum, int leftClip,
     /* Draw the remaining style segment */
     drawString(textD, style, startX, y, x, outStr, outPtr - outStr);
     
+    /* When drawing in the backing store, show the line in the window.  If
+       the rest of the line isn't known to be there yet, only the part which
+       was drawn */
+    if (textD->backingStore != None && XtWindow(textD->w) != 0 &&
+    	    visLineNum < textD->nBackingLines) {
+    	if (leftClip <= textD->left &&
+    		rightClip >= textD->left + textD->width)
+    	    textD->backingLineValid[visLineNum] = True;
+    	if (textD->backingLineValid[visLineNum])
+    	    XCopyArea(XtDisplay(textD->w), textD->backingStore,
+    		    XtWindow(textD->w), textD->backingGC, textD->left, y,
+    		    textD->width, fontHeight, textD->left, y);
+    	else
+    	    XCopyArea(XtDisplay(textD->w), textD->backingStore,
+    		    XtWindow(textD->w), textD->backingGC, leftClip, y,
+    		    rightClip - leftClip, fontHeight, leftClip, y);
+    }
+    
     /* Draw the cursor if part of it appeared on the redisplayed part of
        this line.  Also check for the cases which are not caught as the
        line is scanned above: when the cursor appears at the very end
@@ -1932,6 +2414,7 @@ static void redisplayLine(textDisp *textD, int visLineNum, int leftClip,
         TextDRedrawCalltip(textD, 0);
     
     NEditFree(lineStr);
+    NEditFree(styles);
 }
 
 /*
@@ -2040,7 +2523,7 @@ static void drawString(textDisp *textD, int style, int x, int y, int toX,
     }
 
     /* Draw the string using gc and font set above */
-    XDrawImageString(XtDisplay(textD->w), XtWindow(textD->w), gc, x,
+    XDrawImageString(XtDisplay(textD->w), textDrawable(textD), gc, x,
     	    y + textD->ascent, string, nChars);
     
     /* Underline if style is secondary selection */
@@ -2051,13 +2534,15 @@ static void drawString(textDisp *textD, int style, int x, int y, int toX,
         XChangeGC(XtDisplay(textD->w), gc,
                 GCForeground, &gcValues);
         /* draw underline */
-    	XDrawLine(XtDisplay(textD->w), XtWindow(textD->w), gc, x,
+    	XDrawLine(XtDisplay(textD->w), textDrawable(textD), gc, x,
     	    	y + textD->ascent, toX - 1, y + textD->ascent);
     }
 }
 
 /*
-** Clear a rectangle with the appropriate background color for "style"
+** Clear a rectangle with the appropriate background color for "style".
+** With a backing store, the rectangle is cleared in the window as well,
+** since not all callers go on to copy the area they cleared to the window
 */
 static void clearRect(textDisp *textD, GC gc, int x, int y, 
     	int width, int height)
@@ -2066,12 +2551,20 @@ static void clearRect(textDisp *textD, GC gc, int x, int y,
     if (width == 0 || XtWindow(textD->w) == 0)
     	return;
     
-    if (gc == textD->gc) {
+    if (gc == textD->gc && textD->backingStore != None) {
+        XSetForeground(XtDisplay(textD->w), textD->backingGC, textD->bgPixel);
+        XFillRectangle(XtDisplay(textD->w), textD->backingStore,
+                textD->backingGC, x, y, width, height);
+        XCopyArea(XtDisplay(textD->w), textD->backingStore,
+                XtWindow(textD->w), textD->backingGC, x, y, width, height,
+                x, y);
+    }
+    else if (gc == textD->gc) {
         XClearArea(XtDisplay(textD->w), XtWindow(textD->w), x, y,
                 width, height, False);
     }
     else {
-        XFillRectangle(XtDisplay(textD->w), XtWindow(textD->w),
+        XFillRectangle(XtDisplay(textD->w), textDrawable(textD),
                 gc, x, y, width, height);
     }
 }
@@ -2198,6 +2691,118 @@ static int styleOfPos(textDisp *textD, int lineStartPos,
     return style;
 }
 
+/*
+** Compute the styles (as would be returned by styleOfPos) of the "lineLen"
+** characters "lineStr" of the line starting at "lineStartPos", except for
+** rectangular selections, which depend on the display column and are left
+** to lineStyleOf.  Rather than looking up each layer for every character,
+** the highlight styles are fetched in one piece, and the selections and
+** rangesets are merged in as spans.  Returns an allocated array, or NULL
+** for an empty line.
+*/
+static int *lineStyles(textDisp *textD, int lineStartPos, int lineLen,
+        const char *lineStr)
+{
+    textBuffer *buf = textD->buffer;
+    textBuffer *styleBuf = textD->styleBuffer;
+    int i, start, end, styleOffset, *styles;
+    int lineEndPos = lineStartPos + lineLen;
+    char *styleStr;
+    unsigned char *rangesetIndexes;
+    selection *sel;
+    static const int selMasks[3] = {PRIMARY_MASK, HIGHLIGHT_MASK,
+    	    SECONDARY_MASK};
+    
+    if (lineStartPos == -1 || lineLen <= 0 || buf == NULL)
+    	return NULL;
+    styles = (int *)NEditMalloc(sizeof(int) * lineLen);
+    
+    /* Highlight styles.  Unfinished styles trigger parsing, after which the
+       rest of the line is fetched again */
+    if (styleBuf != NULL) {
+    	styleStr = BufGetRange(styleBuf, lineStartPos, lineEndPos);
+    	styleOffset = 0;
+    	for (i=0; i<lineLen; i++) {
+    	    styles[i] = (unsigned char)styleStr[i - styleOffset];
+    	    if (styles[i] == textD->unfinishedStyle) {
+    		(textD->unfinishedHighlightCB)(textD, lineStartPos + i,
+    			textD->highlightCBArg);
+    		NEditFree(styleStr);
+    		styleStr = BufGetRange(styleBuf, lineStartPos + i, lineEndPos);
+    		styleOffset = i;
+    		styles[i] = (unsigned char)styleStr[0];
+    	    }
+    	}
+    	NEditFree(styleStr);
+    } else {
+    	for (i=0; i<lineLen; i++)
+    	    styles[i] = 0;
+    }
+    
+    /* Plain (non-rectangular) selections cover a single span of the line */
+    for (i=0; i<3; i++) {
+    	sel = i == 0 ? &buf->primary : (i == 1 ? &buf->highlight :
+    		&buf->secondary);
+    	if (!sel->selected || sel->rectangular)
+    	    continue;
+    	start = max(sel->start, lineStartPos) - lineStartPos;
+    	end = min(sel->end, lineEndPos) - lineStartPos;
+    	for (; start < end; start++)
+    	    styles[start] |= selMasks[i];
+    }
+    
+    /* Rangesets, as spans of rangeset indexes */
+    if (buf->rangesetTable) {
+    	rangesetIndexes = (unsigned char *)NEditMalloc(lineLen);
+    	RangesetIndex1ofRange(buf->rangesetTable, lineStartPos, lineEndPos,
+    		True, rangesetIndexes);
+    	for (i=0; i<lineLen; i++)
+    	    styles[i] |= ((int)rangesetIndexes[i] << RANGESET_SHIFT) &
+    		    RANGESET_MASK;
+    	NEditFree(rangesetIndexes);
+    }
+    
+    /* Background color classes of the characters */
+    if (textD->bgClass) {
+    	for (i=0; i<lineLen; i++)
+    	    styles[i] |= textD->bgClass[(unsigned char)lineStr[i]] <<
+    		    BACKLIGHT_SHIFT;
+    }
+    return styles;
+}
+
+/*
+** Return the style of a character of a line, as styleOfPos does, using the
+** styles computed in advance by lineStyles for the part of the line from
+** segStart to segEnd.  Only the rectangular selections still need to be
+** checked here.
+*/
+static int lineStyleOf(textDisp *textD, const int *styles, int segStart,
+        int segEnd, int lineStartPos, int lineLen, int lineIndex,
+        int dispIndex, int thisChar)
+{
+    textBuffer *buf = textD->buffer;
+    int style, pos;
+    
+    if (styles == NULL || lineIndex < segStart || lineIndex >= segEnd ||
+    	    lineIndex >= lineLen)
+    	return styleOfPos(textD, lineStartPos, lineLen, lineIndex, dispIndex,
+    		thisChar);
+    
+    style = styles[lineIndex - segStart];
+    pos = lineStartPos + lineIndex;
+    if (buf->primary.rectangular &&
+    	    inSelection(&buf->primary, pos, lineStartPos, dispIndex))
+    	style |= PRIMARY_MASK;
+    if (buf->highlight.rectangular &&
+    	    inSelection(&buf->highlight, pos, lineStartPos, dispIndex))
+    	style |= HIGHLIGHT_MASK;
+    if (buf->secondary.rectangular &&
+    	    inSelection(&buf->secondary, pos, lineStartPos, dispIndex))
+    	style |= SECONDARY_MASK;
+    return style;
+}
+
 /*
 ** Find the width of a string in the font of a particular style
 */
@@ -2205,7 +2810,16 @@ static int stringWidth(const textDisp* textD, const char *string,
         int length, int style)
 {
     XFontStruct *fs;
-    
+    const short *widths;
+    int i, width = 0;
+    
+    if (textD->fontWidths != NULL) {
+    	widths = textD->fontWidths->styleWidths[(style & STYLE_LOOKUP_MASK) ?
+    		(style & STYLE_LOOKUP_MASK) - ASCII_A + 1 : 0];
+    	for (i=0; i<length; i++)
+    	    width += widths[(unsigned char)string[i]];
+    	return width;
+    }
     if (style & STYLE_LOOKUP_MASK)
     	fs = textD->styleTable[(style & STYLE_LOOKUP_MASK) - ASCII_A].font;
     else 
@@ -2236,7 +2850,7 @@ static int inSelection(selection *sel, int pos, int lineStartPos, int dispIndex)
 */
 static int xyToPos(textDisp *textD, int x, int y, int posType)
 {
-    int charIndex, lineStart, lineLen, fontHeight;
+    int charIndex, lineStart, lineLen, fontHeight, segStart, segEnd;
     int charWidth, charLen, charStyle, visLineNum, xStep, outIndex;
     char *lineStr, expandedChar[MAX_EXP_CHAR_LEN];
 
@@ -2255,19 +2869,32 @@ static int xyToPos(textDisp *textD, int x, int y, int posType)
     if (lineStart == -1)
     	return textD->buffer->length;
     
-    /* Get the line text and its length */
+    /* Find the part of the line to search.  In long lines drawn in a fixed
+       width font, the position is less than a checkpoint interval (plus one
+       character for rounding to the nearest cursor position) beyond the last
+       checkpoint left of x */
     lineLen = visLineLength(textD, visLineNum);
-    lineStr = BufGetRange(textD->buffer, lineStart, lineStart + lineLen);
+    xStep = textD->left - textD->horizOffset;
+    outIndex = 0;
+    segStart = 0;
+    segEnd = lineLen;
+    if (lineLen >= LONG_LINE_LEN && textD->fixedFontWidth != -1) {
+    	segStart = findLineCheckpoint(textD, lineStart, lineLen, -1,
+    		(x - xStep) / textD->fixedFontWidth, &outIndex);
+    	segEnd = min(lineLen, segStart + LINE_CHECKPOINT_INTERVAL + 1);
+    	xStep += outIndex * textD->fixedFontWidth;
+    }
+    lineStr = BufGetRange(textD->buffer, lineStart + segStart,
+    	    lineStart + segEnd);
     
     /* Step through character positions from the beginning of the line
        to find the character position corresponding to the x coordinate */
-    xStep = textD->left - textD->horizOffset;
-    outIndex = 0;
-    for(charIndex=0; charIndex<lineLen; charIndex++) {
-    	charLen = BufExpandCharacter(lineStr[charIndex], outIndex, expandedChar,
-    		textD->buffer->tabDist, textD->buffer->nullSubsChar);
+    for(charIndex=segStart; charIndex<segEnd; charIndex++) {
+    	charLen = BufExpandCharacter(lineStr[charIndex-segStart], outIndex,
+    		expandedChar, textD->buffer->tabDist,
+    		textD->buffer->nullSubsChar);
    	charStyle = styleOfPos(textD, lineStart, lineLen, charIndex, outIndex,
-				lineStr[charIndex]);
+				lineStr[charIndex-segStart]);
     	charWidth = stringWidth(textD, expandedChar, charLen, charStyle);
     	if (x < xStep + (posType == CURSOR_POS ? charWidth/2 : charWidth)) {
     	    NEditFree(lineStr);
@@ -2280,7 +2907,7 @@ static int xyToPos(textDisp *textD, int x, int y, int posType)
     /* If the x position was beyond the end of the line, return the position
        of the newline at the end of the line */
     NEditFree(lineStr);
-    return lineStart + lineLen;
+    return lineStart + segEnd;
 }
 
 /*
@@ -2316,7 +2943,6 @@ static void xyToUnconstrainedPos(textDisp *textD, int x, int y, int *row,
 static void offsetLineStarts(textDisp *textD, int newTopLineNum)
 {
     int oldTopLineNum = textD->topLineNum;
-    int oldFirstChar = textD->firstChar;
     int lineDelta = newTopLineNum - oldTopLineNum;
     int nVisLines = textD->nVisibleLines;
     int *lineStarts = textD->lineStarts;
@@ -2380,7 +3006,7 @@ static void offsetLineStarts(textDisp *textD, int newTopLineNum)
     
     /* If we're numbering lines or being asked to maintain an absolute line
        number, re-calculate the absolute line number */
-    offsetAbsLineNum(textD, oldFirstChar);
+    resetAbsLineNum(textD);
     
     /* {   int i;
     	printf("lineStarts After: ");
@@ -2686,7 +3312,30 @@ static void setScroll(textDisp *textD, int topLineNum, int horizOffset,
        if there's nothing to recover because the scroll distance is large */
     xOffset = origHOffset - textD->horizOffset;
     yOffset = lineDelta * fontHeight;
-    if (textD->visibility != VisibilityUnobscured ||
+    if (textD->backingStore != None) {
+        /* With a backing store, move the part of the text image which is
+           still displayed there, draw what's missing, and copy the result
+           to the window.  Whether the window is obscured doesn't matter */
+        resetClipRectangles(textD);
+        if (abs(xOffset) < textD->width && abs(yOffset) < exactHeight)
+            scrollBackingStore(textD,
+                    textD->left + (xOffset >= 0 ? 0 : -xOffset),
+                    textD->top + (yOffset >= 0 ? 0 : -yOffset),
+                    textD->width - abs(xOffset), exactHeight - abs(yOffset),
+                    textD->left + (xOffset >= 0 ? xOffset : 0),
+                    textD->top + (yOffset >= 0 ? yOffset : 0), lineDelta);
+        else
+            scrollBackingStore(textD, 0, 0, 0, 0, 0, 0, textD->nBackingLines);
+        if (xOffset > 0)
+            TextDRedisplayRect(textD, textD->left, textD->top,
+                    xOffset, textD->height);
+        else if (xOffset < 0)
+            TextDRedisplayRect(textD, textD->left + textD->width + xOffset,
+                    textD->top, -xOffset, textD->height);
+        copyFromBackingStore(textD, textD->left, textD->top, textD->width,
+                textD->height);
+        textDRedisplayRange(textD, textD->cursorPos-1, textD->cursorPos+1);
+    } else if (textD->visibility != VisibilityUnobscured ||
             abs(xOffset) > textD->width || abs(yOffset) > exactHeight) {
         TextDTranlateGraphicExposeQueue(textD, xOffset, yOffset, False);
         TextDRedisplayRect(textD, textD->left, textD->top, textD->width,
@@ -2947,11 +3596,14 @@ static int measureVisLine(textDisp *textD, int visLineNum)
     int charCount = 0, lineStartPos = textD->lineStarts[visLineNum];
     char expandedChar[MAX_EXP_CHAR_LEN];
     
+    if (textD->fixedFontWidth != -1 && lineLen > 0)
+    	return textD->fixedFontWidth *
+    		lineColumn(textD, lineStartPos, lineStartPos + lineLen);
     if (textD->styleBuffer == NULL) {
 	for (i=0; i<lineLen; i++) {
     	    len = BufGetExpandedChar(textD->buffer, lineStartPos + i,
     		    charCount, expandedChar);
-    	    width += XTextWidth(textD->fontStruct, expandedChar, len);
+    	    width += stringWidth(textD, expandedChar, len, 0);
     	    charCount += len;
 	}
     } else {
@@ -2959,9 +3611,8 @@ static int measureVisLine(textDisp *textD, int visLineNum)
     	    len = BufGetExpandedChar(textD->buffer, lineStartPos+i,
     		    charCount, expandedChar);
     	    style = (unsigned char)BufGetCharacter(textD->styleBuffer,
-		    lineStartPos+i) - ASCII_A;
-    	    width += XTextWidth(textD->styleTable[style].font, expandedChar,
-    	    	    len);
+		    lineStartPos+i);
+    	    width += stringWidth(textD, expandedChar, len, style);
     	    charCount += len;
 	}
     }
@@ -3099,6 +3750,9 @@ static void resetClipRectangles(textDisp *textD)
             &clipRect, 1, Unsorted);
     XSetClipRectangles(display, textD->styleGC, 0, 0,
             &clipRect, 1, Unsorted);
+    if (textD->backingGC != NULL)
+        XSetClipRectangles(display, textD->backingGC, 0, 0,
+                &clipRect, 1, Unsorted);
 } 
 
 /*
@@ -3378,6 +4032,12 @@ static void wrappedLineCounter(const textDisp* textD, const textBuffer* buf,
     unsigned char c;
     char nullSubsChar = textD->buffer->nullSubsChar;
     
+    /* Use the wrap points remembered from earlier, if possible */
+    if (cachedWrappedLineCounter(textD, buf, startPos, maxPos, maxLines,
+    	    startPosIsLineStart, styleBufOffset, retPos, retLines,
+    	    retLineStart, retLineEnd))
+    	return;
+    
     /* If the font is fixed, or there's a wrap margin set, it's more efficient
        to measure in columns, than to count pixels.  Determine if we can count
        in columns (countPixels == False) or must count pixels (countPixels ==
@@ -3493,6 +4153,775 @@ static void wrappedLineCounter(const textDisp* textD, const textBuffer* buf,
     *retLineEnd = buf->length;
 }
 
+/*
+** Shared layout.
+**
+** Layout information which depends only on the buffer contents and settings
+** common to its displays (wrap points and column checkpoints), is kept once
+** per buffer and shared by all of the text displays showing it, such as the
+** split panes of a window, so that each additional pane costs only its own
+** drawing.  It is kept up to date by a single buffer modify callback, and
+** freed when the last display detaches from the buffer.
+*/
+typedef struct _sharedLayout {
+    textBuffer *buffer;
+    int nDisplays;                  /* displays attached to the layout */
+    struct _wrapCache *wrapCaches;  /* wrap point caches, one per set of
+                                       wrapping parameters in use */
+    struct _lineCheckpointIndex *lineCheckpoints;
+    struct _sharedLayout *next;
+} sharedLayout;
+
+static sharedLayout *SharedLayouts = NULL;
+
+/*
+** Wrap point cache.
+**
+** In continuous wrap mode, counting display lines (which happens on every
+** scroll, cursor movement and scroll bar update) means measuring the text
+** character by character.  To make this cheap in large files, the places
+** where each (logical, newline terminated) line wraps are remembered as
+** lines are measured, in an array of lines sorted by position.  When the
+** buffer is modified, the lines touched by the modification are marked as
+** invalid, and lines beyond it are moved.  Moving is done lazily: lines from
+** shiftIndex on start shiftDelta characters from their recorded start, so
+** repeated modifications at the same place only cost a binary search.
+** Caches belong to the layout shared by all displays of the buffer, one per
+** set of parameters the wrapping depends upon (wrap margin, window width and
+** font, tab distance), so split panes of the same width share their cache.
+**
+** Only column-based wrapping (fixed width fonts or a wrap margin) is cached,
+** since with proportional fonts the wrap points also depend on highlighting
+** styles, which may change without the buffer being modified.
+*/
+typedef struct {
+    int p;          /* character which pushed the line over the margin */
+    int newStart;   /* start of the following display line */
+    int end;        /* end of the display line which was broken */
+} wrapPoint;        /* (all relative to the start of the logical line) */
+
+typedef struct {
+    int start;      /* start of the line (see shiftIndex) */
+    int length;     /* characters up to the newline, -1 if invalid */
+    int nWraps;
+    wrapPoint *wraps;
+} wrapCacheLine;
+
+typedef struct _wrapCache {
+    int wrapMargin, tabDist; /* parameters the cached wrapping was done with */
+    char nullSubsChar;
+    int nLines, nAllocated;
+    wrapCacheLine *lines;
+    int shiftIndex, shiftDelta;
+    int nUsers;              /* displays currently using the cache */
+    struct _wrapCache *next; /* next cache of the same shared layout */
+} wrapCache;
+
+/*
+** Same as wrappedLineCounter (see above), but using the wrap points in the
+** wrap point cache, measuring lines for the cache when they're not known yet.
+** Returns False if the cache can't be used for the request, in which case
+** the caller must do the measuring itself.
+*/
+static int cachedWrappedLineCounter(const textDisp* textD,
+        const textBuffer* buf, int startPos, int maxPos, int maxLines,
+        Boolean startPosIsLineStart, int styleBufOffset,
+        int* retPos, int* retLines, int* retLineStart, int* retLineEnd)
+{
+    wrapCache *cache;
+    wrapCacheLine *line;
+    wrapPoint *wrap;
+    int i, k, lineStart, logicalStart, nLines = 0, newlinePos;
+    
+    if (buf != textD->buffer || styleBufOffset != 0 ||
+    	    (cache = getWrapCache(textD)) == NULL)
+    	return False;
+    
+    /* Find the logical line containing startPos */
+    i = findWrapCacheLine(cache, startPos);
+    if (i >= 0 && cache->lines[i].length >= 0 &&
+    	    startPos <= wrapCacheLineStart(cache, i) + cache->lines[i].length)
+    	logicalStart = wrapCacheLineStart(cache, i);
+    else
+    	logicalStart = BufStartOfLine(textD->buffer, startPos);
+    
+    /* If startPos is not known to start a display line, find the start of
+       the display line containing it */
+    if (startPosIsLineStart)
+    	lineStart = startPos;
+    else if (!cachedWrappedLineCounter(textD, buf, logicalStart, startPos,
+    	    INT_MAX, True, 0, retPos, retLines, &lineStart, retLineEnd))
+    	return False;
+
+    /* Find where in the logical line counting starts.  If lineStart is not
+       a wrap point the cache knows of, leave it to wrappedLineCounter */
+    i = lookupWrapCacheLine(textD, logicalStart);
+    line = &cache->lines[i];
+    k = 0;
+    if (lineStart != logicalStart) {
+    	for (k=0; k<line->nWraps; k++)
+    	    if (line->wraps[k].newStart >= lineStart - logicalStart)
+    	    	break;
+    	if (k == line->nWraps ||
+    	    	line->wraps[k].newStart != lineStart - logicalStart)
+    	    return False;
+    	k++;
+    }
+    
+    /* Replay the wrap points and newlines in the same way wrappedLineCounter
+       would encounter them */
+    while (True) {
+    	for (; k<line->nWraps; k++) {
+    	    wrap = &line->wraps[k];
+    	    if (logicalStart + wrap->p >= maxPos) {
+    		*retPos = maxPos;
+    		*retLines = maxPos < logicalStart + wrap->newStart ? nLines :
+    			nLines + 1;
+    		*retLineStart = maxPos < logicalStart + wrap->newStart ?
+    			lineStart : logicalStart + wrap->newStart;
+    		*retLineEnd = maxPos;
+    		return True;
+    	    }
+    	    nLines++;
+    	    if (nLines >= maxLines) {
+    		*retPos = logicalStart + wrap->newStart;
+    		*retLines = nLines;
+    		*retLineStart = lineStart;
+    		*retLineEnd = logicalStart + wrap->end;
+    		return True;
+    	    }
+    	    lineStart = logicalStart + wrap->newStart;
+    	}
+    	
+    	newlinePos = logicalStart + line->length;
+    	if (newlinePos >= buf->length)
+    	    break;
+    	if (newlinePos >= maxPos) {
+    	    *retPos = maxPos;
+    	    *retLines = nLines;
+    	    *retLineStart = lineStart;
+    	    *retLineEnd = maxPos;
+    	    return True;
+    	}
+    	nLines++;
+    	if (nLines >= maxLines) {
+    	    *retPos = newlinePos + 1;
+    	    *retLines = nLines;
+    	    *retLineStart = newlinePos + 1;
+    	    *retLineEnd = newlinePos;
+    	    return True;
+    	}
+    	
+    	/* On to the next logical line, which is usually the next in the
+    	   cache */
+    	lineStart = logicalStart = newlinePos + 1;
+    	if (i + 1 < cache->nLines && cache->lines[i+1].length >= 0 &&
+    		wrapCacheLineStart(cache, i+1) == logicalStart)
+    	    i++;
+    	else
+    	    i = lookupWrapCacheLine(textD, logicalStart);
+    	line = &cache->lines[i];
+    	k = 0;
+    }
+    
+    /* reached end of buffer before reaching pos or line target */
+    *retPos = buf->length;
+    *retLines = nLines;
+    *retLineStart = lineStart;
+    *retLineEnd = buf->length;
+    return True;
+}
+
+/*
+** Return the wrap point cache for the current settings of a text display, if
+** wrapping can be cached with them, sharing the cache of another display of
+** the buffer with the same settings, or creating one.  Returns NULL if
+** wrapping can't be cached.
+*/
+static wrapCache *getWrapCache(const textDisp *textD)
+{
+    sharedLayout *layout = textD->layout;
+    wrapCache *cache = textD->wrapCache;
+    int wrapMargin;
+    
+    if (layout == NULL || !textD->continuousWrap ||
+    	    (textD->fixedFontWidth == -1 && textD->wrapMargin == 0)) {
+    	releaseWrapCache((textDisp *)textD);
+    	return NULL;
+    }
+    wrapMargin = textD->wrapMargin != 0 ? textD->wrapMargin :
+    	    textD->width / textD->fixedFontWidth;
+    if (cache != NULL && cache->wrapMargin == wrapMargin &&
+    	    cache->tabDist == textD->buffer->tabDist &&
+    	    cache->nullSubsChar == textD->buffer->nullSubsChar)
+    	return cache;
+    
+    releaseWrapCache((textDisp *)textD);
+    for (cache=layout->wrapCaches; cache!=NULL; cache=cache->next)
+    	if (cache->wrapMargin == wrapMargin &&
+    		cache->tabDist == textD->buffer->tabDist &&
+    		cache->nullSubsChar == textD->buffer->nullSubsChar)
+    	    break;
+    if (cache == NULL) {
+    	cache = (wrapCache *)NEditMalloc(sizeof(wrapCache));
+    	cache->nLines = cache->nAllocated = 0;
+    	cache->lines = NULL;
+    	cache->shiftIndex = cache->shiftDelta = 0;
+    	cache->wrapMargin = wrapMargin;
+    	cache->tabDist = textD->buffer->tabDist;
+    	cache->nullSubsChar = textD->buffer->nullSubsChar;
+    	cache->nUsers = 0;
+    	cache->next = layout->wrapCaches;
+    	layout->wrapCaches = cache;
+    }
+    cache->nUsers++;
+    ((textDisp *)textD)->wrapCache = cache;
+    return cache;
+}
+
+/*
+** Stop using the current wrap point cache of a text display, freeing it if
+** no other display uses it
+*/
+static void releaseWrapCache(textDisp *textD)
+{
+    wrapCache *cache = textD->wrapCache, **prev;
+    
+    if (cache == NULL)
+    	return;
+    textD->wrapCache = NULL;
+    if (--cache->nUsers > 0)
+    	return;
+    for (prev=&textD->layout->wrapCaches; *prev!=cache; prev=&(*prev)->next);
+    *prev = cache->next;
+    freeWrapCache(cache);
+}
+
+static int wrapCacheLineStart(wrapCache *cache, int index)
+{
+    return cache->lines[index].start +
+    	    (index >= cache->shiftIndex ? cache->shiftDelta : 0);
+}
+
+/*
+** Return the index of the last line in the cache starting at or before pos,
+** or -1 if there is none
+*/
+static int findWrapCacheLine(wrapCache *cache, int pos)
+{
+    int lo = 0, hi = cache->nLines - 1, mid;
+    
+    while (lo <= hi) {
+    	mid = (lo + hi) / 2;
+    	if (wrapCacheLineStart(cache, mid) <= pos)
+    	    lo = mid + 1;
+    	else
+    	    hi = mid - 1;
+    }
+    return hi;
+}
+
+/*
+** Return the index of the (valid) cache entry for the logical line starting
+** at lineStart, measuring the line and adding it to the cache if necessary.
+*/
+static int lookupWrapCacheLine(const textDisp *textD, int lineStart)
+{
+    wrapCache *cache = textD->wrapCache;
+    int i, index;
+    
+    /* Look for the line itself, or a free entry at the right place */
+    i = findWrapCacheLine(cache, lineStart);
+    for (index=i; index>=0 && wrapCacheLineStart(cache, index)==lineStart;
+    	    index--)
+    	if (cache->lines[index].length >= 0)
+    	    return index;
+    if (i >= 0 && cache->lines[i].length < 0)
+    	index = i;
+    else if (i + 1 < cache->nLines && cache->lines[i+1].length < 0)
+    	index = i + 1;
+    else {
+    	/* No free entry, make room for one after i */
+    	if (cache->nLines == cache->nAllocated) {
+    	    cache->nAllocated = cache->nAllocated == 0 ? 64 :
+    	    	    cache->nAllocated * 2;
+    	    cache->lines = (wrapCacheLine *)NEditRealloc(cache->lines,
+    	    	    sizeof(wrapCacheLine) * cache->nAllocated);
+    	}
+    	index = i + 1;
+    	memmove(&cache->lines[index+1], &cache->lines[index],
+    	    	sizeof(wrapCacheLine) * (cache->nLines - index));
+    	cache->nLines++;
+    	if (index <= cache->shiftIndex)
+    	    cache->shiftIndex++;
+    	cache->lines[index].wraps = NULL;
+    }
+    
+    cache->lines[index].start = lineStart -
+    	    (index >= cache->shiftIndex ? cache->shiftDelta : 0);
+    measureWrapCacheLine(textD, cache, index);
+    return index;
+}
+
+/*
+** Find the wrap points of a logical line for the cache, in exactly the same
+** way as wrappedLineCounter finds them (using columns rather than pixels)
+*/
+static void measureWrapCacheLine(const textDisp *textD, wrapCache *cache,
+        int index)
+{
+    textBuffer *buf = textD->buffer;
+    wrapCacheLine *line = &cache->lines[index];
+    int start, lineStart, p, b, colNum = 0, foundBreak, newLineStart = 0;
+    int nAllocated = 0, tabDist = buf->tabDist;
+    char nullSubsChar = buf->nullSubsChar;
+    unsigned char c;
+    
+    line->nWraps = 0;
+    NEditFree(line->wraps);
+    line->wraps = NULL;
+    lineStart = start = wrapCacheLineStart(cache, index);
+    for (p=lineStart; p<buf->length; p++) {
+    	c = BufGetCharacter(buf, p);
+    	if (c == '\n')
+    	    break;
+    	colNum += BufCharWidth(c, colNum, tabDist, nullSubsChar);
+    	if (colNum > cache->wrapMargin) {
+    	    foundBreak = False;
+    	    for (b=p; b>=lineStart; b--) {
+    	    	c = BufGetCharacter(buf, b);
+    	    	if (c == '\t' || c == ' ') {
+    	    	    newLineStart = b + 1;
+    	    	    colNum = BufCountDispChars(buf, b+1, p+1);
+    	    	    foundBreak = True;
+    	    	    break;
+    	    	}
+    	    }
+    	    if (!foundBreak) {
+    	    	newLineStart = max(p, lineStart+1);
+    	    	colNum = BufCharWidth(c, colNum, tabDist, nullSubsChar);
+    	    }
+    	    if (line->nWraps == nAllocated) {
+    	    	nAllocated = nAllocated == 0 ? 4 : nAllocated * 2;
+    	    	line->wraps = (wrapPoint *)NEditRealloc(line->wraps,
+    	    	    	sizeof(wrapPoint) * nAllocated);
+    	    }
+    	    line->wraps[line->nWraps].p = p - start;
+    	    line->wraps[line->nWraps].newStart = newLineStart - start;
+    	    line->wraps[line->nWraps].end = (foundBreak ? b : p) - start;
+    	    line->nWraps++;
+    	    lineStart = newLineStart;
+    	}
+    }
+    line->length = p - start;
+}
+
+/*
+** Mark a line of the cache as invalid.  Its recorded start is moved to pos
+** (where the modification invalidating it starts) if it's beyond it, to keep
+** the cache sorted once the lines beyond the modification are moved.
+*/
+static void invalidateWrapCacheLine(wrapCache *cache, int index, int pos)
+{
+    wrapCacheLine *line = &cache->lines[index];
+    
+    line->length = -1;
+    line->nWraps = 0;
+    NEditFree(line->wraps);
+    line->wraps = NULL;
+    if (wrapCacheLineStart(cache, index) > pos)
+    	line->start = pos - (index >= cache->shiftIndex ? cache->shiftDelta : 0);
+}
+
+/*
+** Apply the pending move of lines in the cache, and drop invalid lines
+*/
+static void normalizeWrapCache(wrapCache *cache)
+{
+    int i, n;
+    
+    for (i=0, n=0; i<cache->nLines; i++) {
+    	if (cache->lines[i].length < 0) {
+    	    NEditFree(cache->lines[i].wraps);
+    	    continue;
+    	}
+    	cache->lines[n] = cache->lines[i];
+    	cache->lines[n++].start = wrapCacheLineStart(cache, i);
+    }
+    cache->nLines = n;
+    cache->shiftIndex = n;
+    cache->shiftDelta = 0;
+}
+
+/*
+** Update a wrap point cache for a buffer modification: invalidate the lines
+** touched by the modification, and move the ones beyond it.
+*/
+static void updateWrapCache(wrapCache *cache, int pos, int nInserted,
+	int nDeleted)
+{
+    int i, start;
+    
+    /* Invalidate the lines touching the modified range */
+    i = max(0, findWrapCacheLine(cache, pos));
+    for (; i<cache->nLines; i++) {
+    	start = wrapCacheLineStart(cache, i);
+    	if (start > pos + nDeleted)
+    	    break;
+    	if (cache->lines[i].length >= 0 &&
+    	    	start + cache->lines[i].length >= pos)
+    	    invalidateWrapCacheLine(cache, i, pos);
+    }
+    
+    /* Lines from i on move with the text after the modification */
+    if (cache->shiftIndex != i && cache->shiftDelta != 0) {
+    	normalizeWrapCache(cache);
+    	i = findWrapCacheLine(cache, pos + nDeleted) + 1;
+    }
+    cache->shiftIndex = i;
+    cache->shiftDelta += nInserted - nDeleted;
+}
+
+static void freeWrapCache(wrapCache *cache)
+{
+    int i;
+    
+    for (i=0; i<cache->nLines; i++)
+    	NEditFree(cache->lines[i].wraps);
+    NEditFree(cache->lines);
+    NEditFree(cache);
+}
+
+/*
+** Display column checkpoints of long lines.
+**
+** Finding the x coordinate or display column of a position in a line means
+** adding up the widths of all of the characters before it, which in a line
+** of many megabytes (say, generated or minified data) is too slow to do on
+** every redraw, mouse click and cursor movement.  For such lines, the display
+** columns (as counted by BufCountDispChars) of every LINE_CHECKPOINT_INTERVAL'th
+** character are remembered, so that counting can start from the closest
+** checkpoint.  With a fixed width font, the x coordinate follows directly from
+** the column.  Checkpoints never extend beyond the end of the (logical) line,
+** and modifying the buffer drops those beyond the modification.
+*/
+typedef struct {
+    int lineStart;      /* position the columns are counted from, -1 if
+                           the entry is unused */
+    int lineEnd;        /* offset of the newline (or end of buffer) ending
+                           the line, -1 if not reached yet */
+    int nCheckpoints, nAllocated;
+    int *columns;       /* column of every LINE_CHECKPOINT_INTERVAL'th
+                           character of the line */
+    unsigned lastUsed;
+} lineCheckpoints;
+
+typedef struct _lineCheckpointIndex {
+    lineCheckpoints lines[N_CHECKPOINT_LINES];
+    unsigned useCount;
+} lineCheckpointIndex;
+
+/*
+** Find the last display column checkpoint of the line (or display line)
+** starting at lineStartPos which is at or before character index maxIndex,
+** or at or before column maxColumn, whichever is further into the line, and
+** not beyond lineLen.  Returns the character index of the checkpoint, and
+** its column in "column".  For lines where neither limit reaches beyond
+** LONG_LINE_LEN, returns the start of the line, without keeping checkpoints.
+*/
+static int findLineCheckpoint(textDisp *textD, int lineStartPos, int lineLen,
+        int maxIndex, int maxColumn, int *column)
+{
+    lineCheckpointIndex *index;
+    lineCheckpoints *line = NULL;
+    textBuffer *buf = textD->buffer;
+    int i, p, end, col, lo, hi, mid, n;
+    char c;
+    
+    *column = 0;
+    if (lineStartPos < 0 || textD->layout == NULL ||
+    	    (maxIndex < LONG_LINE_LEN && maxColumn < LONG_LINE_LEN))
+    	return 0;
+    index = textD->layout->lineCheckpoints;
+    
+    /* Find the checkpoints of the line, or the least recently used entry
+       to put them in */
+    if (index == NULL) {
+    	index = (lineCheckpointIndex *)NEditMalloc(sizeof(lineCheckpointIndex));
+    	for (i=0; i<N_CHECKPOINT_LINES; i++) {
+    	    index->lines[i].lineStart = -1;
+    	    index->lines[i].nAllocated = 0;
+    	    index->lines[i].columns = NULL;
+    	    index->lines[i].lastUsed = 0;
+    	}
+    	index->useCount = 0;
+    	textD->layout->lineCheckpoints = index;
+    }
+    for (i=0; i<N_CHECKPOINT_LINES; i++) {
+    	if (index->lines[i].lineStart == lineStartPos) {
+    	    line = &index->lines[i];
+    	    break;
+    	}
+    	if (line == NULL || index->lines[i].lastUsed < line->lastUsed)
+    	    line = &index->lines[i];
+    }
+    if (line->lineStart != lineStartPos) {
+    	line->lineStart = lineStartPos;
+    	line->lineEnd = -1;
+    	line->nCheckpoints = 0;
+    }
+    line->lastUsed = ++index->useCount;
+    if (line->nCheckpoints == 0) {
+    	if (line->nAllocated == 0) {
+    	    line->nAllocated = 64;
+    	    line->columns = (int *)NEditMalloc(sizeof(int) * line->nAllocated);
+    	}
+    	line->columns[0] = 0;
+    	line->nCheckpoints = 1;
+    }
+    
+    /* Add checkpoints until the next one would be beyond both limits, the
+       end of the line, or lineLen */
+    n = line->nCheckpoints;
+    while (line->lineEnd == -1 && n * LINE_CHECKPOINT_INTERVAL <= lineLen &&
+    	    (n * LINE_CHECKPOINT_INTERVAL <= maxIndex ||
+    	    line->columns[n-1] <= maxColumn)) {
+    	col = line->columns[n-1];
+    	end = lineStartPos + n * LINE_CHECKPOINT_INTERVAL;
+    	for (p=end-LINE_CHECKPOINT_INTERVAL; p<end; p++) {
+    	    if (p >= buf->length || (c = BufGetCharacter(buf, p)) == '\n') {
+    		line->lineEnd = p - lineStartPos;
+    		break;
+    	    }
+    	    col += BufCharWidth(c, col, buf->tabDist, buf->nullSubsChar);
+    	}
+    	if (line->lineEnd != -1)
+    	    break;
+    	if (n == line->nAllocated) {
+    	    line->nAllocated *= 2;
+    	    line->columns = (int *)NEditRealloc(line->columns,
+    		    sizeof(int) * line->nAllocated);
+    	}
+    	line->columns[n++] = col;
+    }
+    line->nCheckpoints = n;
+    
+    /* The answer is the further of the last checkpoint at or before
+       maxIndex, and the last one at or before maxColumn */
+    lo = 0;
+    hi = n - 1;
+    while (lo < hi) {
+    	mid = (lo + hi + 1) / 2;
+    	if (line->columns[mid] <= maxColumn)
+    	    lo = mid;
+    	else
+    	    hi = mid - 1;
+    }
+    if (maxIndex >= 0)
+    	lo = max(lo, min(n - 1, maxIndex / LINE_CHECKPOINT_INTERVAL));
+    *column = line->columns[lo];
+    return lo * LINE_CHECKPOINT_INTERVAL;
+}
+
+/*
+** Count the display columns from lineStartPos to pos, as BufCountDispChars
+** does, starting from the closest column checkpoint in long lines
+*/
+static int lineColumn(textDisp *textD, int lineStartPos, int pos)
+{
+    textBuffer *buf = textD->buffer;
+    int column, p;
+    
+    p = lineStartPos + findLineCheckpoint(textD, lineStartPos,
+    	    pos - lineStartPos, pos - lineStartPos, -1, &column);
+    for (; p < pos && p < buf->length; p++)
+    	column += BufCharWidth(BufGetCharacter(buf, p), column, buf->tabDist,
+    		buf->nullSubsChar);
+    return column;
+}
+
+/*
+** Find the position "column" display columns into the line starting at
+** lineStartPos, as BufCountForwardDispChars does, starting from the closest
+** column checkpoint in long lines
+*/
+static int lineColumnToPos(textDisp *textD, int lineStartPos, int column)
+{
+    textBuffer *buf = textD->buffer;
+    int col, pos;
+    char c;
+    
+    pos = lineStartPos + findLineCheckpoint(textD, lineStartPos, INT_MAX, -1,
+    	    column, &col);
+    while (col < column && pos < buf->length) {
+    	c = BufGetCharacter(buf, pos);
+    	if (c == '\n')
+    	    return pos;
+    	col += BufCharWidth(c, col, buf->tabDist, buf->nullSubsChar);
+    	pos++;
+    }
+    return pos;
+}
+
+/*
+** Drop the column checkpoints which are no longer valid after a buffer
+** modification, and move the ones of lines beyond it
+*/
+static void updateLineCheckpoints(lineCheckpointIndex *index, int pos,
+	int nInserted, int nDeleted)
+{
+    lineCheckpoints *line;
+    int i;
+    
+    for (i=0; i<N_CHECKPOINT_LINES; i++) {
+    	line = &index->lines[i];
+    	if (line->lineStart == -1)
+    	    continue;
+    	if (line->lineStart > pos + nDeleted)
+    	    line->lineStart += nInserted - nDeleted;
+    	else if (line->lineStart > pos)
+    	    line->lineStart = -1;
+    	else if (line->lineEnd == -1 || pos <= line->lineStart + line->lineEnd) {
+    	    line->nCheckpoints = min(line->nCheckpoints,
+    		    (pos - line->lineStart) / LINE_CHECKPOINT_INTERVAL + 1);
+    	    line->lineEnd = -1;
+    	}
+    }
+}
+
+static void freeLineCheckpoints(lineCheckpointIndex *index)
+{
+    int i;
+    
+    for (i=0; i<N_CHECKPOINT_LINES; i++)
+    	NEditFree(index->lines[i].columns);
+    NEditFree(index);
+}
+
+/*
+** Attach a text display to the shared layout of its buffer, creating the
+** layout if it's the first display of the buffer
+*/
+static void attachSharedLayout(textDisp *textD)
+{
+    sharedLayout *layout;
+    
+    for (layout=SharedLayouts; layout!=NULL; layout=layout->next)
+    	if (layout->buffer == textD->buffer)
+    	    break;
+    if (layout == NULL) {
+    	layout = (sharedLayout *)NEditMalloc(sizeof(sharedLayout));
+    	layout->buffer = textD->buffer;
+    	layout->nDisplays = 0;
+    	layout->wrapCaches = NULL;
+    	layout->lineCheckpoints = NULL;
+    	layout->next = SharedLayouts;
+    	SharedLayouts = layout;
+    	
+    	/* Ahead of all other modify callbacks, so no one can count lines
+    	   or columns using stale information */
+    	BufAddHighPriorityModifyCB(textD->buffer, sharedLayoutModifiedCB,
+    		layout);
+    }
+    layout->nDisplays++;
+    textD->layout = layout;
+    textD->wrapCache = NULL;
+}
+
+/*
+** Detach a text display from the shared layout of its buffer, freeing the
+** layout when it was the last display of the buffer
+*/
+static void detachSharedLayout(textDisp *textD)
+{
+    sharedLayout *layout = textD->layout, **prev;
+    
+    if (layout == NULL)
+    	return;
+    releaseWrapCache(textD);
+    textD->layout = NULL;
+    if (--layout->nDisplays > 0)
+    	return;
+    BufRemoveModifyCB(layout->buffer, sharedLayoutModifiedCB, layout);
+    while (layout->wrapCaches != NULL) {
+    	wrapCache *cache = layout->wrapCaches;
+    	layout->wrapCaches = cache->next;
+    	freeWrapCache(cache);
+    }
+    if (layout->lineCheckpoints != NULL)
+    	freeLineCheckpoints(layout->lineCheckpoints);
+    for (prev=&SharedLayouts; *prev!=layout; prev=&(*prev)->next);
+    *prev = layout->next;
+    NEditFree(layout);
+}
+
+/*
+** Callback attached to the text buffer to update the shared layout for a
+** buffer modification
+*/
+static void sharedLayoutModifiedCB(int pos, int nInserted, int nDeleted,
+	int nRestyled, const char *deletedText, void *cbArg)
+{
+    sharedLayout *layout = (sharedLayout *)cbArg;
+    wrapCache *cache;
+    
+    if (nInserted == 0 && nDeleted == 0)
+    	return;
+    for (cache=layout->wrapCaches; cache!=NULL; cache=cache->next)
+    	updateWrapCache(cache, pos, nInserted, nDeleted);
+    if (layout->lineCheckpoints != NULL)
+    	updateLineCheckpoints(layout->lineCheckpoints, pos, nInserted,
+    		nDeleted);
+}
+
+/*
+** Fill in the character width tables for the current primary font and style
+** table fonts of a text display.  Styles sharing a font share its table.
+*/
+static void setFontWidths(textDisp *textD)
+{
+    fontWidths *fw;
+    XFontStruct *fs;
+    int i, j, n, nStyles = textD->styleTable == NULL ? 0 : textD->nStyles;
+    char c;
+    
+    freeFontWidths(textD);
+    fw = (fontWidths *)NEditMalloc(sizeof(fontWidths));
+    fw->fonts = (XFontStruct **)NEditMalloc(sizeof(XFontStruct *) *
+    	    (nStyles + 1));
+    fw->widths = (short (*)[256])NEditMalloc(sizeof(short[256]) *
+    	    (nStyles + 1));
+    fw->styleWidths = (short **)NEditMalloc(sizeof(short *) * (nStyles + 1));
+    fw->nFonts = 0;
+    for (i=0; i<=nStyles; i++) {
+    	fs = i == 0 || textD->styleTable[i-1].font == NULL ?
+    		textD->fontStruct : textD->styleTable[i-1].font;
+    	for (n=0; n<fw->nFonts; n++)
+    	    if (fw->fonts[n] == fs)
+    		break;
+    	if (n == fw->nFonts) {
+    	    for (j=0; j<256; j++) {
+    		c = (char)j;
+    		fw->widths[n][j] = XTextWidth(fs, &c, 1);
+    	    }
+    	    fw->fonts[fw->nFonts++] = fs;
+    	}
+    	fw->styleWidths[i] = fw->widths[n];
+    }
+    textD->fontWidths = fw;
+}
+
+static void freeFontWidths(textDisp *textD)
+{
+    if (textD->fontWidths == NULL)
+    	return;
+    NEditFree(textD->fontWidths->fonts);
+    NEditFree(textD->fontWidths->widths);
+    NEditFree(textD->fontWidths->styleWidths);
+    NEditFree(textD->fontWidths);
+    textD->fontWidths = NULL;
+}
+
 /*
 ** Measure the width in pixels of a character "c" at a particular column
 ** "colNum" and buffer position "pos".  This is for measuring characters in
@@ -127,6 +127,8 @@ typedef struct _textDisp {
     					   primary font + all-highlight fonts */
     int fixedFontWidth;			/* Font width if all current fonts are
     					   fixed and match in width, else -1 */
+    struct _fontWidths *fontWidths;	/* Character widths in the primary
+    					   font and the style fonts */
     Widget hScrollBar, vScrollBar;
     GC gc, selectGC, highlightGC;	/* GCs for drawing text */
     GC selectBGGC, highlightBGGC;	/* GCs for erasing text */
@@ -160,6 +162,28 @@ typedef struct _textDisp {
     Boolean pointerHidden;              /* true if the mouse pointer is 
                                            hidden */
     graphicExposeTranslationEntry *graphicsExposeQueue;
+    struct _sharedLayout *layout;       /* Layout information shared with
+                                           other displays of the buffer */
+    struct _wrapCache *wrapCache;       /* Wrap points of the lines measured
+                                           so far in continuous wrap mode
+                                           (part of layout) */
+    int redisplayStart, redisplayEnd;   /* Text waiting to be redrawn by the
+                                           redisplay scheduler, -1 if none */
+    Boolean redisplayAll;               /* Whole display waiting to be redrawn */
+    Boolean redisplayLineNums;          /* Line numbers waiting to be redrawn */
+    XtWorkProcId redisplayProcID;       /* Work proc and timer flushing the */
+    XtIntervalId redisplayTimerID;      /* redisplay scheduler, 0 if none */
+    unsigned long linesRequested;       /* Lines asked of the redisplay */
+    unsigned long linesPainted;         /* scheduler, and lines it painted */
+    Pixmap backingStore;                /* Off-screen copy of the text area
+                                           which text is drawn in, and
+                                           exposures and scrolling are served
+                                           from, or None if not in use */
+    GC backingGC;                       /* GC for filling and copying it */
+    int backingWidth, backingHeight;    /* Size of the backing store */
+    char *backingLineValid;             /* For each visible line, whether the
+                                           backing store holds its image */
+    int nBackingLines;                  /* Lines in backingLineValid */
 } textDisp;
 
 textDisp *TextDCreate(Widget widget, Widget hScrollBar, Widget vScrollBar,
@@ -184,6 +208,9 @@ int TextDMaxFontWidth(textDisp *textD, Boolean considerStyles);
 void TextDResize(textDisp *textD, int width, int height);
 void TextDRedisplayRect(textDisp *textD, int left, int top, int width,
 	int height);
+void TextDExposeRect(textDisp *textD, int left, int top, int width,
+	int height);
+void TextDSetBackingStore(textDisp *textD, int state);
 void TextDSetScroll(textDisp *textD, int topLineNum, int horizOffset);
 void TextDGetScroll(textDisp *textD, int *topLineNum, int *horizOffset);
 void TextDInsert(textDisp *textD, char *text);
@@ -198,7 +225,7 @@ int TextDLineAndColToPos(textDisp *textD, int lineNum, int column);
 int TextDOffsetWrappedColumn(textDisp *textD, int row, int column);
 int TextDOffsetWrappedRow(textDisp *textD, int row);
 int TextDPositionToXY(textDisp *textD, int pos, int *x, int *y);
-int TextDPosToLineAndCol(textDisp *textD, int pos, int *lineNum, int *column);
+void TextDPosToLineAndCol(textDisp *textD, int pos, int *lineNum, int *column);
 int TextDInSelection(textDisp *textD, int x, int y);
 void TextDMakeInsertPosVisible(textDisp *textD);
 int TextDMoveRight(textDisp *textD);
@@ -224,6 +251,8 @@ void TextDSetLineNumberArea(textDisp *textD, int lineNumLeft, int lineNumWidth,
 void TextDMaintainAbsLineNum(textDisp *textD, int state);
 int TextDPosOfPreferredCol(textDisp *textD, int column, int lineStartPos);
 int TextDPreferredColumn(textDisp *textD, int *visLineNum, int *lineStartPos);
+void TextDGetRedisplayCounts(textDisp *textD, unsigned long *linesRequested,
+        unsigned long *linesPainted);
 
 #ifdef VMS /* VMS linker doesn't like long names (>31 chars) */
 #define TextDImposeGraphicsExposeTranslation TextDGraphicsExposeTranslation
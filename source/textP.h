@@ -78,6 +78,7 @@ typedef struct _TextPart {
     int lineNumCols;
     char *delimiters;
     Cardinal cursorVPadding;
+    Boolean backingStore;
     Widget hScrollBar, vScrollBar;
     XtCallbackList focusInCB;
     XtCallbackList focusOutCB;
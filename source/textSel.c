@@ -82,19 +82,66 @@ typedef struct {
     int length;
 } selectNotifyInfo;
 
+/* Largest piece of the primary selection handed to Xt at one time.  Larger
+   selections are sent to the requestor in pieces of this size (or of the
+   largest size the server allows, if that is smaller), using the ICCCM INCR
+   protocol, so the full text never has to be copied out of the buffer */
+#define SEL_CHUNK_SIZE 65536
+
+/* State of a primary selection transfer in progress, one per request.  For
+   ordinary selections, the text is read from the buffer a piece at a time,
+   between "pos" and "end".  Rectangular selections are collected when the
+   transfer starts (in "text"), since they are not contiguous in the buffer */
+typedef struct _selTransfer {
+    Widget widget;
+    XtRequestId id;
+    int started;		/* data has been sent for this request */
+    int finished;		/* all of the data has been sent */
+    int pos, end;		/* remaining range of buffer to send */
+    char *text;			/* collected text of rectangular selection */
+    int textPos, textLen;
+    XtPointer value;		/* last piece handed to Xt, freed on the next
+    				   call or when the transfer is complete */
+    struct _selTransfer *next;
+} selTransfer;
+
+/* Text of the primary selection being received (possibly in pieces) from
+   another selection owner for insertion at the cursor */
+typedef struct {
+    int isColumnar;
+    int failed;			/* a piece of the wrong type arrived, ignore
+    				   the rest of the transfer */
+    char *string;
+    int length;
+    int allocated;
+} selReceive;
+
+static selTransfer *SelTransfers = NULL;
+
 static void modifiedCB(int pos, int nInserted, int nDeleted,
 	int nRestyled, const char *deletedText, void *cbArg);
+static void insertSelectionText(Widget w, char *string, int length,
+	int isColumnar);
 static void sendSecondary(Widget w, Time time, Atom sel, int action,
 	char *actionText, int actionTextLen);
 static void getSelectionCB(Widget w, XtPointer clientData, Atom *selType,
 	Atom *type, XtPointer value, unsigned long *length, int *format);
+static void getIncrSelectionCB(Widget w, XtPointer clientData, Atom *selType,
+	Atom *type, XtPointer value, unsigned long *length, int *format);
 static void getInsertSelectionCB(Widget w, XtPointer clientData,Atom *selType,
 	Atom *type, XtPointer value, unsigned long *length, int *format);
 static void getExchSelCB(Widget w, XtPointer clientData, Atom *selType,
 	Atom *type, XtPointer value, unsigned long *length, int *format);
 static Boolean convertSelectionCB(Widget w, Atom *selType, Atom *target,
-	Atom *type, XtPointer *value, unsigned long *length, int *format);
-static void loseSelectionCB(Widget w, Atom *selType);
+	Atom *type, XtPointer *value, unsigned long *length, int *format,
+	unsigned long *maxLength, XtPointer clientData, XtRequestId *requestID);
+static void loseSelectionCB(Widget w, Atom *selType, XtPointer clientData);
+static void selectionDoneCB(Widget w, Atom *selType, Atom *target,
+	XtRequestId *requestID, XtPointer clientData);
+static void cancelSelectionCB(Widget w, Atom *selType, Atom *target,
+	XtRequestId *requestID, XtPointer clientData);
+static selTransfer *findTransfer(Widget w, XtRequestId id, int create);
+static void freeTransfer(Widget w, XtRequestId id);
 static Boolean convertSecondaryCB(Widget w, Atom *selType, Atom *target,
 	Atom *type, XtPointer *value, unsigned long *length, int *format);
 static void loseSecondaryCB(Widget w, Atom *selType);
@@ -205,15 +252,23 @@ void CopyToClipboard(Widget w, Time time)
 */
 void InsertPrimarySelection(Widget w, Time time, int isColumnar)
 {
-   static int isColFlag;
+   selReceive *recv;
 
    /* Theoretically, strange things could happen if the user managed to get
       in any events between requesting receiving the selection data, however,
-      getSelectionCB simply inserts the selection at the cursor.  Don't
-      bother with further measures until real problems are observed. */
-   isColFlag = isColumnar;
-   XtGetSelectionValue(w, XA_PRIMARY, XA_STRING, getSelectionCB, &isColFlag,
-   	    time);
+      getIncrSelectionCB simply inserts the selection at the cursor.  Don't
+      bother with further measures until real problems are observed.  The
+      selection is requested incrementally, so large selections arrive in
+      pieces which are collected directly, rather than being reassembled by
+      Xt and then copied again here */
+   recv = (selReceive *)NEditMalloc(sizeof(selReceive));
+   recv->isColumnar = isColumnar;
+   recv->failed = False;
+   recv->string = NULL;
+   recv->length = 0;
+   recv->allocated = 0;
+   XtGetSelectionValueIncremental(w, XA_PRIMARY, XA_STRING,
+   	    getIncrSelectionCB, (XtPointer)recv, time);
 }
 
 /*
@@ -395,9 +450,12 @@ static void modifiedCB(int pos, int nInserted, int nDeleted,
        is really only for when the widget is destroyed to avoid a convert
        callback from firing at a bad time. */
 
-    /* Take ownership of the selection */
-    if (!XtOwnSelection((Widget)w, XA_PRIMARY, time, convertSelectionCB,
-    	    loseSelectionCB, NULL))
+    /* Take ownership of the selection.  The selection is served
+       incrementally, so that large selections can be streamed from the
+       buffer rather than copied out of it in one piece */
+    if (!XtOwnSelectionIncremental((Widget)w, XA_PRIMARY, time,
+    	    convertSelectionCB, loseSelectionCB, selectionDoneCB,
+    	    cancelSelectionCB, NULL))
     	BufUnselect(w->text.textD->buffer);
     else
     	w->text.selectionOwner = True;
@@ -459,9 +517,7 @@ static void sendSecondary(Widget w, Time time, Atom sel, int action,
 static void getSelectionCB(Widget w, XtPointer clientData, Atom *selType,
 	Atom *type, XtPointer value, unsigned long *length, int *format)
 {
-    textDisp *textD = ((TextWidget)w)->text.textD;
     int isColumnar = *(int *)clientData;
-    int cursorLineStart, cursorPos, column, row;
     char *string;
  
     /* Confirm that the returned value is of the correct type */
@@ -476,13 +532,97 @@ static void getSelectionCB(Widget w, XtPointer clientData, Atom *selType,
     string = (char*)NEditMalloc(*length + 1);
     memcpy(string, (char *)value, *length);
     string[*length] = '\0';
+    insertSelectionText(w, string, *length, isColumnar);
+    NEditFree(string);
+    
+    /* The selection requstor is required to free the memory passed
+       to it via value */
+    NEditFree(value);
+}
+
+/*
+** Called (repeatedly) as pieces of the PRIMARY selection arrive from an
+** incremental request made by InsertPrimarySelection.  The pieces are
+** collected in the selReceive structure passed as clientData, and inserted
+** at the cursor when the final (zero length) piece arrives.  The text is
+** inserted in one operation, rather than as it arrives, so that it can be
+** undone as a single change.
+*/
+static void getIncrSelectionCB(Widget w, XtPointer clientData, Atom *selType,
+	Atom *type, XtPointer value, unsigned long *length, int *format)
+{
+    selReceive *recv = (selReceive *)clientData;
+    int newSize;
+ 
+    /* If the transfer failed, this is the last call, give up and throw away
+       what has been received so far */
+    if (*type == XT_CONVERT_FAIL || value == NULL) {
+        NEditFree(value);
+        NEditFree(recv->string);
+        NEditFree(recv);
+    	return;
+    }
+    
+    /* A zero length piece marks the end of the transfer, insert the
+       accumulated text (if any, and if all of it was usable) */
+    if (*length == 0) {
+        NEditFree(value);
+        if (recv->string != NULL && !recv->failed) {
+            recv->string[recv->length] = '\0';
+            insertSelectionText(w, recv->string, recv->length,
+            	    recv->isColumnar);
+        }
+        NEditFree(recv->string);
+        NEditFree(recv);
+        return;
+    }
+    
+    /* If the value is not of the correct type, throw away what has been
+       received so far, and ignore the remaining pieces.  Xt still calls
+       with them, and with the final zero length piece, so recv must be
+       kept until then */
+    if (recv->failed || *type != XA_STRING || *format != 8) {
+        recv->failed = True;
+        NEditFree(recv->string);
+        recv->string = NULL;
+        recv->length = recv->allocated = 0;
+        NEditFree(value);
+        return;
+    }
+    
+    /* Append the piece, growing the receive buffer geometrically, with room
+       for the terminating null character */
+    if (recv->length + (int)*length + 1 > recv->allocated) {
+        newSize = recv->allocated * 2;
+        if (newSize < recv->length + (int)*length + 1)
+            newSize = recv->length + (int)*length + 1;
+        recv->string = (char *)NEditRealloc(recv->string, newSize);
+        recv->allocated = newSize;
+    }
+    memcpy(recv->string + recv->length, (char *)value, *length);
+    recv->length += *length;
+    
+    /* The selection requstor is required to free the memory passed
+       to it via value */
+    NEditFree(value);
+}
+
+/*
+** Insert "string" (of length "length", null terminated), received from the
+** selection owner, at the cursor in text widget "w".  If "isColumnar", the
+** text is inserted as a rectangle at the column of the last button press.
+** "string" may be modified to substitute for ascii-nul characters.
+*/
+static void insertSelectionText(Widget w, char *string, int length,
+	int isColumnar)
+{
+    textDisp *textD = ((TextWidget)w)->text.textD;
+    int cursorLineStart, cursorPos, column, row;
     
     /* If the string contains ascii-nul characters, substitute something
        else, or give up, warn, and refuse */
-    if (!BufSubstituteNullChars(string, *length, textD->buffer)) {
+    if (!BufSubstituteNullChars(string, length, textD->buffer)) {
 	fprintf(stderr, "Too much binary data, giving up\n");
-	NEditFree(string);
-	NEditFree(value);
 	return;
     }
     
@@ -497,11 +637,6 @@ static void getSelectionCB(Widget w, XtPointer clientData, Atom *selType,
     } else
     	TextInsertAtCursor(w, string, NULL, False,
 		((TextWidget)w)->text.autoWrapPastedText);
-    NEditFree(string);
-    
-    /* The selection requstor is required to free the memory passed
-       to it via value */
-    NEditFree(value);
 }
 
 /*
@@ -577,37 +712,114 @@ static void getExchSelCB(Widget w, XtPointer clientData, Atom *selType,
 /*
 ** Selection converter procedure used by the widget when it is the selection
 ** owner to provide data in the format requested by the selection requestor.
+** This is an incremental converter: Xt calls it repeatedly for the same
+** request (identified by requestID) until it returns a zero length value.
+** Text is returned in pieces of at most *maxLength bytes, read directly from
+** the buffer, so large selections are never copied out in their entirety.
 **
-** Note: Memory left in the *value field is freed by Xt as long as there is no
-** done_proc procedure registered in the XtOwnSelection call where this
-** procdeure is registered
+** Note: Because a done_proc is registered in the XtOwnSelectionIncremental
+** call, memory returned in the *value field belongs to the widget.  It is
+** kept in the request's selTransfer structure and freed on the next call or
+** when the transfer is done or cancelled.
 */
 static Boolean convertSelectionCB(Widget w, Atom *selType, Atom *target,
-	Atom *type, XtPointer *value, unsigned long *length, int *format)
+	Atom *type, XtPointer *value, unsigned long *length, int *format,
+	unsigned long *maxLength, XtPointer clientData, XtRequestId *requestID)
 {
-    XSelectionRequestEvent *event = XtGetSelectionRequest(w, *selType, 0);
+    XSelectionRequestEvent *event;
     textBuffer *buf = ((TextWidget)w)->text.textD->buffer;
     Display *display = XtDisplay(w);
+    selTransfer *xfer = findTransfer(w, *requestID, True);
     Atom *targets, dummyAtom;
     unsigned long nItems, dummyULong;
     Atom *reqAtoms;
-    int getFmt, result = INSERT_WAITING;
+    int getFmt, result = INSERT_WAITING, rectStart, rectEnd, isRect;
+    int start, end, chunkLen;
     XEvent nextEvent;
     
+    /* Free the piece returned on the previous call for this request */
+    NEditFree(xfer->value);
+    xfer->value = NULL;
+    
+    /* If everything has been sent, return the zero length value which tells
+       Xt that the transfer is complete */
+    if (xfer->finished) {
+    	xfer->value = NEditMalloc(1);
+    	*value = xfer->value;
+    	*length = 0;
+    	*format = 8;
+    	*type = *target == getAtom(display, A_TARGETS) ? XA_ATOM :
+    	    	(*target == XA_STRING || *target == getAtom(display, A_TEXT) ||
+    	    	*target == getAtom(display, A_COMPOUND_TEXT)) ? XA_STRING :
+    	    	*target;
+    	return True;
+    }
+    
     /* target is text, string, or compound text */
     if (*target == XA_STRING || *target == getAtom(display, A_TEXT) ||
         *target == getAtom(display, A_COMPOUND_TEXT)) {
         /* We really don't directly support COMPOUND_TEXT, but recent
            versions gnome-terminal incorrectly ask for it, even though
            don't declare that we do.  Just reply in string format. */
+        
+        /* On the first call, note the extent of the selection.  Rectangular
+           selections are not contiguous in the buffer, so they are
+           collected here and sent from the copy */
+        if (!xfer->started) {
+            xfer->started = True;
+            if (!BufGetSelectionPos(buf, &start, &end, &isRect, &rectStart,
+            	    &rectEnd))
+            	start = end = 0;
+            if (isRect) {
+            	xfer->text = BufGetSelectionText(buf);
+            	xfer->textLen = strlen(xfer->text);
+            	BufUnsubstituteNullChars(xfer->text, buf);
+            } else {
+            	xfer->pos = start;
+            	xfer->end = end;
+            }
+        }
+        
+        /* Hand Xt the next piece, no larger than the requestor can accept
+           in a single property change.  The buffer may have been modified
+           since the transfer started, so don't read beyond its end */
+        chunkLen = *maxLength < SEL_CHUNK_SIZE ? (int)*maxLength :
+        	SEL_CHUNK_SIZE;
+        if (chunkLen < 1)
+            chunkLen = 1;
+        if (xfer->text != NULL) {
+            if (chunkLen > xfer->textLen - xfer->textPos)
+            	chunkLen = xfer->textLen - xfer->textPos;
+            xfer->value = NEditMalloc(chunkLen + 1);
+            memcpy(xfer->value, xfer->text + xfer->textPos, chunkLen);
+            xfer->textPos += chunkLen;
+            if (xfer->textPos >= xfer->textLen)
+            	xfer->finished = True;
+        } else {
+            if (xfer->end > buf->length)
+            	xfer->end = buf->length;
+            if (xfer->pos > xfer->end)
+            	xfer->pos = xfer->end;
+            if (chunkLen > xfer->end - xfer->pos)
+            	chunkLen = xfer->end - xfer->pos;
+            xfer->value = (XtPointer)BufGetRange(buf, xfer->pos,
+            	    xfer->pos + chunkLen);
+            BufUnsubstituteNullChars(xfer->value, buf);
+            xfer->pos += chunkLen;
+            if (xfer->pos >= xfer->end)
+            	xfer->finished = True;
+        }
     	*type = XA_STRING;
-    	*value = (XtPointer)BufGetSelectionText(buf);
-    	*length = strlen((char *)*value);
+    	*value = xfer->value;
+    	*length = chunkLen;
     	*format = 8;
-	BufUnsubstituteNullChars(*value, buf);
     	return True;
     }
     
+    /* The remaining targets are sent in one piece.  If Xt asks for more, the
+       zero length value above ends the transfer */
+    xfer->finished = True;
+    
     /* target is "TARGETS", return a list of targets we can handle */
     if (*target == getAtom(display, A_TARGETS)) {
 	targets = (Atom *)NEditMalloc(sizeof(Atom) * N_SELECT_TARGETS);
@@ -618,6 +830,7 @@ static Boolean convertSelectionCB(Widget w, Atom *selType, Atom *target,
 	targets[4] = getAtom(display, A_TIMESTAMP);
 	targets[5] = getAtom(display, A_INSERT_SELECTION);
 	targets[6] = getAtom(display, A_DELETE);
+	xfer->value = (XtPointer)targets;
 	*type = XA_ATOM;
 	*value = (XtPointer)targets;
 	*length = N_SELECT_TARGETS;
@@ -631,16 +844,23 @@ static Boolean convertSelectionCB(Widget w, Atom *selType, Atom *target,
        2) initiate a get value request for the selection and target named
        in the property, and WAIT until it completes */
     if (*target == getAtom(display, A_INSERT_SELECTION)) {
-	if (((TextWidget)w)->text.readOnly)
+	if (((TextWidget)w)->text.readOnly) {
+	    freeTransfer(w, *requestID);
 	    return False;
+	}
+	event = XtGetSelectionRequest(w, *selType, *requestID);
 	if (XGetWindowProperty(event->display, event->requestor,
 		event->property, 0, 2, False, AnyPropertyType, &dummyAtom,
 		&getFmt, &nItems, &dummyULong,
 		(unsigned char **)&reqAtoms) != Success ||
-		getFmt != 32 || nItems != 2)
+		getFmt != 32 || nItems != 2) {
+	    freeTransfer(w, *requestID);
 	    return False;
-	if (reqAtoms[1] != XA_STRING)
+	}
+	if (reqAtoms[1] != XA_STRING) {
+	    freeTransfer(w, *requestID);
 	    return False;
+	}
 	XtGetSelectionValue(w, reqAtoms[0], reqAtoms[1],
 		getInsertSelectionCB, &result, event->time);
 	XFree((char *)reqAtoms);
@@ -652,7 +872,11 @@ static Boolean convertSelectionCB(Widget w, Atom *selType, Atom *target,
 	*format = 8;
 	*value = NULL;
 	*length = 0;
-	return result == SUCCESSFUL_INSERT;
+	if (result != SUCCESSFUL_INSERT) {
+	    freeTransfer(w, *requestID);
+	    return False;
+	}
+	return True;
     }
     
     /* target is "DELETE": delete primary selection */
@@ -666,11 +890,13 @@ static Boolean convertSelectionCB(Widget w, Atom *selType, Atom *target,
     }
     
     /* targets TIMESTAMP and MULTIPLE are handled by the toolkit, any
-       others are unrecognized, return False */
+       others are unrecognized, return False.  Xt won't call back about
+       refused requests, so free the transfer state here */
+    freeTransfer(w, *requestID);
     return False;
 }
 
-static void loseSelectionCB(Widget w, Atom *selType)
+static void loseSelectionCB(Widget w, Atom *selType, XtPointer clientData)
 {
     TextWidget tw = (TextWidget)w;
     selection *sel = &tw->text.textD->buffer->primary;
@@ -683,6 +909,73 @@ static void loseSelectionCB(Widget w, Atom *selType)
     sel->zeroWidth = zeroWidth;
 }
 
+/*
+** Called by Xt when the requestor has received all of the data for a
+** primary selection request (selectionDoneCB), or when the transfer is
+** abandoned, for example because the requestor stopped responding
+** (cancelSelectionCB).  Frees the transfer state.
+*/
+static void selectionDoneCB(Widget w, Atom *selType, Atom *target,
+	XtRequestId *requestID, XtPointer clientData)
+{
+    freeTransfer(w, *requestID);
+}
+
+static void cancelSelectionCB(Widget w, Atom *selType, Atom *target,
+	XtRequestId *requestID, XtPointer clientData)
+{
+    freeTransfer(w, *requestID);
+}
+
+/*
+** Find the state of the primary selection transfer for request "id" to
+** widget "w".  If there is none and "create" is True, start a new one.
+*/
+static selTransfer *findTransfer(Widget w, XtRequestId id, int create)
+{
+    selTransfer *xfer;
+    
+    for (xfer=SelTransfers; xfer!=NULL; xfer=xfer->next)
+    	if (xfer->widget == w && xfer->id == id)
+    	    return xfer;
+    if (!create)
+    	return NULL;
+    xfer = (selTransfer *)NEditMalloc(sizeof(selTransfer));
+    xfer->widget = w;
+    xfer->id = id;
+    xfer->started = False;
+    xfer->finished = False;
+    xfer->pos = xfer->end = 0;
+    xfer->text = NULL;
+    xfer->textPos = xfer->textLen = 0;
+    xfer->value = NULL;
+    xfer->next = SelTransfers;
+    SelTransfers = xfer;
+    return xfer;
+}
+
+/*
+** Free the state of the primary selection transfer for request "id" to
+** widget "w", along with any data still held for it.
+*/
+static void freeTransfer(Widget w, XtRequestId id)
+{
+    selTransfer *xfer, *prev = NULL;
+    
+    for (xfer=SelTransfers; xfer!=NULL; prev=xfer, xfer=xfer->next) {
+    	if (xfer->widget == w && xfer->id == id) {
+    	    if (prev == NULL)
+    	    	SelTransfers = xfer->next;
+    	    else
+    	    	prev->next = xfer->next;
+    	    NEditFree(xfer->text);
+    	    NEditFree(xfer->value);
+    	    NEditFree(xfer);
+    	    return;
+    	}
+    }
+}
+
 /*
 ** Selection converter procedure used by the widget to (temporarily) provide
 ** the secondary selection data to a single requestor who has been asked
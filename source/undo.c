@@ -41,6 +41,7 @@
 #include "preferences.h"
 #include "../util/nedit_malloc.h"
 
+#include <stdio.h>
 #include <string.h>
 #ifdef VMS
 #include "../util/VMSparam.h"
@@ -61,6 +62,18 @@
 #define FORWARD 1
 #define REVERSE 2
 
+#define SPILL_COPY_SIZE 65536	/* buffer size for copying spilled text */
+#define SPILL_COMPACT_MIN 1048576 /* file size below which holes left by
+				     freed records are not worth reclaiming */
+
+/* When a window's undo text exceeds the memory budget, the text of its
+   oldest records is written to a temporary file shared by all windows, and
+   read back when the record is undone.  The file is created on demand and
+   removed as soon as no record refers to it any more */
+static FILE *SpillFile = NULL;
+static long SpillFileEnd = 0;	/* end of the text written to SpillFile */
+static long SpillFileLive = 0;	/* amount of it still held by undo records */
+
 static void addUndoItem(WindowInfo *window, UndoInfo *undo);
 static void addRedoItem(WindowInfo *window, UndoInfo *redo);
 static void removeUndoItem(WindowInfo *window);
@@ -70,6 +83,14 @@ static void appendDeletedText(WindowInfo *window, const char *deletedText,
 static void trimUndoList(WindowInfo *window, int maxLength);
 static int determineUndoType(int nInserted, int nDeleted);
 static void freeUndoRecord(UndoInfo *undo);
+static void spillUndoList(WindowInfo *window, int budget);
+static void trimSpilledUndo(WindowInfo *window);
+static int spillUndoText(WindowInfo *window, UndoInfo *undo);
+static int loadUndoText(WindowInfo *window, UndoInfo *undo);
+static void releaseSpillText(UndoInfo *undo);
+static long copySpillText(FILE *from, long fromPos, FILE *to, long toPos,
+	int length);
+static void compactSpillFile(void);
 
 void Undo(WindowInfo *window)
 {
@@ -80,6 +101,14 @@ void Undo(WindowInfo *window)
     if (undo == NULL)
     	return;
     
+    /* bring back the saved text if it was moved out to the spill file.  If
+       it can't be read, none of the older records can be undone either */
+    if (!loadUndoText(window, undo)) {
+    	XBell(TheDisplay, 0);
+    	ClearUndoList(window);
+    	return;
+    }
+    
     /* BufReplace will eventually call SaveUndoInformation.  This is mostly
        good because it makes accumulating redo operations easier, however
        SaveUndoInformation needs to know that it is being called in the context
@@ -91,7 +120,7 @@ void Undo(WindowInfo *window)
     BufReplace(window->buffer, undo->startPos, undo->endPos,
     	    (undo->oldText != NULL ? undo->oldText : ""));
     
-    restoredTextLength = undo->oldText != NULL ? strlen(undo->oldText) : 0;
+    restoredTextLength = undo->oldLen > 0 ? undo->oldLen - 1 : 0;
     if (!window->buffer->primary.selected || GetPrefUndoModifiesSelection()) {
 	/* position the cursor in the focus pane after the changed text
 	   to show the user where the undo was done */
@@ -141,7 +170,7 @@ void Redo(WindowInfo *window)
     BufReplace(window->buffer, redo->startPos, redo->endPos,
     	    (redo->oldText != NULL ? redo->oldText : ""));
     
-    restoredTextLength = redo->oldText != NULL ? strlen(redo->oldText) : 0;
+    restoredTextLength = redo->oldLen > 0 ? redo->oldLen - 1 : 0;
     if (!window->buffer->primary.selected || GetPrefUndoModifiesSelection()) {
 	/* position the cursor in the focus pane after the changed text
 	   to show the user where the undo was done */
@@ -201,7 +230,8 @@ void SaveUndoInformation(WindowInfo *window, int pos, int nInserted,
     newType = determineUndoType(nInserted, nDeleted);
     if (newType == UNDO_NOOP)
     	return;
-    oldType = (undo == NULL || isUndo) ? UNDO_NOOP : undo->type;
+    oldType = (undo == NULL || isUndo || undo->spillPos != -1) ? UNDO_NOOP :
+	    undo->type;
         
     /*
     ** Check for continuations of single character operations.  These are
@@ -253,6 +283,9 @@ void SaveUndoInformation(WindowInfo *window, int pos, int nInserted,
     undo = (UndoInfo *)NEditMalloc(sizeof(UndoInfo));
     undo->oldLen = 0;
     undo->oldText = NULL;
+    undo->oldTextBuf = NULL;
+    undo->oldTextBufSize = 0;
+    undo->spillPos = -1;
     undo->type = newType;
     undo->inUndo = False;
     undo->restoresToSaved = False;
@@ -263,7 +296,9 @@ void SaveUndoInformation(WindowInfo *window, int pos, int nInserted,
     if (nDeleted > 0) {
 	undo->oldLen = nDeleted + 1;	/* +1 is for null at end */
 	undo->oldText = (char*)NEditMalloc(nDeleted + 1);
-	strcpy(undo->oldText, deletedText);
+	memcpy(undo->oldText, deletedText, nDeleted + 1);
+	undo->oldTextBuf = undo->oldText;
+	undo->oldTextBufSize = undo->oldLen;
     }
     
     /* increment the operation count for the autosave feature */
@@ -305,6 +340,22 @@ void ClearRedoList(WindowInfo *window)
     	removeRedoItem(window);
 }
 
+/*
+** Give the copy, clone, of undo record orig (already copied field by field)
+** its own copy of the saved text.  Spilled text is not copied, the two
+** records just hold the same place in the spill file.
+*/
+void CopyUndoText(UndoInfo *clone, const UndoInfo *orig)
+{
+    if (orig->oldText != NULL) {
+	clone->oldText = (char*)NEditMalloc(orig->oldLen);
+	memcpy(clone->oldText, orig->oldText, orig->oldLen);
+	clone->oldTextBuf = clone->oldText;
+	clone->oldTextBufSize = clone->oldLen;
+    } else if (orig->spillPos != -1)
+	SpillFileLive += orig->oldLen - 1;
+}
+
 /*
 ** Add an undo record (already allocated by the caller) to the window's undo
 ** list if the item pushes the undo operation or character counts past the
@@ -312,6 +363,7 @@ void ClearRedoList(WindowInfo *window)
 */
 static void addUndoItem(WindowInfo *window, UndoInfo *undo)
 {
+    int budget;
     
     /* Make the undo menu item sensitive now that there's something to undo */
     if (window->undo == NULL) {
@@ -327,12 +379,20 @@ static void addUndoItem(WindowInfo *window, UndoInfo *undo)
     window->undoOpCount++;
     window->undoMemUsed += undo->oldLen;
     
-    /* Trim the list if it exceeds any of the limits */
+    /* Trim the list if it exceeds the operation limit, and move the text
+       of the oldest records out to the spill file if it exceeds the memory
+       budget.  The memory limits only come into play beyond the budget, so
+       when spilling is turned off or fails */
+    budget = GetPrefUndoMemoryBudget() * 1024;
     if (window->undoOpCount > UNDO_OP_LIMIT)
     	trimUndoList(window, UNDO_OP_TRIMTO);
-    if (window->undoMemUsed > UNDO_WORRY_LIMIT)
+    if (budget > 0 && window->undoMemUsed > budget)
+    	spillUndoList(window, budget);
+    if (window->undoDiskUsed > UNDO_SPILL_LIMIT)
+    	trimSpilledUndo(window);
+    if (window->undoMemUsed > UNDO_WORRY_LIMIT && window->undoMemUsed > budget)
     	trimUndoList(window, UNDO_WORRY_TRIMTO);
-    if (window->undoMemUsed > UNDO_PURGE_LIMIT)
+    if (window->undoMemUsed > UNDO_PURGE_LIMIT && window->undoMemUsed > budget)
     	trimUndoList(window, UNDO_PURGE_TRIMTO);
 }
 
@@ -364,7 +424,10 @@ static void removeUndoItem(WindowInfo *window)
     
     /* Decrement the operation and memory counts */
     window->undoOpCount--;
-    window->undoMemUsed -= undo->oldLen;
+    if (undo->spillPos == -1)
+    	window->undoMemUsed -= undo->oldLen;
+    else
+    	window->undoDiskUsed -= undo->oldLen;
     
     /* Remove and free the item */
     window->undo = undo->next;
@@ -399,32 +462,45 @@ static void removeRedoItem(WindowInfo *window)
 ** Add deleted text to the beginning or end
 ** of the text saved for undoing the last operation.  This routine is intended
 ** for continuing of a string of one character deletes or replaces, but will
-** work with more than one character.
+** work with more than one character.  When the buffer holding the text runs
+** out of room on the side being extended, it is reallocated at double the
+** size with free space on both sides, so a long run of deletions, in either
+** or both directions, costs constant time per character.
 */
 static void appendDeletedText(WindowInfo *window, const char *deletedText,
 	int deletedLen, int direction)
 {
     UndoInfo *undo = window->undo;
-    char *comboText;
-
-    /* re-allocate, adding space for the new character(s) */
-    comboText = (char*)NEditMalloc(undo->oldLen + deletedLen);
+    int textLen = undo->oldLen - 1;
+    int before = undo->oldText - undo->oldTextBuf;
+    int after = undo->oldTextBufSize - before - undo->oldLen;
+    char *newBuf;
+    int newSize;
+
+    /* re-allocate if there's no space for the new character(s) */
+    if ((direction == FORWARD && after < deletedLen) ||
+    	    (direction == REVERSE && before < deletedLen)) {
+	newSize = 2 * (undo->oldLen + deletedLen);
+	newBuf = (char*)NEditMalloc(newSize);
+	before = (newSize - undo->oldLen) / 2;
+	memcpy(newBuf + before, undo->oldText, undo->oldLen);
+	NEditFree(undo->oldTextBuf);
+	undo->oldTextBuf = newBuf;
+	undo->oldTextBufSize = newSize;
+	undo->oldText = newBuf + before;
+    }
 
-    /* copy the new character and the already deleted text to the new memory */
+    /* copy the new character(s) in next to the already deleted text */
     if (direction == FORWARD) {
-    	strcpy(comboText, undo->oldText);
-    	strcat(comboText, deletedText);
+    	memcpy(undo->oldText + textLen, deletedText, deletedLen);
+	undo->oldText[textLen + deletedLen] = '\0';
     } else {
-	strcpy(comboText, deletedText);
-	strcat(comboText, undo->oldText);
+	undo->oldText -= deletedLen;
+	memcpy(undo->oldText, deletedText, deletedLen);
     }
 
     /* keep track of the additional memory now used by the undo list */
-    window->undoMemUsed++;
-
-    /* free the old saved text and attach the new */
-    NEditFree(undo->oldText);
-    undo->oldText = comboText;
+    window->undoMemUsed += deletedLen;
     undo->oldLen += deletedLen;
 }
 
@@ -451,7 +527,10 @@ static void trimUndoList(WindowInfo *window, int maxLength)
 	u = lastRec->next;
 	lastRec->next = u->next;
     	window->undoOpCount--;
-    	window->undoMemUsed -= u->oldLen;
+    	if (u->spillPos == -1)
+    	    window->undoMemUsed -= u->oldLen;
+    	else
+    	    window->undoDiskUsed -= u->oldLen;
     	freeUndoRecord(u);
     }
 }
@@ -492,6 +571,195 @@ static void freeUndoRecord(UndoInfo *undo)
     if (undo == NULL)
     	return;
     	
-    NEditFree(undo->oldText);
+    if (undo->spillPos != -1)
+    	releaseSpillText(undo);
+    NEditFree(undo->oldTextBuf);
     NEditFree(undo);
 }
+
+/*
+** Move the saved text of the oldest records on the window's undo list to
+** the spill file, keeping the text of the newest records in memory as long
+** as it fits in budget (in bytes)
+*/
+static void spillUndoList(WindowInfo *window, int budget)
+{
+    UndoInfo *u;
+    int kept = 0;
+    
+    /* reclaim the space of freed records before the file grows further */
+    if (SpillFileEnd > SPILL_COMPACT_MIN && SpillFileEnd > 2 * SpillFileLive)
+    	compactSpillFile();
+
+    for (u=window->undo; u!=NULL; u=u->next) {
+    	if (u->oldText == NULL)
+    	    continue;
+	if (kept + u->oldLen <= budget)
+	    kept += u->oldLen;
+	else if (!spillUndoText(window, u))
+	    return;
+    }
+}
+
+/*
+** Trim records off of the end of the undo list to bring the amount of
+** spilled text back down to UNDO_SPILL_LIMIT, leaving at least one record
+*/
+static void trimSpilledUndo(WindowInfo *window)
+{
+    UndoInfo *u;
+    int n, diskUsed = 0;
+    
+    for (n=1, u=window->undo; u!=NULL; n++, u=u->next) {
+    	if (u->spillPos != -1)
+    	    diskUsed += u->oldLen;
+	if (diskUsed > UNDO_SPILL_LIMIT) {
+	    trimUndoList(window, n > 1 ? n-1 : 1);
+	    return;
+	}
+    }
+}
+
+/*
+** Write the saved text of an undo record to the end of the spill file and
+** free it from memory.  Returns False if the text couldn't be written.
+*/
+static int spillUndoText(WindowInfo *window, UndoInfo *undo)
+{
+    int length = undo->oldLen - 1;
+    
+    if (SpillFile == NULL) {
+    	SpillFile = tmpfile();
+	if (SpillFile == NULL)
+	    return False;
+    }
+    if (fseek(SpillFile, SpillFileEnd, SEEK_SET) != 0 ||
+    	    fwrite(undo->oldText, 1, length, SpillFile) != (size_t)length ||
+	    fflush(SpillFile) != 0)
+    	return False;
+    
+    undo->spillPos = SpillFileEnd;
+    SpillFileEnd += length;
+    SpillFileLive += length;
+    NEditFree(undo->oldTextBuf);
+    undo->oldText = undo->oldTextBuf = NULL;
+    undo->oldTextBufSize = 0;
+    window->undoMemUsed -= undo->oldLen;
+    window->undoDiskUsed += undo->oldLen;
+    return True;
+}
+
+/*
+** Read the saved text of an undo record back into memory if it was moved
+** out to the spill file.  Returns False if it couldn't be read.
+*/
+static int loadUndoText(WindowInfo *window, UndoInfo *undo)
+{
+    int length = undo->oldLen - 1;
+    char *text;
+    
+    if (undo->spillPos == -1)
+    	return True;
+    
+    text = (char*)NEditMalloc(undo->oldLen);
+    if (fseek(SpillFile, undo->spillPos, SEEK_SET) != 0 ||
+    	    fread(text, 1, length, SpillFile) != (size_t)length) {
+	NEditFree(text);
+	return False;
+    }
+    text[length] = '\0';
+    
+    releaseSpillText(undo);
+    undo->oldText = undo->oldTextBuf = text;
+    undo->oldTextBufSize = undo->oldLen;
+    window->undoDiskUsed -= undo->oldLen;
+    window->undoMemUsed += undo->oldLen;
+    return True;
+}
+
+/*
+** Give up an undo record's claim on the spill file, and close (and thereby
+** remove) the file when no record refers to it any more.  The space itself
+** is only reclaimed by compactSpillFile, since other records may share it.
+*/
+static void releaseSpillText(UndoInfo *undo)
+{
+    SpillFileLive -= undo->oldLen - 1;
+    undo->spillPos = -1;
+    if (SpillFileLive == 0) {
+    	fclose(SpillFile);
+	SpillFile = NULL;
+	SpillFileEnd = 0;
+    }
+}
+
+/*
+** Copy length bytes of spilled text at fromPos in file from to toPos in
+** file to.  Returns toPos, or -1 if the copy failed.
+*/
+static long copySpillText(FILE *from, long fromPos, FILE *to, long toPos,
+	int length)
+{
+    char *buf;
+    int chunk, copied;
+    
+    buf = (char*)NEditMalloc(length < SPILL_COPY_SIZE ? length :
+    	    SPILL_COPY_SIZE);
+    for (copied=0; copied<length; copied+=chunk) {
+    	chunk = length - copied < SPILL_COPY_SIZE ? length - copied :
+		SPILL_COPY_SIZE;
+	if (fseek(from, fromPos + copied, SEEK_SET) != 0 ||
+		fread(buf, 1, chunk, from) != (size_t)chunk ||
+		fseek(to, toPos + copied, SEEK_SET) != 0 ||
+		fwrite(buf, 1, chunk, to) != (size_t)chunk) {
+	    NEditFree(buf);
+	    return -1;
+	}
+    }
+    NEditFree(buf);
+    return fflush(to) == 0 ? toPos : -1;
+}
+
+/*
+** Copy the text still held by undo records to a fresh spill file, dropping
+** the holes left by records which were freed since the file was created.
+** If anything goes wrong, the old file stays in use.
+*/
+static void compactSpillFile(void)
+{
+    FILE *newFile;
+    WindowInfo *w;
+    UndoInfo *u;
+    long end = 0;
+    
+    newFile = tmpfile();
+    if (newFile == NULL)
+    	return;
+    
+    /* copy everything first, so the old positions stay valid on failure */
+    for (w=WindowList; w!=NULL; w=w->next) {
+    	for (u=w->undo; u!=NULL; u=u->next) {
+	    if (u->spillPos == -1)
+	    	continue;
+	    if (copySpillText(SpillFile, u->spillPos, newFile, end,
+		    u->oldLen - 1) == -1) {
+		fclose(newFile);
+		return;
+	    }
+	    end += u->oldLen - 1;
+	}
+    }
+    
+    end = 0;
+    for (w=WindowList; w!=NULL; w=w->next) {
+    	for (u=w->undo; u!=NULL; u=u->next) {
+	    if (u->spillPos == -1)
+	    	continue;
+	    u->spillPos = end;
+	    end += u->oldLen - 1;
+	}
+    }
+    fclose(SpillFile);
+    SpillFile = newFile;
+    SpillFileEnd = SpillFileLive = end;
+}
@@ -38,5 +38,6 @@ void SaveUndoInformation(WindowInfo *window, int pos, int nInserted,
 	int nDeleted, const char *deletedText);
 void ClearUndoList(WindowInfo *window);
 void ClearRedoList(WindowInfo *window);
+void CopyUndoText(UndoInfo *clone, const UndoInfo *orig);
 
 #endif /* NEDIT_UNDO_H_INCLUDED */
@@ -264,8 +264,14 @@ WindowInfo *CreateWindow(const char *name, char *geometry, int iconic)
     window->nPanes = 0;
     window->autoSaveCharCount = 0;
     window->autoSaveOpCount = 0;
+    window->journalText = NULL;
+    window->journalTextLen = 0;
+    window->journalTextSize = 0;
+    window->journalState = JOURNAL_NONE;
+    window->journalSize = 0;
     window->undoOpCount = 0;
     window->undoMemUsed = 0;
+    window->undoDiskUsed = 0;
     CLEAR_ALL_LOCKS(window->lockReasons);
     window->indentStyle = GetPrefAutoIndent(PLAIN_LANGUAGE_MODE);
     window->autoSave = GetPrefAutoSave();
@@ -1042,6 +1048,7 @@ void CloseWindow(WindowInfo *window)
     /* free the undo and redo lists */
     ClearUndoList(window);
     ClearRedoList(window);
+    NEditFree(window->journalText);
     
     /* close the document/window */
     if (NDocuments(window) > 1) {
@@ -2357,6 +2364,11 @@ static void modifiedCB(int pos, int nInserted, int nDeleted, int nRestyled,
 	}
     }
 
+    /* Record the change for the backup journal.  This must also see changes
+       made with ignoreModify set, since it can't reproduce those */
+    if (nDeleted != 0 || nInserted != 0)
+        JournalModification(window, pos, nInserted, nDeleted);
+
     /* When the program needs to make a change to a text area without without
        recording it for undo or marking file as changed it sets ignoreModify */
     if (window->ignoreModify || (nDeleted == 0 && nInserted == 0))
@@ -2373,7 +2385,7 @@ static void modifiedCB(int pos, int nInserted, int nDeleted, int nRestyled,
     if (window->autoSave &&
             (window->autoSaveCharCount > AUTOSAVE_CHAR_LIMIT ||
              window->autoSaveOpCount > AUTOSAVE_OP_LIMIT)) {
-        WriteBackupFile(window);
+        UpdateBackupFile(window);
         window->autoSaveCharCount = 0;
         window->autoSaveOpCount = 0;
     }
@@ -2712,25 +2724,19 @@ void UpdateStatsLine(WindowInfo *window)
     if (!window->showStats)
         return;
     
-    /* Compose the string to display. If line # isn't available, leave it off */
+    /* Compose the string to display */
     pos = TextGetCursorPos(window->lastFocus);
     string = (char*)NEditMalloc(strlen(window->filename) + strlen(window->path) + 45);
     format = window->fileFormat == DOS_FILE_FORMAT ? " DOS" :
             (window->fileFormat == MAC_FILE_FORMAT ? " Mac" : "");
-    if (!TextPosToLineAndCol(window->lastFocus, pos, &line, &colNum)) {
-        sprintf(string, "%s%s%s %d bytes", window->path, window->filename,
-                format, window->buffer->length);
-        sprintf(slinecol, "L: ---  C: ---");
-    } else {
-        sprintf(slinecol, "L: %d  C: %d", line, colNum);
-        if (window->showLineNumbers)
-            sprintf(string, "%s%s%s byte %d of %d", window->path,
-                    window->filename, format, pos, 
-                    window->buffer->length);
-        else
-            sprintf(string, "%s%s%s %d bytes", window->path,
-                    window->filename, format, window->buffer->length);
-    }
+    TextPosToLineAndCol(window->lastFocus, pos, &line, &colNum);
+    sprintf(slinecol, "L: %d  C: %d", line, colNum);
+    if (window->showLineNumbers)
+        sprintf(string, "%s%s%s byte %d of %d", window->path,
+                window->filename, format, pos, window->buffer->length);
+    else
+        sprintf(string, "%s%s%s %d bytes", window->path,
+                window->filename, format, window->buffer->length);
     
     /* Update the line/column number */
     xmslinecol = XmStringCreateSimple(slinecol);
@@ -3301,8 +3307,14 @@ WindowInfo* CreateDocument(WindowInfo* shellWindow, const char* name)
     window->nPanes = 0;
     window->autoSaveCharCount = 0;
     window->autoSaveOpCount = 0;
+    window->journalText = NULL;
+    window->journalTextLen = 0;
+    window->journalTextSize = 0;
+    window->journalState = JOURNAL_NONE;
+    window->journalSize = 0;
     window->undoOpCount = 0;
     window->undoMemUsed = 0;
+    window->undoDiskUsed = 0;
     CLEAR_ALL_LOCKS(window->lockReasons);
     window->indentStyle = GetPrefAutoIndent(PLAIN_LANGUAGE_MODE);
     window->autoSave = GetPrefAutoSave();
@@ -4309,8 +4321,10 @@ static void cloneDocument(WindowInfo *window, WindowInfo *orgWin)
     window->lockReasons = orgWin->lockReasons;
     window->autoSaveCharCount = orgWin->autoSaveCharCount;
     window->autoSaveOpCount = orgWin->autoSaveOpCount;
+    window->journalState = JOURNAL_NONE; /* new backup, see file.c */
     window->undoOpCount = orgWin->undoOpCount;
     window->undoMemUsed = orgWin->undoMemUsed;
+    window->undoDiskUsed = orgWin->undoDiskUsed;
     window->lockReasons = orgWin->lockReasons;
     window->autoSave = orgWin->autoSave;
     window->saveOldVersion = orgWin->saveOldVersion;
@@ -4381,11 +4395,7 @@ static UndoInfo *cloneUndoItems(UndoInfo *orgList)
     for (undo = orgList; undo; undo = undo->next) {
 	clone = (UndoInfo *)NEditMalloc(sizeof(UndoInfo));
 	memcpy(clone, undo, sizeof(UndoInfo));
-
-	if (undo->oldText) {
-	    clone->oldText = (char*)NEditMalloc(strlen(undo->oldText)+1);
-	    strcpy(clone->oldText, undo->oldText);
-	}
+	CopyUndoText(clone, undo);
 	clone->next = NULL;
 
 	if (last)
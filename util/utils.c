@@ -42,6 +42,10 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <pwd.h>
+#include <time.h>
+#ifndef VMS
+#include <sys/time.h>
+#endif
 
 /* just to get 'Boolean' types defined: */
 #include <X11/Intrinsic.h>
@@ -52,11 +56,15 @@
 
 #define DEFAULT_NEDIT_HOME ".nedit"
 #ifdef VMS
-    static char* hiddenFileNames[N_FILE_TYPES] = {".nedit", ".neditmacro", ".neditdb;1"};
-    static char* plainFileNames[N_FILE_TYPES] = {"nedit.rc", "autoload.nm", "nedit.history;1"};
+    static char* hiddenFileNames[N_FILE_TYPES] = {".nedit", ".neditmacro", ".neditdb;1",
+        ".neditpatterns;1"};
+    static char* plainFileNames[N_FILE_TYPES] = {"nedit.rc", "autoload.nm", "nedit.history;1",
+        "patterns.cache;1"};
 #else
-    static char* hiddenFileNames[N_FILE_TYPES] = {".nedit", ".neditmacro", ".neditdb"};
-    static char* plainFileNames[N_FILE_TYPES] = {"nedit.rc", "autoload.nm", "nedit.history"};
+    static char* hiddenFileNames[N_FILE_TYPES] = {".nedit", ".neditmacro", ".neditdb",
+        ".neditpatterns"};
+    static char* plainFileNames[N_FILE_TYPES] = {"nedit.rc", "autoload.nm", "nedit.history",
+        "patterns.cache"};
 #endif
 
 static void buildFilePath(char* fullPath, const char* dir, const char* file);
@@ -230,6 +238,25 @@ int Min(int i1, int i2)
     return i1 <= i2 ? i1 : i2;
 }
 
+/*
+** Return the current wall clock time in seconds, with microsecond resolution
+** where the system supports it.  Only the difference between two calls is
+** meaningful; this is intended for profiling and time-slicing, not dates.
+** On VMS, which lacks gettimeofday, the processor time used is returned
+** instead, which at least has better than one second resolution.
+*/
+double GetWallClock(void)
+{
+#ifndef VMS
+    struct timeval current;
+
+    gettimeofday(&current, NULL);
+    return (double)current.tv_sec + (double)current.tv_usec * 1e-6;
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
 /*
 **  Returns a pointer to the name of an rc file of the requested type.
 **
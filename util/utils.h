@@ -42,6 +42,7 @@ char *PrependHome(const char *filename, char *buf, size_t buflen);
 const char *GetUserName(void);
 const char *GetNameOfHost(void);
 int Min(int i1, int i2);
+double GetWallClock(void);
 const char* GetRCFileName(int type);
 
 /*
@@ -72,7 +73,7 @@ void Push(Stack* stack, const void* value);
 void* Pop(Stack* stack);
 
 /* N_FILE_TYPES must be the last entry!! This saves us from counting. */
-enum {NEDIT_RC, AUTOLOAD_NM, NEDIT_HISTORY, N_FILE_TYPES};
+enum {NEDIT_RC, AUTOLOAD_NM, NEDIT_HISTORY, NEDIT_PATTERN_CACHE, N_FILE_TYPES};
 
 /* If anyone knows where to get this from system include files (in a machine
    independent way), please change this (L_cuserid is apparently not ANSI) */